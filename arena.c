@@ -0,0 +1,80 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Arena allocator
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+
+#define ARENA_CHUNK_SIZE (1024 * 1024) // 1 MB
+#define ARENA_ALIGN 8
+
+typedef struct ARENACHUNK
+{
+    struct ARENACHUNK *pNext;
+    SIZE_T cb; // including this header
+} ARENACHUNK;
+
+VOID InitArena(ARENA *pArena)
+{
+    ZeroMemory(pArena, sizeof(*pArena));
+}
+
+LPVOID ArenaAlloc(ARENA *pArena, SIZE_T cb)
+{
+    ARENACHUNK *pChunk;
+    SIZE_T cbChunk;
+    LPBYTE pb;
+    BOOL fBig;
+
+    if (cb >= ((SIZE_T)-1) / 2)
+        return NULL;
+    cb = (cb + ARENA_ALIGN - 1) & ~(SIZE_T)(ARENA_ALIGN - 1);
+    if (cb <= (SIZE_T)(pArena->pbEnd - pArena->pbNext))
+    {
+        pb = pArena->pbNext;
+        pArena->pbNext += cb;
+        return pb;
+    }
+
+    // A big block gets a chunk of its own, so that the rest of the current
+    // chunk is still used for small blocks
+    fBig = (cb > ARENA_CHUNK_SIZE / 4);
+    cbChunk = (fBig ? sizeof(ARENACHUNK) + cb : ARENA_CHUNK_SIZE);
+    pChunk = malloc(cbChunk);
+    if (!pChunk)
+        return NULL;
+    pChunk->cb = cbChunk;
+    pb = (LPBYTE)(pChunk + 1);
+
+    pArena->cbTotal += cbChunk;
+    if (pArena->cbPeak < pArena->cbTotal)
+        pArena->cbPeak = pArena->cbTotal;
+
+    if (fBig && pArena->pChunks)
+    {
+        pChunk->pNext = pArena->pChunks->pNext;
+        pArena->pChunks->pNext = pChunk;
+        return pb;
+    }
+
+    pChunk->pNext = pArena->pChunks;
+    pArena->pChunks = pChunk;
+    pArena->pbNext = pb + cb;
+    pArena->pbEnd = (LPBYTE)pChunk + cbChunk;
+    return pb;
+}
+
+// Frees all the blocks at once. The high-water mark (cbPeak) is kept.
+VOID FreeArena(ARENA *pArena)
+{
+    ARENACHUNK *pChunk, *pNext;
+    for (pChunk = pArena->pChunks; pChunk; pChunk = pNext)
+    {
+        pNext = pChunk->pNext;
+        free(pChunk);
+    }
+    pArena->pChunks = NULL;
+    pArena->pbNext = pArena->pbEnd = NULL;
+    pArena->cbTotal = 0;
+}
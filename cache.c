@@ -0,0 +1,473 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Persistent cache of file content hashes (/CACHE)
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+
+// The cache file is a header followed by a fixed-size open-addressing table
+// of CACHEENTRY, and is mapped into memory. Several FC processes may share
+// it: the header byte is locked (shared for lookups, exclusive for updates)
+// around every access, and each entry carries a checksum so that an entry
+// torn by a killed process is ignored instead of trusted.
+#define CACHE_MAGIC 0x32434346 // "FCC2"
+#define CACHE_SLOTS (128 * 1024) // a power of two
+#define CACHE_PROBES 8
+#define CACHE_RACY_TIME (2 * 10000000) // 2 seconds in FILETIME units
+
+typedef struct CACHEHEADER
+{
+    DWORD dwMagic;
+    DWORD cbEntry;
+    DWORD cSlots;
+    DWORD dwReserved;
+} CACHEHEADER;
+
+typedef struct CACHEENTRY
+{
+    DWORD dwCheck; // checksum of the rest; zero if the slot is empty
+    DWORD dwVolume;
+    ULONGLONG ullPathHash;
+    ULONGLONG ullFileIndex;
+    ULONGLONG cb;
+    ULONGLONG ullWriteTime;
+    BYTE digest[CACHE_DIGEST_SIZE]; // the content hash (see CACHEHASH)
+} CACHEENTRY;
+
+#define CACHE_SIZE (sizeof(CACHEHEADER) + CACHE_SLOTS * sizeof(CACHEENTRY))
+
+// SHA-256 (FIPS 180-4)
+typedef struct SHA256
+{
+    DWORD state[8];
+    ULONGLONG cb;
+    BYTE buf[64];
+} SHA256;
+
+static const DWORD s_sha256K[64] =
+{
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+    0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+    0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+    0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+    0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+    0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static VOID Sha256Block(SHA256 *pSha, const BYTE *pb)
+{
+    DWORD w[64], a, b, c, d, e, f, g, h, t1, t2;
+    INT i;
+
+    for (i = 0; i < 16; ++i, pb += 4)
+        w[i] = ((DWORD)pb[0] << 24) | ((DWORD)pb[1] << 16) | ((DWORD)pb[2] << 8) | pb[3];
+    for (; i < 64; ++i)
+    {
+        t1 = ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        t2 = ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+    }
+
+    a = pSha->state[0]; b = pSha->state[1]; c = pSha->state[2]; d = pSha->state[3];
+    e = pSha->state[4]; f = pSha->state[5]; g = pSha->state[6]; h = pSha->state[7];
+    for (i = 0; i < 64; ++i)
+    {
+        t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) +
+             s_sha256K[i] + w[i];
+        t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    pSha->state[0] += a; pSha->state[1] += b; pSha->state[2] += c; pSha->state[3] += d;
+    pSha->state[4] += e; pSha->state[5] += f; pSha->state[6] += g; pSha->state[7] += h;
+}
+
+static VOID Sha256Init(SHA256 *pSha)
+{
+    static const DWORD s_init[8] =
+    {
+        0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+        0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+    };
+    CopyMemory(pSha->state, s_init, sizeof(s_init));
+    pSha->cb = 0;
+}
+
+static VOID Sha256Update(SHA256 *pSha, const BYTE *pb, SIZE_T cb)
+{
+    DWORD ib = (DWORD)(pSha->cb & 63), cbCopy;
+
+    pSha->cb += cb;
+    if (ib > 0)
+    {
+        cbCopy = (DWORD)min(64 - ib, cb);
+        CopyMemory(&pSha->buf[ib], pb, cbCopy);
+        pb += cbCopy;
+        cb -= cbCopy;
+        if (ib + cbCopy < 64)
+            return;
+        Sha256Block(pSha, pSha->buf);
+    }
+    for (; cb >= 64; pb += 64, cb -= 64)
+        Sha256Block(pSha, pb);
+    CopyMemory(pSha->buf, pb, cb);
+}
+
+static VOID Sha256Final(SHA256 *pSha, BYTE *digest)
+{
+    ULONGLONG cBits = pSha->cb * 8;
+    BYTE pad[72];
+    DWORD cbPad = 64 - (DWORD)((pSha->cb + 8) & 63);
+    INT i;
+
+    ZeroMemory(pad, sizeof(pad));
+    pad[0] = 0x80;
+    for (i = 0; i < 8; ++i)
+        pad[cbPad + i] = (BYTE)(cBits >> (56 - 8 * i));
+    Sha256Update(pSha, pad, cbPad + 8);
+
+    for (i = 0; i < 32; ++i)
+        digest[i] = (BYTE)(pSha->state[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+// The content hash of a file is the SHA-256 of the SHA-256 of each
+// CACHE_PIECE_SIZE piece of it, so that the pieces can also be hashed by the
+// threads of /THREADS. It is computed from the bytes that the comparison
+// reads, when they are read in order, so the files are never read just to
+// be hashed. It is stored when the whole file was read.
+struct CACHEHASH
+{
+    FCCACHE *pCache;
+    CACHEENTRY key; // the file when it was opened
+    SHA256 sha; // of the hashes of the pieces
+    SHA256 shaPiece; // of the current piece
+    LONGLONG ib; // the bytes hashed so far
+};
+
+static DWORD EntryCheck(const CACHEENTRY *pEntry)
+{
+    const BYTE *pb = (const BYTE *)pEntry + sizeof(pEntry->dwCheck);
+    DWORD cb = sizeof(CACHEENTRY) - sizeof(pEntry->dwCheck), check = 2166136261U;
+    while (cb-- > 0)
+        check = (check ^ *pb++) * 16777619U;
+    return check ? check : 1;
+}
+
+// Gets the identity of a disk file without reading it
+static BOOL GetCacheKey(LPCWSTR file, CACHEENTRY *pKey)
+{
+    HANDLE hFile;
+    BY_HANDLE_FILE_INFORMATION info;
+    WCHAR szPath[MAX_PATH];
+    ULONGLONG hash = ((ULONGLONG)0xCBF29CE4 << 32) | 0x84222325; // FNV-1a
+    DWORD cch, ich;
+    BOOL ret;
+
+    cch = GetFullPathNameW(file, _countof(szPath), szPath, NULL);
+    if (cch == 0 || cch >= _countof(szPath))
+        return FALSE;
+    for (ich = 0; ich < cch; ++ich)
+        hash = (hash ^ towupper(szPath[ich])) * (((ULONGLONG)1 << 40) | 0x1B3);
+
+    hFile = CreateFileW(file, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                        NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return FALSE;
+    ret = (GetFileType(hFile) == FILE_TYPE_DISK && GetFileInformationByHandle(hFile, &info));
+    CloseHandle(hFile);
+    if (!ret)
+        return FALSE;
+
+    ZeroMemory(pKey, sizeof(*pKey));
+    pKey->dwVolume = info.dwVolumeSerialNumber;
+    pKey->ullPathHash = hash;
+    pKey->ullFileIndex = ((ULONGLONG)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+    pKey->cb = ((ULONGLONG)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    pKey->ullWriteTime = ((ULONGLONG)info.ftLastWriteTime.dwHighDateTime << 32) |
+                         info.ftLastWriteTime.dwLowDateTime;
+    return TRUE;
+}
+
+static __inline BOOL IsSameFile(const CACHEENTRY *pEntry, const CACHEENTRY *pKey)
+{
+    return pEntry->ullPathHash == pKey->ullPathHash &&
+           pEntry->dwVolume == pKey->dwVolume &&
+           pEntry->ullFileIndex == pKey->ullFileIndex;
+}
+
+static BOOL LockCache(FCCACHE *pCache, BOOL fExclusive)
+{
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    return LockFileEx(pCache->hFile, fExclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0, 0, 1, 0, &ov);
+}
+
+static VOID UnlockCache(FCCACHE *pCache)
+{
+    OVERLAPPED ov;
+    ZeroMemory(&ov, sizeof(ov));
+    UnlockFileEx(pCache->hFile, 0, 1, 0, &ov);
+}
+
+static CACHEENTRY *CacheSlots(FCCACHE *pCache)
+{
+    return (CACHEENTRY *)((LPBYTE)pCache->pvView + sizeof(CACHEHEADER));
+}
+
+static BOOL LookupCache(FCCACHE *pCache, const CACHEENTRY *pKey, BYTE *digest)
+{
+    CACHEENTRY *pSlots, entry;
+    DWORD iProbe, iSlot;
+    BOOL ret = FALSE;
+
+    if (!LockCache(pCache, FALSE))
+        return FALSE;
+    pSlots = CacheSlots(pCache);
+    for (iProbe = 0; iProbe < CACHE_PROBES; ++iProbe)
+    {
+        iSlot = (DWORD)(pKey->ullPathHash + iProbe) & (CACHE_SLOTS - 1);
+        entry = pSlots[iSlot];
+        if (entry.dwCheck == 0 || entry.dwCheck != EntryCheck(&entry) || !IsSameFile(&entry, pKey))
+            continue;
+        // a changed file is hashed again
+        if (entry.cb == pKey->cb && entry.ullWriteTime == pKey->ullWriteTime)
+        {
+            CopyMemory(digest, entry.digest, CACHE_DIGEST_SIZE);
+            ret = TRUE;
+        }
+        break;
+    }
+    UnlockCache(pCache);
+    return ret;
+}
+
+static VOID StoreCache(FCCACHE *pCache, const CACHEENTRY *pKey, const BYTE *digest)
+{
+    CACHEENTRY *pSlots, *pSlot = NULL, entry;
+    DWORD iProbe, iSlot;
+    FILETIME ftNow;
+    ULONGLONG ullNow;
+
+    // a file written just now may change again without a new time stamp
+    GetSystemTimeAsFileTime(&ftNow);
+    ullNow = ((ULONGLONG)ftNow.dwHighDateTime << 32) | ftNow.dwLowDateTime;
+    if (ullNow < pKey->ullWriteTime + CACHE_RACY_TIME)
+        return;
+
+    entry = *pKey;
+    CopyMemory(entry.digest, digest, CACHE_DIGEST_SIZE);
+    entry.dwCheck = EntryCheck(&entry);
+
+    if (!LockCache(pCache, TRUE))
+        return;
+    pSlots = CacheSlots(pCache);
+    for (iProbe = 0; iProbe < CACHE_PROBES; ++iProbe)
+    {
+        iSlot = (DWORD)(pKey->ullPathHash + iProbe) & (CACHE_SLOTS - 1);
+        if (pSlots[iSlot].dwCheck == 0 || IsSameFile(&pSlots[iSlot], pKey))
+        {
+            pSlot = &pSlots[iSlot];
+            break;
+        }
+    }
+    // all the probed slots are used: evict the first one
+    if (!pSlot)
+        pSlot = &pSlots[(DWORD)pKey->ullPathHash & (CACHE_SLOTS - 1)];
+    *pSlot = entry;
+    UnlockCache(pCache);
+}
+
+BOOL OpenCache(FCCACHE *pCache, LPCWSTR file)
+{
+    CACHEHEADER header, *pHeader;
+    DWORD cbFile, cbRead;
+    BOOL ret = FALSE;
+
+    ZeroMemory(pCache, sizeof(*pCache));
+    pCache->hFile = CreateFileW(file, GENERIC_READ | GENERIC_WRITE,
+                                FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+                                FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pCache->hFile == INVALID_HANDLE_VALUE || !LockCache(pCache, TRUE))
+    {
+        CloseCache(pCache);
+        return FALSE;
+    }
+
+    do
+    {
+        // don't touch a file that is not an empty or a cache file
+        cbFile = GetFileSize(pCache->hFile, NULL);
+        if (cbFile != 0)
+        {
+            if (cbFile != CACHE_SIZE ||
+                !ReadFile(pCache->hFile, &header, sizeof(header), &cbRead, NULL) ||
+                cbRead != sizeof(header) || header.dwMagic != CACHE_MAGIC ||
+                header.cbEntry != sizeof(CACHEENTRY) || header.cSlots != CACHE_SLOTS)
+            {
+                break;
+            }
+        }
+
+        // a mapping larger than the file extends it with zeros
+        pCache->hMapping = CreateFileMappingW(pCache->hFile, NULL, PAGE_READWRITE, 0,
+                                              (DWORD)CACHE_SIZE, NULL);
+        if (!pCache->hMapping)
+            break;
+        pCache->pvView = MapViewOfFile(pCache->hMapping, FILE_MAP_WRITE, 0, 0, CACHE_SIZE);
+        if (!pCache->pvView)
+            break;
+
+        if (cbFile == 0)
+        {
+            pHeader = pCache->pvView;
+            pHeader->dwMagic = CACHE_MAGIC;
+            pHeader->cbEntry = sizeof(CACHEENTRY);
+            pHeader->cSlots = CACHE_SLOTS;
+        }
+        ret = TRUE;
+    } while (0);
+
+    UnlockCache(pCache);
+    if (!ret)
+        CloseCache(pCache);
+    return ret;
+}
+
+VOID CloseCache(FCCACHE *pCache)
+{
+    if (pCache->pvView)
+        UnmapViewOfFile(pCache->pvView);
+    if (pCache->hMapping)
+        CloseHandle(pCache->hMapping);
+    if (pCache->hFile != INVALID_HANDLE_VALUE && pCache->hFile != NULL)
+        CloseHandle(pCache->hFile);
+    ZeroMemory(pCache, sizeof(*pCache));
+}
+
+// Compares the content hashes of the files. Returns FCRET_INVALID if the
+// files have to be compared; their hashes are then computed by the
+// comparison (StartCacheHash).
+FCRET CacheCompare(FILECOMPARE *pFC)
+{
+    CACHEENTRY key[2];
+    BYTE digest[2][CACHE_DIGEST_SIZE];
+    INT i;
+
+    for (i = 0; i < 2; ++i)
+    {
+        if (!GetCacheKey(pFC->file[i], &key[i]) ||
+            !LookupCache(pFC->pCache, &key[i], digest[i]))
+        {
+            return FCRET_INVALID;
+        }
+    }
+
+    if (key[0].cb == key[1].cb && memcmp(digest[0], digest[1], CACHE_DIGEST_SIZE) == 0)
+        return FCRET_IDENTICAL;
+    return FCRET_DIFFERENT;
+}
+
+// Starts hashing the bytes of the input as they are read, if it is a disk
+// file and pCache isn't NULL.
+VOID StartCacheHash(FCCACHE *pCache, FCINPUT *pInput)
+{
+    CACHEHASH *pHash;
+    BYTE digest[CACHE_DIGEST_SIZE];
+
+    if (!pCache || pInput->cb.QuadPart < 0)
+        return;
+    pHash = malloc(sizeof(*pHash));
+    if (!pHash)
+        return;
+    // a file whose hash is in the cache isn't hashed again
+    if (!GetCacheKey(pInput->file, &pHash->key) ||
+        pHash->key.cb != (ULONGLONG)pInput->cb.QuadPart ||
+        LookupCache(pCache, &pHash->key, digest))
+    {
+        free(pHash);
+        return;
+    }
+    pHash->pCache = pCache;
+    Sha256Init(&pHash->sha);
+    Sha256Init(&pHash->shaPiece);
+    pHash->ib = 0;
+    pInput->pHash = pHash;
+}
+
+// Hashes the bytes pb[0, cb) at the offset ib of the input, as far as they
+// follow the bytes hashed so far. Bytes that were hashed are skipped.
+VOID UpdateCacheHash(CACHEHASH *pHash, LONGLONG ib, const BYTE *pb, SIZE_T cb)
+{
+    BYTE digest[CACHE_DIGEST_SIZE];
+    SIZE_T cbPiece;
+
+    if (ib > pHash->ib || ib + (LONGLONG)cb <= pHash->ib)
+        return;
+    pb += pHash->ib - ib;
+    cb -= (SIZE_T)(pHash->ib - ib);
+    while (cb > 0)
+    {
+        cbPiece = (SIZE_T)min(cb, CACHE_PIECE_SIZE - pHash->ib % CACHE_PIECE_SIZE);
+        Sha256Update(&pHash->shaPiece, pb, cbPiece);
+        pHash->ib += cbPiece;
+        pb += cbPiece;
+        cb -= cbPiece;
+        if (pHash->ib % CACHE_PIECE_SIZE == 0)
+        {
+            Sha256Final(&pHash->shaPiece, digest);
+            Sha256Update(&pHash->sha, digest, sizeof(digest));
+            Sha256Init(&pHash->shaPiece);
+        }
+    }
+}
+
+// Hashes a whole piece of an input. Any thread may call it.
+VOID HashCachePiece(const BYTE *pb, BYTE *digest)
+{
+    SHA256 sha;
+    Sha256Init(&sha);
+    Sha256Update(&sha, pb, CACHE_PIECE_SIZE);
+    Sha256Final(&sha, digest);
+}
+
+// Adds the hash of the piece at the offset ib (HashCachePiece), if it is the
+// next piece to hash.
+VOID AddCachePiece(CACHEHASH *pHash, LONGLONG ib, const BYTE *digest)
+{
+    if (ib != pHash->ib || ib % CACHE_PIECE_SIZE != 0)
+        return;
+    Sha256Update(&pHash->sha, digest, CACHE_DIGEST_SIZE);
+    pHash->ib += CACHE_PIECE_SIZE;
+}
+
+// Stores the content hash of the input if all of it was hashed and the file
+// didn't change meanwhile, and frees the hash.
+VOID EndCacheHash(FCINPUT *pInput)
+{
+    CACHEHASH *pHash = pInput->pHash;
+    CACHEENTRY key;
+    BYTE digest[CACHE_DIGEST_SIZE];
+
+    if (!pHash)
+        return;
+    pInput->pHash = NULL;
+
+    if ((ULONGLONG)pHash->ib == pHash->key.cb && GetCacheKey(pInput->file, &key) &&
+        key.cb == pHash->key.cb && key.ullWriteTime == pHash->key.ullWriteTime &&
+        IsSameFile(&key, &pHash->key))
+    {
+        if (pHash->ib % CACHE_PIECE_SIZE != 0 || pHash->ib == 0)
+        {
+            Sha256Final(&pHash->shaPiece, digest);
+            Sha256Update(&pHash->sha, digest, sizeof(digest));
+        }
+        Sha256Final(&pHash->sha, digest);
+        StoreCache(pHash->pCache, &pHash->key, digest);
+    }
+    free(pHash);
+}
@@ -0,0 +1,368 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Shift-aware binary comparison (/DELTA)
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+
+// The blocks of the first file are put into a hash table by a rolling
+// checksum (like rsync). The second file is scanned byte by byte for these
+// blocks, and each found block is extended as far as the bytes are equal.
+// The bytes of the second file that are not in any match are inserted,
+// and the bytes of the first file that are not in any match are deleted.
+#define DELTA_MIN_BLOCK 64
+#define DELTA_MAX_BLOCK (64 * 1024)
+#define DELTA_MAX_CHAIN 16 // # of candidate blocks verified per position
+#define DELTA_NONE ((SIZE_T)-1)
+
+// The bytes at ib0 of the first file are at ib1 of the second file
+typedef struct DELTACOPY
+{
+    SIZE_T ib0, ib1, cb;
+} DELTACOPY;
+
+typedef struct DELTA
+{
+    const BYTE *pb[2];
+    SIZE_T cb[2];
+    DWORD cbBlock;
+    DWORD cBlocks;
+    DWORD nBits; // log2 of # of buckets
+    DWORD *pHead; // bucket -> first block + 1
+    DWORD *pNext; // block -> next block + 1
+    DWORD *pSums; // block -> checksum
+    DELTACOPY *pCopies;
+    SIZE_T cCopies, cCopiesMax;
+    BOOL fQuad; // 16-digit offsets
+} DELTA;
+
+static __inline DWORD CombineSums(DWORD s1, DWORD s2)
+{
+    return (s1 & 0xFFFF) | (s2 << 16);
+}
+
+static DWORD BlockSum(const BYTE *pb, DWORD cb, DWORD *ps1, DWORD *ps2)
+{
+    DWORD s1 = 0, s2 = 0;
+    while (cb-- > 0)
+    {
+        s1 += *pb++;
+        s2 += s1;
+    }
+    *ps1 = s1;
+    *ps2 = s2;
+    return CombineSums(s1, s2);
+}
+
+static __inline DWORD BucketOf(const DELTA *pDelta, DWORD sum)
+{
+    return (sum * 0x9E3779B1) >> (32 - pDelta->nBits);
+}
+
+static BOOL BuildBlockTable(DELTA *pDelta)
+{
+    DWORD iBlock, iBucket, s1, s2;
+    SIZE_T cbBlock;
+
+    // about the square root of the size, like rsync
+    for (cbBlock = DELTA_MIN_BLOCK; cbBlock < DELTA_MAX_BLOCK; cbBlock *= 2)
+    {
+        if (cbBlock * cbBlock >= pDelta->cb[0])
+            break;
+    }
+    pDelta->cbBlock = (DWORD)cbBlock;
+    pDelta->cBlocks = (DWORD)min(pDelta->cb[0] / cbBlock, MAXDWORD - 1);
+    for (pDelta->nBits = 1; pDelta->nBits < 31; ++pDelta->nBits)
+    {
+        if ((1UL << pDelta->nBits) >= pDelta->cBlocks)
+            break;
+    }
+
+    pDelta->pHead = calloc((SIZE_T)1 << pDelta->nBits, sizeof(DWORD));
+    pDelta->pNext = malloc(max(pDelta->cBlocks, 1) * sizeof(DWORD));
+    pDelta->pSums = malloc(max(pDelta->cBlocks, 1) * sizeof(DWORD));
+    if (!pDelta->pHead || !pDelta->pNext || !pDelta->pSums)
+        return FALSE;
+
+    // backward, so that the chains are in the file order
+    for (iBlock = pDelta->cBlocks; iBlock-- > 0; )
+    {
+        pDelta->pSums[iBlock] = BlockSum(&pDelta->pb[0][iBlock * cbBlock], pDelta->cbBlock,
+                                         &s1, &s2);
+        iBucket = BucketOf(pDelta, pDelta->pSums[iBlock]);
+        pDelta->pNext[iBlock] = pDelta->pHead[iBucket];
+        pDelta->pHead[iBucket] = iBlock + 1;
+    }
+    return TRUE;
+}
+
+// Finds the block of the first file at ib1 of the second file
+static SIZE_T FindDeltaBlock(const DELTA *pDelta, SIZE_T ib1, DWORD sum, SIZE_T ibExpect)
+{
+    const BYTE *pb0 = pDelta->pb[0], *pb1 = &pDelta->pb[1][ib1];
+    DWORD cbBlock = pDelta->cbBlock, iBlock, cTries = 0;
+
+    // the bytes following the previous match come first
+    if (ibExpect + cbBlock <= pDelta->cb[0] && pb0[ibExpect] == pb1[0] &&
+        memcmp(&pb0[ibExpect], pb1, cbBlock) == 0)
+    {
+        return ibExpect;
+    }
+
+    for (iBlock = pDelta->pHead[BucketOf(pDelta, sum)]; iBlock; iBlock = pDelta->pNext[iBlock - 1])
+    {
+        if (pDelta->pSums[iBlock - 1] != sum)
+            continue;
+        if (memcmp(&pb0[(SIZE_T)(iBlock - 1) * cbBlock], pb1, cbBlock) == 0)
+            return (SIZE_T)(iBlock - 1) * cbBlock;
+        if (++cTries >= DELTA_MAX_CHAIN)
+            break;
+    }
+    return DELTA_NONE;
+}
+
+static BOOL AddDeltaCopy(DELTA *pDelta, SIZE_T ib0, SIZE_T ib1, SIZE_T cb)
+{
+    DELTACOPY *pCopy;
+    SIZE_T cCopiesMax;
+
+    if (pDelta->cCopies > 0)
+    {
+        pCopy = &pDelta->pCopies[pDelta->cCopies - 1];
+        if (pCopy->ib0 + pCopy->cb == ib0 && pCopy->ib1 + pCopy->cb == ib1)
+        {
+            pCopy->cb += cb;
+            return TRUE;
+        }
+    }
+
+    if (pDelta->cCopies >= pDelta->cCopiesMax)
+    {
+        cCopiesMax = max(pDelta->cCopiesMax * 2, 64);
+        pCopy = realloc(pDelta->pCopies, cCopiesMax * sizeof(DELTACOPY));
+        if (!pCopy)
+            return FALSE;
+        pDelta->pCopies = pCopy;
+        pDelta->cCopiesMax = cCopiesMax;
+    }
+    pCopy = &pDelta->pCopies[pDelta->cCopies++];
+    pCopy->ib0 = ib0;
+    pCopy->ib1 = ib1;
+    pCopy->cb = cb;
+    return TRUE;
+}
+
+static BOOL FindDeltaCopies(DELTA *pDelta)
+{
+    const BYTE *pb0 = pDelta->pb[0], *pb1 = pDelta->pb[1];
+    SIZE_T cb0 = pDelta->cb[0], cb1 = pDelta->cb[1];
+    SIZE_T ib1, ibLit, ibExpect, ib0, cbBack, cb;
+    DWORD cbBlock = pDelta->cbBlock, s1 = 0, s2 = 0, bOut;
+    BOOL fSum = FALSE;
+
+    // the common prefix
+    cb = FindMismatch(pb0, pb1, min(cb0, cb1));
+    if (cb > 0 && !AddDeltaCopy(pDelta, 0, 0, cb))
+        return FALSE;
+    ib1 = ibLit = ibExpect = cb;
+
+    while (pDelta->cBlocks > 0 && ib1 + cbBlock <= cb1)
+    {
+        if (!fSum)
+        {
+            BlockSum(&pb1[ib1], cbBlock, &s1, &s2);
+            fSum = TRUE;
+        }
+
+        ib0 = FindDeltaBlock(pDelta, ib1, CombineSums(s1, s2), ibExpect);
+        if (ib0 == DELTA_NONE)
+        {
+            // roll the checksum by one byte
+            if (ib1 + cbBlock < cb1)
+            {
+                bOut = pb1[ib1];
+                s1 += pb1[ib1 + cbBlock] - bOut;
+                s2 += s1 - cbBlock * bOut;
+            }
+            ++ib1;
+            continue;
+        }
+
+        // extend the match backward over the unmatched bytes, and forward
+        for (cbBack = 0; cbBack < ib1 - ibLit && cbBack < ib0; ++cbBack)
+        {
+            if (pb0[ib0 - cbBack - 1] != pb1[ib1 - cbBack - 1])
+                break;
+        }
+        cb = cbBlock + FindMismatch(&pb0[ib0 + cbBlock], &pb1[ib1 + cbBlock],
+                                    min(cb0 - ib0, cb1 - ib1) - cbBlock);
+        if (!AddDeltaCopy(pDelta, ib0 - cbBack, ib1 - cbBack, cb + cbBack))
+            return FALSE;
+
+        ib1 += cb;
+        ibLit = ib1;
+        ibExpect = ib0 + cb;
+        fSum = FALSE;
+    }
+
+    // the common suffix, which may be shorter than a block
+    for (cb = 0; cb < cb1 - ibLit && cb < cb0 - ibExpect; ++cb)
+    {
+        if (pb0[cb0 - cb - 1] != pb1[cb1 - cb - 1])
+            break;
+    }
+    return cb == 0 || AddDeltaCopy(pDelta, cb0 - cb, cb1 - cb, cb);
+}
+
+static int __cdecl CompareCopyByIb0(const void *p0, const void *p1)
+{
+    const DELTACOPY *pCopy0 = p0, *pCopy1 = p1;
+    if (pCopy0->ib0 < pCopy1->ib0)
+        return -1;
+    return pCopy0->ib0 > pCopy1->ib0;
+}
+
+// Prints the bytes between ib0 and ibEnd of the first file that are not copied
+static BOOL PrintDeleted(const DELTA *pDelta, const DELTACOPY *pSorted, SIZE_T ib0, SIZE_T ibEnd)
+{
+    SIZE_T iLo = 0, iHi = pDelta->cCopies, iMid;
+    BOOL fPrinted = FALSE;
+
+    // the first copy that ends after ib0
+    while (iLo < iHi)
+    {
+        iMid = (iLo + iHi) / 2;
+        if (pSorted[iMid].ib0 + pSorted[iMid].cb <= ib0)
+            iLo = iMid + 1;
+        else
+            iHi = iMid;
+    }
+
+    for (; ib0 < ibEnd; ++iLo)
+    {
+        if (iLo < pDelta->cCopies && pSorted[iLo].ib0 <= ib0)
+        {
+            ib0 = max(ib0, pSorted[iLo].ib0 + pSorted[iLo].cb);
+            continue;
+        }
+        if (iLo < pDelta->cCopies && pSorted[iLo].ib0 < ibEnd)
+        {
+            PrintDeltaRange(L'-', ib0, pSorted[iLo].ib0 - ib0, 0, pDelta->fQuad);
+            ib0 = pSorted[iLo].ib0 + pSorted[iLo].cb;
+        }
+        else
+        {
+            PrintDeltaRange(L'-', ib0, ibEnd - ib0, 0, pDelta->fQuad);
+            ib0 = ibEnd;
+        }
+        fPrinted = TRUE;
+    }
+    return fPrinted;
+}
+
+// Walks the copies in the order of the second file. A copy from before the
+// end of the previous one in the first file is moved.
+static FCRET PrintDelta(DELTA *pDelta)
+{
+    DELTACOPY *pSorted;
+    const DELTACOPY *pCopy;
+    SIZE_T iCopy, ibLit = 0, ibPrev0 = 0;
+    BOOL fDifferent = FALSE, fMoved;
+
+    pSorted = malloc(max(pDelta->cCopies, 1) * sizeof(DELTACOPY));
+    if (!pSorted)
+        return OutOfMemory();
+    if (pDelta->cCopies > 0)
+    {
+        CopyMemory(pSorted, pDelta->pCopies, pDelta->cCopies * sizeof(DELTACOPY));
+        qsort(pSorted, pDelta->cCopies, sizeof(DELTACOPY), CompareCopyByIb0);
+    }
+
+    for (iCopy = 0; iCopy < pDelta->cCopies; ++iCopy)
+    {
+        pCopy = &pDelta->pCopies[iCopy];
+        fMoved = (pCopy->ib0 < ibPrev0);
+        if (!fMoved)
+        {
+            fDifferent |= PrintDeleted(pDelta, pSorted, ibPrev0, pCopy->ib0);
+            ibPrev0 = pCopy->ib0 + pCopy->cb;
+        }
+        if (pCopy->ib1 > ibLit)
+        {
+            PrintDeltaRange(L'+', ibLit, pCopy->ib1 - ibLit, 0, pDelta->fQuad);
+            fDifferent = TRUE;
+        }
+        if (fMoved)
+        {
+            PrintDeltaRange(L'>', pCopy->ib0, pCopy->cb, pCopy->ib1, pDelta->fQuad);
+            fDifferent = TRUE;
+        }
+        ibLit = pCopy->ib1 + pCopy->cb;
+    }
+    fDifferent |= PrintDeleted(pDelta, pSorted, ibPrev0, pDelta->cb[0]);
+    if (pDelta->cb[1] > ibLit)
+    {
+        PrintDeltaRange(L'+', ibLit, pDelta->cb[1] - ibLit, 0, pDelta->fQuad);
+        fDifferent = TRUE;
+    }
+
+    free(pSorted);
+    return fDifferent ? FCRET_DIFFERENT : NoDifference();
+}
+
+FCRET DeltaFileCompare(FILECOMPARE *pFC)
+{
+    FCRET ret;
+    FCINPUT input0, input1;
+    DELTA delta;
+
+    ret = OpenInput(&input0, pFC->file[0], (pFC->dwFlags & FLAG_STREAM));
+    if (ret != FCRET_IDENTICAL)
+    {
+        CloseInput(&input0);
+        return ret;
+    }
+    ret = OpenInput(&input1, pFC->file[1], (pFC->dwFlags & FLAG_STREAM));
+    if (ret != FCRET_IDENTICAL)
+    {
+        CloseInput(&input0);
+        CloseInput(&input1);
+        return ret;
+    }
+    StartCacheHash(pFC->pCache, &input0);
+    StartCacheHash(pFC->pCache, &input1);
+
+    ZeroMemory(&delta, sizeof(delta));
+    do
+    {
+        if (_wcsicmp(pFC->file[0], pFC->file[1]) == 0)
+        {
+            ret = NoDifference();
+            break;
+        }
+
+        ret = LoadInput(&input0, &delta.pb[0], &delta.cb[0]);
+        if (ret != FCRET_IDENTICAL)
+            break;
+        ret = LoadInput(&input1, &delta.pb[1], &delta.cb[1]);
+        if (ret != FCRET_IDENTICAL)
+            break;
+        delta.fQuad = (max(delta.cb[0], delta.cb[1]) > MAXDWORD);
+
+        if (!BuildBlockTable(&delta) || !FindDeltaCopies(&delta))
+        {
+            ret = OutOfMemory();
+            break;
+        }
+        ret = PrintDelta(&delta);
+    } while (0);
+
+    free(delta.pHead);
+    free(delta.pNext);
+    free(delta.pSums);
+    free(delta.pCopies);
+    CloseInput(&input0);
+    CloseInput(&input1);
+    return ret;
+}
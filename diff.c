@@ -0,0 +1,585 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Diff algorithms on the symbols of lines (/ALG)
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+
+// E. W. Myers, "An O(ND) Difference Algorithm and Its Variations" (1986).
+// The middle snake of the shortest edit script is found by searching from
+// both ends at once, and the halves on either side of it are compared
+// recursively. Only two vectors of diagonals are needed (linear space).
+typedef struct MYERS
+{
+    const DWORD *pSym[2];
+    LPBYTE pfChanged[2];
+    LONG *pFwd; // the furthest x on each diagonal (x - y) going forward
+    LONG *pBwd; // the furthest x on each diagonal going backward
+} MYERS;
+
+// Finds the middle snake of a[x0, x1) and b[y0, y1). Neither range is empty,
+// and the ranges don't start or end with the same line.
+static VOID
+FindMiddleSnake(MYERS *pMyers, LONG x0, LONG x1, LONG y0, LONG y1, LONG *px, LONG *py)
+{
+    const DWORD *a = pMyers->pSym[0], *b = pMyers->pSym[1];
+    LONG *fd = pMyers->pFwd, *bd = pMyers->pBwd;
+    LONG dmin = x0 - y1, dmax = x1 - y0, fmid = x0 - y0, bmid = x1 - y1;
+    LONG fmin = fmid, fmax = fmid, bmin = bmid, bmax = bmid;
+    LONG d, x, y, lo, hi;
+    BOOL fOdd = (fmid - bmid) & 1;
+
+    fd[fmid] = x0;
+    bd[bmid] = x1;
+    for (;;)
+    {
+        // extend the forward paths by one edit; the diagonals out of range
+        // are fenced with values that are never taken
+        if (fmin > dmin)
+            fd[--fmin - 1] = -1;
+        else
+            ++fmin;
+        if (fmax < dmax)
+            fd[++fmax + 1] = -1;
+        else
+            --fmax;
+        for (d = fmax; d >= fmin; d -= 2)
+        {
+            lo = fd[d - 1];
+            hi = fd[d + 1];
+            x = (lo >= hi ? lo + 1 : hi);
+            y = x - d;
+            while (x < x1 && y < y1 && a[x] == b[y])
+            {
+                ++x;
+                ++y;
+            }
+            fd[d] = x;
+            if (fOdd && bmin <= d && d <= bmax && bd[d] <= x)
+            {
+                *px = x;
+                *py = y;
+                return;
+            }
+        }
+
+        // extend the backward paths by one edit
+        if (bmin > dmin)
+            bd[--bmin - 1] = MAXLONG;
+        else
+            ++bmin;
+        if (bmax < dmax)
+            bd[++bmax + 1] = MAXLONG;
+        else
+            --bmax;
+        for (d = bmax; d >= bmin; d -= 2)
+        {
+            lo = bd[d - 1];
+            hi = bd[d + 1];
+            x = (lo < hi ? lo : hi - 1);
+            y = x - d;
+            while (x > x0 && y > y0 && a[x - 1] == b[y - 1])
+            {
+                --x;
+                --y;
+            }
+            bd[d] = x;
+            if (!fOdd && fmin <= d && d <= fmax && x <= fd[d])
+            {
+                *px = x;
+                *py = y;
+                return;
+            }
+        }
+    }
+}
+
+static VOID CompareSymbols(MYERS *pMyers, LONG x0, LONG x1, LONG y0, LONG y1)
+{
+    const DWORD *a = pMyers->pSym[0], *b = pMyers->pSym[1];
+    LONG x, y;
+
+    for (;;)
+    {
+        // the common head and tail are not part of the edit script
+        while (x0 < x1 && y0 < y1 && a[x0] == b[y0])
+        {
+            ++x0;
+            ++y0;
+        }
+        while (x0 < x1 && y0 < y1 && a[x1 - 1] == b[y1 - 1])
+        {
+            --x1;
+            --y1;
+        }
+
+        if (x0 == x1)
+        {
+            while (y0 < y1)
+                pMyers->pfChanged[1][y0++] = TRUE;
+            return;
+        }
+        if (y0 == y1)
+        {
+            while (x0 < x1)
+                pMyers->pfChanged[0][x0++] = TRUE;
+            return;
+        }
+
+        FindMiddleSnake(pMyers, x0, x1, y0, y1, &x, &y);
+        CompareSymbols(pMyers, x0, x, y0, y);
+        x0 = x;
+        y0 = y;
+    }
+}
+
+static BOOL InitMyers(MYERS *pMyers, const DWORD *pSym0, DWORD cSym0,
+                      const DWORD *pSym1, DWORD cSym1, LPBYTE pfChanged0, LPBYTE pfChanged1)
+{
+    SIZE_T cDiags;
+
+    if (cSym0 >= MAXLONG / 2 || cSym1 >= MAXLONG / 2)
+        return FALSE;
+
+    // the diagonals go from -cSym1 - 1 to cSym0 + 1
+    cDiags = (SIZE_T)cSym0 + cSym1 + 3;
+    pMyers->pFwd = malloc(2 * cDiags * sizeof(LONG));
+    if (!pMyers->pFwd)
+        return FALSE;
+    pMyers->pBwd = pMyers->pFwd + cDiags + cSym1 + 1;
+    pMyers->pFwd += cSym1 + 1;
+
+    pMyers->pSym[0] = pSym0;
+    pMyers->pSym[1] = pSym1;
+    pMyers->pfChanged[0] = pfChanged0;
+    pMyers->pfChanged[1] = pfChanged1;
+    return TRUE;
+}
+
+static VOID FreeMyers(MYERS *pMyers, DWORD cSym1)
+{
+    free(pMyers->pFwd - cSym1 - 1);
+}
+
+// Finds a shortest edit script from the symbols of file 0 to those of file 1
+// (/ALG:MYERS). pfChanged[i][n] is set for each line n of file i that is
+// deleted or inserted; the arrays must be zero-filled.
+BOOL MyersDiff(const DWORD *pSym0, DWORD cSym0, const DWORD *pSym1, DWORD cSym1,
+               LPBYTE pfChanged0, LPBYTE pfChanged1)
+{
+    MYERS myers;
+
+    if (!InitMyers(&myers, pSym0, cSym0, pSym1, cSym1, pfChanged0, pfChanged1))
+        return FALSE;
+    CompareSymbols(&myers, 0, (LONG)cSym0, 0, (LONG)cSym1);
+    FreeMyers(&myers, cSym1);
+    return TRUE;
+}
+
+// The histogram diff of git. The lines that occur least often in a region of
+// file 0 are taken as anchors. The longest common run of lines around the
+// rarest anchor splits the region, and the parts on either side are compared
+// in the same way. A region whose common lines are all too frequent is left
+// to Myers. Frequent lines such as blank lines and braces never decide how
+// the files line up.
+#define HISTOGRAM_MAX_COUNT 64
+
+typedef struct HISTOGRAM
+{
+    const DWORD *pSym[2];
+    LPBYTE pfChanged[2];
+    LONG *pCount; // symbol -> # of the lines in the region of file 0
+    LONG *pFirst; // symbol -> the first of the lines in the region of file 0
+    LONG *pNext; // line of file 0 -> the next line of the same symbol, or -1
+    MYERS myers;
+} HISTOGRAM;
+
+// A common run of lines a[x0, x1) == b[y0, y1)
+typedef struct DIFFRUN
+{
+    LONG x0, x1, y0, y1;
+} DIFFRUN;
+
+// Finds the anchor run of a[x0, x1) and b[y0, y1). Returns FALSE if there is
+// no common line; *pfFrequent is set if the common lines are too frequent.
+static BOOL FindAnchor(HISTOGRAM *pHist, LONG x0, LONG x1, LONG y0, LONG y1,
+                       DIFFRUN *pRun, BOOL *pfFrequent)
+{
+    const DWORD *a = pHist->pSym[0], *b = pHist->pSym[1];
+    LONG *pCount = pHist->pCount, *pFirst = pHist->pFirst, *pNext = pHist->pNext;
+    LONG x, y, yNext, xs, xe, ys, ye, xNext, count, cMin = HISTOGRAM_MAX_COUNT + 1;
+    BOOL fFound = FALSE, fCommon = FALSE;
+
+    // count the lines of file 0, chaining each to the next of the same symbol
+    for (x = x1 - 1; x >= x0; --x)
+    {
+        pNext[x] = (pCount[a[x]] ? pFirst[a[x]] : -1);
+        pFirst[a[x]] = x;
+        ++pCount[a[x]];
+    }
+
+    for (y = y0; y < y1; y = yNext)
+    {
+        yNext = y + 1;
+        if (!pCount[b[y]])
+            continue;
+        fCommon = TRUE;
+        if (pCount[b[y]] > cMin)
+            continue;
+
+        for (x = pFirst[b[y]]; x >= 0; x = xNext)
+        {
+            // grow the run both ways, noting its rarest line
+            xNext = pNext[x];
+            xs = x;
+            ys = y;
+            xe = x + 1;
+            ye = y + 1;
+            count = pCount[a[x]];
+            while (xs > x0 && ys > y0 && a[xs - 1] == b[ys - 1])
+            {
+                --xs;
+                --ys;
+                count = min(count, pCount[a[xs]]);
+            }
+            while (xe < x1 && ye < y1 && a[xe] == b[ye])
+            {
+                count = min(count, pCount[a[xe]]);
+                ++xe;
+                ++ye;
+            }
+
+            if (yNext < ye)
+                yNext = ye;
+            if (!fFound || pRun->x1 - pRun->x0 < xe - xs || count < cMin)
+            {
+                pRun->x0 = xs;
+                pRun->x1 = xe;
+                pRun->y0 = ys;
+                pRun->y1 = ye;
+                cMin = count;
+                fFound = TRUE;
+            }
+
+            // the other lines of the symbol in this run give the same run
+            while (xNext >= 0 && xNext < xe)
+                xNext = pNext[xNext];
+        }
+    }
+
+    for (x = x0; x < x1; ++x)
+        pCount[a[x]] = 0;
+
+    *pfFrequent = (fCommon && cMin > HISTOGRAM_MAX_COUNT);
+    return fFound;
+}
+
+static VOID CompareHistogram(HISTOGRAM *pHist, LONG x0, LONG x1, LONG y0, LONG y1)
+{
+    const DWORD *a = pHist->pSym[0], *b = pHist->pSym[1];
+    DIFFRUN run;
+    BOOL fFrequent;
+
+    for (;;)
+    {
+        while (x0 < x1 && y0 < y1 && a[x0] == b[y0])
+        {
+            ++x0;
+            ++y0;
+        }
+        while (x0 < x1 && y0 < y1 && a[x1 - 1] == b[y1 - 1])
+        {
+            --x1;
+            --y1;
+        }
+
+        if (x0 == x1 || y0 == y1 ||
+            (!FindAnchor(pHist, x0, x1, y0, y1, &run, &fFrequent) && !fFrequent))
+        {
+            // nothing in common
+            while (x0 < x1)
+                pHist->pfChanged[0][x0++] = TRUE;
+            while (y0 < y1)
+                pHist->pfChanged[1][y0++] = TRUE;
+            return;
+        }
+        if (fFrequent)
+        {
+            CompareSymbols(&pHist->myers, x0, x1, y0, y1);
+            return;
+        }
+
+        // recurse into the smaller side, so that the stack stays shallow
+        if (run.x0 - x0 + run.y0 - y0 < x1 - run.x1 + y1 - run.y1)
+        {
+            CompareHistogram(pHist, x0, run.x0, y0, run.y0);
+            x0 = run.x1;
+            y0 = run.y1;
+        }
+        else
+        {
+            CompareHistogram(pHist, run.x1, x1, run.y1, y1);
+            x1 = run.x0;
+            y1 = run.y0;
+        }
+    }
+}
+
+// Finds the differences by the histogram diff (/ALG:HISTOGRAM). The symbols
+// must be less than cSymbols. The arguments are as of MyersDiff.
+BOOL HistogramDiff(const DWORD *pSym0, DWORD cSym0, const DWORD *pSym1, DWORD cSym1,
+                   DWORD cSymbols, LPBYTE pfChanged0, LPBYTE pfChanged1)
+{
+    HISTOGRAM hist;
+    BOOL ret = FALSE;
+
+    ZeroMemory(&hist, sizeof(hist));
+    if (!InitMyers(&hist.myers, pSym0, cSym0, pSym1, cSym1, pfChanged0, pfChanged1))
+        return FALSE;
+
+    do
+    {
+        hist.pCount = calloc((SIZE_T)cSymbols + 1, sizeof(LONG));
+        hist.pFirst = malloc(((SIZE_T)cSymbols + 1) * sizeof(LONG));
+        hist.pNext = malloc(((SIZE_T)cSym0 + 1) * sizeof(LONG));
+        if (!hist.pCount || !hist.pFirst || !hist.pNext)
+            break;
+
+        hist.pSym[0] = pSym0;
+        hist.pSym[1] = pSym1;
+        hist.pfChanged[0] = pfChanged0;
+        hist.pfChanged[1] = pfChanged1;
+        CompareHistogram(&hist, 0, (LONG)cSym0, 0, (LONG)cSym1);
+        ret = TRUE;
+    } while (0);
+
+    free(hist.pCount);
+    free(hist.pFirst);
+    free(hist.pNext);
+    FreeMyers(&hist.myers, cSym1);
+    return ret;
+}
+
+// /THREADS with /ALG splits the files at anchors: the lines that occur once
+// in each file, in the same order in both (the longest increasing run of
+// them, as in patience diff). The anchors are unchanged lines, so the
+// segments between them are compared independently by a pool of workers.
+// Only the anchors that end a segment of the target size are used.
+#define PARALLEL_MIN_SEGMENT 4096 // lines of both files
+#define PARALLEL_SEGMENTS(nThreads) (4 * (nThreads))
+
+typedef struct DIFFPOOL
+{
+    FCALG alg;
+    const DWORD *pSym[2];
+    LPBYTE pfChanged[2];
+    DIFFRUN *pSegs; // a[x0, x1) and b[y0, y1) of each segment
+    LONG cSegs;
+    LONG iNext;
+    volatile BOOL fFailed;
+} DIFFPOOL;
+
+// Splits the files into the segments at the anchors
+static BOOL FindAnchors(DIFFPOOL *pPool, DWORD cSym0, DWORD cSym1, DWORD cSymbols,
+                        DWORD cTarget)
+{
+    const DWORD *a = pPool->pSym[0], *b = pPool->pSym[1];
+    LONG *pPos0, *pPos1, *pCandX = NULL, *pCandY = NULL, *pPrev = NULL, *pTails = NULL;
+    LONG x, y, x0 = 0, y0 = 0, k, lo, hi, mid, cCand = 0, cTails = 0;
+    BOOL ret = FALSE;
+
+    pPos0 = malloc(((SIZE_T)cSymbols + 1) * sizeof(LONG));
+    pPos1 = malloc(((SIZE_T)cSymbols + 1) * sizeof(LONG));
+    do
+    {
+        if (!pPos0 || !pPos1)
+            break;
+
+        // the line of each symbol that occurs once, -1 if none, or -2 if more
+        FillMemory(pPos0, ((SIZE_T)cSymbols + 1) * sizeof(LONG), 0xFF);
+        FillMemory(pPos1, ((SIZE_T)cSymbols + 1) * sizeof(LONG), 0xFF);
+        for (x = 0; x < (LONG)cSym0; ++x)
+            pPos0[a[x]] = (pPos0[a[x]] == -1 ? x : -2);
+        for (y = 0; y < (LONG)cSym1; ++y)
+            pPos1[b[y]] = (pPos1[b[y]] == -1 ? y : -2);
+
+        // the candidates in the order of file 1
+        k = (LONG)min(cSym0, cSym1) + 1;
+        pCandX = malloc(k * sizeof(LONG));
+        pCandY = malloc(k * sizeof(LONG));
+        pPrev = malloc(k * sizeof(LONG));
+        pTails = malloc(k * sizeof(LONG));
+        pPool->pSegs = malloc(k * sizeof(DIFFRUN));
+        if (!pCandX || !pCandY || !pPrev || !pTails || !pPool->pSegs)
+            break;
+        for (y = 0; y < (LONG)cSym1; ++y)
+        {
+            if (pPos0[b[y]] >= 0 && pPos1[b[y]] >= 0)
+            {
+                pCandX[cCand] = pPos0[b[y]];
+                pCandY[cCand] = y;
+                ++cCand;
+            }
+        }
+
+        // the longest run of them that goes forward in file 0 (patience sorting);
+        // pTails[n] is the candidate that ends the best run of n + 1
+        for (k = 0; k < cCand; ++k)
+        {
+            lo = 0;
+            hi = cTails;
+            while (lo < hi)
+            {
+                mid = (lo + hi) / 2;
+                if (pCandX[pTails[mid]] < pCandX[k])
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            pPrev[k] = (lo > 0 ? pTails[lo - 1] : -1);
+            pTails[lo] = k;
+            if (lo == cTails)
+                ++cTails;
+        }
+
+        // link the run forward, reusing pTails
+        for (k = (cTails ? pTails[cTails - 1] : -1), lo = cTails; k >= 0; k = pPrev[k])
+            pTails[--lo] = k;
+
+        pPool->cSegs = 0;
+        for (lo = 0; lo < cTails; ++lo)
+        {
+            x = pCandX[pTails[lo]];
+            y = pCandY[pTails[lo]];
+            if ((DWORD)(x - x0 + y - y0) < cTarget)
+                continue;
+            pPool->pSegs[pPool->cSegs].x0 = x0;
+            pPool->pSegs[pPool->cSegs].x1 = x;
+            pPool->pSegs[pPool->cSegs].y0 = y0;
+            pPool->pSegs[pPool->cSegs].y1 = y;
+            ++pPool->cSegs;
+            x0 = x + 1;
+            y0 = y + 1;
+        }
+        pPool->pSegs[pPool->cSegs].x0 = x0;
+        pPool->pSegs[pPool->cSegs].x1 = (LONG)cSym0;
+        pPool->pSegs[pPool->cSegs].y0 = y0;
+        pPool->pSegs[pPool->cSegs].y1 = (LONG)cSym1;
+        ++pPool->cSegs;
+        ret = TRUE;
+    } while (0);
+
+    free(pPos0);
+    free(pPos1);
+    free(pCandX);
+    free(pCandY);
+    free(pPrev);
+    free(pTails);
+    return ret;
+}
+
+// Compares a segment. The symbols are numbered again from 0 for the
+// histogram, so that its arrays are as small as the segment.
+static BOOL DiffSegment(DIFFPOOL *pPool, const DIFFRUN *pSeg)
+{
+    const DWORD *a = pPool->pSym[0] + pSeg->x0, *b = pPool->pSym[1] + pSeg->y0;
+    DWORD cSym0 = pSeg->x1 - pSeg->x0, cSym1 = pSeg->y1 - pSeg->y0;
+    LPBYTE pfChanged0 = pPool->pfChanged[0] + pSeg->x0, pfChanged1 = pPool->pfChanged[1] + pSeg->y0;
+    LPDWORD pLocal, pSlots;
+    DWORD cSlots, cLocal = 0, n, sym, iSlot;
+    BOOL ret = FALSE;
+
+    if (pPool->alg != ALG_HISTOGRAM)
+        return MyersDiff(a, cSym0, b, cSym1, pfChanged0, pfChanged1);
+
+    for (cSlots = 16; cSlots < 2 * (cSym0 + cSym1); cSlots *= 2)
+        ;
+    pLocal = malloc(((SIZE_T)cSym0 + cSym1 + 1) * sizeof(DWORD));
+    pSlots = calloc(cSlots, 2 * sizeof(DWORD)); // symbol + 1 and its new number
+    if (pLocal && pSlots)
+    {
+        for (n = 0; n < cSym0 + cSym1; ++n)
+        {
+            sym = (n < cSym0 ? a[n] : b[n - cSym0]);
+            for (iSlot = (DWORD)((sym * 0x9E3779B97F4A7C15ULL) >> 32) & (cSlots - 1);
+                 pSlots[2 * iSlot] && pSlots[2 * iSlot] != sym + 1;
+                 iSlot = (iSlot + 1) & (cSlots - 1))
+            {
+                ;
+            }
+            if (!pSlots[2 * iSlot])
+            {
+                pSlots[2 * iSlot] = sym + 1;
+                pSlots[2 * iSlot + 1] = cLocal++;
+            }
+            pLocal[n] = pSlots[2 * iSlot + 1];
+        }
+        ret = HistogramDiff(pLocal, cSym0, pLocal + cSym0, cSym1, cLocal,
+                            pfChanged0, pfChanged1);
+    }
+
+    free(pLocal);
+    free(pSlots);
+    return ret;
+}
+
+static DWORD WINAPI DiffSegmentThread(LPVOID pParam)
+{
+    DIFFPOOL *pPool = pParam;
+    LONG iSeg;
+
+    while ((iSeg = InterlockedIncrement(&pPool->iNext) - 1) < pPool->cSegs)
+    {
+        if (pPool->fFailed)
+            break;
+        if (!DiffSegment(pPool, &pPool->pSegs[iSeg]))
+            pPool->fFailed = TRUE;
+    }
+    return 0;
+}
+
+// Finds the differences by the algorithm with nThreads threads. The arguments
+// are as of HistogramDiff.
+BOOL ParallelDiff(FCALG alg, INT nThreads, const DWORD *pSym0, DWORD cSym0,
+                  const DWORD *pSym1, DWORD cSym1, DWORD cSymbols,
+                  LPBYTE pfChanged0, LPBYTE pfChanged1)
+{
+    DIFFPOOL pool;
+    HANDLE ahThreads[MAXIMUM_WAIT_OBJECTS];
+    INT cThreads = 0, i;
+    DWORD cTarget;
+
+    if (cSym0 >= MAXLONG / 2 || cSym1 >= MAXLONG / 2)
+        return FALSE;
+
+    ZeroMemory(&pool, sizeof(pool));
+    pool.alg = alg;
+    pool.pSym[0] = pSym0;
+    pool.pSym[1] = pSym1;
+    pool.pfChanged[0] = pfChanged0;
+    pool.pfChanged[1] = pfChanged1;
+    cTarget = max((cSym0 + cSym1) / PARALLEL_SEGMENTS(nThreads), PARALLEL_MIN_SEGMENT);
+    if (!FindAnchors(&pool, cSym0, cSym1, cSymbols, cTarget))
+    {
+        free(pool.pSegs);
+        return FALSE;
+    }
+
+    nThreads = min(nThreads, pool.cSegs);
+    for (; cThreads < nThreads; ++cThreads)
+    {
+        ahThreads[cThreads] = CreateThread(NULL, 0, DiffSegmentThread, &pool, 0, NULL);
+        if (!ahThreads[cThreads])
+            break;
+    }
+    if (cThreads > 0)
+        WaitForMultipleObjects(cThreads, ahThreads, TRUE, INFINITE);
+    else
+        DiffSegmentThread(&pool);
+    for (i = 0; i < cThreads; ++i)
+        CloseHandle(ahThreads[i]);
+
+    free(pool.pSegs);
+    return !pool.fFailed;
+}
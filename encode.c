@@ -0,0 +1,232 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Detecting and decoding text encodings
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+
+#define REPLACEMENT_CHAR 0xFFFD
+
+// Gets the length of a UTF-8 sequence from its lead byte, or 0 if invalid
+static __inline DWORD Utf8SeqLength(BYTE b)
+{
+    if (b < 0x80)
+        return 1;
+    if (b >= 0xC2 && b <= 0xDF)
+        return 2;
+    if (b >= 0xE0 && b <= 0xEF)
+        return 3;
+    if (b >= 0xF0 && b <= 0xF4)
+        return 4;
+    return 0;
+}
+
+// Checks the second byte of a sequence. Overlong forms, surrogates and code
+// points above U+10FFFF are rejected here.
+static __inline BOOL IsUtf8Second(BYTE b0, BYTE b1)
+{
+    if ((b1 & 0xC0) != 0x80)
+        return FALSE;
+    switch (b0)
+    {
+        case 0xE0: return b1 >= 0xA0;
+        case 0xED: return b1 <= 0x9F;
+        case 0xF0: return b1 >= 0x90;
+        case 0xF4: return b1 <= 0x8F;
+        default:   return TRUE;
+    }
+}
+
+// Gets the length of the valid UTF-8 prefix of the sequence at pb. It is
+// shorter than the sequence if the sequence is broken or cut at cb.
+static DWORD Utf8ValidLength(const BYTE *pb, DWORD cb, DWORD cbSeq)
+{
+    DWORD ib;
+    for (ib = 1; ib < cbSeq && ib < cb; ++ib)
+    {
+        if (ib == 1 ? !IsUtf8Second(pb[0], pb[1]) : (pb[ib] & 0xC0) != 0x80)
+            break;
+    }
+    return ib;
+}
+
+// Checks whether the sample is UTF-8. A sequence that is cut at the end of
+// the sample is accepted unless the sample is the whole file (fLast).
+static BOOL IsUtf8Text(const BYTE *pb, DWORD cb, BOOL fLast, BOOL *pfAscii)
+{
+    DWORD ib = 0, cbSeq;
+
+    *pfAscii = TRUE;
+    while (ib < cb)
+    {
+        if (pb[ib] < 0x80)
+        {
+            if (pb[ib] == 0)
+                return FALSE;
+            ++ib;
+            continue;
+        }
+        *pfAscii = FALSE;
+        cbSeq = Utf8SeqLength(pb[ib]);
+        if (cbSeq == 0 || Utf8ValidLength(&pb[ib], cb - ib, cbSeq) < min(cbSeq, cb - ib) ||
+            (fLast && cbSeq > cb - ib))
+        {
+            return FALSE;
+        }
+        ib += cbSeq;
+    }
+    return TRUE;
+}
+
+// Detects the encoding of a text file from a sample of its head, which is the
+// whole file if fLast. A byte order mark is always taken. Otherwise the file
+// is UTF-16LE if fUnicode (/U), and UTF-8 if the sample is valid UTF-8 with
+// any non-ASCII character.
+FCENCODING DetectEncoding(const BYTE *pb, DWORD cb, BOOL fLast, BOOL fUnicode, LPDWORD pcbBOM)
+{
+    BOOL fAscii;
+
+    *pcbBOM = 0;
+    if (cb >= 3 && pb[0] == 0xEF && pb[1] == 0xBB && pb[2] == 0xBF)
+    {
+        *pcbBOM = 3;
+        return ENC_UTF8;
+    }
+    if (cb >= 2 && pb[0] == 0xFF && pb[1] == 0xFE)
+    {
+        *pcbBOM = 2;
+        return ENC_UTF16LE;
+    }
+    if (cb >= 2 && pb[0] == 0xFE && pb[1] == 0xFF)
+    {
+        *pcbBOM = 2;
+        return ENC_UTF16BE;
+    }
+
+    if (fUnicode)
+        return ENC_UTF16LE;
+    if (!IsUtf8Text(pb, cb, fLast, &fAscii))
+        return ENC_ANSI;
+    return (fAscii ? ENC_ASCII : ENC_UTF8);
+}
+
+static DWORD
+DecodeUtf8(LPWSTR pch, const BYTE *pb, DWORD cb, LPDWORD pcbUsed, BOOL fLast)
+{
+    DWORD ib = 0, ich = 0, cbSeq, cbValid, ibSeq;
+    UINT ch;
+
+    while (ib < cb)
+    {
+        // the ASCII runs are widened by the fast kernel
+        cbSeq = (DWORD)WidenAscii(&pch[ich], &pb[ib], cb - ib);
+        ib += cbSeq;
+        ich += cbSeq;
+        if (ib >= cb)
+            break;
+
+        cbSeq = Utf8SeqLength(pb[ib]);
+        if (cbSeq == 0)
+        {
+            pch[ich++] = REPLACEMENT_CHAR;
+            ++ib;
+            continue;
+        }
+        cbValid = Utf8ValidLength(&pb[ib], cb - ib, cbSeq);
+        if (cbValid < cbSeq)
+        {
+            if (ib + cbValid >= cb && !fLast)
+                break; // cut at the end of the block; wait for the rest
+            // the broken sequence is replaced as a whole
+            pch[ich++] = REPLACEMENT_CHAR;
+            ib += cbValid;
+            continue;
+        }
+
+        ch = pb[ib] & (0x7F >> cbSeq);
+        for (ibSeq = 1; ibSeq < cbSeq; ++ibSeq)
+            ch = (ch << 6) | (pb[ib + ibSeq] & 0x3F);
+        ib += cbSeq;
+
+        if (ch >= 0x10000)
+        {
+            ch -= 0x10000;
+            pch[ich++] = (WCHAR)(0xD800 | (ch >> 10));
+            pch[ich++] = (WCHAR)(0xDC00 | (ch & 0x3FF));
+        }
+        else
+        {
+            pch[ich++] = (WCHAR)ch;
+        }
+    }
+
+    *pcbUsed = ib;
+    return ich;
+}
+
+static DWORD
+DecodeUtf16BE(LPWSTR pch, const BYTE *pb, DWORD cb, LPDWORD pcbUsed, BOOL fLast)
+{
+    DWORD ich, cch = cb / 2;
+
+    for (ich = 0; ich < cch; ++ich)
+        pch[ich] = (WCHAR)((pb[2 * ich] << 8) | pb[2 * ich + 1]);
+
+    *pcbUsed = cch * 2;
+    if (fLast && (cb & 1))
+    {
+        pch[cch++] = REPLACEMENT_CHAR;
+        *pcbUsed = cb;
+    }
+    return cch;
+}
+
+// Whether the ANSI code page has double-byte characters
+BOOL IsDBCSCodePage(VOID)
+{
+    static INT s_nMaxCharSize = 0;
+    CPINFO info;
+
+    if (s_nMaxCharSize == 0)
+        s_nMaxCharSize = GetCPInfo(CP_ACP, &info) ? info.MaxCharSize : 1;
+    return s_nMaxCharSize > 1;
+}
+
+static DWORD
+DecodeAnsi(LPWSTR pch, const BYTE *pb, DWORD cb, LPDWORD pcbUsed, BOOL fLast)
+{
+    DWORD ib = 0;
+
+    // a double-byte character must not be cut at the end of the block
+    if (IsDBCSCodePage() && !fLast)
+    {
+        while (ib < cb)
+            ib += (IsDBCSLeadByte(pb[ib]) ? 2 : 1);
+        if (ib > cb)
+            --cb;
+    }
+
+    *pcbUsed = cb;
+    if (cb == 0)
+        return 0;
+    return (DWORD)MultiByteToWideChar(CP_ACP, 0, (LPCSTR)pb, (INT)cb, pch, (INT)cb);
+}
+
+// Decodes text into UTF-16. pch must have room for cb characters. A character
+// that is cut at the end of the block is left unless fLast; *pcbUsed receives
+// the bytes decoded. At least one byte is decoded if cb >= 4 or fLast.
+DWORD DecodeText(FCENCODING encoding, LPWSTR pch, const BYTE *pb, DWORD cb,
+                 LPDWORD pcbUsed, BOOL fLast)
+{
+    switch (encoding)
+    {
+        case ENC_ASCII:
+        case ENC_UTF8:
+            return DecodeUtf8(pch, pb, cb, pcbUsed, fLast);
+        case ENC_UTF16BE:
+            return DecodeUtf16BE(pch, pb, cb, pcbUsed, fLast);
+        default:
+            return DecodeAnsi(pch, pb, cb, pcbUsed, fLast);
+    }
+}
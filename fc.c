@@ -34,7 +34,7 @@
     }
     void ConResPuts(FILE *fp, UINT nID)
     {
-        WCHAR sz[MAX_PATH*5];
+        WCHAR sz[4096];
         LoadStringW(NULL, nID, sz, _countof(sz));
         fputws(sz, fp);
     }
@@ -521,32 +521,299 @@ BOOL WINAPI PathAddExtensionW(WCHAR *path, const WCHAR *ext)
 }
 #endif
 
+// All output of stdout goes through a large buffer that is written out when
+// it is full, instead of a ConPrintf call per line. To a console, the buffer
+// holds wide characters for ConPuts. To a file or a pipe, it holds bytes in
+// one code page and with one line break for the whole run, which
+// ChooseOutputFormat picks from the files before anything is written: UTF-8
+// if any text file is Unicode, and LF if the text files break their lines
+// with LF. ANSI lines are copied as they are if they are in that code page,
+// and converted otherwise.
+#define OUTBUF_SIZE (64 * 1024) // in bytes
+#define MESSAGE_SIZE (1024 + 2 * MAX_PATH) // in WCHARs, with the file names
+
+typedef struct OUTBUF
+{
+    HANDLE hOutput;
+    BOOL fConsole;
+    UINT uCodePage; // of the output
+    UINT uTextCodePage; // of the ANSI lines of the file pair
+    BOOL fCRLF; // CR LF, or LF
+    DWORD cb;
+    union
+    {
+        BYTE ab[OUTBUF_SIZE];
+        WCHAR sz[OUTBUF_SIZE / sizeof(WCHAR) + 1];
+    } u;
+} OUTBUF;
+
+static OUTBUF s_out;
+
+static VOID InitOutput(VOID)
+{
+    DWORD dwMode;
+    s_out.hOutput = GetStdHandle(STD_OUTPUT_HANDLE);
+    s_out.fConsole = GetConsoleMode(s_out.hOutput, &dwMode);
+    s_out.uCodePage = s_out.uTextCodePage = CP_ACP;
+    s_out.fCRLF = !s_out.fConsole;
+    s_out.cb = 0;
+}
+
+// Writes the bytes after whatever ConPrintf has written before
+static VOID WriteOutput(LPCVOID pv, SIZE_T cb)
+{
+    const BYTE *pb = pv;
+    DWORD cbPart, cbWritten;
+    fflush(stdout);
+    for (; cb > 0; pb += cbPart, cb -= cbPart)
+    {
+        cbPart = (DWORD)min(cb, 0x40000000);
+        if (!WriteFile(s_out.hOutput, pb, cbPart, &cbWritten, NULL))
+            break;
+    }
+}
+
+static VOID FlushOutput(VOID)
+{
+    if (s_out.cb == 0)
+        return;
+    if (s_out.fConsole)
+    {
+        s_out.u.sz[s_out.cb / sizeof(WCHAR)] = 0;
+        ConPuts(StdOut, s_out.u.sz);
+    }
+    else
+    {
+        WriteOutput(s_out.u.ab, s_out.cb);
+    }
+    s_out.cb = 0;
+}
+
+static VOID OutputW(LPCWSTR pch, SIZE_T cch)
+{
+    LPWSTR psz;
+    LPSTR pb;
+    SIZE_T ich;
+    INT cb;
+
+    if (s_out.fConsole)
+    {
+        // up to a null character, as %.*ls
+        for (ich = 0; ich < cch && pch[ich]; ++ich)
+            ;
+        cch = ich;
+        if (s_out.cb + cch * sizeof(WCHAR) > OUTBUF_SIZE)
+            FlushOutput();
+        if (cch * sizeof(WCHAR) <= OUTBUF_SIZE)
+        {
+            memcpy(&s_out.u.sz[s_out.cb / sizeof(WCHAR)], pch, cch * sizeof(WCHAR));
+            s_out.cb += (DWORD)(cch * sizeof(WCHAR));
+        }
+        else if ((psz = malloc((cch + 1) * sizeof(WCHAR))) != NULL)
+        {
+            memcpy(psz, pch, cch * sizeof(WCHAR));
+            psz[cch] = 0;
+            ConPuts(StdOut, psz);
+            free(psz);
+        }
+        return;
+    }
+
+    // a WCHAR takes up to 4 bytes (in GB18030; 3 in UTF-8)
+    if (s_out.cb + cch * 4 > OUTBUF_SIZE)
+        FlushOutput();
+    if (cch * 4 <= OUTBUF_SIZE)
+    {
+        s_out.cb += WideCharToMultiByte(s_out.uCodePage, 0, pch, (INT)cch,
+                                        (LPSTR)&s_out.u.ab[s_out.cb],
+                                        OUTBUF_SIZE - s_out.cb, NULL, NULL);
+        return;
+    }
+    cb = WideCharToMultiByte(s_out.uCodePage, 0, pch, (INT)cch, NULL, 0, NULL, NULL);
+    if (cb > 0 && (pb = malloc(cb)) != NULL)
+    {
+        cb = WideCharToMultiByte(s_out.uCodePage, 0, pch, (INT)cch, pb, cb, NULL, NULL);
+        WriteOutput(pb, cb);
+        free(pb);
+    }
+}
+
+static BOOL IsAsciiA(LPCSTR pch, SIZE_T cch)
+{
+    for (; cch > 0; --cch, ++pch)
+    {
+        if (*pch & 0x80)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+// Writes ANSI text of the file pair in the code page of the output
+static VOID OutputConvertedA(LPCSTR pch, SIZE_T cch)
+{
+    WCHAR sz[256];
+    LPWSTR psz = sz;
+    INT cchWide;
+    if (cch > _countof(sz) && (psz = malloc(cch * sizeof(WCHAR))) == NULL)
+        return;
+    cchWide = MultiByteToWideChar(s_out.uTextCodePage, 0, pch, (INT)cch, psz, (INT)cch);
+    OutputW(psz, cchWide);
+    if (psz != sz)
+        free(psz);
+}
+
+static VOID OutputA(LPCSTR pch, SIZE_T cch)
+{
+    LPWSTR psz;
+    LPCSTR pchNul;
+    INT cchWide;
+
+    if (!s_out.fConsole)
+    {
+        if (s_out.uTextCodePage != s_out.uCodePage && !IsAsciiA(pch, cch))
+        {
+            OutputConvertedA(pch, cch);
+            return;
+        }
+        if (s_out.cb + cch > OUTBUF_SIZE)
+            FlushOutput();
+        if (cch <= OUTBUF_SIZE)
+        {
+            memcpy(&s_out.u.ab[s_out.cb], pch, cch);
+            s_out.cb += (DWORD)cch;
+        }
+        else
+        {
+            WriteOutput(pch, cch);
+        }
+        return;
+    }
+
+    // up to a null character, as %.*hs
+    pchNul = memchr(pch, 0, cch);
+    if (pchNul)
+        cch = pchNul - pch;
+    if (s_out.cb + cch * sizeof(WCHAR) > OUTBUF_SIZE)
+        FlushOutput();
+    if (cch * sizeof(WCHAR) <= OUTBUF_SIZE)
+    {
+        cchWide = MultiByteToWideChar(s_out.uTextCodePage, 0, pch, (INT)cch,
+                                      &s_out.u.sz[s_out.cb / sizeof(WCHAR)], (INT)cch);
+        s_out.cb += cchWide * sizeof(WCHAR);
+    }
+    else if ((psz = malloc((cch + 1) * sizeof(WCHAR))) != NULL)
+    {
+        cchWide = MultiByteToWideChar(s_out.uTextCodePage, 0, pch, (INT)cch, psz, (INT)cch);
+        psz[cchWide] = 0;
+        ConPuts(StdOut, psz);
+        free(psz);
+    }
+}
+
+static __inline VOID OutputString(LPCSTR psz)
+{
+    OutputA(psz, strlen(psz));
+}
+
+// The line break of the run (see ChooseOutputFormat)
+static __inline VOID OutputNewLine(VOID)
+{
+    if (s_out.fCRLF)
+        OutputA("\r\n", 2);
+    else
+        OutputA("\n", 1);
+}
+
+// Formats n as %*I64u would; returns the start of the digits before pchEnd
+static LPSTR FormatDecimal(LPSTR pchEnd, ULONGLONG n, INT cchWidth)
+{
+    LPSTR pch = pchEnd;
+    do
+    {
+        *--pch = (CHAR)('0' + n % 10);
+        n /= 10;
+    } while (n);
+    while (pchEnd - pch < cchWidth)
+        *--pch = ' ';
+    return pch;
+}
+
+static VOID OutputDecimal(ULONGLONG n, INT cchWidth)
+{
+    CHAR sz[24];
+    LPSTR pch = FormatDecimal(&sz[_countof(sz)], n, cchWidth);
+    OutputA(pch, &sz[_countof(sz)] - pch);
+}
+
+// Writes n as %0*I64X would
+static VOID OutputHex(ULONGLONG n, INT cDigits)
+{
+    CHAR sz[16];
+    INT i;
+    for (i = cDigits; i-- > 0; n >>= 4)
+        sz[i] = "0123456789ABCDEF"[n & 0xF];
+    OutputA(sz, cDigits);
+}
+
+// Writes the text, with its '\n' as OutputNewLine
+static VOID OutputText(LPCWSTR psz)
+{
+    LPCWSTR pchEnd;
+    for (; (pchEnd = wcschr(psz, L'\n')) != NULL; psz = pchEnd + 1)
+    {
+        OutputW(psz, pchEnd - psz);
+        OutputNewLine();
+    }
+    OutputW(psz, wcslen(psz));
+}
+
+static VOID FormatResStringV(LPWSTR psz, UINT nID, va_list va)
+{
+    WCHAR szFormat[1024];
+    LoadStringW(NULL, nID, szFormat, _countof(szFormat));
+    _vsnwprintf(psz, MESSAGE_SIZE - 1, szFormat, va);
+    psz[MESSAGE_SIZE - 1] = 0;
+}
+
+// A message of stdout, as ConResPrintf
+static VOID OutputMessage(UINT nID, ...)
+{
+    WCHAR sz[MESSAGE_SIZE];
+    va_list va;
+    va_start(va, nID);
+    FormatResStringV(sz, nID, va);
+    va_end(va);
+    OutputText(sz);
+}
+
 FCRET NoDifference(VOID)
 {
-    ConResPuts(StdOut, IDS_NO_DIFFERENCE);
+    OutputMessage(IDS_NO_DIFFERENCE);
     return FCRET_IDENTICAL;
 }
 
 FCRET Different(LPCWSTR file0, LPCWSTR file1)
 {
-    ConResPrintf(StdOut, IDS_DIFFERENT, file0, file1);
+    OutputMessage(IDS_DIFFERENT, file0, file1);
     return FCRET_DIFFERENT;
 }
 
 FCRET LongerThan(LPCWSTR file0, LPCWSTR file1)
 {
-    ConResPrintf(StdOut, IDS_LONGER_THAN, file0, file1);
+    OutputMessage(IDS_LONGER_THAN, file0, file1);
     return FCRET_DIFFERENT;
 }
 
 FCRET OutOfMemory(VOID)
 {
+    FlushOutput();
     ConResPuts(StdErr, IDS_OUT_OF_MEMORY);
     return FCRET_INVALID;
 }
 
 FCRET CannotRead(LPCWSTR file)
 {
+    FlushOutput();
     ConResPrintf(StdErr, IDS_CANNOT_READ, file);
     return FCRET_INVALID;
 }
@@ -559,38 +826,119 @@ FCRET InvalidSwitch(VOID)
 
 FCRET ResyncFailed(VOID)
 {
-    ConResPuts(StdOut, IDS_RESYNC_FAILED);
+    OutputMessage(IDS_RESYNC_FAILED);
     return FCRET_DIFFERENT;
 }
 
+VOID OverMaxMem(VOID)
+{
+    FlushOutput();
+    ConResPuts(StdErr, IDS_OVER_MAXMEM);
+}
+
 VOID PrintCaption(LPCWSTR file)
 {
-    ConPrintf(StdOut, L"***** %ls\n", file);
+    OutputString("***** ");
+    OutputW(file, wcslen(file));
+    OutputNewLine();
 }
 
 VOID PrintEndOfDiff(VOID)
 {
-    ConPuts(StdOut, L"*****\n\n");
+    OutputString("*****");
+    OutputNewLine();
+    OutputNewLine();
 }
 
 VOID PrintDots(VOID)
 {
-    ConPuts(StdOut, L"...\n");
+    OutputString("...");
+    OutputNewLine();
+}
+
+VOID PrintUnifiedHeader(LPCWSTR file0, LPCWSTR file1)
+{
+    OutputString("--- ");
+    OutputW(file0, wcslen(file0));
+    OutputNewLine();
+    OutputString("+++ ");
+    OutputW(file1, wcslen(file1));
+    OutputNewLine();
+}
+
+// @@ -start,count +start,count @@. An empty range starts at the line before
+// it, and a count of one is left out, as in diff -u.
+VOID PrintHunkHeader(const DWORD lineno[2], const DWORD cLines[2])
+{
+    INT i;
+    OutputString("@@");
+    for (i = 0; i < 2; ++i)
+    {
+        OutputString(i ? " +" : " -");
+        if (cLines[i] == 1)
+        {
+            OutputDecimal(lineno[i], 0);
+        }
+        else
+        {
+            OutputDecimal(cLines[i] ? lineno[i] : lineno[i] - 1, 0);
+            OutputString(",");
+            OutputDecimal(cLines[i], 0);
+        }
+    }
+    OutputString(" @@");
+    OutputNewLine();
 }
 
-VOID PrintLineW(const FILECOMPARE *pFC, DWORD lineno, LPCWSTR psz)
+// Prints the text as it is, with its own line breaks (the hunks of /UNIFIED).
+// It goes in pieces up to a null character, which a console would cut at.
+VOID PrintTextW(LPCWSTR pch, SIZE_T cch)
+{
+    SIZE_T ich;
+    while (cch > 0)
+    {
+        ich = FindLineBreakW(pch, cch);
+        if (ich < cch)
+            ++ich;
+        OutputW(pch, ich);
+        pch += ich;
+        cch -= ich;
+    }
+}
+VOID PrintTextA(LPCSTR pch, SIZE_T cch)
+{
+    SIZE_T ich;
+    while (cch > 0)
+    {
+        ich = FindLineBreakA(pch, cch);
+        if (ich < cch)
+            ++ich;
+        OutputA(pch, ich);
+        pch += ich;
+        cch -= ich;
+    }
+}
+
+// L"%5d:  %.*ls\n" with /N, or L"%.*ls\n"
+VOID PrintLineW(const FILECOMPARE *pFC, DWORD lineno, LPCWSTR pch, DWORD cch)
 {
     if (pFC->dwFlags & FLAG_N)
-        ConPrintf(StdOut, L"%5d:  %ls\n", lineno, psz);
-    else
-        ConPrintf(StdOut, L"%ls\n", psz);
+    {
+        OutputDecimal(lineno, 5);
+        OutputString(":  ");
+    }
+    OutputW(pch, cch);
+    OutputNewLine();
 }
-VOID PrintLineA(const FILECOMPARE *pFC, DWORD lineno, LPCSTR psz)
+VOID PrintLineA(const FILECOMPARE *pFC, DWORD lineno, LPCSTR pch, DWORD cch)
 {
     if (pFC->dwFlags & FLAG_N)
-        ConPrintf(StdOut, L"%5d:  %hs\n", lineno, psz);
-    else
-        ConPrintf(StdOut, L"%hs\n", psz);
+    {
+        OutputDecimal(lineno, 5);
+        OutputString(":  ");
+    }
+    OutputA(pch, cch);
+    OutputNewLine();
 }
 
 HANDLE DoOpenFileForInput(LPCWSTR file)
@@ -598,212 +946,819 @@ HANDLE DoOpenFileForInput(LPCWSTR file)
     HANDLE hFile = CreateFileW(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
     if (hFile == INVALID_HANDLE_VALUE)
     {
+        FlushOutput();
         ConResPrintf(StdErr, IDS_CANNOT_OPEN, file);
     }
     return hFile;
 }
 
+// Binary differences are formatted through lookup tables into a buffer that
+// goes to the output buffer in big pieces, instead of one call per byte.
+#define HEXOUT_SIZE (16 * 1024) // in CHARs
+#define HEXOUT_LINE_MAX 25 // "0123456789ABCDEF: XX XX\r\n"
+
+typedef struct HEXOUT
+{
+    BOOL fQuad; // 16-digit offsets
+    DWORD cch;
+    CHAR sz[HEXOUT_SIZE];
+} HEXOUT;
+
+static CHAR s_szHexByte[256][2];
+
+static VOID InitHexTable(VOID)
+{
+    static const CHAR s_szHex[] = "0123456789ABCDEF";
+    UINT i;
+    if (s_szHexByte[255][0])
+        return;
+    for (i = 0; i < 256; ++i)
+    {
+        s_szHexByte[i][0] = s_szHex[i >> 4];
+        s_szHexByte[i][1] = s_szHex[i & 0xF];
+    }
+}
+
+static __inline LPSTR PutHexByte(LPSTR pch, BYTE b)
+{
+    pch[0] = s_szHexByte[b][0];
+    pch[1] = s_szHexByte[b][1];
+    return pch + 2;
+}
+
+// Same layout as "%08lX: %02X %02X\n" or "%016I64X: %02X %02X\n", with the
+// line break of the run
+static DWORD FormatHexDiff(LPSTR pch, ULONGLONG ib, BYTE b0, BYTE b1, BOOL fQuad)
+{
+    LPSTR pchStart = pch;
+    INT shift;
+    for (shift = (fQuad ? 56 : 24); shift >= 0; shift -= 8)
+        pch = PutHexByte(pch, (BYTE)(ib >> shift));
+    *pch++ = ':';
+    *pch++ = ' ';
+    pch = PutHexByte(pch, b0);
+    *pch++ = ' ';
+    pch = PutHexByte(pch, b1);
+    if (s_out.fCRLF)
+        *pch++ = '\r';
+    *pch++ = '\n';
+    return (DWORD)(pch - pchStart);
+}
+
+static HEXOUT *AllocHexOut(BOOL fQuad)
+{
+    HEXOUT *pOut = malloc(sizeof(HEXOUT));
+    if (!pOut)
+        return NULL;
+    InitHexTable();
+    pOut->fQuad = fQuad;
+    pOut->cch = 0;
+    return pOut;
+}
+
+static VOID FlushHexOut(HEXOUT *pOut)
+{
+    OutputA(pOut->sz, pOut->cch);
+    pOut->cch = 0;
+}
+
+static __inline VOID PrintHexDiff(HEXOUT *pOut, ULONGLONG ib, BYTE b0, BYTE b1)
+{
+    if (pOut->cch + HEXOUT_LINE_MAX > HEXOUT_SIZE)
+        FlushHexOut(pOut);
+    // the size of a stream is not known in advance
+    pOut->cch += FormatHexDiff(&pOut->sz[pOut->cch], ib, b0, b1,
+                               pOut->fQuad || ib > MAXDWORD);
+}
+
+// A run of adjacent differing bytes (/RANGES)
+typedef struct DIFFRANGE
+{
+    ULONGLONG ib;
+    ULONGLONG cb;
+    DWORD crc0, crc1;
+} DIFFRANGE;
+
+static DWORD s_crcTable[256];
+
+static VOID InitCrcTable(VOID)
+{
+    DWORD i, j, crc;
+    if (s_crcTable[255])
+        return;
+    for (i = 0; i < 256; ++i)
+    {
+        crc = i;
+        for (j = 0; j < 8; ++j)
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        s_crcTable[i] = crc;
+    }
+}
+
+// CRC-32 (IEEE 802.3); pass ~0 first and invert the final value
+static DWORD UpdateCrc(DWORD crc, const BYTE *pb, DWORD cb)
+{
+    while (cb-- > 0)
+        crc = s_crcTable[(crc ^ *pb++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+static DWORD Gf2MatrixTimes(const DWORD *mat, DWORD vec)
+{
+    DWORD sum = 0;
+    for (; vec; vec >>= 1, ++mat)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+    return sum;
+}
+
+static VOID Gf2MatrixSquare(DWORD *square, const DWORD *mat)
+{
+    INT n;
+    for (n = 0; n < 32; ++n)
+        square[n] = Gf2MatrixTimes(mat, mat[n]);
+}
+
+// Gets the CRC-32 of A followed by B from the final CRCs of A and B (cf. zlib's crc32_combine)
+static DWORD CombineCrc(DWORD crc0, DWORD crc1, ULONGLONG cb1)
+{
+    DWORD even[32], odd[32], row;
+    INT n;
+
+    if (cb1 == 0)
+        return crc0;
+
+    // the operator for one zero bit, then for two and four zero bits
+    odd[0] = 0xEDB88320;
+    for (n = 1, row = 1; n < 32; ++n, row <<= 1)
+        odd[n] = row;
+    Gf2MatrixSquare(even, odd);
+    Gf2MatrixSquare(odd, even);
+
+    // apply cb1 zero bytes to crc0
+    do
+    {
+        Gf2MatrixSquare(even, odd);
+        if (cb1 & 1)
+            crc0 = Gf2MatrixTimes(even, crc0);
+        cb1 >>= 1;
+        if (cb1 == 0)
+            break;
+        Gf2MatrixSquare(odd, even);
+        if (cb1 & 1)
+            crc0 = Gf2MatrixTimes(odd, crc0);
+        cb1 >>= 1;
+    } while (cb1 != 0);
+
+    return crc0 ^ crc1;
+}
+
+static VOID PrintDiffRange(const FILECOMPARE *pFC, const DIFFRANGE *pRange, BOOL fQuad)
+{
+    ULONGLONG ibLast = pRange->ib + pRange->cb - 1;
+    INT cDigits = ((fQuad || ibLast > MAXDWORD) ? 16 : 8);
+    if (pRange->cb == 0)
+        return;
+    // "%08lX-%08lX (%lu)", or "%016I64X-%016I64X (%I64u)"
+    OutputHex(pRange->ib, cDigits);
+    OutputString("-");
+    OutputHex(ibLast, cDigits);
+    OutputString(" (");
+    OutputDecimal(pRange->cb, 0);
+    OutputString(")");
+    if (pFC->dwFlags & FLAG_RANGES_CRC)
+    {
+        OutputString(" ");
+        OutputHex(~pRange->crc0, 8);
+        OutputString(" ");
+        OutputHex(~pRange->crc1, 8);
+    }
+    OutputNewLine();
+}
+
+// /DELTA: "- start-end (length)" for deleted bytes, "+ ..." for inserted bytes,
+// or "> start-end (length) offset" for bytes moved to the offset
+VOID PrintDeltaRange(WCHAR chOp, ULONGLONG ib, ULONGLONG cb, ULONGLONG ibTo, BOOL fQuad)
+{
+    ULONGLONG ibLast = ib + cb - 1;
+    INT cDigits = (fQuad ? 16 : 8);
+    OutputW(&chOp, 1);
+    OutputString(" ");
+    OutputHex(ib, cDigits);
+    OutputString("-");
+    OutputHex(ibLast, cDigits);
+    OutputString(" (");
+    OutputDecimal(cb, 0);
+    OutputString(")");
+    if (chOp == L'>')
+    {
+        OutputString(" ");
+        OutputHex(ibTo, cDigits);
+    }
+    OutputNewLine();
+}
+
+// Extends the current range with cb differing bytes at ib, or starts a new one.
+static VOID AddDiffRange(const FILECOMPARE *pFC, DIFFRANGE *pRange, ULONGLONG ib,
+                         const BYTE *pb0, const BYTE *pb1, DWORD cb, BOOL fQuad)
+{
+    if (pRange->cb == 0 || pRange->ib + pRange->cb != ib)
+    {
+        PrintDiffRange(pFC, pRange, fQuad);
+        pRange->ib = ib;
+        pRange->cb = 0;
+        pRange->crc0 = pRange->crc1 = 0xFFFFFFFF;
+    }
+    pRange->cb += cb;
+    if (pFC->dwFlags & FLAG_RANGES_CRC)
+    {
+        pRange->crc0 = UpdateCrc(pRange->crc0, pb0, cb);
+        pRange->crc1 = UpdateCrc(pRange->crc1, pb1, cb);
+    }
+}
+
+// Same as AddDiffRange, for a range whose CRCs are already calculated
+static VOID MergeDiffRange(const FILECOMPARE *pFC, DIFFRANGE *pRange, const DIFFRANGE *pNext,
+                           BOOL fQuad)
+{
+    if (pRange->cb == 0 || pRange->ib + pRange->cb != pNext->ib)
+    {
+        PrintDiffRange(pFC, pRange, fQuad);
+        *pRange = *pNext;
+        return;
+    }
+    if (pFC->dwFlags & FLAG_RANGES_CRC)
+    {
+        pRange->crc0 = ~CombineCrc(~pRange->crc0, ~pNext->crc0, pNext->cb);
+        pRange->crc1 = ~CombineCrc(~pRange->crc1, ~pNext->crc1, pNext->cb);
+    }
+    pRange->cb += pNext->cb;
+}
+
+// /THREADS:n splits the common part of two mapped files into chunks. The
+// workers compare the chunks and collect the differences of each chunk;
+// the chunks are printed in order, so the output is the same as that of
+// a single thread. At most PARALLEL_SLOTS(n) chunks are in flight.
+// The chunks are the pieces of the content hash, so that the workers can
+// hash them for /CACHE.
+#define PARALLEL_CHUNK_SIZE CACHE_PIECE_SIZE // a multiple of VIEW_ALIGNMENT
+#define PARALLEL_SLOTS(nThreads) (2 * (nThreads))
+
+typedef struct DIFFBYTE
+{
+    DWORD ib; // offset in the chunk
+    BYTE b0, b1;
+} DIFFBYTE;
+
+typedef struct CHUNK
+{
+    HANDLE hDone;
+    DWORD dwError; // ERROR_NOT_ENOUGH_MEMORY or a read error
+    INT iFile; // the input that cannot be read
+    BOOL fDifferent;
+    LPVOID pItems; // DIFFBYTE or DIFFRANGE
+    DWORD cItems;
+    DWORD cItemsMax;
+    BOOL fHashed[2];
+    BYTE digest[2][CACHE_DIGEST_SIZE]; // the hashes of the chunk (/CACHE)
+} CHUNK;
+
+typedef struct PARALLEL
+{
+    const FILECOMPARE *pFC;
+    FCINPUT *pInput[2];
+    LONG cChunks;
+    volatile LONG iNext; // the next chunk to compare
+    volatile BOOL fFound; // /Q: a difference was found; skip the rest
+    volatile BOOL fQuit;
+    HANDLE hSlots; // semaphore of free chunk slots
+    INT cSlots;
+    CHUNK *pChunks;
+} PARALLEL;
+
+static LPVOID AddChunkItem(CHUNK *pChunk, DWORD cbItem)
+{
+    LPVOID pItems;
+    DWORD cItemsMax;
+
+    if (pChunk->cItems >= pChunk->cItemsMax)
+    {
+        cItemsMax = max(pChunk->cItemsMax * 2, 256);
+        pItems = realloc(pChunk->pItems, cItemsMax * cbItem);
+        if (!pItems)
+            return NULL;
+        pChunk->pItems = pItems;
+        pChunk->cItemsMax = cItemsMax;
+    }
+    return (LPBYTE)pChunk->pItems + cbItem * pChunk->cItems++;
+}
+
+static VOID CompareChunk(PARALLEL *pPar, LONG iChunk, CHUNK *pChunk)
+{
+    const FILECOMPARE *pFC = pPar->pFC;
+    LARGE_INTEGER ib;
+    LPVOID pvView[2] = { NULL, NULL };
+    const BYTE *pb0, *pb1;
+    DWORD cb, ibBlock, ibEnd;
+    DIFFBYTE *pByte;
+    DIFFRANGE *pRange;
+    INT i;
+
+    pChunk->dwError = NO_ERROR;
+    pChunk->fDifferent = FALSE;
+    pChunk->cItems = 0;
+    pChunk->fHashed[0] = pChunk->fHashed[1] = FALSE;
+    if (pPar->fFound)
+        return;
+
+    ib.QuadPart = (LONGLONG)iChunk * PARALLEL_CHUNK_SIZE;
+    cb = PARALLEL_CHUNK_SIZE;
+    for (i = 0; i < 2; ++i)
+    {
+        pvView[i] = MapViewOfFile(pPar->pInput[i]->hMapping, FILE_MAP_READ,
+                                  ib.HighPart, ib.LowPart, cb);
+        if (!pvView[i])
+        {
+            pChunk->dwError = GetLastError();
+            pChunk->iFile = i;
+            break;
+        }
+    }
+
+    for (i = 0; i < 2 && pChunk->dwError == NO_ERROR; ++i)
+    {
+        if (pPar->pInput[i]->pHash)
+        {
+            HashCachePiece(pvView[i], pChunk->digest[i]);
+            pChunk->fHashed[i] = TRUE;
+        }
+    }
+
+    pb0 = pvView[0];
+    pb1 = pvView[1];
+    for (ibBlock = 0; pChunk->dwError == NO_ERROR; )
+    {
+        ibBlock += (DWORD)FindMismatch(&pb0[ibBlock], &pb1[ibBlock], cb - ibBlock);
+        if (ibBlock >= cb)
+            break;
+
+        pChunk->fDifferent = TRUE;
+        if (pFC->dwFlags & FLAG_Q)
+        {
+            pPar->fFound = TRUE;
+            break;
+        }
+        if (pFC->dwFlags & FLAG_RANGES)
+        {
+            for (ibEnd = ibBlock + 1; ibEnd < cb; ++ibEnd)
+            {
+                if (pb0[ibEnd] == pb1[ibEnd])
+                    break;
+            }
+            pRange = AddChunkItem(pChunk, sizeof(DIFFRANGE));
+            if (!pRange)
+            {
+                pChunk->dwError = ERROR_NOT_ENOUGH_MEMORY;
+                break;
+            }
+            pRange->ib = ib.QuadPart + ibBlock;
+            pRange->cb = ibEnd - ibBlock;
+            pRange->crc0 = pRange->crc1 = 0xFFFFFFFF;
+            if (pFC->dwFlags & FLAG_RANGES_CRC)
+            {
+                pRange->crc0 = UpdateCrc(pRange->crc0, &pb0[ibBlock], ibEnd - ibBlock);
+                pRange->crc1 = UpdateCrc(pRange->crc1, &pb1[ibBlock], ibEnd - ibBlock);
+            }
+            ibBlock = ibEnd;
+        }
+        else
+        {
+            pByte = AddChunkItem(pChunk, sizeof(DIFFBYTE));
+            if (!pByte)
+            {
+                pChunk->dwError = ERROR_NOT_ENOUGH_MEMORY;
+                break;
+            }
+            pByte->ib = ibBlock;
+            pByte->b0 = pb0[ibBlock];
+            pByte->b1 = pb1[ibBlock];
+            ++ibBlock;
+        }
+    }
+
+    for (i = 0; i < 2; ++i)
+    {
+        if (pvView[i])
+            UnmapViewOfFile(pvView[i]);
+    }
+}
+
+static DWORD WINAPI CompareChunkThread(LPVOID pParam)
+{
+    PARALLEL *pPar = pParam;
+    LONG iChunk;
+    CHUNK *pChunk;
+
+    for (;;)
+    {
+        WaitForSingleObject(pPar->hSlots, INFINITE);
+        iChunk = InterlockedIncrement(&pPar->iNext) - 1;
+        if (pPar->fQuit || iChunk >= pPar->cChunks)
+        {
+            // let the next waiting worker see it too
+            ReleaseSemaphore(pPar->hSlots, 1, NULL);
+            break;
+        }
+
+        pChunk = &pPar->pChunks[iChunk % pPar->cSlots];
+        CompareChunk(pPar, iChunk, pChunk);
+        SetEvent(pChunk->hDone);
+    }
+    return 0;
+}
+
+// Compares the first cChunks chunks of the mapped inputs with pFC->nThreads threads
+static FCRET ParallelBinaryCompare(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1,
+                                   LONG cChunks, HEXOUT *pOut, DIFFRANGE *pRange,
+                                   BOOL *pfDifferent)
+{
+    FCRET ret = FCRET_IDENTICAL;
+    PARALLEL par;
+    HANDLE ahThreads[MAXIMUM_WAIT_OBJECTS];
+    INT cThreads = 0, i;
+    LONG iChunk;
+    CHUNK *pChunk;
+    const DIFFBYTE *pByte;
+    const DIFFRANGE *pNext;
+    ULONGLONG ibChunk;
+    DWORD iItem;
+
+    ZeroMemory(&par, sizeof(par));
+    par.pFC = pFC;
+    par.pInput[0] = pInput0;
+    par.pInput[1] = pInput1;
+    par.cChunks = cChunks;
+    par.cSlots = PARALLEL_SLOTS(pFC->nThreads);
+
+    do
+    {
+        par.pChunks = calloc(par.cSlots, sizeof(CHUNK));
+        par.hSlots = CreateSemaphoreW(NULL, par.cSlots, MAXLONG, NULL);
+        if (!par.pChunks || !par.hSlots)
+        {
+            ret = OutOfMemory();
+            break;
+        }
+        for (i = 0; i < par.cSlots; ++i)
+        {
+            par.pChunks[i].hDone = CreateEventW(NULL, FALSE, FALSE, NULL);
+            if (!par.pChunks[i].hDone)
+                break;
+        }
+        if (i < par.cSlots)
+        {
+            ret = OutOfMemory();
+            break;
+        }
+        for (; cThreads < pFC->nThreads; ++cThreads)
+        {
+            ahThreads[cThreads] = CreateThread(NULL, 0, CompareChunkThread, &par, 0, NULL);
+            if (!ahThreads[cThreads])
+                break;
+        }
+        if (cThreads == 0)
+        {
+            ret = OutOfMemory();
+            break;
+        }
+
+        // print the results in order, freeing the slots for the workers
+        for (iChunk = 0; iChunk < cChunks; ++iChunk)
+        {
+            pChunk = &par.pChunks[iChunk % par.cSlots];
+            WaitForSingleObject(pChunk->hDone, INFINITE);
+            if (pChunk->dwError == ERROR_NOT_ENOUGH_MEMORY)
+            {
+                ret = OutOfMemory();
+                break;
+            }
+            if (pChunk->dwError != NO_ERROR)
+            {
+                ret = CannotRead(pFC->file[pChunk->iFile]);
+                break;
+            }
+            if (pChunk->fDifferent)
+            {
+                *pfDifferent = TRUE;
+                if (pFC->dwFlags & FLAG_Q)
+                    break;
+            }
+
+            ibChunk = (ULONGLONG)iChunk * PARALLEL_CHUNK_SIZE;
+            for (i = 0; i < 2; ++i)
+            {
+                if (pChunk->fHashed[i])
+                    AddCachePiece(par.pInput[i]->pHash, ibChunk, pChunk->digest[i]);
+            }
+            for (iItem = 0; iItem < pChunk->cItems; ++iItem)
+            {
+                if (pFC->dwFlags & FLAG_RANGES)
+                {
+                    pNext = (const DIFFRANGE *)pChunk->pItems + iItem;
+                    MergeDiffRange(pFC, pRange, pNext, pOut->fQuad);
+                }
+                else
+                {
+                    pByte = (const DIFFBYTE *)pChunk->pItems + iItem;
+                    PrintHexDiff(pOut, ibChunk + pByte->ib, pByte->b0, pByte->b1);
+                }
+            }
+            ReleaseSemaphore(par.hSlots, 1, NULL);
+        }
+    } while (0);
+
+    // stop the workers
+    par.fQuit = TRUE;
+    if (cThreads > 0)
+    {
+        ReleaseSemaphore(par.hSlots, cThreads, NULL);
+        WaitForMultipleObjects(cThreads, ahThreads, TRUE, INFINITE);
+    }
+    for (i = 0; i < cThreads; ++i)
+        CloseHandle(ahThreads[i]);
+
+    if (par.pChunks)
+    {
+        for (i = 0; i < par.cSlots; ++i)
+        {
+            if (par.pChunks[i].hDone)
+                CloseHandle(par.pChunks[i].hDone);
+            free(par.pChunks[i].pItems);
+        }
+        free(par.pChunks);
+    }
+    if (par.hSlots)
+        CloseHandle(par.hSlots);
+    return ret;
+}
+
 static FCRET BinaryFileCompare(FILECOMPARE *pFC)
 {
     FCRET ret;
-    HANDLE hFile0, hFile1, hMapping0 = NULL, hMapping1 = NULL;
-    LPBYTE pb0 = NULL, pb1 = NULL;
-    LARGE_INTEGER ib, cb0, cb1, cbCommon;
-    DWORD cbView, ibView;
+    FCINPUT input0, input1;
+    const BYTE *pb0 = NULL, *pb1 = NULL;
+    LARGE_INTEGER ib, cb0, cb1;
+    DWORD cbRest0 = 0, cbRest1 = 0, cbBlock, ibBlock, ibEnd;
+    LONG cChunks;
     BOOL fDifferent = FALSE;
-    DWORD dwLastError = 0;
+    HEXOUT *pOut = NULL;
+    DIFFRANGE range = { 0 };
 
-    hFile0 = DoOpenFileForInput(pFC->file[0]);
-    if (hFile0 == INVALID_HANDLE_VALUE)
-        return FCRET_CANT_FIND;
-    hFile1 = DoOpenFileForInput(pFC->file[1]);
-    if (hFile1 == INVALID_HANDLE_VALUE)
+    ret = OpenInput(&input0, pFC->file[0], (pFC->dwFlags & FLAG_STREAM));
+    if (ret != FCRET_IDENTICAL)
     {
-        CloseHandle(hFile0);
-        return FCRET_CANT_FIND;
+        CloseInput(&input0);
+        return ret;
+    }
+    ret = OpenInput(&input1, pFC->file[1], (pFC->dwFlags & FLAG_STREAM));
+    if (ret != FCRET_IDENTICAL)
+    {
+        CloseInput(&input0);
+        CloseInput(&input1);
+        return ret;
     }
+    StartCacheHash(pFC->pCache, &input0);
+    StartCacheHash(pFC->pCache, &input1);
 
     do
     {
         if (_wcsicmp(pFC->file[0], pFC->file[1]) == 0)
         {
-            ret = NoDifference();
+            ret = (pFC->dwFlags & FLAG_Q) ? FCRET_IDENTICAL : NoDifference();
             break;
         }
-        //if (!GetFileSizeEx(hFile0, &cb0))
-        cb0.LowPart = GetFileSize(hFile0, &(cb0.HighPart));
-        if (cb0.LowPart == INVALID_FILE_SIZE)
-            dwLastError = GetLastError();
-        else dwLastError = 0;
-        if (dwLastError != NO_ERROR)
+        cb0 = input0.cb; // -1 if unknown
+        cb1 = input1.cb;
+        if ((pFC->dwFlags & FLAG_Q) && cb0.QuadPart >= 0 && cb1.QuadPart >= 0 &&
+            cb0.QuadPart != cb1.QuadPart)
         {
-            ret = CannotRead(pFC->file[0]);
+            ret = FCRET_DIFFERENT;
             break;
         }
-        //if (!GetFileSizeEx(hFile1, &cb1))
-        cb1.LowPart = GetFileSize(hFile1, &(cb1.HighPart));
-        if (cb1.LowPart == INVALID_FILE_SIZE)
-            dwLastError = GetLastError();
-        else dwLastError = 0;
-        if (dwLastError != NO_ERROR)
+
+        pOut = AllocHexOut(min(cb0.QuadPart, cb1.QuadPart) > MAXDWORD);
+        if (!pOut)
         {
-            ret = CannotRead(pFC->file[1]);
+            ret = OutOfMemory();
             break;
         }
-        cbCommon.QuadPart = min(cb0.QuadPart, cb1.QuadPart);
-        if (cbCommon.QuadPart > 0)
+
+        if (pFC->dwFlags & FLAG_RANGES_CRC)
+            InitCrcTable();
+
+        ret = FCRET_IDENTICAL;
+        ib.QuadPart = 0;
+        if (pFC->nThreads > 1 && !input0.fStream && !input1.fStream)
+        {
+            // the chunks of the common part; the rest is done below
+            cChunks = (LONG)min(min(cb0.QuadPart, cb1.QuadPart) / PARALLEL_CHUNK_SIZE, MAXLONG);
+            if (cChunks > 1)
+            {
+                ret = ParallelBinaryCompare(pFC, &input0, &input1, cChunks, pOut, &range,
+                                            &fDifferent);
+                ib.QuadPart = (LONGLONG)cChunks * PARALLEL_CHUNK_SIZE;
+                input0.ibNext = input1.ibNext = ib.QuadPart;
+            }
+        }
+
+        for (; ret == FCRET_IDENTICAL && !(fDifferent && (pFC->dwFlags & FLAG_Q));
+             ib.QuadPart += cbBlock)
         {
-            hMapping0 = CreateFileMappingW(hFile0, NULL, PAGE_READONLY,
-                                           cb0.HighPart, cb0.LowPart, NULL);
-            if (hMapping0 == NULL)
+            // the blocks of the two inputs may have different sizes
+            if (cbRest0 == 0 && !ReadInputBlock(&input0, &pb0, &cbRest0))
             {
                 ret = CannotRead(pFC->file[0]);
                 break;
             }
-            hMapping1 = CreateFileMappingW(hFile1, NULL, PAGE_READONLY,
-                                           cb1.HighPart, cb1.LowPart, NULL);
-            if (hMapping1 == NULL)
+            if (cbRest1 == 0 && !ReadInputBlock(&input1, &pb1, &cbRest1))
             {
                 ret = CannotRead(pFC->file[1]);
                 break;
             }
+            if (cbRest0 == 0 || cbRest1 == 0)
+                break;
 
-            ret = FCRET_IDENTICAL;
-            for (ib.QuadPart = 0; ib.QuadPart < cbCommon.QuadPart; )
+            cbBlock = min(cbRest0, cbRest1);
+            for (ibBlock = 0; ; )
             {
-                cbView = (DWORD)min(cbCommon.QuadPart - ib.QuadPart, MAX_VIEW_SIZE);
-                pb0 = MapViewOfFile(hMapping0, FILE_MAP_READ, ib.HighPart, ib.LowPart, cbView);
-                pb1 = MapViewOfFile(hMapping1, FILE_MAP_READ, ib.HighPart, ib.LowPart, cbView);
-                if (!pb0 || !pb1)
-                {
-                    ret = OutOfMemory();
+                // skip the identical bytes in wide blocks
+                ibBlock += (DWORD)FindMismatch(&pb0[ibBlock], &pb1[ibBlock], cbBlock - ibBlock);
+                if (ibBlock >= cbBlock)
                     break;
-                }
-                for (ibView = 0; ibView < cbView; ++ib.QuadPart, ++ibView)
-                {
-                    if (pb0[ibView] == pb1[ibView])
-                        continue;
 
-                    fDifferent = TRUE;
-                    if (cbCommon.QuadPart > MAXDWORD)
-                    {
-                        ConPrintf(StdOut, L"%016I64X: %02X %02X\n", ib.QuadPart,
-                                  pb0[ibView], pb1[ibView]);
-                    }
-                    else
+                fDifferent = TRUE;
+                if (pFC->dwFlags & FLAG_Q)
+                    break;
+                if (pFC->dwFlags & FLAG_RANGES)
+                {
+                    for (ibEnd = ibBlock + 1; ibEnd < cbBlock; ++ibEnd)
                     {
-                        ConPrintf(StdOut, L"%08lX: %02X %02X\n", ib.LowPart,
-                                  pb0[ibView], pb1[ibView]);
+                        if (pb0[ibEnd] == pb1[ibEnd])
+                            break;
                     }
+                    AddDiffRange(pFC, &range, ib.QuadPart + ibBlock, &pb0[ibBlock],
+                                 &pb1[ibBlock], ibEnd - ibBlock, pOut->fQuad);
+                    ibBlock = ibEnd;
+                }
+                else
+                {
+                    PrintHexDiff(pOut, ib.QuadPart + ibBlock, pb0[ibBlock], pb1[ibBlock]);
+                    ++ibBlock;
                 }
-                UnmapViewOfFile(pb0);
-                UnmapViewOfFile(pb1);
-                pb0 = pb1 = NULL;
             }
-            if (ret != FCRET_IDENTICAL)
-                break;
+            pb0 += cbBlock;
+            pb1 += cbBlock;
+            cbRest0 -= cbBlock;
+            cbRest1 -= cbBlock;
         }
+        FlushHexOut(pOut);
+        PrintDiffRange(pFC, &range, pOut->fQuad);
+        if (ret != FCRET_IDENTICAL)
+            break;
 
-        if (cb0.QuadPart < cb1.QuadPart)
-            ret = LongerThan(pFC->file[1], pFC->file[0]);
-        else if (cb0.QuadPart > cb1.QuadPart)
-            ret = LongerThan(pFC->file[0], pFC->file[1]);
+        // the input with data left over is the longer one
+        if (fDifferent && (pFC->dwFlags & FLAG_Q))
+            ret = FCRET_DIFFERENT;
+        else if (cbRest0 < cbRest1)
+            ret = (pFC->dwFlags & FLAG_Q) ? FCRET_DIFFERENT : LongerThan(pFC->file[1], pFC->file[0]);
+        else if (cbRest0 > cbRest1)
+            ret = (pFC->dwFlags & FLAG_Q) ? FCRET_DIFFERENT : LongerThan(pFC->file[0], pFC->file[1]);
         else if (fDifferent)
             ret = FCRET_DIFFERENT;/*Different(pFC->file[0], pFC->file[1]);*/
+        else if (pFC->dwFlags & FLAG_Q)
+            ret = FCRET_IDENTICAL;
         else
             ret = NoDifference();
     } while (0);
 
-    UnmapViewOfFile(pb0);
-    UnmapViewOfFile(pb1);
-    CloseHandle(hMapping0);
-    CloseHandle(hMapping1);
-    CloseHandle(hFile0);
-    CloseHandle(hFile1);
+    free(pOut);
+    CloseInput(&input0);
+    CloseInput(&input1);
     return ret;
 }
 
+static BOOL IsUnicodeEncoding(FCENCODING encoding)
+{
+    return encoding == ENC_UTF16LE || encoding == ENC_UTF16BE;
+}
+
+// Detects the encodings of the text files. Files in the same byte encoding
+// are compared as they are (after the BOMs). Otherwise both are compared in
+// UTF-16, and a file that isn't UTF-16LE is decoded while it is read.
+static FCRET
+SetTextEncodings(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1, BOOL *pfUnicode)
+{
+    FCRET ret;
+    FCINPUT *pInputs[2];
+    FCENCODING encodings[2];
+    DWORD cbBOMs[2], cb;
+    const BYTE *pb;
+    BOOL fLast;
+    INT i;
+
+    *pfUnicode = !!(pFC->dwFlags & FLAG_U);
+    if (pFC->dwFlags & FLAG_L)
+        return FCRET_IDENTICAL; // as they are
+
+    pInputs[0] = pInput0;
+    pInputs[1] = pInput1;
+    for (i = 0; i < 2; ++i)
+    {
+        if (!SampleInput(pInputs[i], &pb, &cb, &fLast))
+            return CannotRead(pInputs[i]->file);
+        encodings[i] = DetectEncoding(pb, cb, fLast, !!(pFC->dwFlags & FLAG_U), &cbBOMs[i]);
+    }
+    if (IsUnicodeEncoding(encodings[0]) || IsUnicodeEncoding(encodings[1]))
+        *pfUnicode = TRUE;
+
+    // non-ASCII characters of UTF-8 and ANSI are different bytes
+    if ((encodings[0] == ENC_UTF8 && encodings[1] == ENC_ANSI) ||
+        (encodings[0] == ENC_ANSI && encodings[1] == ENC_UTF8))
+    {
+        *pfUnicode = TRUE;
+    }
+
+    for (i = 0; i < 2; ++i)
+    {
+        ret = SetInputEncoding(pInputs[i], encodings[i], cbBOMs[i],
+                               *pfUnicode && encodings[i] != ENC_UTF16LE);
+        if (ret != FCRET_IDENTICAL)
+            return ret;
+    }
+    return FCRET_IDENTICAL;
+}
+
 static FCRET TextFileCompare(FILECOMPARE *pFC)
 {
     FCRET ret;
-    HANDLE hFile0, hFile1, hMapping0 = NULL, hMapping1 = NULL;
-    LARGE_INTEGER cb0, cb1;
-    BOOL fUnicode = !!(pFC->dwFlags & FLAG_U);
-    DWORD dwLastError = 0;
+    FCINPUT input0, input1;
+    BOOL fUnicode;
 
-    hFile0 = DoOpenFileForInput(pFC->file[0]);
-    if (hFile0 == INVALID_HANDLE_VALUE)
-        return FCRET_CANT_FIND;
-    hFile1 = DoOpenFileForInput(pFC->file[1]);
-    if (hFile1 == INVALID_HANDLE_VALUE)
+    ret = OpenInput(&input0, pFC->file[0], (pFC->dwFlags & FLAG_STREAM));
+    if (ret != FCRET_IDENTICAL)
     {
-        CloseHandle(hFile0);
-        return FCRET_CANT_FIND;
+        CloseInput(&input0);
+        return ret;
+    }
+    ret = OpenInput(&input1, pFC->file[1], (pFC->dwFlags & FLAG_STREAM));
+    if (ret != FCRET_IDENTICAL)
+    {
+        CloseInput(&input0);
+        CloseInput(&input1);
+        return ret;
     }
+    StartCacheHash(pFC->pCache, &input0);
+    StartCacheHash(pFC->pCache, &input1);
 
     do
     {
         if (_wcsicmp(pFC->file[0], pFC->file[1]) == 0)
         {
-            ret = NoDifference();
-            break;
-        }
-        //if (!GetFileSizeEx(hFile0, &cb0))
-        cb0.LowPart = GetFileSize(hFile0, &(cb0.HighPart));
-        if (cb0.LowPart == INVALID_FILE_SIZE)
-            dwLastError = GetLastError();
-        else dwLastError = 0;
-        if (dwLastError != NO_ERROR)
-        {
-            ret = CannotRead(pFC->file[0]);
+            ret = (pFC->dwFlags & (FLAG_Q | FLAG_UNIFIED)) ? FCRET_IDENTICAL : NoDifference();
             break;
         }
-        //if (!GetFileSizeEx(hFile1, &cb1))
-        cb1.LowPart = GetFileSize(hFile1, &(cb1.HighPart));
-        if (cb1.LowPart == INVALID_FILE_SIZE)
-            dwLastError = GetLastError();
-        else dwLastError = 0;
-        if (dwLastError != NO_ERROR)
+
+        if (input0.cb.QuadPart == 0 && input1.cb.QuadPart == 0)
         {
-            ret = CannotRead(pFC->file[1]);
+            ret = (pFC->dwFlags & (FLAG_Q | FLAG_UNIFIED)) ? FCRET_IDENTICAL : NoDifference();
             break;
         }
 
-        if (cb0.QuadPart == 0 && cb1.QuadPart == 0)
-        {
-            ret = NoDifference();
+        ret = SetTextEncodings(pFC, &input0, &input1, &fUnicode);
+        if (ret != FCRET_IDENTICAL)
             break;
-        }
-        if (cb0.QuadPart > 0)
-        {
-            hMapping0 = CreateFileMappingW(hFile0, NULL, PAGE_READONLY,
-                                           cb0.HighPart, cb0.LowPart, NULL);
-            if (hMapping0 == NULL)
-            {
-                ret = CannotRead(pFC->file[0]);
-                break;
-            }
-        }
-        if (cb1.QuadPart > 0)
+
+        // the ANSI lines are in UTF-8 or in the ANSI code page
+        if (!fUnicode && (input0.encoding == ENC_UTF8 || input1.encoding == ENC_UTF8))
+            s_out.uTextCodePage = CP_UTF8;
+
+        if (pFC->dwFlags & FLAG_Q)
         {
-            hMapping1 = CreateFileMappingW(hFile1, NULL, PAGE_READONLY,
-                                           cb1.HighPart, cb1.LowPart, NULL);
-            if (hMapping1 == NULL)
-            {
-                ret = CannotRead(pFC->file[1]);
-                break;
-            }
+            if (fUnicode)
+                ret = TextCompareQuietW(pFC, &input0, &input1);
+            else
+                ret = TextCompareQuietA(pFC, &input0, &input1);
         }
-        if (fUnicode)
-            ret = TextCompareW(pFC, &hMapping0, &cb0, &hMapping1, &cb1);
+        else if (fUnicode)
+            ret = TextCompareW(pFC, &input0, &input1);
         else
-            ret = TextCompareA(pFC, &hMapping0, &cb0, &hMapping1, &cb1);
+            ret = TextCompareA(pFC, &input0, &input1);
     } while (0);
 
-    CloseHandle(hMapping0);
-    CloseHandle(hMapping1);
-    CloseHandle(hFile0);
-    CloseHandle(hFile1);
+    CloseInput(&input0);
+    CloseInput(&input1);
     return ret;
 }
 
@@ -841,10 +1796,34 @@ static BOOL IsBinaryExt(LPCWSTR filename)
 static FCRET FileCompare(FILECOMPARE *pFC)
 {
     FCRET ret;
-    ConResPrintf(StdOut, IDS_COMPARING, pFC->file[0], pFC->file[1]);
-
-    if (!(pFC->dwFlags & FLAG_L) &&
-        ((pFC->dwFlags & FLAG_B) || IsBinaryExt(pFC->file[0]) || IsBinaryExt(pFC->file[1])))
+    BOOL fBinary, fQuiet;
+
+    fBinary = !(pFC->dwFlags & FLAG_L) &&
+              ((pFC->dwFlags & (FLAG_B | FLAG_DELTA)) ||
+               IsBinaryExt(pFC->file[0]) || IsBinaryExt(pFC->file[1]));
+    // a unified diff has nothing but the hunks, so that it can be applied
+    fQuiet = (pFC->dwFlags & FLAG_Q) || (!fBinary && (pFC->dwFlags & FLAG_UNIFIED));
+    s_out.uTextCodePage = CP_ACP;
+    if (!fQuiet)
+        OutputMessage(IDS_COMPARING, pFC->file[0], pFC->file[1]);
+
+    // The cached hashes tell whether the contents are the same. Different
+    // contents are enough only for /B /Q; otherwise the differences are shown.
+    ret = pFC->pCache ? CacheCompare(pFC) : FCRET_INVALID;
+    if (ret == FCRET_IDENTICAL)
+    {
+        if (!fQuiet)
+            ret = NoDifference();
+    }
+    else if (ret == FCRET_DIFFERENT && fBinary && (pFC->dwFlags & FLAG_Q))
+    {
+        // nothing to do
+    }
+    else if (fBinary && (pFC->dwFlags & FLAG_DELTA) && !(pFC->dwFlags & FLAG_Q))
+    {
+        ret = DeltaFileCompare(pFC);
+    }
+    else if (fBinary)
     {
         ret = BinaryFileCompare(pFC);
     }
@@ -853,7 +1832,9 @@ static FCRET FileCompare(FILECOMPARE *pFC)
         ret = TextFileCompare(pFC);
     }
 
-    ConPuts(StdOut, L"\n");
+    if (!fQuiet)
+        OutputNewLine();
+    FlushOutput();
     return ret;
 }
 
@@ -903,6 +1884,7 @@ static FCRET WildcardFileCompareOneSide(FILECOMPARE *pFC, BOOL bWildRight)
                 ret = FCRET_INVALID;
                 break;
         }
+        pFC->cbPeak = max(pFC->cbPeak, fc.cbPeak); // for IDS_PEAK_MEMORY
     } while (FindNextFileW(hFind, &find));
 
     return ret;
@@ -969,6 +1951,7 @@ static FCRET WildcardFileCompareBoth(FILECOMPARE *pFC)
                 ret = FCRET_INVALID;
                 break;
         }
+        pFC->cbPeak = max(pFC->cbPeak, fc.cbPeak); // for IDS_PEAK_MEMORY
         f0 = FindNextFileW(hFind0, &find0);
         f1 = FindNextFileW(hFind1, &find1);
     } while (f0 && f1);
@@ -1032,14 +2015,139 @@ static FCRET WildcardFileCompare(FILECOMPARE *pFC)
     return FileCompare(pFC);
 }
 
+// The first line break of a text file: -1 if there is none in the sample, or
+// whether it is CR LF
+static INT SampleLineBreak(const BYTE *pb, DWORD cb, FCENCODING encoding)
+{
+    DWORD ib;
+    switch (encoding)
+    {
+        case ENC_UTF16LE:
+            for (ib = 0; ib + 1 < cb; ib += 2)
+            {
+                if (pb[ib] == '\n' && pb[ib + 1] == 0)
+                    return (ib >= 2 && pb[ib - 2] == '\r' && pb[ib - 1] == 0);
+            }
+            return -1;
+        case ENC_UTF16BE:
+            for (ib = 0; ib + 1 < cb; ib += 2)
+            {
+                if (pb[ib] == 0 && pb[ib + 1] == '\n')
+                    return (ib >= 2 && pb[ib - 2] == 0 && pb[ib - 1] == '\r');
+            }
+            return -1;
+        default:
+            for (ib = 0; ib < cb; ++ib)
+            {
+                if (pb[ib] == '\n')
+                    return (ib >= 1 && pb[ib - 1] == '\r');
+            }
+            return -1;
+    }
+}
+
+typedef struct OUTFORMAT
+{
+    BOOL fUnicode; // a text file is in UTF-8 or UTF-16
+    BOOL fCRLF; // a text file breaks its lines with CR LF
+    BOOL fLF; // a text file breaks its lines with LF
+} OUTFORMAT;
+
+// Looks at the head of a file as TextFileCompare does, without messages
+static VOID SampleOutputFile(const FILECOMPARE *pFC, LPCWSTR file, OUTFORMAT *pFormat)
+{
+    HANDLE hFile;
+    LPBYTE pb;
+    DWORD cb, cbBOM;
+    FCENCODING encoding;
+    INT iBreak;
+
+    if (!(pFC->dwFlags & FLAG_L) &&
+        ((pFC->dwFlags & (FLAG_B | FLAG_DELTA)) || IsBinaryExt(file)))
+    {
+        return;
+    }
+    hFile = CreateFileW(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return;
+    pb = malloc(ENCODING_SAMPLE_SIZE);
+    if (pb && ReadFile(hFile, pb, ENCODING_SAMPLE_SIZE, &cb, NULL))
+    {
+        // /L compares the bytes as they are
+        encoding = ENC_ANSI;
+        if (!(pFC->dwFlags & FLAG_L))
+        {
+            // a short read is the whole file
+            encoding = DetectEncoding(pb, cb, cb < ENCODING_SAMPLE_SIZE, !!(pFC->dwFlags & FLAG_U),
+                                      &cbBOM);
+            if (encoding != ENC_ANSI && encoding != ENC_ASCII)
+                pFormat->fUnicode = TRUE;
+        }
+        iBreak = SampleLineBreak(pb, cb, encoding);
+        if (iBreak > 0)
+            pFormat->fCRLF = TRUE;
+        else if (iBreak == 0)
+            pFormat->fLF = TRUE;
+    }
+    free(pb);
+    CloseHandle(hFile);
+}
+
+// Picks the code page and the line break of the output for the whole run
+// before anything is written, so that the output of a wildcard run isn't a
+// mix of encodings. The output is in UTF-8 if a text file is in UTF-8 or
+// UTF-16 (as with /U), and in the ANSI code page otherwise. Its lines end
+// with LF if the text files do, and with CR LF otherwise.
+static VOID ChooseOutputFormat(const FILECOMPARE *pFC)
+{
+    OUTFORMAT format = { !!(pFC->dwFlags & FLAG_U), FALSE, FALSE };
+    WIN32_FIND_DATAW find;
+    HANDLE hFind;
+    WCHAR szPath[MAX_PATH];
+    INT i;
+
+    if (s_out.fConsole || !pFC->file[0] || !pFC->file[1])
+        return; // a console takes wide characters
+    for (i = 0; i < 2; ++i)
+    {
+        if (!HasWildcard(pFC->file[i]))
+        {
+            SampleOutputFile(pFC, pFC->file[i], &format);
+            continue;
+        }
+        hFind = FindFirstFileW(pFC->file[i], &find);
+        if (hFind == INVALID_HANDLE_VALUE)
+            continue;
+        wcscpy(szPath, pFC->file[i]);
+        do
+        {
+            if (IS_DOTS(find.cFileName))
+                continue;
+            PathRemoveFileSpecW(szPath);
+            PathAppendW(szPath, find.cFileName);
+            SampleOutputFile(pFC, szPath, &format);
+        } while (FindNextFileW(hFind, &find));
+        FindClose(hFind);
+    }
+
+    s_out.uCodePage = (format.fUnicode ? CP_UTF8 : CP_ACP);
+    s_out.fCRLF = (format.fCRLF || !format.fLF);
+}
+
 int wmain(int argc, WCHAR **argv)
 {
     FILECOMPARE fc = { 0, 100, 2 };
     PWCHAR endptr;
-    INT i;
+    ULONG ul;
+    SYSTEM_INFO si;
+    LPCWSTR pszCache = NULL;
+    FCCACHE cache;
+    INT i, ret;
 
     /* Initialize the Console Standard Streams */
     ConInitStdStreams();
+    InitOutput();
+    InitScan();
 
     for (i = 1; i < argc; ++i)
     {
@@ -1056,19 +2164,54 @@ int wmain(int argc, WCHAR **argv)
         switch (towupper(argv[i][1]))
         {
             case L'A':
-                fc.dwFlags |= FLAG_A;
+                if (_wcsnicmp(argv[i], L"/ALG:", 5) == 0)
+                {
+                    if (_wcsicmp(&argv[i][5], L"FC") == 0)
+                        fc.alg = ALG_FC;
+                    else if (_wcsicmp(&argv[i][5], L"MYERS") == 0)
+                        fc.alg = ALG_MYERS;
+                    else if (_wcsicmp(&argv[i][5], L"HISTOGRAM") == 0)
+                        fc.alg = ALG_HISTOGRAM;
+                    else
+                        return InvalidSwitch();
+                }
+                else
+                {
+                    fc.dwFlags |= FLAG_A;
+                }
                 break;
             case L'B':
                 fc.dwFlags |= FLAG_B;
                 break;
             case L'C':
-                fc.dwFlags |= FLAG_C;
+                if (_wcsnicmp(argv[i], L"/CACHE:", 7) == 0 && argv[i][7])
+                    pszCache = &argv[i][7];
+                else
+                    fc.dwFlags |= FLAG_C;
+                break;
+            case L'D':
+                if (_wcsicmp(argv[i], L"/DELTA") == 0)
+                    fc.dwFlags |= FLAG_DELTA;
+                else
+                    return InvalidSwitch();
+                break;
+            case L'I':
+                if (_wcsicmp(argv[i], L"/INLINE") == 0)
+                    fc.dwFlags |= FLAG_INLINE;
+                else if (_wcsicmp(argv[i], L"/INLINE:WORD") == 0)
+                    fc.dwFlags |= FLAG_INLINE | FLAG_INLINE_WORD;
+                else
+                    return InvalidSwitch();
                 break;
             case L'L':
                 if (_wcsicmp(argv[i], L"/L") == 0)
                 {
                     fc.dwFlags |= FLAG_L;
                 }
+                else if (_wcsicmp(argv[i], L"/LOCALE") == 0)
+                {
+                    fc.dwFlags |= FLAG_LOCALE;
+                }
                 else if (towupper(argv[i][2]) == L'B')
                 {
                     if (iswdigit(argv[i][3]))
@@ -1084,6 +2227,27 @@ int wmain(int argc, WCHAR **argv)
                     }
                 }
                 break;
+            case L'M':
+                if (_wcsicmp(argv[i], L"/MEM") == 0)
+                {
+                    fc.dwFlags |= FLAG_MEM;
+                }
+                else if (_wcsnicmp(argv[i], L"/MAXMEM:", 8) == 0 && iswdigit(argv[i][8]))
+                {
+                    // in megabytes
+                    ul = wcstoul(&argv[i][8], &endptr, 10);
+                    if (endptr == NULL || *endptr != 0 || ul < 1 ||
+                        ul > (SIZE_T)-1 / (1024 * 1024))
+                    {
+                        return InvalidSwitch();
+                    }
+                    fc.cbMaxMem = (SIZE_T)ul * 1024 * 1024;
+                }
+                else
+                {
+                    return InvalidSwitch();
+                }
+                break;
             case L'N':
                 fc.dwFlags |= FLAG_N;
                 break;
@@ -1093,11 +2257,68 @@ int wmain(int argc, WCHAR **argv)
                     fc.dwFlags |= FLAG_OFFLINE;
                 }
                 break;
+            case L'Q':
+                fc.dwFlags |= FLAG_Q;
+                break;
+            case L'R':
+                if (_wcsicmp(argv[i], L"/RANGES") == 0)
+                    fc.dwFlags |= FLAG_RANGES;
+                else if (_wcsicmp(argv[i], L"/RANGES:CRC") == 0)
+                    fc.dwFlags |= FLAG_RANGES | FLAG_RANGES_CRC;
+                else
+                    return InvalidSwitch();
+                break;
+            case L'S':
+                if (_wcsicmp(argv[i], L"/STREAM") == 0)
+                    fc.dwFlags |= FLAG_STREAM;
+                else
+                    return InvalidSwitch();
+                break;
             case L'T':
-                fc.dwFlags |= FLAG_T;
+                if (_wcsnicmp(argv[i], L"/THREADS", 8) == 0)
+                {
+                    if (argv[i][8] == 0)
+                    {
+                        GetSystemInfo(&si);
+                        fc.nThreads = (INT)si.dwNumberOfProcessors;
+                    }
+                    else if (argv[i][8] == L':' && iswdigit(argv[i][9]))
+                    {
+                        fc.nThreads = wcstoul(&argv[i][9], &endptr, 10);
+                        if (endptr == NULL || *endptr != 0 || fc.nThreads < 1)
+                            return InvalidSwitch();
+                    }
+                    else
+                    {
+                        return InvalidSwitch();
+                    }
+                    fc.nThreads = min(fc.nThreads, MAXIMUM_WAIT_OBJECTS);
+                }
+                else
+                {
+                    fc.dwFlags |= FLAG_T;
+                }
                 break;
             case L'U':
-                fc.dwFlags |= FLAG_U;
+                if (_wcsnicmp(argv[i], L"/UNIFIED", 8) == 0)
+                {
+                    fc.dwFlags |= FLAG_UNIFIED;
+                    fc.nContext = 3;
+                    if (argv[i][8] == L':' && iswdigit(argv[i][9]))
+                    {
+                        fc.nContext = wcstoul(&argv[i][9], &endptr, 10);
+                        if (endptr == NULL || *endptr != 0 || fc.nContext < 0)
+                            return InvalidSwitch();
+                    }
+                    else if (argv[i][8] != 0)
+                    {
+                        return InvalidSwitch();
+                    }
+                }
+                else
+                {
+                    fc.dwFlags |= FLAG_U;
+                }
                 break;
             case L'W':
                 fc.dwFlags |= FLAG_W;
@@ -1116,7 +2337,22 @@ int wmain(int argc, WCHAR **argv)
                 return InvalidSwitch();
         }
     }
-    return WildcardFileCompare(&fc);
+
+    if (pszCache)
+    {
+        if (OpenCache(&cache, pszCache))
+            fc.pCache = &cache;
+        else
+            ConResPrintf(StdErr, IDS_CANNOT_USE_CACHE, pszCache);
+    }
+
+    ChooseOutputFormat(&fc);
+    ret = WildcardFileCompare(&fc);
+    if (fc.pCache)
+        CloseCache(fc.pCache);
+    if (fc.dwFlags & FLAG_MEM)
+        ConResPrintf(StdErr, IDS_PEAK_MEMORY, (DWORD)((fc.cbPeak + 1023) / 1024));
+    return ret;
 }
 
 #ifndef __REACTOS__
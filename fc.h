@@ -29,21 +29,34 @@ typedef enum FCRET // return code of FC command
     FCRET_NO_MORE_DATA = 3 // (extension)
 } FCRET;
 
+// The line break after a line (NODE.eol)
+#define EOL_LF 0
+#define EOL_CRLF 1
+#define EOL_CR 2 // the last line ends with CR
+#define EOL_NONE 3 // the last line has no line break
+
+// A line of a text file. pch points into the loaded input (no CR/LF, not terminated).
 typedef struct NODE_W
 {
     struct list entry;
-    LPWSTR pszLine;
-    LPWSTR pszComp; // compressed
+    LPCWSTR pch;
+    DWORD cch;
     DWORD lineno;
-    DWORD hash;
+    ULONGLONG hash;
+    DWORD sym; // the symbol of the line (see LINESYMTAB)
+    BYTE fNormalize; // compared with tabs expanded or spaces compressed
+    BYTE eol; // EOL_...; compared only by /UNIFIED
 } NODE_W;
 typedef struct NODE_A
 {
     struct list entry;
-    LPSTR pszLine;
-    LPSTR pszComp; // compressed
+    LPCSTR pch;
+    DWORD cch;
     DWORD lineno;
-    DWORD hash;
+    ULONGLONG hash;
+    DWORD sym; // the symbol of the line (see LINESYMTAB)
+    BYTE fNormalize; // compared with tabs expanded or spaces compressed
+    BYTE eol; // EOL_...; compared only by /UNIFIED
 } NODE_A;
 
 #define FLAG_A (1 << 0) // abbreviation
@@ -58,29 +71,244 @@ typedef struct NODE_A
 #define FLAG_W (1 << 9) // compress white space
 #define FLAG_nnnn (1 << 10) // ???
 #define FLAG_HELP (1 << 11) // show usage
+#define FLAG_RANGES (1 << 12) // binary: merge adjacent differences into ranges
+#define FLAG_RANGES_CRC (1 << 13) // binary: show CRC-32 of each range
+#define FLAG_Q (1 << 14) // quiet: stop at the first difference
+#define FLAG_DELTA (1 << 15) // binary: find inserted, deleted and moved bytes
+#define FLAG_MEM (1 << 16) // show the peak memory of the line arena
+#define FLAG_LOCALE (1 << 17) // compare lines by the collation of the user locale
+#define FLAG_INLINE (1 << 18) // mark the changed characters of paired lines
+#define FLAG_INLINE_WORD (1 << 19) // mark whole words with FLAG_INLINE
+#define FLAG_UNIFIED (1 << 20) // show text differences as a unified diff
+#define FLAG_STREAM (1 << 21) // read the files as streams, without mapping them
+
+#define STREAM_BLOCK_SIZE (1024 * 1024) // 1 MB
+#define STREAM_WINDOW_SIZE (4 * STREAM_BLOCK_SIZE)
+#define ENCODING_SAMPLE_SIZE (64 * 1024) // the head of a text file to detect its encoding
+#define CACHE_PIECE_SIZE (4 * 1024 * 1024) // the pieces of the content hash (/CACHE)
+#define CACHE_DIGEST_SIZE 32
+
+typedef struct CACHEHASH CACHEHASH; // the content hash of an input (cache.c)
+
+// The encoding of a text file
+typedef enum FCENCODING
+{
+    ENC_ANSI,
+    ENC_ASCII, // 7-bit text; the same in ANSI and UTF-8
+    ENC_UTF8,
+    ENC_UTF16LE,
+    ENC_UTF16BE
+} FCENCODING;
+
+// An input file, read through a file mapping or as a stream
+typedef struct FCINPUT
+{
+    LPCWSTR file;
+    HANDLE hFile;
+    LARGE_INTEGER cb; // file size, or -1 if unknown (pipe or device)
+    BOOL fStream;
+    // mapped input
+    HANDLE hMapping;
+    LPVOID pvView;
+    LONGLONG ibNext; // offset of the next block
+    // streamed input (double-buffered by a read-ahead thread)
+    HANDLE hThread;
+    HANDLE hFilled[2];
+    HANDLE hEmpty[2];
+    LPBYTE pbBlock[2];
+    DWORD cbBlock[2];
+    BOOL fBlockError[2];
+    INT iBlock; // the block to be returned next
+    BOOL fHeld; // the previous block is in use
+    volatile BOOL fStop;
+    BOOL fEOF;
+    BOOL fError;
+    // streamed view window
+    LPBYTE pbWindow;
+    DWORD cbWindowMax;
+    LONGLONG ibWindow;
+    DWORD cbWindow;
+    const BYTE *pbRest; // rest of the current block
+    DWORD cbRest;
+    LPBYTE pbLoaded; // streamed input read into memory by LoadInput
+    // text encoding
+    FCENCODING encoding;
+    LONGLONG ibText; // offset of the text in the views (after the BOM)
+    BOOL fDecode; // the views are the input decoded into UTF-16
+    DWORD cbBOM; // the byte order mark that the decoder skips
+    const BYTE *pbSrc; // rest of the current undecoded block
+    DWORD cbSrc;
+    BOOL fSrcEnd;
+    BYTE abCarry[8]; // a character that is cut at the end of a block
+    DWORD cbCarry;
+    LPWSTR pchDecoded; // the decoded block
+    BOOL fDecodedEOF;
+    CACHEHASH *pHash; // the hash of the bytes read in order (/CACHE), or NULL
+} FCINPUT;
+
+// The content hash cache (/CACHE)
+typedef struct FCCACHE
+{
+    HANDLE hFile;
+    HANDLE hMapping;
+    LPVOID pvView;
+} FCCACHE;
+
+// A bump allocator whose blocks are freed all at once
+typedef struct ARENA
+{
+    struct ARENACHUNK *pChunks;
+    LPBYTE pbNext;
+    LPBYTE pbEnd;
+    SIZE_T cbTotal; // bytes of the chunks
+    SIZE_T cbPeak; // high-water mark of cbTotal
+} ARENA;
+
+// The lines of a text file that are in memory (text.h). The lines are parsed
+// from a view of the input as the comparison goes on, and dropped when they
+// are behind the sync point.
+typedef struct LINEWINDOW
+{
+    struct list list; // NODE_W or NODE_A
+    struct list chunks; // the arenas of the nodes, oldest first
+    FCINPUT *pInput;
+    const BYTE *pbView;
+    LONGLONG ibView;
+    DWORD cbView;
+    BOOL fLast; // the view reaches the end of the input
+    LONGLONG ibNext; // offset of the next line to parse
+    DWORD lineno; // line number of the next line
+    BOOL fEOF; // all the lines are parsed
+    BOOL fFailed; // an error was reported
+    SIZE_T cbArena; // bytes of the arenas
+    LONGLONG ibTail; // the first line of the common tail of the inputs, or 0
+    DWORD linenoTail; // the line number of ibTail once it is parsed, or 0
+} LINEWINDOW;
+
+// A distinct line in the windows
+typedef struct LINESYM
+{
+    ULONGLONG hash;
+    LPVOID pRep[2]; // the newest node of the line in each window, or NULL
+    DWORD cRefs[2]; // the nodes of the line in each window
+    DWORD iNextFree;
+    LPVOID pResync; // the first node of the line in window 0 (Resync)
+} LINESYM;
+
+// Interns the lines of both windows (text.h). Equal lines get the same
+// symbol, so that lines are compared as integers. A symbol is freed with the
+// last node of its line, and its number is used again, unless fKeep.
+typedef struct LINESYMTAB
+{
+    LINESYM *pSyms;
+    DWORD cSyms; // symbols in use or freed
+    DWORD cSymsMax;
+    DWORD iFree; // the first freed symbol, or SYM_NONE
+    DWORD cLive; // symbols in use
+    LPDWORD pSlots; // open addressing by hash; symbol + 1, or 0 if empty
+    DWORD cSlots; // a power of two
+    BOOL fKeep; // the symbols outlive their nodes (DiffIndexed)
+} LINESYMTAB;
+
+// The diff algorithm of text comparisons (/ALG)
+typedef enum FCALG
+{
+    ALG_FC, // resync within /LBn lines (default)
+    ALG_MYERS, // shortest edit script of the whole files
+    ALG_HISTOGRAM // anchored on the rarest lines of the whole files
+} FCALG;
+
+// The changed lines paired up in a difference (/INLINE)
+#define INLINE_MAX_PAIRS 256
+
+// The characters of a changed line that differ from its pair (/INLINE)
+typedef struct INLINEMARK
+{
+    DWORD lineno;
+    DWORD ichBegin; // pch[ichBegin, ichEnd) differs
+    DWORD ichEnd;
+} INLINEMARK;
+
+// A hunk of the unified diff that is being collected (/UNIFIED). It is
+// printed when its line counts are known.
+typedef struct UNIHUNK
+{
+    LPVOID pText; // the lines of the hunk (TCHAR), each with its prefix and its own
+                  // line break, and the marker of diff after a last line without a LF
+    SIZE_T cchText;
+    SIZE_T cchTextMax;
+    DWORD lineno[2]; // the first line of the hunk in each file
+    DWORD cLines[2]; // the lines of the hunk in each file
+    DWORD linenoNext; // the line of file 0 after the last change
+    DWORD cTrail; // the lines of context after the last change
+    BOOL fPending; // a hunk is being collected
+    BOOL fHeader; // the file names are printed
+} UNIHUNK;
 
 typedef struct FILECOMPARE
 {
     DWORD dwFlags; // FLAG_...
     INT n; // # of line buffers
     INT nnnn; // retry count before resynch
+    INT nThreads; // # of threads for binary comparison (/THREADS:n)
+    INT nContext; // # of context lines of /UNIFIED:n
+    FCALG alg;
+    SIZE_T cbMaxMem; // the memory limit of the lines of /ALG (/MAXMEM:n), or 0
+    FCCACHE *pCache; // or NULL
+    SIZE_T cbPeak; // the highest memory of the nodes of text comparisons (/MEM)
     LPCWSTR file[2];
-    struct list list[2];
+    LINEWINDOW window[2];
+    LINESYMTAB symtab;
+    INLINEMARK aMarks[2][INLINE_MAX_PAIRS]; // the marks of the current difference
+    DWORD cMarks;
+    DWORD iMark[2]; // the next mark to print
+    UNIHUNK hunk;
 } FILECOMPARE;
 
 // text.h
-FCRET TextCompareW(FILECOMPARE *pFC,
-                   HANDLE *phMapping0, const LARGE_INTEGER *pcb0,
-                   HANDLE *phMapping1, const LARGE_INTEGER *pcb1);
-FCRET TextCompareA(FILECOMPARE *pFC,
-                   HANDLE *phMapping0, const LARGE_INTEGER *pcb0,
-                   HANDLE *phMapping1, const LARGE_INTEGER *pcb1);
+FCRET TextCompareW(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1);
+FCRET TextCompareA(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1);
+FCRET TextCompareQuietW(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1);
+FCRET TextCompareQuietA(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1);
+// arena.c
+VOID InitArena(ARENA *pArena);
+LPVOID ArenaAlloc(ARENA *pArena, SIZE_T cb);
+VOID FreeArena(ARENA *pArena);
+// cache.c
+BOOL OpenCache(FCCACHE *pCache, LPCWSTR file);
+VOID CloseCache(FCCACHE *pCache);
+FCRET CacheCompare(FILECOMPARE *pFC);
+VOID StartCacheHash(FCCACHE *pCache, FCINPUT *pInput);
+VOID UpdateCacheHash(CACHEHASH *pHash, LONGLONG ib, const BYTE *pb, SIZE_T cb);
+VOID HashCachePiece(const BYTE *pb, BYTE *digest);
+VOID AddCachePiece(CACHEHASH *pHash, LONGLONG ib, const BYTE *digest);
+VOID EndCacheHash(FCINPUT *pInput);
+// delta.c
+FCRET DeltaFileCompare(FILECOMPARE *pFC);
+// diff.c
+BOOL MyersDiff(const DWORD *pSym0, DWORD cSym0, const DWORD *pSym1, DWORD cSym1,
+               LPBYTE pfChanged0, LPBYTE pfChanged1);
+BOOL HistogramDiff(const DWORD *pSym0, DWORD cSym0, const DWORD *pSym1, DWORD cSym1,
+                   DWORD cSymbols, LPBYTE pfChanged0, LPBYTE pfChanged1);
+BOOL ParallelDiff(FCALG alg, INT nThreads, const DWORD *pSym0, DWORD cSym0,
+                  const DWORD *pSym1, DWORD cSym1, DWORD cSymbols,
+                  LPBYTE pfChanged0, LPBYTE pfChanged1);
+// encode.c
+FCENCODING DetectEncoding(const BYTE *pb, DWORD cb, BOOL fLast, BOOL fUnicode, LPDWORD pcbBOM);
+DWORD DecodeText(FCENCODING encoding, LPWSTR pch, const BYTE *pb, DWORD cb,
+                 LPDWORD pcbUsed, BOOL fLast);
+BOOL IsDBCSCodePage(VOID);
 // fc.c
-VOID PrintLineW(const FILECOMPARE *pFC, DWORD lineno, LPCWSTR psz);
-VOID PrintLineA(const FILECOMPARE *pFC, DWORD lineno, LPCSTR psz);
+VOID PrintLineW(const FILECOMPARE *pFC, DWORD lineno, LPCWSTR pch, DWORD cch);
+VOID PrintLineA(const FILECOMPARE *pFC, DWORD lineno, LPCSTR pch, DWORD cch);
 VOID PrintCaption(LPCWSTR file);
 VOID PrintEndOfDiff(VOID);
 VOID PrintDots(VOID);
+VOID PrintUnifiedHeader(LPCWSTR file0, LPCWSTR file1);
+VOID PrintHunkHeader(const DWORD lineno[2], const DWORD cLines[2]);
+VOID PrintTextW(LPCWSTR pch, SIZE_T cch);
+VOID PrintTextA(LPCSTR pch, SIZE_T cch);
+VOID PrintDeltaRange(WCHAR chOp, ULONGLONG ib, ULONGLONG cb, ULONGLONG ibTo, BOOL fQuad);
 FCRET NoDifference(VOID);
 FCRET Different(LPCWSTR file0, LPCWSTR file1);
 FCRET LongerThan(LPCWSTR file0, LPCWSTR file1);
@@ -88,10 +316,31 @@ FCRET OutOfMemory(VOID);
 FCRET CannotRead(LPCWSTR file);
 FCRET InvalidSwitch(VOID);
 FCRET ResyncFailed(VOID);
+VOID OverMaxMem(VOID);
 HANDLE DoOpenFileForInput(LPCWSTR file);
+// input.c
+FCRET OpenInput(FCINPUT *pInput, LPCWSTR file, BOOL fStream);
+VOID CloseInput(FCINPUT *pInput);
+BOOL ReadInputBlock(FCINPUT *pInput, const BYTE **ppb, LPDWORD pcb);
+BOOL GetInputView(FCINPUT *pInput, LONGLONG ib, DWORD cbMax,
+                  LPCVOID *ppv, LPDWORD pcb, BOOL *pfLast);
+FCRET LoadInput(FCINPUT *pInput, const BYTE **ppb, SIZE_T *pcb);
+BOOL SampleInput(FCINPUT *pInput, const BYTE **ppb, LPDWORD pcb, BOOL *pfLast);
+FCRET SetInputEncoding(FCINPUT *pInput, FCENCODING encoding, DWORD cbBOM, BOOL fDecode);
+BOOL RewindInput(FCINPUT *pInput);
+// scan.c
+VOID InitScan(VOID);
+SIZE_T FindMismatch(LPCVOID pv0, LPCVOID pv1, SIZE_T cb);
+SIZE_T FindMismatchBack(LPCVOID pv0, LPCVOID pv1, SIZE_T cb);
+SIZE_T FindMismatchNoCaseA(LPCSTR pch0, LPCSTR pch1, SIZE_T cch);
+SIZE_T FindMismatchNoCaseW(LPCWSTR pch0, LPCWSTR pch1, SIZE_T cch);
+SIZE_T FindLineBreakA(LPCSTR pch, SIZE_T cch);
+SIZE_T FindLineBreakW(LPCWSTR pch, SIZE_T cch);
+SIZE_T WidenAscii(LPWSTR pch, const BYTE *pb, SIZE_T cb);
 
 #ifdef _WIN64
     #define MAX_VIEW_SIZE (256 * 1024 * 1024) // 256 MB
 #else
     #define MAX_VIEW_SIZE (64 * 1024 * 1024) // 64 MB
 #endif
+#define VIEW_ALIGNMENT (64 * 1024) // allocation granularity of file views
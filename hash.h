@@ -0,0 +1,52 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     The hash of the lines
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#pragma once
+
+// An xxHash64-style hash of the whole line
+#define MAKE_ULONGLONG(hi, lo) (((ULONGLONG)(hi) << 32) | (lo))
+#define HASH_PRIME1 MAKE_ULONGLONG(0x9E3779B1, 0x85EBCA87)
+#define HASH_PRIME2 MAKE_ULONGLONG(0xC2B2AE3D, 0x27D4EB4F)
+#define HASH_PRIME3 MAKE_ULONGLONG(0x165667B1, 0x9E3779F9)
+#define HASH_EOF ((ULONGLONG)-1)
+#define HASH_MASK (HASH_EOF >> 1)
+
+static __inline ULONGLONG HashRound(ULONGLONG acc, ULONGLONG w)
+{
+    acc += w * HASH_PRIME2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * HASH_PRIME1;
+}
+
+// Hashes the bytes in 8-byte words. cb must be a multiple of 8 except at the
+// end of the line.
+static ULONGLONG HashBytes(ULONGLONG acc, const BYTE *pb, SIZE_T cb)
+{
+    ULONGLONG w;
+    for (; cb >= sizeof(w); pb += sizeof(w), cb -= sizeof(w))
+    {
+        memcpy(&w, pb, sizeof(w));
+        acc = HashRound(acc, w);
+    }
+    if (cb > 0)
+    {
+        w = 0;
+        memcpy(&w, pb, cb);
+        acc = HashRound(acc, w);
+    }
+    return acc;
+}
+
+static ULONGLONG HashFinal(ULONGLONG acc, SIZE_T cch)
+{
+    acc ^= (ULONGLONG)cch * HASH_PRIME1;
+    acc ^= acc >> 33;
+    acc *= HASH_PRIME2;
+    acc ^= acc >> 29;
+    acc *= HASH_PRIME3;
+    acc ^= acc >> 32;
+    return acc & HASH_MASK;
+}
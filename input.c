@@ -0,0 +1,622 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Reading input files
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+
+// Local disk files are mapped. Pipes, devices and files on network drives
+// (where page-fault driven I/O is slow) are streamed with large reads.
+static BOOL IsRemoteFile(LPCWSTR file)
+{
+    WCHAR szPath[MAX_PATH], szRoot[4];
+    DWORD cch = GetFullPathNameW(file, _countof(szPath), szPath, NULL);
+    if (cch == 0 || cch >= _countof(szPath))
+        return FALSE;
+
+    if (szPath[0] == L'\\' && szPath[1] == L'\\')
+        return szPath[2] != L'?' && szPath[2] != L'.'; // UNC, not a device path
+
+    if (szPath[0] == 0 || szPath[1] != L':')
+        return FALSE;
+    szRoot[0] = szPath[0];
+    szRoot[1] = L':';
+    szRoot[2] = L'\\';
+    szRoot[3] = 0;
+    return GetDriveTypeW(szRoot) == DRIVE_REMOTE;
+}
+
+static DWORD WINAPI ReadAheadThread(LPVOID pParam)
+{
+    FCINPUT *pInput = pParam;
+    INT i = 0;
+    DWORD cbRead, cbTotal;
+    BOOL fOK;
+
+    for (;;)
+    {
+        WaitForSingleObject(pInput->hEmpty[i], INFINITE);
+        if (pInput->fStop)
+            break;
+
+        // fill the whole block unless the input ends (pipes return short reads)
+        for (cbTotal = 0, fOK = TRUE; cbTotal < STREAM_BLOCK_SIZE; cbTotal += cbRead)
+        {
+            fOK = ReadFile(pInput->hFile, pInput->pbBlock[i] + cbTotal,
+                           STREAM_BLOCK_SIZE - cbTotal, &cbRead, NULL);
+            if (!fOK)
+            {
+                // the writer closed the pipe: this is the end of the input
+                fOK = (GetLastError() == ERROR_BROKEN_PIPE);
+                break;
+            }
+            if (cbRead == 0)
+                break;
+        }
+        pInput->cbBlock[i] = cbTotal;
+        pInput->fBlockError[i] = !fOK;
+        SetEvent(pInput->hFilled[i]);
+        if (cbTotal == 0 || !fOK)
+            break;
+        i ^= 1;
+    }
+    return 0;
+}
+
+static BOOL StartStream(FCINPUT *pInput)
+{
+    INT i;
+
+    for (i = 0; i < 2; ++i)
+    {
+        pInput->pbBlock[i] = VirtualAlloc(NULL, STREAM_BLOCK_SIZE, MEM_COMMIT, PAGE_READWRITE);
+        pInput->hFilled[i] = CreateEventW(NULL, FALSE, FALSE, NULL);
+        pInput->hEmpty[i] = CreateEventW(NULL, FALSE, TRUE, NULL);
+        if (!pInput->pbBlock[i] || !pInput->hFilled[i] || !pInput->hEmpty[i])
+            return FALSE;
+    }
+
+    pInput->hThread = CreateThread(NULL, 0, ReadAheadThread, pInput, 0, NULL);
+    return pInput->hThread != NULL;
+}
+
+// Opens the file for reading. It is read as a stream if fStream, or if it
+// can't be mapped.
+FCRET OpenInput(FCINPUT *pInput, LPCWSTR file, BOOL fStream)
+{
+    DWORD dwLastError;
+
+    ZeroMemory(pInput, sizeof(*pInput));
+    pInput->file = file;
+    pInput->cb.QuadPart = -1;
+
+    pInput->hFile = DoOpenFileForInput(file);
+    if (pInput->hFile == INVALID_HANDLE_VALUE)
+        return FCRET_CANT_FIND;
+
+    pInput->fStream = (GetFileType(pInput->hFile) != FILE_TYPE_DISK);
+    if (!pInput->fStream)
+    {
+        //if (!GetFileSizeEx(pInput->hFile, &pInput->cb))
+        pInput->cb.LowPart = GetFileSize(pInput->hFile, (LPDWORD)&pInput->cb.HighPart);
+        if (pInput->cb.LowPart == INVALID_FILE_SIZE)
+            dwLastError = GetLastError();
+        else dwLastError = 0;
+        if (dwLastError != NO_ERROR)
+            return CannotRead(file);
+
+        pInput->fStream = fStream || IsRemoteFile(file);
+        if (!pInput->fStream && pInput->cb.QuadPart > 0)
+        {
+            pInput->hMapping = CreateFileMappingW(pInput->hFile, NULL, PAGE_READONLY,
+                                                  pInput->cb.HighPart, pInput->cb.LowPart,
+                                                  NULL);
+            if (pInput->hMapping == NULL)
+                pInput->fStream = TRUE; // read it instead
+        }
+    }
+
+    if (pInput->fStream && !StartStream(pInput))
+        return OutOfMemory();
+
+    return FCRET_IDENTICAL;
+}
+
+VOID CloseInput(FCINPUT *pInput)
+{
+    INT i;
+
+    EndCacheHash(pInput);
+    if (pInput->hThread)
+    {
+        pInput->fStop = TRUE;
+        SetEvent(pInput->hEmpty[0]);
+        SetEvent(pInput->hEmpty[1]);
+        WaitForSingleObject(pInput->hThread, INFINITE);
+        CloseHandle(pInput->hThread);
+    }
+    for (i = 0; i < 2; ++i)
+    {
+        if (pInput->pbBlock[i])
+            VirtualFree(pInput->pbBlock[i], 0, MEM_RELEASE);
+        if (pInput->hFilled[i])
+            CloseHandle(pInput->hFilled[i]);
+        if (pInput->hEmpty[i])
+            CloseHandle(pInput->hEmpty[i]);
+    }
+    if (pInput->pbWindow)
+        VirtualFree(pInput->pbWindow, 0, MEM_RELEASE);
+    if (pInput->pchDecoded)
+        VirtualFree(pInput->pchDecoded, 0, MEM_RELEASE);
+    free(pInput->pbLoaded);
+
+    if (pInput->pvView)
+        UnmapViewOfFile(pInput->pvView);
+    if (pInput->hMapping)
+        CloseHandle(pInput->hMapping);
+    if (pInput->hFile != INVALID_HANDLE_VALUE && pInput->hFile != NULL)
+        CloseHandle(pInput->hFile);
+
+    ZeroMemory(pInput, sizeof(*pInput));
+}
+
+static BOOL ReadStreamBlock(FCINPUT *pInput, const BYTE **ppb, LPDWORD pcb)
+{
+    INT i = pInput->iBlock;
+
+    *ppb = NULL;
+    *pcb = 0;
+    if (pInput->fEOF || pInput->fError)
+        return !pInput->fError;
+
+    // give the previous block back to the reader; it is refilled while we work
+    if (pInput->fHeld)
+        SetEvent(pInput->hEmpty[i ^ 1]);
+
+    WaitForSingleObject(pInput->hFilled[i], INFINITE);
+    pInput->fHeld = TRUE;
+    pInput->iBlock = i ^ 1;
+    if (pInput->fBlockError[i])
+    {
+        pInput->fError = TRUE;
+        return FALSE;
+    }
+    if (pInput->cbBlock[i] == 0)
+    {
+        pInput->fEOF = TRUE;
+        return TRUE;
+    }
+
+    *ppb = pInput->pbBlock[i];
+    *pcb = pInput->cbBlock[i];
+    if (pInput->pHash)
+        UpdateCacheHash(pInput->pHash, pInput->ibNext, *ppb, *pcb);
+    pInput->ibNext += *pcb;
+    return TRUE;
+}
+
+static BOOL ReadMappedBlock(FCINPUT *pInput, const BYTE **ppb, LPDWORD pcb)
+{
+    LARGE_INTEGER ib;
+    DWORD cbView;
+
+    if (pInput->pvView)
+    {
+        UnmapViewOfFile(pInput->pvView);
+        pInput->pvView = NULL;
+    }
+
+    *ppb = NULL;
+    *pcb = 0;
+    if (pInput->ibNext >= pInput->cb.QuadPart)
+        return TRUE;
+
+    ib.QuadPart = pInput->ibNext;
+    cbView = (DWORD)min(pInput->cb.QuadPart - ib.QuadPart, MAX_VIEW_SIZE);
+    pInput->pvView = MapViewOfFile(pInput->hMapping, FILE_MAP_READ, ib.HighPart, ib.LowPart, cbView);
+    if (!pInput->pvView)
+        return FALSE;
+
+    pInput->ibNext += cbView;
+    *ppb = pInput->pvView;
+    *pcb = cbView;
+    if (pInput->pHash)
+        UpdateCacheHash(pInput->pHash, ib.QuadPart, *ppb, *pcb);
+    return TRUE;
+}
+
+// Gets the next block of the input in order. *pcb is zero at the end.
+BOOL ReadInputBlock(FCINPUT *pInput, const BYTE **ppb, LPDWORD pcb)
+{
+    if (pInput->fStream)
+        return ReadStreamBlock(pInput, ppb, pcb);
+    return ReadMappedBlock(pInput, ppb, pcb);
+}
+
+static BOOL GetMappedView(FCINPUT *pInput, LONGLONG ib, DWORD cbMax,
+                          LPCVOID *ppv, LPDWORD pcb, BOOL *pfLast)
+{
+    LARGE_INTEGER ibView;
+    DWORD cbView, ibDelta;
+
+    if (pInput->pvView)
+    {
+        UnmapViewOfFile(pInput->pvView);
+        pInput->pvView = NULL;
+    }
+
+    *ppv = NULL;
+    *pcb = 0;
+    *pfLast = TRUE;
+    if (ib >= pInput->cb.QuadPart)
+        return TRUE;
+
+    // views must start at a multiple of the allocation granularity
+    ibView.QuadPart = ib & ~(LONGLONG)(VIEW_ALIGNMENT - 1);
+    ibDelta = (DWORD)(ib - ibView.QuadPart);
+    cbView = (DWORD)min(pInput->cb.QuadPart - ibView.QuadPart, (LONGLONG)cbMax + ibDelta);
+    pInput->pvView = MapViewOfFile(pInput->hMapping, FILE_MAP_READ,
+                                   ibView.HighPart, ibView.LowPart, cbView);
+    if (!pInput->pvView)
+        return FALSE;
+
+    *ppv = (LPBYTE)pInput->pvView + ibDelta;
+    *pcb = cbView - ibDelta;
+    *pfLast = (ib + *pcb >= pInput->cb.QuadPart);
+    if (pInput->pHash)
+        UpdateCacheHash(pInput->pHash, ib, *ppv, *pcb);
+    return TRUE;
+}
+
+static BOOL GrowStreamWindow(FCINPUT *pInput, DWORD cbWindowMax)
+{
+    LPBYTE pbNew = VirtualAlloc(NULL, cbWindowMax, MEM_COMMIT, PAGE_READWRITE);
+    if (!pbNew)
+        return FALSE;
+    if (pInput->pbWindow)
+    {
+        CopyMemory(pbNew, pInput->pbWindow, pInput->cbWindow);
+        VirtualFree(pInput->pbWindow, 0, MEM_RELEASE);
+    }
+    pInput->pbWindow = pbNew;
+    pInput->cbWindowMax = cbWindowMax;
+    return TRUE;
+}
+
+#define DECODE_BLOCK_SIZE (STREAM_BLOCK_SIZE / sizeof(WCHAR)) // characters
+
+static BOOL ReadSourceBlock(FCINPUT *pInput)
+{
+    if (!ReadInputBlock(pInput, &pInput->pbSrc, &pInput->cbSrc))
+        return FALSE;
+    pInput->fSrcEnd = (pInput->cbSrc == 0);
+    return TRUE;
+}
+
+// Decodes the next block of the input into UTF-16. *pcb is zero at the end.
+// Only one block of the decoded text is in memory at a time.
+static BOOL DecodeInputBlock(FCINPUT *pInput, const BYTE **ppb, LPDWORD pcb)
+{
+    LPWSTR pch = pInput->pchDecoded;
+    DWORD cch = 0, cb, cbUsed;
+
+    *ppb = NULL;
+    *pcb = 0;
+
+    while (cch == 0 && !pInput->fDecodedEOF)
+    {
+        if (pInput->cbSrc == 0 && !pInput->fSrcEnd && !ReadSourceBlock(pInput))
+            return FALSE;
+
+        if (pInput->cbCarry > 0)
+        {
+            // complete the character that was cut at the end of the previous block
+            cb = min(pInput->cbSrc, sizeof(pInput->abCarry) - pInput->cbCarry);
+            CopyMemory(&pInput->abCarry[pInput->cbCarry], pInput->pbSrc, cb);
+            cb += pInput->cbCarry;
+            cch = DecodeText(pInput->encoding, pch, pInput->abCarry, cb, &cbUsed,
+                             pInput->fSrcEnd);
+            if (cbUsed >= pInput->cbCarry)
+            {
+                pInput->pbSrc += cbUsed - pInput->cbCarry;
+                pInput->cbSrc -= cbUsed - pInput->cbCarry;
+                pInput->cbCarry = 0;
+            }
+            else if (cbUsed > 0)
+            {
+                MoveMemory(pInput->abCarry, &pInput->abCarry[cbUsed], pInput->cbCarry - cbUsed);
+                pInput->cbCarry -= cbUsed;
+            }
+            else
+            {
+                // still too short; the whole block is carried
+                pInput->pbSrc += cb - pInput->cbCarry;
+                pInput->cbSrc -= cb - pInput->cbCarry;
+                pInput->cbCarry = cb;
+            }
+        }
+        else if (pInput->cbSrc > 0)
+        {
+            cb = (DWORD)min(pInput->cbSrc, DECODE_BLOCK_SIZE);
+            cch = DecodeText(pInput->encoding, pch, pInput->pbSrc, cb, &cbUsed, FALSE);
+            pInput->pbSrc += cbUsed;
+            pInput->cbSrc -= cbUsed;
+            if (cbUsed < cb && pInput->cbSrc == cb - cbUsed)
+            {
+                // the block ends in the middle of a character
+                CopyMemory(pInput->abCarry, pInput->pbSrc, pInput->cbSrc);
+                pInput->cbCarry = pInput->cbSrc;
+                pInput->cbSrc = 0;
+            }
+        }
+        else if (pInput->fSrcEnd)
+        {
+            pInput->fDecodedEOF = TRUE;
+        }
+    }
+
+    *ppb = (const BYTE *)pch;
+    *pcb = cch * sizeof(WCHAR);
+    return TRUE;
+}
+
+// Gets the next block for the streamed view window
+static BOOL ReadWindowBlock(FCINPUT *pInput)
+{
+    if (pInput->fDecode)
+        return DecodeInputBlock(pInput, &pInput->pbRest, &pInput->cbRest);
+    return ReadStreamBlock(pInput, &pInput->pbRest, &pInput->cbRest);
+}
+
+static __inline BOOL IsWindowEOF(const FCINPUT *pInput)
+{
+    return (pInput->fDecode ? pInput->fDecodedEOF : pInput->fEOF);
+}
+
+static BOOL GetStreamView(FCINPUT *pInput, LONGLONG ib, DWORD cbMax,
+                          LPCVOID *ppv, LPDWORD pcb, BOOL *pfLast)
+{
+    LONGLONG cbSkip;
+    DWORD cbCopy, cbWant, cbKept;
+
+    *ppv = NULL;
+    *pcb = 0;
+    *pfLast = TRUE;
+
+    // a stream can only move forward
+    if (ib < pInput->ibWindow)
+        return FALSE;
+
+    if (!pInput->pbWindow && !GrowStreamWindow(pInput, STREAM_WINDOW_SIZE))
+        return FALSE;
+    cbWant = min(cbMax, STREAM_WINDOW_SIZE);
+
+    // drop what is before ib; keep the rest (e.g. an unfinished line)
+    cbSkip = ib - pInput->ibWindow;
+    if (cbSkip < pInput->cbWindow)
+    {
+        MoveMemory(pInput->pbWindow, pInput->pbWindow + cbSkip,
+                   pInput->cbWindow - (DWORD)cbSkip);
+        pInput->cbWindow -= (DWORD)cbSkip;
+        cbSkip = 0;
+    }
+    else
+    {
+        cbSkip -= pInput->cbWindow;
+        pInput->cbWindow = 0;
+    }
+    pInput->ibWindow = ib;
+    cbKept = pInput->cbWindow;
+
+    // fill up the window from the blocks
+    for (;;)
+    {
+        if (pInput->cbWindow >= cbWant)
+        {
+            // A line must not be split just because it is longer than the
+            // window, so that a stream and a mapped file give the same lines.
+            // The caller has seen the kept part, so a new line must come in.
+            if (cbWant >= cbMax ||
+                memchr(pInput->pbWindow + cbKept, '\n', pInput->cbWindow - cbKept))
+            {
+                break;
+            }
+            cbWant = (DWORD)min((ULONGLONG)cbWant * 2, cbMax);
+            if (cbWant > pInput->cbWindowMax && !GrowStreamWindow(pInput, cbWant))
+                return FALSE;
+            continue;
+        }
+
+        if (pInput->cbRest == 0)
+        {
+            if (!ReadWindowBlock(pInput))
+                return FALSE;
+            if (pInput->cbRest == 0)
+                break;
+        }
+        if (cbSkip > 0)
+        {
+            cbCopy = (DWORD)min(cbSkip, pInput->cbRest);
+            cbSkip -= cbCopy;
+        }
+        else
+        {
+            cbCopy = min(pInput->cbRest, cbWant - pInput->cbWindow);
+            CopyMemory(pInput->pbWindow + pInput->cbWindow, pInput->pbRest, cbCopy);
+            pInput->cbWindow += cbCopy;
+        }
+        pInput->pbRest += cbCopy;
+        pInput->cbRest -= cbCopy;
+    }
+
+    // look ahead one block to know whether this is the last view
+    if (pInput->cbRest == 0 && !IsWindowEOF(pInput))
+    {
+        if (!ReadWindowBlock(pInput))
+            return FALSE;
+    }
+
+    *ppv = pInput->pbWindow;
+    *pcb = pInput->cbWindow;
+    *pfLast = (pInput->cbRest == 0 && IsWindowEOF(pInput));
+    return TRUE;
+}
+
+// Gets a view of up to cbMax bytes at the offset ib. The previous view is
+// invalidated. Streamed and decoded inputs can't go back and may return less
+// than cbMax bytes even if the input goes on (*pfLast is FALSE then).
+BOOL GetInputView(FCINPUT *pInput, LONGLONG ib, DWORD cbMax,
+                  LPCVOID *ppv, LPDWORD pcb, BOOL *pfLast)
+{
+    if (pInput->fStream || pInput->fDecode)
+        return GetStreamView(pInput, ib, cbMax, ppv, pcb, pfLast);
+    return GetMappedView(pInput, ib, cbMax, ppv, pcb, pfLast);
+}
+
+// Gets the whole input at once. A file is mapped in one view and a stream is
+// read into memory. Both stay valid until CloseInput.
+FCRET LoadInput(FCINPUT *pInput, const BYTE **ppb, SIZE_T *pcb)
+{
+    const BYTE *pb;
+    DWORD cb;
+    LPBYTE pbNew;
+    SIZE_T cbMax = 0;
+
+    *ppb = NULL;
+    *pcb = 0;
+
+    if (!pInput->fStream)
+    {
+        if (pInput->cb.QuadPart == 0)
+            return FCRET_IDENTICAL;
+        if ((ULONGLONG)pInput->cb.QuadPart > (SIZE_T)-1)
+            return OutOfMemory();
+        pInput->pvView = MapViewOfFile(pInput->hMapping, FILE_MAP_READ, 0, 0, 0);
+        if (!pInput->pvView)
+            return CannotRead(pInput->file);
+        *ppb = pInput->pvView;
+        *pcb = (SIZE_T)pInput->cb.QuadPart;
+        if (pInput->pHash)
+            UpdateCacheHash(pInput->pHash, 0, *ppb, *pcb);
+        return FCRET_IDENTICAL;
+    }
+
+    for (;;)
+    {
+        if (!ReadInputBlock(pInput, &pb, &cb))
+            return CannotRead(pInput->file);
+        if (cb == 0)
+            break;
+        if (*pcb + cb > cbMax)
+        {
+            cbMax = max(cbMax * 2, *pcb + cb);
+            pbNew = realloc(pInput->pbLoaded, cbMax);
+            if (!pbNew)
+                return OutOfMemory();
+            pInput->pbLoaded = pbNew;
+        }
+        CopyMemory(pInput->pbLoaded + *pcb, pb, cb);
+        *pcb += cb;
+    }
+    *ppb = pInput->pbLoaded;
+    return FCRET_IDENTICAL;
+}
+
+// Gets the head of the input to detect its encoding. Nothing is consumed.
+// *pfLast tells whether the head is the whole input.
+BOOL SampleInput(FCINPUT *pInput, const BYTE **ppb, LPDWORD pcb, BOOL *pfLast)
+{
+    LPCVOID pv;
+
+    *ppb = NULL;
+    *pcb = 0;
+    *pfLast = TRUE;
+
+    if (pInput->fStream)
+    {
+        // the first block stays there for the view window or the decoder
+        if (pInput->cbRest == 0 && !pInput->fEOF &&
+            !ReadStreamBlock(pInput, &pInput->pbRest, &pInput->cbRest))
+        {
+            return FALSE;
+        }
+        *ppb = pInput->pbRest;
+        *pcb = min(pInput->cbRest, ENCODING_SAMPLE_SIZE);
+        // a block is full unless the input ends in it
+        *pfLast = (pInput->cbRest <= ENCODING_SAMPLE_SIZE && pInput->cbRest < STREAM_BLOCK_SIZE);
+        return TRUE;
+    }
+
+    if (!GetMappedView(pInput, 0, ENCODING_SAMPLE_SIZE, &pv, pcb, pfLast))
+        return FALSE;
+    *ppb = pv;
+    return TRUE;
+}
+
+// Sets how the text of the input is read. The views start after the BOM, or
+// are the text decoded into UTF-16 if fDecode.
+FCRET SetInputEncoding(FCINPUT *pInput, FCENCODING encoding, DWORD cbBOM, BOOL fDecode)
+{
+    pInput->encoding = encoding;
+    if (!fDecode)
+    {
+        pInput->ibText = cbBOM;
+        return FCRET_IDENTICAL;
+    }
+
+    pInput->pchDecoded = VirtualAlloc(NULL, DECODE_BLOCK_SIZE * sizeof(WCHAR),
+                                      MEM_COMMIT, PAGE_READWRITE);
+    if (!pInput->pchDecoded)
+        return OutOfMemory();
+    pInput->fDecode = TRUE;
+    pInput->ibText = 0;
+    pInput->cbBOM = cbBOM;
+
+    // the decoder reads the blocks from the beginning, including the sampled one
+    if (pInput->fStream)
+    {
+        pInput->pbSrc = pInput->pbRest;
+        pInput->cbSrc = pInput->cbRest;
+        pInput->fSrcEnd = (pInput->cbSrc == 0);
+        pInput->pbRest = NULL;
+        pInput->cbRest = 0;
+    }
+    else if (!ReadSourceBlock(pInput))
+    {
+        return CannotRead(pInput->file);
+    }
+
+    cbBOM = min(cbBOM, pInput->cbSrc);
+    pInput->pbSrc += cbBOM;
+    pInput->cbSrc -= cbBOM;
+    return FCRET_IDENTICAL;
+}
+
+// Lets the views of a mapped input go back to the beginning. A decoded input
+// is decoded again from there, as its views only go forward. A stream can't
+// go back.
+BOOL RewindInput(FCINPUT *pInput)
+{
+    DWORD cbBOM;
+
+    if (pInput->fStream)
+        return FALSE;
+    if (!pInput->fDecode)
+        return TRUE;
+
+    pInput->ibNext = 0;
+    pInput->ibWindow = 0;
+    pInput->cbWindow = 0;
+    pInput->pbRest = NULL;
+    pInput->cbRest = 0;
+    pInput->cbCarry = 0;
+    pInput->fDecodedEOF = FALSE;
+    if (!ReadSourceBlock(pInput))
+        return FALSE;
+
+    cbBOM = min(pInput->cbBOM, pInput->cbSrc);
+    pInput->pbSrc += cbBOM;
+    pInput->cbSrc -= cbBOM;
+    return TRUE;
+}
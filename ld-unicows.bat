@@ -1 +1 @@
-link /out:fc_unicows.exe fc.obj texta.obj textw.obj fc.res libunicows-vc.lib user32.lib
+link /out:fc_unicows.exe arena.obj cache.obj delta.obj diff.obj encode.obj fc.obj input.obj scan.obj texta.obj textw.obj fc.res libunicows-vc.lib user32.lib
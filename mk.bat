@@ -1,5 +1,12 @@
+cl /O2 /c /I. arena.c
+cl /O2 /c /I. cache.c
+cl /O2 /c /I. delta.c
+cl /O2 /c /I. diff.c
+cl /O2 /c /I. encode.c
 cl /O2 /c /I. fc.c
+cl /O2 /c /I. input.c
+cl /O2 /c /I. scan.c
 cl /O2 /c /I. texta.c
 cl /O2 /c /I. textw.c
 rc fc.rc
-link /out:fc.exe fc.obj texta.obj textw.obj fc.res user32.lib
+link /out:fc.exe arena.obj cache.obj delta.obj diff.obj encode.obj fc.obj input.obj scan.obj texta.obj textw.obj fc.res user32.lib
@@ -11,3 +11,6 @@
 #define IDS_DIFFERENT           1010
 #define IDS_TOO_LARGE           1011
 #define IDS_RESYNC_FAILED       1012
+#define IDS_CANNOT_USE_CACHE    1013
+#define IDS_PEAK_MEMORY         1014
+#define IDS_OVER_MAXMEM         1015
@@ -0,0 +1,698 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Fast memory scanning kernels
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+
+#if (defined(_M_IX86) || defined(_M_X64) || defined(_M_AMD64) || \
+     defined(__i386__) || defined(__x86_64__)) && \
+    (!defined(_MSC_VER) || _MSC_VER >= 1400)
+    #define HAVE_SSE2
+    #if !defined(_MSC_VER) || _MSC_VER >= 1700
+        #define HAVE_AVX2
+    #endif
+#endif
+
+#ifdef HAVE_SSE2
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+    #include <emmintrin.h>
+#endif
+#ifdef HAVE_AVX2
+    #include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(HAVE_AVX2)
+    #define AVX2_TARGET __attribute__((__target__("avx2")))
+#else
+    #define AVX2_TARGET
+#endif
+
+typedef SIZE_T (*FN_FINDMISMATCH)(const BYTE *pb0, const BYTE *pb1, SIZE_T cb);
+typedef SIZE_T (*FN_FINDMISMATCHNOCASEW)(const WORD *pw0, const WORD *pw1, SIZE_T cw);
+typedef SIZE_T (*FN_FINDLINEBREAKA)(const BYTE *pb, SIZE_T cb);
+typedef SIZE_T (*FN_FINDLINEBREAKW)(const WORD *pw, SIZE_T cw);
+typedef SIZE_T (*FN_WIDENASCII)(WORD *pw, const BYTE *pb, SIZE_T cb);
+
+typedef enum SCANLEVEL
+{
+    SCAN_SCALAR,
+    SCAN_SSE2,
+    SCAN_AVX2
+} SCANLEVEL;
+
+static __inline DWORD FirstSetBit(DWORD dw)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward(&i, dw);
+    return i;
+#elif defined(__GNUC__)
+    return (DWORD)__builtin_ctz(dw);
+#else
+    DWORD i = 0;
+    while (!(dw & 1))
+    {
+        dw >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+static __inline DWORD LastSetBit(DWORD dw)
+{
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanReverse(&i, dw);
+    return i;
+#elif defined(__GNUC__)
+    return 31 - (DWORD)__builtin_clz(dw);
+#else
+    DWORD i = 31;
+    while (!(dw & 0x80000000))
+    {
+        dw <<= 1;
+        --i;
+    }
+    return i;
+#endif
+}
+
+static SIZE_T FindMismatchScalar(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib = 0, w0, w1;
+
+    // compare word by word, then locate the byte
+    for (; ib + sizeof(SIZE_T) <= cb; ib += sizeof(SIZE_T))
+    {
+        memcpy(&w0, &pb0[ib], sizeof(w0));
+        memcpy(&w1, &pb1[ib], sizeof(w1));
+        if (w0 != w1)
+            break;
+    }
+    while (ib < cb && pb0[ib] == pb1[ib])
+        ++ib;
+    return ib;
+}
+
+#ifdef HAVE_SSE2
+static SIZE_T FindMismatchSSE2(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    DWORD mask;
+    __m128i x0, x1;
+
+    // 64 bytes per iteration; equal regions are skipped without branching per byte
+    for (; ib + 64 <= cb; ib += 64)
+    {
+        __m128i eq;
+        eq = _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&pb0[ib]),
+                           _mm_loadu_si128((const __m128i *)&pb1[ib])),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&pb0[ib + 16]),
+                           _mm_loadu_si128((const __m128i *)&pb1[ib + 16])));
+        eq = _mm_and_si128(eq, _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&pb0[ib + 32]),
+                           _mm_loadu_si128((const __m128i *)&pb1[ib + 32])),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&pb0[ib + 48]),
+                           _mm_loadu_si128((const __m128i *)&pb1[ib + 48]))));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            break;
+    }
+
+    for (; ib + 16 <= cb; ib += 16)
+    {
+        x0 = _mm_loadu_si128((const __m128i *)&pb0[ib]);
+        x1 = _mm_loadu_si128((const __m128i *)&pb1[ib]);
+        mask = (DWORD)_mm_movemask_epi8(_mm_cmpeq_epi8(x0, x1)) ^ 0xFFFF;
+        if (mask)
+            return ib + FirstSetBit(mask);
+    }
+
+    return ib + FindMismatchScalar(&pb0[ib], &pb1[ib], cb - ib);
+}
+#endif
+
+#ifdef HAVE_AVX2
+static AVX2_TARGET SIZE_T FindMismatchAVX2(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    DWORD mask;
+    __m256i x0, x1;
+
+    for (; ib + 128 <= cb; ib += 128)
+    {
+        __m256i eq;
+        eq = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&pb0[ib]),
+                              _mm256_loadu_si256((const __m256i *)&pb1[ib])),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&pb0[ib + 32]),
+                              _mm256_loadu_si256((const __m256i *)&pb1[ib + 32])));
+        eq = _mm256_and_si256(eq, _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&pb0[ib + 64]),
+                              _mm256_loadu_si256((const __m256i *)&pb1[ib + 64])),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&pb0[ib + 96]),
+                              _mm256_loadu_si256((const __m256i *)&pb1[ib + 96]))));
+        if ((DWORD)_mm256_movemask_epi8(eq) != MAXDWORD)
+            break;
+    }
+
+    for (; ib + 32 <= cb; ib += 32)
+    {
+        x0 = _mm256_loadu_si256((const __m256i *)&pb0[ib]);
+        x1 = _mm256_loadu_si256((const __m256i *)&pb1[ib]);
+        mask = ~(DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, x1));
+        if (mask)
+            return ib + FirstSetBit(mask);
+    }
+
+    return ib + FindMismatchScalar(&pb0[ib], &pb1[ib], cb - ib);
+}
+#endif
+
+static SIZE_T FindMismatchBackScalar(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T cbSame = 0, w0, w1;
+
+    for (; cbSame + sizeof(SIZE_T) <= cb; cbSame += sizeof(SIZE_T))
+    {
+        memcpy(&w0, &pb0[cb - cbSame - sizeof(SIZE_T)], sizeof(w0));
+        memcpy(&w1, &pb1[cb - cbSame - sizeof(SIZE_T)], sizeof(w1));
+        if (w0 != w1)
+            break;
+    }
+    while (cbSame < cb && pb0[cb - cbSame - 1] == pb1[cb - cbSame - 1])
+        ++cbSame;
+    return cbSame;
+}
+
+#ifdef HAVE_SSE2
+static SIZE_T FindMismatchBackSSE2(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T cbSame = 0;
+    const BYTE *pbEnd0 = pb0 + cb, *pbEnd1 = pb1 + cb;
+    DWORD mask;
+    __m128i x0, x1;
+
+    for (; cbSame + 64 <= cb; cbSame += 64)
+    {
+        __m128i eq;
+        eq = _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pbEnd0 - cbSame - 16)),
+                           _mm_loadu_si128((const __m128i *)(pbEnd1 - cbSame - 16))),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pbEnd0 - cbSame - 32)),
+                           _mm_loadu_si128((const __m128i *)(pbEnd1 - cbSame - 32))));
+        eq = _mm_and_si128(eq, _mm_and_si128(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pbEnd0 - cbSame - 48)),
+                           _mm_loadu_si128((const __m128i *)(pbEnd1 - cbSame - 48))),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(pbEnd0 - cbSame - 64)),
+                           _mm_loadu_si128((const __m128i *)(pbEnd1 - cbSame - 64)))));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            break;
+    }
+
+    for (; cbSame + 16 <= cb; cbSame += 16)
+    {
+        x0 = _mm_loadu_si128((const __m128i *)(pbEnd0 - cbSame - 16));
+        x1 = _mm_loadu_si128((const __m128i *)(pbEnd1 - cbSame - 16));
+        mask = (DWORD)_mm_movemask_epi8(_mm_cmpeq_epi8(x0, x1)) ^ 0xFFFF;
+        if (mask)
+            return cbSame + 15 - LastSetBit(mask);
+    }
+
+    return cbSame + FindMismatchBackScalar(pb0, pb1, cb - cbSame);
+}
+#endif
+
+#ifdef HAVE_AVX2
+static AVX2_TARGET SIZE_T FindMismatchBackAVX2(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T cbSame = 0;
+    const BYTE *pbEnd0 = pb0 + cb, *pbEnd1 = pb1 + cb;
+    DWORD mask;
+    __m256i x0, x1;
+
+    for (; cbSame + 128 <= cb; cbSame += 128)
+    {
+        __m256i eq;
+        eq = _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pbEnd0 - cbSame - 32)),
+                              _mm256_loadu_si256((const __m256i *)(pbEnd1 - cbSame - 32))),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pbEnd0 - cbSame - 64)),
+                              _mm256_loadu_si256((const __m256i *)(pbEnd1 - cbSame - 64))));
+        eq = _mm256_and_si256(eq, _mm256_and_si256(
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pbEnd0 - cbSame - 96)),
+                              _mm256_loadu_si256((const __m256i *)(pbEnd1 - cbSame - 96))),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(pbEnd0 - cbSame - 128)),
+                              _mm256_loadu_si256((const __m256i *)(pbEnd1 - cbSame - 128)))));
+        if ((DWORD)_mm256_movemask_epi8(eq) != MAXDWORD)
+            break;
+    }
+
+    for (; cbSame + 32 <= cb; cbSame += 32)
+    {
+        x0 = _mm256_loadu_si256((const __m256i *)(pbEnd0 - cbSame - 32));
+        x1 = _mm256_loadu_si256((const __m256i *)(pbEnd1 - cbSame - 32));
+        mask = ~(DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, x1));
+        if (mask)
+            return cbSame + 31 - LastSetBit(mask);
+    }
+
+    return cbSame + FindMismatchBackScalar(pb0, pb1, cb - cbSame);
+}
+#endif
+
+#define FOLD_ASCII(ch) (((ch) >= 'a' && (ch) <= 'z') ? (ch) - ('a' - 'A') : (ch))
+
+static SIZE_T FindMismatchNoCaseScalarA(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+
+    // skip the equal bytes word by word, then check the case of the mismatch
+    for (;;)
+    {
+        ib += FindMismatchScalar(&pb0[ib], &pb1[ib], cb - ib);
+        if (ib >= cb || FOLD_ASCII(pb0[ib]) != FOLD_ASCII(pb1[ib]))
+            return ib;
+        ++ib;
+    }
+}
+
+static SIZE_T FindMismatchNoCaseScalarW(const WORD *pw0, const WORD *pw1, SIZE_T cw)
+{
+    SIZE_T iw = 0;
+    while (iw < cw && FOLD_ASCII(pw0[iw]) == FOLD_ASCII(pw1[iw]))
+        ++iw;
+    return iw;
+}
+
+#ifdef HAVE_SSE2
+// Folds the ASCII small letters to capital letters
+static __inline __m128i FoldAsciiSSE2A(__m128i x)
+{
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('z' + 1), x));
+    return _mm_sub_epi8(x, _mm_and_si128(lower, _mm_set1_epi8('a' - 'A')));
+}
+
+static __inline __m128i FoldAsciiSSE2W(__m128i x)
+{
+    __m128i lower = _mm_and_si128(_mm_cmpgt_epi16(x, _mm_set1_epi16('a' - 1)),
+                                  _mm_cmpgt_epi16(_mm_set1_epi16('z' + 1), x));
+    return _mm_sub_epi16(x, _mm_and_si128(lower, _mm_set1_epi16('a' - 'A')));
+}
+
+static SIZE_T FindMismatchNoCaseSSE2A(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    DWORD mask;
+    __m128i x0, x1;
+
+    for (; ib + 16 <= cb; ib += 16)
+    {
+        x0 = FoldAsciiSSE2A(_mm_loadu_si128((const __m128i *)&pb0[ib]));
+        x1 = FoldAsciiSSE2A(_mm_loadu_si128((const __m128i *)&pb1[ib]));
+        mask = (DWORD)_mm_movemask_epi8(_mm_cmpeq_epi8(x0, x1)) ^ 0xFFFF;
+        if (mask)
+            return ib + FirstSetBit(mask);
+    }
+
+    return ib + FindMismatchNoCaseScalarA(&pb0[ib], &pb1[ib], cb - ib);
+}
+
+static SIZE_T FindMismatchNoCaseSSE2W(const WORD *pw0, const WORD *pw1, SIZE_T cw)
+{
+    SIZE_T iw = 0;
+    DWORD mask;
+    __m128i x0, x1;
+
+    for (; iw + 8 <= cw; iw += 8)
+    {
+        x0 = FoldAsciiSSE2W(_mm_loadu_si128((const __m128i *)&pw0[iw]));
+        x1 = FoldAsciiSSE2W(_mm_loadu_si128((const __m128i *)&pw1[iw]));
+        mask = (DWORD)_mm_movemask_epi8(_mm_cmpeq_epi16(x0, x1)) ^ 0xFFFF;
+        if (mask)
+            return iw + FirstSetBit(mask) / 2;
+    }
+
+    return iw + FindMismatchNoCaseScalarW(&pw0[iw], &pw1[iw], cw - iw);
+}
+#endif
+
+#ifdef HAVE_AVX2
+static __inline AVX2_TARGET __m256i FoldAsciiAVX2A(__m256i x)
+{
+    __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('a' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), x));
+    return _mm256_sub_epi8(x, _mm256_and_si256(lower, _mm256_set1_epi8('a' - 'A')));
+}
+
+static __inline AVX2_TARGET __m256i FoldAsciiAVX2W(__m256i x)
+{
+    __m256i lower = _mm256_and_si256(_mm256_cmpgt_epi16(x, _mm256_set1_epi16('a' - 1)),
+                                     _mm256_cmpgt_epi16(_mm256_set1_epi16('z' + 1), x));
+    return _mm256_sub_epi16(x, _mm256_and_si256(lower, _mm256_set1_epi16('a' - 'A')));
+}
+
+static AVX2_TARGET SIZE_T FindMismatchNoCaseAVX2A(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    DWORD mask;
+    __m256i x0, x1;
+
+    for (; ib + 32 <= cb; ib += 32)
+    {
+        x0 = FoldAsciiAVX2A(_mm256_loadu_si256((const __m256i *)&pb0[ib]));
+        x1 = FoldAsciiAVX2A(_mm256_loadu_si256((const __m256i *)&pb1[ib]));
+        mask = ~(DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x0, x1));
+        if (mask)
+            return ib + FirstSetBit(mask);
+    }
+
+    return ib + FindMismatchNoCaseScalarA(&pb0[ib], &pb1[ib], cb - ib);
+}
+
+static AVX2_TARGET SIZE_T FindMismatchNoCaseAVX2W(const WORD *pw0, const WORD *pw1, SIZE_T cw)
+{
+    SIZE_T iw = 0;
+    DWORD mask;
+    __m256i x0, x1;
+
+    for (; iw + 16 <= cw; iw += 16)
+    {
+        x0 = FoldAsciiAVX2W(_mm256_loadu_si256((const __m256i *)&pw0[iw]));
+        x1 = FoldAsciiAVX2W(_mm256_loadu_si256((const __m256i *)&pw1[iw]));
+        mask = ~(DWORD)_mm256_movemask_epi8(_mm256_cmpeq_epi16(x0, x1));
+        if (mask)
+            return iw + FirstSetBit(mask) / 2;
+    }
+
+    return iw + FindMismatchNoCaseScalarW(&pw0[iw], &pw1[iw], cw - iw);
+}
+#endif
+
+#define SWAR_ONES ((SIZE_T)-1 / 0xFF) // 0x0101...01
+#define SWAR_HIGHS (SWAR_ONES * 0x80) // 0x8080...80
+#define SWAR_HAS_ZERO(w) (((w) - SWAR_ONES) & ~(w) & SWAR_HIGHS)
+
+static SIZE_T FindLineBreakScalarA(const BYTE *pb, SIZE_T cb)
+{
+    SIZE_T ib = 0, w;
+
+    // skip the words that have neither '\n' nor '\0'
+    for (; ib + sizeof(SIZE_T) <= cb; ib += sizeof(SIZE_T))
+    {
+        memcpy(&w, &pb[ib], sizeof(w));
+        if (SWAR_HAS_ZERO(w) || SWAR_HAS_ZERO(w ^ (SWAR_ONES * '\n')))
+            break;
+    }
+    while (ib < cb && pb[ib] != '\n' && pb[ib] != 0)
+        ++ib;
+    return ib;
+}
+
+static SIZE_T FindLineBreakScalarW(const WORD *pw, SIZE_T cw)
+{
+    SIZE_T iw = 0;
+    while (iw < cw && pw[iw] != L'\n' && pw[iw] != 0)
+        ++iw;
+    return iw;
+}
+
+#ifdef HAVE_SSE2
+static SIZE_T FindLineBreakSSE2A(const BYTE *pb, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    DWORD mask;
+    __m128i x, nl = _mm_set1_epi8('\n'), zero = _mm_setzero_si128();
+
+    for (; ib + 16 <= cb; ib += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *)&pb[ib]);
+        mask = (DWORD)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, nl),
+                                                     _mm_cmpeq_epi8(x, zero)));
+        if (mask)
+            return ib + FirstSetBit(mask);
+    }
+
+    return ib + FindLineBreakScalarA(&pb[ib], cb - ib);
+}
+
+static SIZE_T FindLineBreakSSE2W(const WORD *pw, SIZE_T cw)
+{
+    SIZE_T iw = 0;
+    DWORD mask;
+    __m128i x, nl = _mm_set1_epi16(L'\n'), zero = _mm_setzero_si128();
+
+    // two mask bits per WCHAR
+    for (; iw + 8 <= cw; iw += 8)
+    {
+        x = _mm_loadu_si128((const __m128i *)&pw[iw]);
+        mask = (DWORD)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi16(x, nl),
+                                                     _mm_cmpeq_epi16(x, zero)));
+        if (mask)
+            return iw + FirstSetBit(mask) / 2;
+    }
+
+    return iw + FindLineBreakScalarW(&pw[iw], cw - iw);
+}
+#endif
+
+#ifdef HAVE_AVX2
+static AVX2_TARGET SIZE_T FindLineBreakAVX2A(const BYTE *pb, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    DWORD mask;
+    __m256i x, nl = _mm256_set1_epi8('\n'), zero = _mm256_setzero_si256();
+
+    for (; ib + 32 <= cb; ib += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *)&pb[ib]);
+        mask = (DWORD)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, nl),
+                                                           _mm256_cmpeq_epi8(x, zero)));
+        if (mask)
+            return ib + FirstSetBit(mask);
+    }
+
+    return ib + FindLineBreakScalarA(&pb[ib], cb - ib);
+}
+
+static AVX2_TARGET SIZE_T FindLineBreakAVX2W(const WORD *pw, SIZE_T cw)
+{
+    SIZE_T iw = 0;
+    DWORD mask;
+    __m256i x, nl = _mm256_set1_epi16(L'\n'), zero = _mm256_setzero_si256();
+
+    for (; iw + 16 <= cw; iw += 16)
+    {
+        x = _mm256_loadu_si256((const __m256i *)&pw[iw]);
+        mask = (DWORD)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi16(x, nl),
+                                                           _mm256_cmpeq_epi16(x, zero)));
+        if (mask)
+            return iw + FirstSetBit(mask) / 2;
+    }
+
+    return iw + FindLineBreakScalarW(&pw[iw], cw - iw);
+}
+#endif
+
+static SIZE_T WidenAsciiScalar(WORD *pw, const BYTE *pb, SIZE_T cb)
+{
+    SIZE_T ib = 0, i, w;
+
+    for (; ib + sizeof(SIZE_T) <= cb; ib += sizeof(SIZE_T))
+    {
+        memcpy(&w, &pb[ib], sizeof(w));
+        if (w & SWAR_HIGHS)
+            break;
+    }
+    while (ib < cb && pb[ib] < 0x80)
+        ++ib;
+
+    for (i = 0; i < ib; ++i)
+        pw[i] = pb[i];
+    return ib;
+}
+
+#ifdef HAVE_SSE2
+static SIZE_T WidenAsciiSSE2(WORD *pw, const BYTE *pb, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    __m128i x, zero = _mm_setzero_si128();
+
+    for (; ib + 16 <= cb; ib += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *)&pb[ib]);
+        if (_mm_movemask_epi8(x))
+            break;
+        _mm_storeu_si128((__m128i *)&pw[ib], _mm_unpacklo_epi8(x, zero));
+        _mm_storeu_si128((__m128i *)&pw[ib + 8], _mm_unpackhi_epi8(x, zero));
+    }
+
+    return ib + WidenAsciiScalar(&pw[ib], &pb[ib], cb - ib);
+}
+#endif
+
+#ifdef HAVE_AVX2
+static AVX2_TARGET SIZE_T WidenAsciiAVX2(WORD *pw, const BYTE *pb, SIZE_T cb)
+{
+    SIZE_T ib = 0;
+    __m256i x;
+
+    for (; ib + 32 <= cb; ib += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *)&pb[ib]);
+        if (_mm256_movemask_epi8(x))
+            break;
+        _mm256_storeu_si256((__m256i *)&pw[ib],
+                            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(x)));
+        _mm256_storeu_si256((__m256i *)&pw[ib + 16],
+                            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(x, 1)));
+    }
+
+    return ib + WidenAsciiScalar(&pw[ib], &pb[ib], cb - ib);
+}
+#endif
+
+#ifdef HAVE_SSE2
+static BOOL HasSSE2(VOID)
+{
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__x86_64__)
+    return TRUE;
+#elif defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    return !!(regs[3] & (1 << 26));
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return FALSE;
+    return !!(edx & (1 << 26));
+#endif
+}
+#endif
+
+#ifdef HAVE_AVX2
+static BOOL HasAVX2(VOID)
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+        return FALSE;
+    __cpuid(regs, 1);
+    // the OS must save the YMM registers (OSXSAVE + AVX, XCR0 bits 1-2)
+    if ((regs[2] & ((1 << 27) | (1 << 28))) != ((1 << 27) | (1 << 28)))
+        return FALSE;
+    if ((_xgetbv(0) & 6) != 6)
+        return FALSE;
+    __cpuidex(regs, 7, 0);
+    return !!(regs[1] & (1 << 5));
+#else
+    __builtin_cpu_init();
+    return !!__builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static SCANLEVEL GetScanLevel(VOID)
+{
+#ifdef HAVE_AVX2
+    if (HasAVX2())
+        return SCAN_AVX2;
+#endif
+#ifdef HAVE_SSE2
+    if (HasSSE2())
+        return SCAN_SSE2;
+#endif
+    return SCAN_SCALAR;
+}
+
+// The kernels are scalar until InitScan chooses them for the CPU
+static FN_FINDMISMATCH s_pfnFindMismatch = FindMismatchScalar;
+static FN_FINDMISMATCH s_pfnFindMismatchBack = FindMismatchBackScalar;
+static FN_FINDMISMATCH s_pfnFindMismatchNoCaseA = FindMismatchNoCaseScalarA;
+static FN_FINDMISMATCHNOCASEW s_pfnFindMismatchNoCaseW = FindMismatchNoCaseScalarW;
+static FN_FINDLINEBREAKA s_pfnFindLineBreakA = FindLineBreakScalarA;
+static FN_FINDLINEBREAKW s_pfnFindLineBreakW = FindLineBreakScalarW;
+static FN_WIDENASCII s_pfnWidenAscii = WidenAsciiScalar;
+
+// Chooses the kernels for the CPU. It is called once before any thread starts,
+// so that the kernels never change while they are used.
+VOID InitScan(VOID)
+{
+    switch (GetScanLevel())
+    {
+#ifdef HAVE_AVX2
+        case SCAN_AVX2:
+            s_pfnFindMismatch = FindMismatchAVX2;
+            s_pfnFindMismatchBack = FindMismatchBackAVX2;
+            s_pfnFindMismatchNoCaseA = FindMismatchNoCaseAVX2A;
+            s_pfnFindMismatchNoCaseW = FindMismatchNoCaseAVX2W;
+            s_pfnFindLineBreakA = FindLineBreakAVX2A;
+            s_pfnFindLineBreakW = FindLineBreakAVX2W;
+            s_pfnWidenAscii = WidenAsciiAVX2;
+            break;
+#endif
+#ifdef HAVE_SSE2
+        case SCAN_SSE2:
+            s_pfnFindMismatch = FindMismatchSSE2;
+            s_pfnFindMismatchBack = FindMismatchBackSSE2;
+            s_pfnFindMismatchNoCaseA = FindMismatchNoCaseSSE2A;
+            s_pfnFindMismatchNoCaseW = FindMismatchNoCaseSSE2W;
+            s_pfnFindLineBreakA = FindLineBreakSSE2A;
+            s_pfnFindLineBreakW = FindLineBreakSSE2W;
+            s_pfnWidenAscii = WidenAsciiSSE2;
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+// Returns the offset of the first differing byte, or cb if the blocks are equal.
+SIZE_T FindMismatch(LPCVOID pv0, LPCVOID pv1, SIZE_T cb)
+{
+    return s_pfnFindMismatch(pv0, pv1, cb);
+}
+
+// Returns the number of equal bytes at the end of the blocks (cb if they are equal).
+SIZE_T FindMismatchBack(LPCVOID pv0, LPCVOID pv1, SIZE_T cb)
+{
+    return s_pfnFindMismatchBack(pv0, pv1, cb);
+}
+
+// Returns the index of the first character that differs after the ASCII
+// letters are folded to capitals, or cch if there is none. Other characters
+// are compared as they are.
+SIZE_T FindMismatchNoCaseA(LPCSTR pch0, LPCSTR pch1, SIZE_T cch)
+{
+    return s_pfnFindMismatchNoCaseA((const BYTE *)pch0, (const BYTE *)pch1, cch);
+}
+SIZE_T FindMismatchNoCaseW(LPCWSTR pch0, LPCWSTR pch1, SIZE_T cch)
+{
+    return s_pfnFindMismatchNoCaseW((const WORD *)pch0, (const WORD *)pch1, cch);
+}
+
+// Returns the index of the first '\n' or '\0', or cch if there is none.
+SIZE_T FindLineBreakA(LPCSTR pch, SIZE_T cch)
+{
+    return s_pfnFindLineBreakA((const BYTE *)pch, cch);
+}
+SIZE_T FindLineBreakW(LPCWSTR pch, SIZE_T cch)
+{
+    return s_pfnFindLineBreakW((const WORD *)pch, cch);
+}
+
+// Copies the leading ASCII bytes into WCHARs. Returns the number of bytes
+// copied; pb[return value] is the first non-ASCII byte unless it is cb.
+SIZE_T WidenAscii(LPWSTR pch, const BYTE *pb, SIZE_T cb)
+{
+    return s_pfnWidenAscii((WORD *)pch, pb, cb);
+}
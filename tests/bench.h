@@ -0,0 +1,53 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Timing and random data for the tests and benchmarks
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#pragma once
+#include <stdio.h>
+#ifndef _WIN32
+    #include <time.h>
+#endif
+
+#define BENCH_MIN_SECONDS 0.5 // each measurement runs at least this long
+
+// Returns a monotonic time in seconds
+static __inline double GetSeconds(VOID)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
+}
+
+// A xorshift generator, so that the data is the same on every system
+static DWORD s_dwRandom = 2463534242U;
+
+static __inline DWORD Random(VOID)
+{
+    s_dwRandom ^= s_dwRandom << 13;
+    s_dwRandom ^= s_dwRandom >> 17;
+    s_dwRandom ^= s_dwRandom << 5;
+    return s_dwRandom;
+}
+
+// Counts the failures in s_cFailures, which the test defines
+#define CHECK(expr, ...) \
+    do { \
+        if (!(expr)) \
+        { \
+            if (++s_cFailures <= 20) \
+            { \
+                printf("%s(%d): check failed: %s: ", __FILE__, __LINE__, #expr); \
+                printf(__VA_ARGS__); \
+                printf("\n"); \
+            } \
+        } \
+    } while (0)
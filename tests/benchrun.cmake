@@ -0,0 +1,28 @@
+# Times FC on a generated pair of files with each set of switches.
+#
+# cmake -DFC=fc.exe -DMKINPUT=mkinput.exe -DFCBENCH=fcbench.exe
+#       "-DINPUT=binary a b 1024 100" "-DRUNS=/B|/B /STREAM" -P benchrun.cmake
+#
+# INPUT and RUNS are as in samerun.cmake. The number of lines that FC
+# displays is shown with the times, to compare the output of the algorithms.
+
+separate_arguments(input UNIX_COMMAND "${INPUT}")
+list(GET input 1 file0)
+list(GET input 2 file1)
+execute_process(COMMAND "${MKINPUT}" ${input} RESULT_VARIABLE code)
+if(NOT code EQUAL 0)
+    message(FATAL_ERROR "mkinput ${INPUT} failed")
+endif()
+
+message(STATUS "${INPUT}")
+string(REPLACE "|" ";" runs "${RUNS}")
+foreach(run IN LISTS runs)
+    separate_arguments(switches UNIX_COMMAND "${run}")
+    execute_process(COMMAND "${FCBENCH}" "${FC}" ${switches} "${file0}" "${file1}"
+                    RESULT_VARIABLE code OUTPUT_VARIABLE output)
+    string(STRIP "${output}" output)
+    execute_process(COMMAND "${FC}" ${switches} "${file0}" "${file1}" OUTPUT_VARIABLE text)
+    string(REGEX MATCHALL "\n" lines "${text}")
+    list(LENGTH lines count)
+    message(STATUS "FC ${run}: ${output}, ${count} lines displayed")
+endforeach()
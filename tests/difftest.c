@@ -0,0 +1,378 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Tests and speed of the diff algorithms of /ALG
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include <stdio.h>
+#include "fc.h"
+#include "bench.h"
+
+// usage: difftest [lines]
+// Checks on small random files that the edit script of MyersDiff turns file 0
+// into file 1 and is as short as the longest common subsequence allows, that
+// those of HistogramDiff and ParallelDiff turn file 0 into file 1, and that
+// ParallelDiff diffs each segment as one thread would. Then times MyersDiff and
+// HistogramDiff on files of the given lines with few and with many edits.
+
+#define MAX_TEST_LINES 48
+#define TEST_ROUNDS 20000
+
+static INT s_cFailures = 0;
+
+// The length of the longest common subsequence, by dynamic programming
+static DWORD LcsLength(const DWORD *a, DWORD n, const DWORD *b, DWORD m)
+{
+    static DWORD s_aLcs[MAX_TEST_LINES + 1][MAX_TEST_LINES + 1];
+    DWORD i, j;
+    for (i = 0; i <= n; ++i)
+    {
+        for (j = 0; j <= m; ++j)
+        {
+            if (i == 0 || j == 0)
+                s_aLcs[i][j] = 0;
+            else if (a[i - 1] == b[j - 1])
+                s_aLcs[i][j] = s_aLcs[i - 1][j - 1] + 1;
+            else
+                s_aLcs[i][j] = max(s_aLcs[i - 1][j], s_aLcs[i][j - 1]);
+        }
+    }
+    return s_aLcs[n][m];
+}
+
+// Deletes the changed lines of file 0 and inserts those of file 1 in front of
+// the next kept line. Returns the number of lines in pOut, which is file 1 if
+// the edit script is right, or MAXDWORD if the kept lines don't pair up.
+static DWORD ApplyEdits(const DWORD *a, DWORD n, const DWORD *b, DWORD m,
+                        const BYTE *pfChanged0, const BYTE *pfChanged1, DWORD *pOut)
+{
+    DWORD i = 0, j = 0, cOut = 0;
+    for (;;)
+    {
+        for (; i < n && pfChanged0[i]; ++i)
+            ;
+        for (; j < m && pfChanged1[j]; ++j)
+            pOut[cOut++] = b[j];
+        if (i == n && j == m)
+            return cOut;
+        if (i == n || j == m)
+            return MAXDWORD;
+        pOut[cOut++] = a[i++];
+        ++j;
+    }
+}
+
+static DWORD CountChanged(const BYTE *pfChanged, DWORD c)
+{
+    DWORD i, cChanged = 0;
+    for (i = 0; i < c; ++i)
+        cChanged += !!pfChanged[i];
+    return cChanged;
+}
+
+// Random files of few distinct lines, so that there are many ways to line
+// them up
+static VOID TestDiff(VOID)
+{
+    DWORD a[MAX_TEST_LINES], b[MAX_TEST_LINES], out[2 * MAX_TEST_LINES];
+    BYTE fChanged0[MAX_TEST_LINES], fChanged1[MAX_TEST_LINES];
+    DWORD n, m, i, cSymbols, cOut, cLcs, cChanged;
+    INT iRound;
+
+    for (iRound = 0; iRound < TEST_ROUNDS; ++iRound)
+    {
+        n = Random() % (MAX_TEST_LINES + 1);
+        m = Random() % (MAX_TEST_LINES + 1);
+        cSymbols = 1 + Random() % 8;
+        for (i = 0; i < n; ++i)
+            a[i] = Random() % cSymbols;
+        for (i = 0; i < m; ++i)
+        {
+            // file 1 is often an edited copy of file 0
+            b[i] = (i < n && Random() % 4 != 0) ? a[i] : Random() % cSymbols;
+        }
+
+        ZeroMemory(fChanged0, sizeof(fChanged0));
+        ZeroMemory(fChanged1, sizeof(fChanged1));
+        if (!MyersDiff(a, n, b, m, fChanged0, fChanged1))
+        {
+            CHECK(FALSE, "MyersDiff failed on %u and %u lines", n, m);
+            continue;
+        }
+
+        cOut = ApplyEdits(a, n, b, m, fChanged0, fChanged1, out);
+        CHECK(cOut == m && memcmp(out, b, m * sizeof(DWORD)) == 0,
+              "round %d: the edits don't turn %u lines into %u", iRound, n, m);
+
+        cLcs = LcsLength(a, n, b, m);
+        cChanged = CountChanged(fChanged0, n) + CountChanged(fChanged1, m);
+        CHECK(cChanged == n + m - 2 * cLcs, "round %d: %u lines changed, the shortest is %u",
+              iRound, cChanged, n + m - 2 * cLcs);
+
+        // the histogram diff needn't be the shortest
+        ZeroMemory(fChanged0, sizeof(fChanged0));
+        ZeroMemory(fChanged1, sizeof(fChanged1));
+        if (!HistogramDiff(a, n, b, m, cSymbols, fChanged0, fChanged1))
+        {
+            CHECK(FALSE, "HistogramDiff failed on %u and %u lines", n, m);
+            continue;
+        }
+        cOut = ApplyEdits(a, n, b, m, fChanged0, fChanged1, out);
+        CHECK(cOut == m && memcmp(out, b, m * sizeof(DWORD)) == 0,
+              "round %d: the histogram edits don't turn %u lines into %u", iRound, n, m);
+    }
+}
+
+// File 0 has cLines random lines; file 1 has cEdits runs of 1 to 3 lines
+// changed, inserted or deleted, as "mkinput text" makes.
+static VOID MakeEdits(DWORD *a, DWORD cLines, DWORD *b, LPDWORD pcLines1, DWORD cEdits)
+{
+    DWORD i, j = 0, cRun;
+    for (i = 0; i < cLines; ++i)
+        a[i] = Random() % (cLines / 4 + 1);
+    for (i = 0; i < cLines;)
+    {
+        if (cEdits && Random() % cLines < cEdits)
+        {
+            cRun = 1 + Random() % 3;
+            switch (Random() % 3)
+            {
+                case 0: // changed
+                    for (; cRun > 0 && i < cLines; --cRun, ++i)
+                        b[j++] = cLines + Random() % cLines;
+                    break;
+                case 1: // inserted
+                    for (; cRun > 0; --cRun)
+                        b[j++] = cLines + Random() % cLines;
+                    break;
+                default: // deleted
+                    for (; cRun > 0 && i < cLines; --cRun, ++i)
+                        ;
+                    break;
+            }
+            continue;
+        }
+        b[j++] = a[i++];
+    }
+    *pcLines1 = j;
+}
+
+// Each algorithm with 1 to 4 threads on a larger file
+static VOID TestParallel(VOID)
+{
+    static const FCALG s_algs[] = { ALG_MYERS, ALG_HISTOGRAM };
+    DWORD cLines = 20000, cLines1, cOut;
+    DWORD *a = malloc(cLines * sizeof(DWORD)), *b = malloc(4 * cLines * sizeof(DWORD) + 16);
+    DWORD *pOut = malloc(4 * cLines * sizeof(DWORD) + 16);
+    LPBYTE pfChanged0 = malloc(cLines), pfChanged1 = malloc(4 * cLines + 16);
+    INT iAlg, nThreads;
+
+    if (!a || !b || !pOut || !pfChanged0 || !pfChanged1)
+    {
+        CHECK(FALSE, "out of memory");
+        return;
+    }
+    MakeEdits(a, cLines, b, &cLines1, cLines / 100);
+    for (iAlg = 0; iAlg < (INT)_countof(s_algs); ++iAlg)
+    {
+        for (nThreads = 1; nThreads <= 4; ++nThreads)
+        {
+            ZeroMemory(pfChanged0, cLines);
+            ZeroMemory(pfChanged1, cLines1);
+            if (!ParallelDiff(s_algs[iAlg], nThreads, a, cLines, b, cLines1, 2 * cLines,
+                              pfChanged0, pfChanged1))
+            {
+                CHECK(FALSE, "ParallelDiff failed with %d threads", nThreads);
+                continue;
+            }
+            cOut = ApplyEdits(a, cLines, b, cLines1, pfChanged0, pfChanged1, pOut);
+            CHECK(cOut == cLines1 && memcmp(pOut, b, cLines1 * sizeof(DWORD)) == 0,
+                  "ParallelDiff with algorithm %d and %d threads: wrong edits",
+                  (INT)s_algs[iAlg], nThreads);
+        }
+    }
+
+    free(a);
+    free(b);
+    free(pOut);
+    free(pfChanged0);
+    free(pfChanged1);
+}
+
+// Diffs a[x0, x1) and b[y0, y1) by one thread into their slices of the arrays
+static BOOL DiffOne(FCALG alg, const DWORD *a, DWORD x0, DWORD x1, const DWORD *b,
+                    DWORD y0, DWORD y1, DWORD cSymbols, LPBYTE pfChanged0, LPBYTE pfChanged1)
+{
+    if (alg == ALG_HISTOGRAM)
+        return HistogramDiff(a + x0, x1 - x0, b + y0, y1 - y0, cSymbols,
+                             pfChanged0 + x0, pfChanged1 + y0);
+    return MyersDiff(a + x0, x1 - x0, b + y0, y1 - y0, pfChanged0 + x0, pfChanged1 + y0);
+}
+
+#define SEGMENT_BLOCKS 8
+#define SEGMENT_BLOCK_LINES 2500
+#define SEGMENT_SYMBOLS 64 // no line of a block occurs once in a file
+
+// ParallelDiff gives the same changed lines as the diff of one thread: on a
+// file that stays in one segment, and on the segments of a file that is cut
+// at every marker line. Each block between the markers is SEGMENT_BLOCK_LINES
+// lines, so that with 4 or 8 threads every marker closes a segment
+// (PARALLEL_MIN_SEGMENT).
+static VOID TestSegments(VOID)
+{
+    static const FCALG s_algs[] = { ALG_MYERS, ALG_HISTOGRAM };
+    static const INT s_nThreads[] = { 4, 8 };
+    DWORD cMax = SEGMENT_BLOCKS * (2 * SEGMENT_BLOCK_LINES + 1);
+    DWORD *a = malloc(cMax * sizeof(DWORD)), *b = malloc(cMax * sizeof(DWORD));
+    LPBYTE pfChanged[2][2] = { { malloc(cMax), malloc(cMax) }, { malloc(cMax), malloc(cMax) } };
+    DWORD aMarks[2][SEGMENT_BLOCKS], cLines0, cLines1, n, m, iBlock, i, x0, y0;
+    INT iAlg, iThreads, nThreads;
+
+    if (!a || !b || !pfChanged[0][0] || !pfChanged[0][1] || !pfChanged[1][0] || !pfChanged[1][1])
+    {
+        CHECK(FALSE, "out of memory");
+        return;
+    }
+
+    // a small file stays in one segment
+    for (iAlg = 0; iAlg < (INT)_countof(s_algs); ++iAlg)
+    {
+        n = 1000;
+        for (i = 0; i < n; ++i)
+            a[i] = Random() % SEGMENT_SYMBOLS;
+        for (m = i = 0; i < n; ++i)
+        {
+            if (Random() % 16 == 0)
+                b[m++] = Random() % SEGMENT_SYMBOLS;
+            if (Random() % 16 != 0)
+                b[m++] = a[i];
+        }
+        ZeroMemory(pfChanged[0][0], n);
+        ZeroMemory(pfChanged[0][1], m);
+        CHECK(DiffOne(s_algs[iAlg], a, 0, n, b, 0, m, SEGMENT_SYMBOLS,
+                      pfChanged[0][0], pfChanged[0][1]), "the diff failed");
+        for (nThreads = 1; nThreads <= 4; ++nThreads)
+        {
+            ZeroMemory(pfChanged[1][0], n);
+            ZeroMemory(pfChanged[1][1], m);
+            CHECK(ParallelDiff(s_algs[iAlg], nThreads, a, n, b, m, SEGMENT_SYMBOLS,
+                               pfChanged[1][0], pfChanged[1][1]), "ParallelDiff failed");
+            CHECK(memcmp(pfChanged[0][0], pfChanged[1][0], n) == 0 &&
+                  memcmp(pfChanged[0][1], pfChanged[1][1], m) == 0,
+                  "algorithm %d, %d threads: not the diff of one thread on %u lines",
+                  (INT)s_algs[iAlg], nThreads, n);
+        }
+    }
+
+    // blocks of edited lines, each followed by a marker line
+    for (cLines0 = cLines1 = iBlock = 0; iBlock < SEGMENT_BLOCKS; ++iBlock)
+    {
+        for (i = 0; i < SEGMENT_BLOCK_LINES; ++i)
+        {
+            a[cLines0++] = Random() % SEGMENT_SYMBOLS;
+            if (Random() % 32 == 0)
+                b[cLines1++] = Random() % SEGMENT_SYMBOLS;
+            if (Random() % 32 != 0)
+                b[cLines1++] = a[cLines0 - 1];
+        }
+        aMarks[0][iBlock] = cLines0;
+        aMarks[1][iBlock] = cLines1;
+        a[cLines0++] = b[cLines1++] = SEGMENT_SYMBOLS + iBlock;
+    }
+
+    for (iAlg = 0; iAlg < (INT)_countof(s_algs); ++iAlg)
+    {
+        ZeroMemory(pfChanged[0][0], cLines0);
+        ZeroMemory(pfChanged[0][1], cLines1);
+        for (x0 = y0 = iBlock = 0; iBlock < SEGMENT_BLOCKS; ++iBlock)
+        {
+            CHECK(DiffOne(s_algs[iAlg], a, x0, aMarks[0][iBlock], b, y0, aMarks[1][iBlock],
+                          SEGMENT_SYMBOLS + SEGMENT_BLOCKS, pfChanged[0][0], pfChanged[0][1]),
+                  "the diff of block %u failed", iBlock);
+            x0 = aMarks[0][iBlock] + 1;
+            y0 = aMarks[1][iBlock] + 1;
+        }
+        for (iThreads = 0; iThreads < (INT)_countof(s_nThreads); ++iThreads)
+        {
+            ZeroMemory(pfChanged[1][0], cLines0);
+            ZeroMemory(pfChanged[1][1], cLines1);
+            CHECK(ParallelDiff(s_algs[iAlg], s_nThreads[iThreads], a, cLines0, b, cLines1,
+                               SEGMENT_SYMBOLS + SEGMENT_BLOCKS,
+                               pfChanged[1][0], pfChanged[1][1]), "ParallelDiff failed");
+            CHECK(memcmp(pfChanged[0][0], pfChanged[1][0], cLines0) == 0 &&
+                  memcmp(pfChanged[0][1], pfChanged[1][1], cLines1) == 0,
+                  "algorithm %d, %d threads: the segments are not diffed as by one thread",
+                  (INT)s_algs[iAlg], s_nThreads[iThreads]);
+        }
+    }
+
+    free(a);
+    free(b);
+    for (i = 0; i < 4; ++i)
+        free(pfChanged[i / 2][i % 2]);
+}
+
+static VOID MeasureDiff(DWORD cLines, DWORD cEdits)
+{
+    DWORD *a = malloc(cLines * sizeof(DWORD)), *b = malloc(4 * cLines * sizeof(DWORD) + 16);
+    LPBYTE pfChanged0 = malloc(cLines), pfChanged1 = malloc(4 * cLines + 16);
+    DWORD cLines1, cChanged;
+    BOOL fHistogram, fOK;
+    double t0, t;
+    INT cRuns;
+
+    if (!a || !b || !pfChanged0 || !pfChanged1)
+    {
+        CHECK(FALSE, "out of memory");
+        return;
+    }
+    MakeEdits(a, cLines, b, &cLines1, cEdits);
+    printf("%8u edits:", cEdits);
+    for (fHistogram = FALSE; fHistogram <= TRUE; ++fHistogram)
+    {
+        t = 0;
+        cRuns = 0;
+        do
+        {
+            ZeroMemory(pfChanged0, cLines);
+            ZeroMemory(pfChanged1, cLines1);
+            t0 = GetSeconds();
+            if (fHistogram)
+                fOK = HistogramDiff(a, cLines, b, cLines1, 2 * cLines, pfChanged0, pfChanged1);
+            else
+                fOK = MyersDiff(a, cLines, b, cLines1, pfChanged0, pfChanged1);
+            t += GetSeconds() - t0;
+            ++cRuns;
+            CHECK(fOK, "the diff failed");
+        } while (t < BENCH_MIN_SECONDS && fOK);
+        cChanged = CountChanged(pfChanged0, cLines) + CountChanged(pfChanged1, cLines1);
+        printf(" %8u changed, %9.2f ms", cChanged, t / cRuns * 1000);
+    }
+    printf("\n");
+
+    free(a);
+    free(b);
+    free(pfChanged0);
+    free(pfChanged1);
+}
+
+int main(int argc, char **argv)
+{
+    DWORD cLines = (argc > 1 ? atoi(argv[1]) : 200000);
+
+    TestDiff();
+    TestParallel();
+    TestSegments();
+
+    printf("%u lines:         MyersDiff                     HistogramDiff\n", cLines);
+    MeasureDiff(cLines, 20);
+    MeasureDiff(cLines, cLines / 100);
+    MeasureDiff(cLines, cLines / 10);
+
+    if (s_cFailures)
+    {
+        printf("%d checks failed\n", s_cFailures);
+        return 1;
+    }
+    return 0;
+}
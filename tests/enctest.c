@@ -0,0 +1,504 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Tests of the detection and the decoding of text encodings
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include <stdio.h>
+#include <string.h>
+#include "fc.h"
+#include "bench.h"
+
+// usage: enctest [dbcs]
+// Checks DetectEncoding on samples that are cut in the middle of a UTF-8
+// sequence, and that DecodeText gives the same text when a block ends in the
+// middle of a character as when it doesn't. Then samples and decodes files
+// through input.c: small files that end in the middle of a character, files
+// whose first stream block ends in the middle of one, and a mapped file that
+// is decoded again from its beginning. With dbcs, the ANSI text is in a
+// double-byte code page (the one of the shim; on Windows, the tests run only
+// if the code page is one). The file of the tests is written to the current
+// directory.
+
+static INT s_cFailures = 0;
+
+// ----------------------------------------------------------------------------
+// The functions of fc.c that input.c calls
+
+HANDLE DoOpenFileForInput(LPCWSTR file)
+{
+    return CreateFileW(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                       FILE_ATTRIBUTE_NORMAL, NULL);
+}
+
+FCRET OutOfMemory(VOID)
+{
+    CHECK(FALSE, "out of memory");
+    return FCRET_INVALID;
+}
+
+FCRET CannotRead(LPCWSTR file)
+{
+    CHECK(FALSE, "cannot read a file");
+    return FCRET_INVALID;
+}
+
+// ----------------------------------------------------------------------------
+// DetectEncoding
+
+typedef struct DETECTCASE
+{
+    LPCSTR pszSample;
+    BOOL fLast; // the sample is the whole file
+    BOOL fUnicode;
+    FCENCODING encoding;
+    DWORD cbBOM;
+} DETECTCASE;
+
+static VOID TestDetect(VOID)
+{
+    static const DETECTCASE s_cases[] =
+    {
+        { "\xEF\xBB\xBF" "abc", TRUE, FALSE, ENC_UTF8, 3 },
+        { "\xFF\xFE" "a", TRUE, FALSE, ENC_UTF16LE, 2 },
+        { "\xFE\xFF" "a", TRUE, TRUE, ENC_UTF16BE, 2 },
+        { "abc", TRUE, TRUE, ENC_UTF16LE, 0 },
+        { "abc\r\n", TRUE, FALSE, ENC_ASCII, 0 },
+        { "caf\xC3\xA9", TRUE, FALSE, ENC_UTF8, 0 },
+        { "caf\xE9x", FALSE, FALSE, ENC_ANSI, 0 },
+        // a sequence that is cut at the end of the sample is taken, unless the
+        // file ends there
+        { "ab\xE2\x82", FALSE, FALSE, ENC_UTF8, 0 },
+        { "ab\xF0", FALSE, FALSE, ENC_UTF8, 0 },
+        { "ab\xE2\x82", TRUE, FALSE, ENC_ANSI, 0 },
+        { "caf\xE9", TRUE, FALSE, ENC_ANSI, 0 },
+        // a sequence that is broken before the end isn't
+        { "ab\xE2\x82" "c", FALSE, FALSE, ENC_ANSI, 0 },
+        { "ab\xE2(", FALSE, FALSE, ENC_ANSI, 0 },
+        // overlong forms, surrogates and code points above U+10FFFF
+        { "\xC0\xAF", FALSE, FALSE, ENC_ANSI, 0 },
+        { "\xE0\x80", FALSE, FALSE, ENC_ANSI, 0 },
+        { "\xED\xA0", FALSE, FALSE, ENC_ANSI, 0 },
+        { "\xF4\x90", FALSE, FALSE, ENC_ANSI, 0 },
+        // a double-byte text of 932 isn't UTF-8
+        { "\x82\xA0\x82\xA2", TRUE, FALSE, ENC_ANSI, 0 },
+    };
+    // 1 to 4 bytes a character
+    static const BYTE s_abText[] = "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80"
+                                   "z\xE2\x82\xAC\xF0\x9F\x98\x80";
+    const DETECTCASE *pCase;
+    FCENCODING encoding;
+    DWORD cbBOM, cb;
+    BOOL fCut;
+    INT iCase;
+
+    for (iCase = 0; iCase < (INT)_countof(s_cases); ++iCase)
+    {
+        pCase = &s_cases[iCase];
+        encoding = DetectEncoding((const BYTE *)pCase->pszSample, (DWORD)strlen(pCase->pszSample),
+                                  pCase->fLast, pCase->fUnicode, &cbBOM);
+        CHECK(encoding == pCase->encoding && cbBOM == pCase->cbBOM,
+              "case %d: encoding %d with a BOM of %u bytes, not %d and %u", iCase, encoding,
+              cbBOM, pCase->encoding, pCase->cbBOM);
+    }
+
+    // the sample may end anywhere in the text, and the file only after a
+    // character
+    for (cb = 1; cb < sizeof(s_abText); ++cb)
+    {
+        encoding = DetectEncoding(s_abText, cb, FALSE, FALSE, &cbBOM);
+        CHECK(encoding == (cb == 1 ? ENC_ASCII : ENC_UTF8), "%u bytes: encoding %d", cb,
+              encoding);
+        fCut = ((s_abText[cb] & 0xC0) == 0x80);
+        encoding = DetectEncoding(s_abText, cb, TRUE, FALSE, &cbBOM);
+        CHECK(encoding == (cb == 1 ? ENC_ASCII : (fCut ? ENC_ANSI : ENC_UTF8)),
+              "%u bytes of a whole file: encoding %d", cb, encoding);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// DecodeText with a character cut at the end of the block
+
+#define SPLIT_ROUNDS 2000
+#define SPLIT_PIECES_MAX 40
+#define SPLIT_TEXT_MAX (SPLIT_PIECES_MAX * 4)
+
+typedef struct DECODECASE
+{
+    LPCSTR pszText;
+    LPCWSTR pszExpected;
+} DECODECASE;
+
+// Decodes the whole text as one block, and checks that it is the same as the
+// text decoded as two blocks, for every end of the first block. The bytes
+// that the first block leaves are the head of the second, as in input.c.
+static VOID CheckSplit(FCENCODING encoding, BOOL fDBCS, const BYTE *pb, DWORD cb)
+{
+    WCHAR achWhole[SPLIT_TEXT_MAX], achSplit[SPLIT_TEXT_MAX];
+    DWORD cchWhole, cchSplit, cbUsed, cbUsed2, ib;
+
+    cchWhole = DecodeText(encoding, achWhole, pb, cb, &cbUsed, TRUE);
+    CHECK(cbUsed == cb, "encoding %d: %u of %u bytes decoded at the end", encoding, cbUsed, cb);
+
+    for (ib = 0; ib <= cb; ++ib)
+    {
+        cchSplit = DecodeText(encoding, achSplit, pb, ib, &cbUsed, FALSE);
+        CHECK(cbUsed <= ib && ib - cbUsed < 4, "encoding %d: %u of %u bytes decoded", encoding,
+              cbUsed, ib);
+        CHECK(cbUsed > 0 || ib < (fDBCS ? 2 : 4), "encoding %d: nothing of %u bytes decoded",
+              encoding, ib);
+        if (encoding == ENC_ANSI)
+        {
+            // only a lead byte is left
+            CHECK(cbUsed == ib || (cbUsed == ib - 1 && fDBCS && IsDBCSLeadByte(pb[cbUsed])),
+                  "encoding %d: %u of %u bytes decoded", encoding, cbUsed, ib);
+        }
+        cchSplit += DecodeText(encoding, &achSplit[cchSplit], &pb[cbUsed], cb - cbUsed,
+                               &cbUsed2, TRUE);
+        CHECK(cchSplit == cchWhole && memcmp(achSplit, achWhole, cchWhole * sizeof(WCHAR)) == 0,
+              "encoding %d: %u bytes decoded differently when the block ends at %u",
+              encoding, cb, ib);
+    }
+}
+
+// Joins random pieces of text
+static DWORD MakeSplitText(BYTE *pb, const LPCSTR *ppszPieces, DWORD cPieces)
+{
+    DWORD cb = 0, cch, n = Random() % (SPLIT_PIECES_MAX + 1);
+    LPCSTR pszPiece;
+    for (; n > 0; --n)
+    {
+        pszPiece = ppszPieces[Random() % cPieces];
+        cch = (DWORD)strlen(pszPiece);
+        memcpy(&pb[cb], pszPiece, cch);
+        cb += cch;
+    }
+    return cb;
+}
+
+static VOID TestSplit(BOOL fDBCS)
+{
+    // the broken sequences are replaced as a whole, or byte by byte when their
+    // lead byte is invalid
+    static const DECODECASE s_cases[] =
+    {
+        { "a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80", L"a\x00E9\x20AC\xD83D\xDE00" },
+        { "\xE2\x82x\xF0\x9F\x98", L"\xFFFDx\xFFFD" },
+        { "\x80\xC0\xAF", L"\xFFFD\xFFFD\xFFFD" },
+        { "\xED\xA0\x80", L"\xFFFD\xFFFD\xFFFD" },
+    };
+    static const LPCSTR s_apszUtf8[] =
+    {
+        "a", "\n", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xE2\x82", "\xF0\x9F\x98",
+        "\x80", "\xC0\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80"
+    };
+    // the same bytes, and double-byte characters
+    static const LPCSTR s_apszAnsi[] =
+    {
+        "a", "\n", "\xE9", "\x82\xA0", "\x82\x61", "\x81\x40", "\xB1", "\x82\x82"
+    };
+    WCHAR ach[SPLIT_TEXT_MAX];
+    BYTE ab[SPLIT_TEXT_MAX];
+    DWORD cch, cbUsed;
+    INT iCase, iRound;
+
+    if (!fDBCS)
+    {
+        for (iCase = 0; iCase < (INT)_countof(s_cases); ++iCase)
+        {
+            cch = DecodeText(ENC_UTF8, ach, (const BYTE *)s_cases[iCase].pszText,
+                             (DWORD)strlen(s_cases[iCase].pszText), &cbUsed, TRUE);
+            CHECK(cch == wcslen(s_cases[iCase].pszExpected) &&
+                  memcmp(ach, s_cases[iCase].pszExpected, cch * sizeof(WCHAR)) == 0,
+                  "case %d: decoded wrongly", iCase);
+        }
+        for (iRound = 0; iRound < SPLIT_ROUNDS; ++iRound)
+            CheckSplit(ENC_UTF8, FALSE, ab, MakeSplitText(ab, s_apszUtf8, _countof(s_apszUtf8)));
+    }
+    for (iRound = 0; iRound < SPLIT_ROUNDS; ++iRound)
+    {
+        CheckSplit(ENC_ANSI, IsDBCSCodePage(), ab,
+                   MakeSplitText(ab, s_apszAnsi, _countof(s_apszAnsi)));
+    }
+}
+
+// ----------------------------------------------------------------------------
+// The files, through input.c
+
+#define ENC_FILE_MAX (STREAM_BLOCK_SIZE + 16)
+
+typedef struct CARRYCASE
+{
+    FCENCODING encoding;
+    LPCSTR pszPiece;
+    LPCWSTR pszExpected; // the decoded piece, or NULL for the ANSI code page
+    DWORD cbBefore; // the bytes of the piece in the first block
+} CARRYCASE;
+
+static LPCWSTR s_pszFile = L"enctest.txt";
+static BYTE s_abFile[ENC_FILE_MAX];
+static WCHAR s_achExpected[ENC_FILE_MAX];
+static WCHAR s_achDecoded[ENC_FILE_MAX];
+
+static BOOL WriteEncFile(DWORD cb)
+{
+    FILE *fp = fopen("enctest.txt", "wb");
+    BOOL ret = (fp && fwrite(s_abFile, 1, cb, fp) == cb);
+    ret = (fp && fclose(fp) == 0) && ret;
+    CHECK(ret, "cannot write enctest.txt");
+    return ret;
+}
+
+// Opens the file and takes the sample of its encoding, as fc.c does
+static BOOL OpenEncFile(FCINPUT *pInput, BOOL fStream, FCENCODING *pEncoding, BOOL *pfLast)
+{
+    const BYTE *pb;
+    DWORD cb, cbBOM;
+
+    if (OpenInput(pInput, s_pszFile, fStream) != FCRET_IDENTICAL)
+    {
+        CHECK(FALSE, "cannot open enctest.txt");
+        return FALSE;
+    }
+    if (!SampleInput(pInput, &pb, &cb, pfLast))
+    {
+        CHECK(FALSE, "cannot sample enctest.txt");
+        CloseInput(pInput);
+        return FALSE;
+    }
+    *pEncoding = DetectEncoding(pb, cb, *pfLast, FALSE, &cbBOM);
+    return TRUE;
+}
+
+// A file that ends in the middle of a UTF-8 sequence is ANSI, whether it is
+// mapped or streamed, but a longer file isn't cut at the end of its sample
+static VOID TestSample(VOID)
+{
+    static const CHAR s_szCafe[] = "caf\xE9";
+    FCINPUT input;
+    FCENCODING encoding;
+    BOOL fLast, fStream;
+    DWORD cb;
+
+    for (fStream = FALSE; fStream <= TRUE; ++fStream)
+    {
+        cb = (DWORD)strlen(s_szCafe);
+        memcpy(s_abFile, s_szCafe, cb);
+        if (!WriteEncFile(cb) || !OpenEncFile(&input, fStream, &encoding, &fLast))
+            return;
+        CloseInput(&input);
+        CHECK(fLast && encoding == ENC_ANSI, "stream %d: whole file %d, encoding %d", fStream,
+              fLast, encoding);
+
+        // the sample ends with the lead byte of "\xE9x"
+        memset(s_abFile, 'x', ENCODING_SAMPLE_SIZE + 1);
+        s_abFile[ENCODING_SAMPLE_SIZE - 1] = 0xE9;
+        if (!WriteEncFile(ENCODING_SAMPLE_SIZE + 1) ||
+            !OpenEncFile(&input, fStream, &encoding, &fLast))
+        {
+            return;
+        }
+        CloseInput(&input);
+        CHECK(!fLast && encoding == ENC_UTF8, "stream %d: whole file %d, encoding %d", fStream,
+              fLast, encoding);
+    }
+}
+
+// Reads the file as streamed and decoded, view by view
+static DWORD ReadDecoded(FCENCODING encoding)
+{
+    FCINPUT input;
+    FCENCODING detected;
+    LPCVOID pv;
+    DWORD cb, cbTotal = 0;
+    BOOL fLast;
+
+    if (!OpenEncFile(&input, TRUE, &detected, &fLast))
+        return 0;
+    CHECK(!fLast, "the sample is the whole file");
+    if (SetInputEncoding(&input, encoding, 0, TRUE) != FCRET_IDENTICAL)
+        CHECK(FALSE, "cannot decode enctest.txt");
+    else
+    {
+        for (fLast = FALSE; !fLast; cbTotal += cb)
+        {
+            if (!GetInputView(&input, cbTotal, STREAM_WINDOW_SIZE, &pv, &cb, &fLast))
+            {
+                CHECK(FALSE, "cannot read enctest.txt");
+                break;
+            }
+            cb = min(cb, (DWORD)sizeof(s_achDecoded) - cbTotal);
+            CopyMemory((LPBYTE)s_achDecoded + cbTotal, pv, cb);
+        }
+    }
+    CloseInput(&input);
+    return cbTotal / sizeof(WCHAR);
+}
+
+// Decodes files whose first stream block ends in the middle of a character
+// (DecodeInputBlock carries the head of the character to the next block)
+static VOID TestCarry(BOOL fDBCS)
+{
+    static const CARRYCASE s_cases[] =
+    {
+        { ENC_UTF8, "\xC3\xA9", L"\x00E9", 0 },
+        { ENC_UTF8, "\xC3\xA9", L"\x00E9", 1 },
+        { ENC_UTF8, "\xE2\x82\xAC", L"\x20AC", 1 },
+        { ENC_UTF8, "\xE2\x82\xAC", L"\x20AC", 2 },
+        { ENC_UTF8, "\xF0\x9F\x98\x80", L"\xD83D\xDE00", 1 },
+        { ENC_UTF8, "\xF0\x9F\x98\x80", L"\xD83D\xDE00", 2 },
+        { ENC_UTF8, "\xF0\x9F\x98\x80", L"\xD83D\xDE00", 3 },
+        // a broken sequence across the end
+        { ENC_UTF8, "\xE2\x82x", L"\xFFFDx", 1 },
+        { ENC_UTF8, "\xE2\x82x", L"\xFFFDx", 2 },
+    };
+    static const CARRYCASE s_casesDBCS[] =
+    {
+        { ENC_ANSI, "\x82\xA0", NULL, 0 },
+        { ENC_ANSI, "\x82\xA0", NULL, 1 },
+        { ENC_ANSI, "\x82\x61", NULL, 1 },
+    };
+    static const CHAR s_szTail[] = "tail\n";
+    const CARRYCASE *pCases = (fDBCS ? s_casesDBCS : s_cases);
+    INT cCases = (INT)(fDBCS ? _countof(s_casesDBCS) : _countof(s_cases));
+    const CARRYCASE *pCase;
+    DWORD cbHead, cbPiece, cchExpected, cchPiece, cch;
+    INT iCase;
+
+    for (iCase = 0; iCase < cCases; ++iCase)
+    {
+        pCase = &pCases[iCase];
+        cbPiece = (DWORD)strlen(pCase->pszPiece);
+        cbHead = STREAM_BLOCK_SIZE - pCase->cbBefore;
+        memset(s_abFile, 'x', cbHead);
+        memcpy(&s_abFile[cbHead], pCase->pszPiece, cbPiece);
+        memcpy(&s_abFile[cbHead + cbPiece], s_szTail, strlen(s_szTail));
+        if (!WriteEncFile(cbHead + cbPiece + (DWORD)strlen(s_szTail)))
+            return;
+
+        for (cchExpected = 0; cchExpected < cbHead; ++cchExpected)
+            s_achExpected[cchExpected] = L'x';
+        if (pCase->pszExpected)
+        {
+            cchPiece = (DWORD)wcslen(pCase->pszExpected);
+            memcpy(&s_achExpected[cchExpected], pCase->pszExpected, cchPiece * sizeof(WCHAR));
+        }
+        else
+        {
+            cchPiece = (DWORD)MultiByteToWideChar(CP_ACP, 0, pCase->pszPiece, (INT)cbPiece,
+                                                  &s_achExpected[cchExpected], 16);
+        }
+        cchExpected += cchPiece;
+        for (cch = 0; s_szTail[cch]; ++cch)
+            s_achExpected[cchExpected++] = (WCHAR)s_szTail[cch];
+
+        cch = ReadDecoded(pCase->encoding);
+        CHECK(cch == cchExpected &&
+              memcmp(s_achDecoded, s_achExpected, cch * sizeof(WCHAR)) == 0,
+              "case %d: %u characters decoded differently, %u expected", iCase, cch,
+              cchExpected);
+    }
+}
+
+#define REWIND_ROUNDS 20
+#define REWIND_VIEW_MAX 4096
+
+// Decodes a mapped file with a BOM from a random offset on, going back to its
+// beginning (RewindInput) before each read but the first, as DiffIndexed
+// does. Half of the reads stop before the end, as when the index exceeds
+// /MAXMEM.
+static VOID TestRewind(VOID)
+{
+    static const CHAR s_szPiece[] = "caf\xC3\xA9\n";
+    static const WCHAR s_szPieceW[] = L"caf\x00E9\n";
+    FCINPUT input;
+    FCENCODING encoding;
+    LPCVOID pv;
+    DWORD cbFile = 3, cchExpected = 0, cbExpected, cb;
+    LONGLONG ib, ibFirst, ibStop;
+    BOOL fLast;
+    INT iRound;
+
+    memcpy(s_abFile, "\xEF\xBB\xBF", 3);
+    while (cbFile + strlen(s_szPiece) <= ENC_FILE_MAX)
+    {
+        memcpy(&s_abFile[cbFile], s_szPiece, strlen(s_szPiece));
+        cbFile += (DWORD)strlen(s_szPiece);
+        memcpy(&s_achExpected[cchExpected], s_szPieceW, wcslen(s_szPieceW) * sizeof(WCHAR));
+        cchExpected += (DWORD)wcslen(s_szPieceW);
+    }
+    cbExpected = cchExpected * sizeof(WCHAR);
+    if (!WriteEncFile(cbFile) || !OpenEncFile(&input, FALSE, &encoding, &fLast))
+        return;
+    CHECK(encoding == ENC_UTF8, "encoding %d", encoding);
+    if (SetInputEncoding(&input, ENC_UTF8, 3, TRUE) != FCRET_IDENTICAL)
+    {
+        CHECK(FALSE, "cannot decode enctest.txt");
+        CloseInput(&input);
+        return;
+    }
+
+    for (iRound = 0; iRound < REWIND_ROUNDS; ++iRound)
+    {
+        if (iRound > 0 && !RewindInput(&input))
+        {
+            CHECK(FALSE, "round %d: cannot rewind enctest.txt", iRound);
+            break;
+        }
+        ibFirst = (LONGLONG)(Random() % cchExpected) * sizeof(WCHAR);
+        ibStop = (iRound % 2 ? ibFirst + Random() % (cbExpected - ibFirst) : cbExpected);
+        for (ib = ibFirst, fLast = FALSE; !fLast && ib < ibStop; ib += cb)
+        {
+            if (!GetInputView(&input, ib, REWIND_VIEW_MAX, &pv, &cb, &fLast))
+            {
+                CHECK(FALSE, "round %d: cannot read enctest.txt at %u", iRound, (DWORD)ib);
+                break;
+            }
+            if (ib + cb > cbExpected || memcmp(pv, (const BYTE *)s_achExpected + ib, cb) != 0)
+            {
+                CHECK(FALSE, "round %d: the view at %u differs", iRound, (DWORD)ib);
+                break;
+            }
+        }
+        CHECK(ib >= ibStop && (ib == cbExpected) == !!fLast,
+              "round %d: read from %u to %u of %u", iRound, (DWORD)ibFirst, (DWORD)ib,
+              cbExpected);
+    }
+    CloseInput(&input);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "dbcs") == 0)
+    {
+#ifndef _WIN32
+        SetShimACP(CP_SHIM_DBCS);
+#endif
+        InitScan();
+        if (!IsDBCSCodePage())
+        {
+            printf("the code page isn't a double-byte one\n");
+            return 0;
+        }
+        TestSplit(TRUE);
+        TestCarry(TRUE);
+    }
+    else
+    {
+        InitScan();
+        TestDetect();
+        TestSplit(FALSE);
+        TestSample();
+        TestCarry(FALSE);
+        TestRewind();
+    }
+
+    remove("enctest.txt");
+
+    if (s_cFailures)
+    {
+        printf("%d checks failed\n", s_cFailures);
+        return 1;
+    }
+    return 0;
+}
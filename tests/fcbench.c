@@ -0,0 +1,157 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Times a command, such as FC on a pair of files
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+#include "bench.h"
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/wait.h>
+#endif
+
+// usage: fcbench program [arguments...]
+// Runs the command once to warm up the file cache, then BENCH_RUNS times with
+// its output discarded, and displays the fastest and the median time.
+
+#define BENCH_RUNS 5
+
+static int CompareTimes(const void *p0, const void *p1)
+{
+    double t0 = *(const double *)p0, t1 = *(const double *)p1;
+    return (t0 > t1) - (t0 < t1);
+}
+
+#ifdef _WIN32
+// Skips the program name of the command line
+static LPWSTR SkipProgramName(LPWSTR pszCmdLine)
+{
+    if (*pszCmdLine == L'"')
+    {
+        for (++pszCmdLine; *pszCmdLine && *pszCmdLine != L'"'; ++pszCmdLine)
+            ;
+        if (*pszCmdLine)
+            ++pszCmdLine;
+    }
+    else
+    {
+        for (; *pszCmdLine && *pszCmdLine != L' ' && *pszCmdLine != L'\t'; ++pszCmdLine)
+            ;
+    }
+    while (*pszCmdLine == L' ' || *pszCmdLine == L'\t')
+        ++pszCmdLine;
+    return pszCmdLine;
+}
+
+static BOOL RunCommand(LPWSTR pszCmdLine, HANDLE hNull, double *pt, LPDWORD pdwExitCode)
+{
+    STARTUPINFOW si;
+    PROCESS_INFORMATION pi;
+    double t0;
+
+    ZeroMemory(&si, sizeof(si));
+    si.cb = sizeof(si);
+    si.dwFlags = STARTF_USESTDHANDLES;
+    si.hStdInput = hNull;
+    si.hStdOutput = hNull;
+    si.hStdError = hNull;
+
+    t0 = GetSeconds();
+    if (!CreateProcessW(NULL, pszCmdLine, NULL, NULL, TRUE, 0, NULL, NULL, &si, &pi))
+        return FALSE;
+    WaitForSingleObject(pi.hProcess, INFINITE);
+    *pt = GetSeconds() - t0;
+    GetExitCodeProcess(pi.hProcess, pdwExitCode);
+    CloseHandle(pi.hThread);
+    CloseHandle(pi.hProcess);
+    return TRUE;
+}
+
+int main(void)
+{
+    SECURITY_ATTRIBUTES sa = { sizeof(sa), NULL, TRUE };
+    double at[BENCH_RUNS];
+    DWORD dwExitCode;
+    LPWSTR pszCmdLine;
+    HANDLE hNull;
+    INT i;
+
+    pszCmdLine = _wcsdup(SkipProgramName(GetCommandLineW()));
+    if (!pszCmdLine || !*pszCmdLine)
+    {
+        printf("usage: fcbench program [arguments...]\n");
+        return 2;
+    }
+
+    hNull = CreateFileW(L"NUL", GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                        &sa, OPEN_EXISTING, 0, NULL);
+    for (i = -1; i < BENCH_RUNS; ++i)
+    {
+        if (!RunCommand(pszCmdLine, hNull, &at[max(i, 0)], &dwExitCode))
+        {
+            printf("fcbench: cannot run %ls\n", pszCmdLine);
+            return 2;
+        }
+    }
+    CloseHandle(hNull);
+    free(pszCmdLine);
+
+    qsort(at, BENCH_RUNS, sizeof(at[0]), CompareTimes);
+    printf("best %.1f ms, median %.1f ms (exit code %lu)\n",
+           at[0] * 1000, at[BENCH_RUNS / 2] * 1000, dwExitCode);
+    return 0;
+}
+#else
+static BOOL RunCommand(char **argv, double *pt, LPDWORD pdwExitCode)
+{
+    double t0 = GetSeconds();
+    int fd, status;
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return FALSE;
+    if (pid == 0)
+    {
+        fd = open("/dev/null", O_RDWR);
+        dup2(fd, 0);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if (waitpid(pid, &status, 0) != pid)
+        return FALSE;
+    *pt = GetSeconds() - t0;
+    *pdwExitCode = WIFEXITED(status) ? (DWORD)WEXITSTATUS(status) : MAXDWORD;
+    return *pdwExitCode != 127;
+}
+
+int main(int argc, char **argv)
+{
+    double at[BENCH_RUNS];
+    DWORD dwExitCode;
+    INT i;
+
+    if (argc < 2)
+    {
+        printf("usage: fcbench program [arguments...]\n");
+        return 2;
+    }
+
+    for (i = -1; i < BENCH_RUNS; ++i)
+    {
+        if (!RunCommand(&argv[1], &at[max(i, 0)], &dwExitCode))
+        {
+            printf("fcbench: cannot run %s\n", argv[1]);
+            return 2;
+        }
+    }
+
+    qsort(at, BENCH_RUNS, sizeof(at[0]), CompareTimes);
+    printf("best %.1f ms, median %.1f ms (exit code %u)\n",
+           at[0] * 1000, at[BENCH_RUNS / 2] * 1000, dwExitCode);
+    return 0;
+}
+#endif
@@ -0,0 +1,26 @@
+# Runs FC on files of the golden directory, and checks that it writes exactly
+# the expected file to stdout, byte for byte, and returns the exit code.
+#
+# cmake -DFC=fc.exe -DDIR=tests/golden "-DARGS=/B hex0.bin hex1.bin"
+#       -DEXPECTED=hex.out -DCODE=1 -P golden.cmake
+#
+# ARGS is split as a Windows command line, so that "dir\*.txt" keeps its
+# backslash. FC runs in DIR, so that the file names in its output are as in
+# ARGS.
+
+separate_arguments(args WINDOWS_COMMAND "${ARGS}")
+set(actual "${CMAKE_CURRENT_BINARY_DIR}/${EXPECTED}.actual")
+execute_process(COMMAND "${FC}" ${args} WORKING_DIRECTORY "${DIR}"
+                RESULT_VARIABLE code OUTPUT_FILE "${actual}")
+if(NOT code STREQUAL CODE)
+    message(FATAL_ERROR "FC ${ARGS}: exit code ${code}, expected ${CODE}; "
+                        "its output is in ${actual}")
+endif()
+# in hex, because file(READ) drops the CRs of text
+file(READ "${actual}" output HEX)
+file(READ "${DIR}/${EXPECTED}" expected HEX)
+if(NOT output STREQUAL expected)
+    message(FATAL_ERROR "FC ${ARGS} doesn't write ${EXPECTED}; its output is in ${actual}")
+endif()
+file(REMOVE "${actual}")
+message(STATUS "FC ${ARGS}: exit code ${code}, ${EXPECTED}")
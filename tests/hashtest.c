@@ -0,0 +1,251 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Collision rate and speed of the line hash
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include <stdio.h>
+#include <windows.h>
+#include "hash.h"
+#include "bench.h"
+
+// usage: hashtest lines | hashtest file
+// Hashes the distinct lines of the file, or as many generated log lines, with
+// the shift-add hash that FC used before and with the hash of hash.h, and
+// displays how many hash values each gives. Fails if two different lines
+// have the same hash of hash.h.
+
+static INT s_cFailures = 0;
+
+typedef struct LINES
+{
+    char *pch;     // the lines, each ending with '\0'
+    SIZE_T cch;
+    SIZE_T cchMax;
+    SIZE_T *aich;  // the start of each line
+    SIZE_T cLines;
+    SIZE_T cMax;
+} LINES;
+
+// The hash of the lines before 64-bit hashing (without /C). Each character
+// shifts the ones before it by 2 bits, so only the last 16 count.
+static DWORD OldHash(const char *pch, SIZE_T cch)
+{
+    DWORD ret = 0xDEADFACE;
+    while (cch-- > 0)
+    {
+        ret += *pch;
+        ret <<= 2;
+        ++pch;
+    }
+    return (ret & 0x7FFFFFFF);
+}
+
+static ULONGLONG NewHash(const char *pch, SIZE_T cch)
+{
+    return HashFinal(HashBytes(HASH_PRIME3, (const BYTE *)pch, cch), cch);
+}
+
+static BOOL AddLine(LINES *pLines, const char *pch, SIZE_T cch)
+{
+    if (pLines->cch + cch + 1 > pLines->cchMax)
+    {
+        pLines->cchMax = max(2 * pLines->cchMax, pLines->cch + cch + 1);
+        pLines->pch = realloc(pLines->pch, pLines->cchMax);
+    }
+    if (pLines->cLines == pLines->cMax)
+    {
+        pLines->cMax = max(2 * pLines->cMax, 1024);
+        pLines->aich = realloc(pLines->aich, pLines->cMax * sizeof(SIZE_T));
+    }
+    if (!pLines->pch || !pLines->aich)
+        return FALSE;
+    pLines->aich[pLines->cLines++] = pLines->cch;
+    memcpy(&pLines->pch[pLines->cch], pch, cch);
+    pLines->cch += cch;
+    pLines->pch[pLines->cch++] = 0;
+    return TRUE;
+}
+
+// Lines of a server log: a time, a thread, a level and a message
+static BOOL MakeLog(LINES *pLines, DWORD cLines)
+{
+    static const char *apszMessages[] =
+    {
+        "INFO  request %u served in %u ms",
+        "INFO  session %u opened from 10.0.%u.17",
+        "WARN  retrying job %u (attempt %u)",
+        "DEBUG cache miss for key %u, loaded %u bytes",
+        "ERROR connection %u reset after %u bytes",
+    };
+    char sz[160];
+    DWORD i, cch;
+    for (i = 0; i < cLines; ++i)
+    {
+        cch = sprintf(sz, "2021-06-14 %02u:%02u:%02u.%03u [worker-%02u] ",
+                      i / 3600000 % 24, i / 60000 % 60, i / 1000 % 60, i % 1000,
+                      Random() % 16);
+        cch += sprintf(&sz[cch], apszMessages[Random() % _countof(apszMessages)],
+                       Random() % 100000, Random() % 1000);
+        if (!AddLine(pLines, sz, cch))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+static BOOL ReadLines(LINES *pLines, const char *file)
+{
+    char *psz = NULL;
+    SIZE_T cch, cchMax = 0;
+    int ch;
+    FILE *fp = fopen(file, "rb");
+    if (!fp)
+        return FALSE;
+    for (;;)
+    {
+        for (cch = 0; (ch = getc(fp)) != EOF && ch != '\n';)
+        {
+            if (cch == cchMax)
+            {
+                cchMax = max(2 * cchMax, 256);
+                psz = realloc(psz, cchMax);
+                if (!psz)
+                    return FALSE;
+            }
+            psz[cch++] = (char)ch;
+        }
+        if (cch > 0 && psz[cch - 1] == '\r')
+            --cch;
+        if (ch == EOF && cch == 0)
+            break;
+        if (!AddLine(pLines, psz, cch))
+            return FALSE;
+    }
+    free(psz);
+    fclose(fp);
+    return TRUE;
+}
+
+static const LINES *s_pLines;
+static ULONGLONG *s_aHash;
+
+// Sorts the lines by the hash, then by the text, so equal lines are together
+static int CompareLines(const void *p0, const void *p1)
+{
+    SIZE_T i0 = *(const SIZE_T *)p0, i1 = *(const SIZE_T *)p1;
+    if (s_aHash[i0] != s_aHash[i1])
+        return s_aHash[i0] < s_aHash[i1] ? -1 : 1;
+    return strcmp(&s_pLines->pch[s_pLines->aich[i0]], &s_pLines->pch[s_pLines->aich[i1]]);
+}
+
+static int CompareHashes(const void *p0, const void *p1)
+{
+    ULONGLONG h0 = *(const ULONGLONG *)p0, h1 = *(const ULONGLONG *)p1;
+    return (h0 > h1) - (h0 < h1);
+}
+
+static SIZE_T CountDistinct(ULONGLONG *aHash, SIZE_T c)
+{
+    SIZE_T i, cDistinct = 0;
+    qsort(aHash, c, sizeof(aHash[0]), CompareHashes);
+    for (i = 0; i < c; ++i)
+    {
+        if (i == 0 || aHash[i] != aHash[i - 1])
+            ++cDistinct;
+    }
+    return cDistinct;
+}
+
+// Hashes every line until BENCH_MIN_SECONDS have passed
+static double MeasureHash(const LINES *pLines, BOOL fNew)
+{
+    double t0 = GetSeconds(), t;
+    ULONGLONG cbTotal = 0, sum = 0;
+    const char *pch;
+    SIZE_T i, cch;
+    do
+    {
+        for (i = 0; i < pLines->cLines; ++i)
+        {
+            pch = &pLines->pch[pLines->aich[i]];
+            cch = (i + 1 < pLines->cLines ? pLines->aich[i + 1] : pLines->cch) - pLines->aich[i] - 1;
+            sum += fNew ? NewHash(pch, cch) : OldHash(pch, cch);
+            cbTotal += cch;
+        }
+        t = GetSeconds() - t0;
+    } while (t < BENCH_MIN_SECONDS);
+    if (sum == 1)
+        printf("\n"); // keeps the hashing from being optimized away
+    return cbTotal / t / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    LINES lines = { 0 };
+    SIZE_T *ai, i, cDistinct, cOld, cNew, cch;
+    ULONGLONG *aOld, *aNew;
+    const char *pch;
+
+    if (argc != 2)
+    {
+        printf("usage: hashtest lines | hashtest file\n");
+        return 2;
+    }
+    if (!(atoi(argv[1]) > 0 ? MakeLog(&lines, atoi(argv[1])) : ReadLines(&lines, argv[1])))
+    {
+        printf("hashtest: cannot read %s\n", argv[1]);
+        return 2;
+    }
+
+    ai = malloc(lines.cLines * sizeof(SIZE_T));
+    s_aHash = malloc(lines.cLines * sizeof(ULONGLONG));
+    aOld = malloc(lines.cLines * sizeof(ULONGLONG));
+    aNew = malloc(lines.cLines * sizeof(ULONGLONG));
+    if (!ai || !s_aHash || !aOld || !aNew)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    // the distinct lines
+    for (i = 0; i < lines.cLines; ++i)
+    {
+        pch = &lines.pch[lines.aich[i]];
+        ai[i] = i;
+        s_aHash[i] = NewHash(pch, strlen(pch));
+    }
+    s_pLines = &lines;
+    qsort(ai, lines.cLines, sizeof(ai[0]), CompareLines);
+    for (i = 0, cDistinct = 0; i < lines.cLines; ++i)
+    {
+        if (i > 0 && CompareLines(&ai[i - 1], &ai[i]) == 0)
+            continue;
+        pch = &lines.pch[lines.aich[ai[i]]];
+        cch = strlen(pch);
+        aOld[cDistinct] = OldHash(pch, cch);
+        aNew[cDistinct] = s_aHash[ai[i]];
+        ++cDistinct;
+    }
+
+    cOld = CountDistinct(aOld, cDistinct);
+    cNew = CountDistinct(aNew, cDistinct);
+    printf("%u lines, %u distinct\n", (UINT)lines.cLines, (UINT)cDistinct);
+    printf("%-24s %8u hash values, %7.1f MB/s\n", "shift-add, 31 bits", (UINT)cOld,
+           MeasureHash(&lines, FALSE));
+    printf("%-24s %8u hash values, %7.1f MB/s\n", "xxHash64-style, 63 bits", (UINT)cNew,
+           MeasureHash(&lines, TRUE));
+    CHECK(cNew == cDistinct, "%u distinct lines share a hash", (UINT)(cDistinct - cNew));
+
+    free(ai);
+    free(s_aHash);
+    free(aOld);
+    free(aNew);
+    free(lines.pch);
+    free(lines.aich);
+    if (s_cFailures)
+    {
+        printf("%d checks failed\n", s_cFailures);
+        return 1;
+    }
+    return 0;
+}
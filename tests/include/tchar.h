@@ -0,0 +1,18 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     The generic-text mappings that FC uses, for building FC on
+ *              other systems
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#pragma once
+#include <windows.h>
+
+#ifdef _UNICODE
+    #define _T(x) L##x
+    #define _tcslen wcslen
+#else
+    #define _T(x) x
+    #define _tcslen strlen
+#endif
+#define _TEXT(x) _T(x)
@@ -0,0 +1,325 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     The Win32 declarations that FC needs, for building FC and its
+ *              tests on other systems. winshim.c implements the functions.
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+// WCHAR is 16 bits, and L"" too with -fshort-wchar (as fc is built). The
+// wide functions of the C library take 32-bit characters, so the wide string
+// functions that FC uses are those of winshim.c.
+
+#define VOID void
+#define CONST const
+#define WINAPI
+#define __cdecl
+#define TRUE 1
+#define FALSE 0
+#define MAXDWORD 0xFFFFFFFF
+#define MAXLONG 0x7FFFFFFF
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_FAILED 0xFFFFFFFF
+#define MAXIMUM_WAIT_OBJECTS 64
+#define MAX_PATH 260
+
+typedef int BOOL;
+typedef int INT;
+typedef unsigned int UINT;
+typedef int32_t LONG;
+typedef uint32_t ULONG;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef size_t SIZE_T;
+typedef intptr_t LONG_PTR;
+typedef uintptr_t ULONG_PTR;
+typedef char CHAR;
+typedef uint16_t WCHAR;
+typedef WCHAR *PWCHAR;
+typedef void *LPVOID;
+typedef const void *LPCVOID;
+typedef BYTE *LPBYTE;
+typedef WORD *LPWORD;
+typedef DWORD *LPDWORD;
+typedef LONG *LPLONG;
+typedef CHAR *LPSTR;
+typedef const CHAR *LPCSTR;
+typedef WCHAR *LPWSTR;
+typedef const WCHAR *LPCWSTR;
+typedef void *HANDLE;
+typedef HANDLE HGLOBAL;
+typedef HANDLE HLOCAL;
+typedef HANDLE HINSTANCE;
+typedef DWORD LCID;
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+#ifdef UNICODE
+    typedef WCHAR TCHAR;
+    #define __TEXT(quote) L##quote
+#else
+    typedef CHAR TCHAR;
+    #define __TEXT(quote) quote
+#endif
+#define TEXT(quote) __TEXT(quote)
+typedef TCHAR *LPTSTR;
+typedef const TCHAR *LPCTSTR;
+
+typedef union _LARGE_INTEGER
+{
+    struct
+    {
+        DWORD LowPart;
+        LONG HighPart;
+    };
+    struct
+    {
+        DWORD LowPart;
+        LONG HighPart;
+    } u;
+    LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _FILETIME
+{
+    DWORD dwLowDateTime;
+    DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct _OVERLAPPED
+{
+    ULONG_PTR Internal;
+    ULONG_PTR InternalHigh;
+    DWORD Offset;
+    DWORD OffsetHigh;
+    HANDLE hEvent;
+} OVERLAPPED, *LPOVERLAPPED;
+
+typedef struct _BY_HANDLE_FILE_INFORMATION
+{
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastAccessTime;
+    FILETIME ftLastWriteTime;
+    DWORD dwVolumeSerialNumber;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+    DWORD nNumberOfLinks;
+    DWORD nFileIndexHigh;
+    DWORD nFileIndexLow;
+} BY_HANDLE_FILE_INFORMATION;
+
+typedef struct _WIN32_FIND_DATAW
+{
+    DWORD dwFileAttributes;
+    FILETIME ftCreationTime;
+    FILETIME ftLastAccessTime;
+    FILETIME ftLastWriteTime;
+    DWORD nFileSizeHigh;
+    DWORD nFileSizeLow;
+    WCHAR cFileName[MAX_PATH];
+} WIN32_FIND_DATAW;
+
+typedef struct _SYSTEM_INFO
+{
+    DWORD dwPageSize;
+    DWORD dwAllocationGranularity;
+    DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+typedef struct _CPINFO
+{
+    UINT MaxCharSize;
+    BYTE DefaultChar[2];
+    BYTE LeadByte[12];
+} CPINFO;
+
+#ifndef _countof
+    #define _countof(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#ifndef min
+    #define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef max
+    #define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define ZeroMemory(pv, cb) memset((pv), 0, (cb))
+#define FillMemory(pv, cb, b) memset((pv), (b), (cb))
+#define CopyMemory(pv, pvSrc, cb) memcpy((pv), (pvSrc), (cb))
+#define MoveMemory(pv, pvSrc, cb) memmove((pv), (pvSrc), (cb))
+
+static __inline LONG InterlockedIncrement(LONG volatile *pl)
+{
+    return __sync_add_and_fetch(pl, 1);
+}
+
+// errors
+#define NO_ERROR 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_ACCESS_DENIED 5
+#define ERROR_INVALID_HANDLE 6
+#define ERROR_NOT_ENOUGH_MEMORY 8
+#define ERROR_READ_FAULT 30
+#define ERROR_LOCK_VIOLATION 33
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_BROKEN_PIPE 109
+#define ERROR_FILE_INVALID 1006
+DWORD WINAPI GetLastError(VOID);
+VOID WINAPI SetLastError(DWORD dwError);
+
+// files
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+#define INVALID_FILE_SIZE 0xFFFFFFFF
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define FILE_SHARE_READ 1
+#define FILE_SHARE_WRITE 2
+#define FILE_SHARE_DELETE 4
+#define CREATE_NEW 1
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define OPEN_ALWAYS 4
+#define FILE_ATTRIBUTE_DIRECTORY 0x10
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define FILE_TYPE_UNKNOWN 0
+#define FILE_TYPE_DISK 1
+#define FILE_TYPE_CHAR 2
+#define FILE_TYPE_PIPE 3
+#define LOCKFILE_EXCLUSIVE_LOCK 2
+#define DRIVE_FIXED 3
+#define DRIVE_REMOTE 4
+#define STD_INPUT_HANDLE ((DWORD)-10)
+#define STD_OUTPUT_HANDLE ((DWORD)-11)
+#define STD_ERROR_HANDLE ((DWORD)-12)
+HANDLE WINAPI CreateFileW(LPCWSTR file, DWORD dwAccess, DWORD dwShare, LPVOID pSecurity,
+                          DWORD dwCreation, DWORD dwFlags, HANDLE hTemplate);
+BOOL WINAPI ReadFile(HANDLE hFile, LPVOID pv, DWORD cb, LPDWORD pcbRead, LPOVERLAPPED pov);
+BOOL WINAPI WriteFile(HANDLE hFile, LPCVOID pv, DWORD cb, LPDWORD pcbWritten, LPOVERLAPPED pov);
+DWORD WINAPI GetFileType(HANDLE hFile);
+DWORD WINAPI GetFileSize(HANDLE hFile, LPDWORD pdwHigh);
+BOOL WINAPI GetFileInformationByHandle(HANDLE hFile, BY_HANDLE_FILE_INFORMATION *pInfo);
+BOOL WINAPI LockFileEx(HANDLE hFile, DWORD dwFlags, DWORD dwReserved, DWORD cbLow, DWORD cbHigh,
+                       LPOVERLAPPED pov);
+BOOL WINAPI UnlockFileEx(HANDLE hFile, DWORD dwReserved, DWORD cbLow, DWORD cbHigh,
+                         LPOVERLAPPED pov);
+HANDLE WINAPI GetStdHandle(DWORD nStdHandle);
+BOOL WINAPI GetConsoleMode(HANDLE hConsole, LPDWORD pdwMode);
+DWORD WINAPI GetFullPathNameW(LPCWSTR file, DWORD cchMax, LPWSTR psz, LPWSTR *ppszFilePart);
+UINT WINAPI GetDriveTypeW(LPCWSTR pszRoot);
+HANDLE WINAPI FindFirstFileW(LPCWSTR pszPattern, WIN32_FIND_DATAW *pFind);
+BOOL WINAPI FindNextFileW(HANDLE hFind, WIN32_FIND_DATAW *pFind);
+BOOL WINAPI FindClose(HANDLE hFind);
+BOOL WINAPI CloseHandle(HANDLE h);
+
+// file mappings and memory
+#define PAGE_READONLY 0x02
+#define PAGE_READWRITE 0x04
+#define FILE_MAP_WRITE 0x02
+#define FILE_MAP_READ 0x04
+#define MEM_COMMIT 0x1000
+#define MEM_RESERVE 0x2000
+#define MEM_RELEASE 0x8000
+#define GMEM_FIXED 0
+HANDLE WINAPI CreateFileMappingW(HANDLE hFile, LPVOID pSecurity, DWORD dwProtect,
+                                 DWORD cbHigh, DWORD cbLow, LPCWSTR pszName);
+LPVOID WINAPI MapViewOfFile(HANDLE hMapping, DWORD dwAccess, DWORD ibHigh, DWORD ibLow, SIZE_T cb);
+BOOL WINAPI UnmapViewOfFile(LPCVOID pv);
+LPVOID WINAPI VirtualAlloc(LPVOID pv, SIZE_T cb, DWORD dwType, DWORD dwProtect);
+BOOL WINAPI VirtualFree(LPVOID pv, SIZE_T cb, DWORD dwType);
+HGLOBAL WINAPI GlobalAlloc(UINT uFlags, SIZE_T cb);
+LPVOID WINAPI GlobalLock(HGLOBAL hMem);
+HLOCAL WINAPI LocalFree(HLOCAL hMem);
+VOID WINAPI GetSystemInfo(SYSTEM_INFO *pInfo);
+VOID WINAPI GetSystemTimeAsFileTime(FILETIME *pft);
+
+// threads and their synchronization
+HANDLE WINAPI CreateThread(LPVOID pSecurity, SIZE_T cbStack, LPTHREAD_START_ROUTINE pfn,
+                           LPVOID pParam, DWORD dwFlags, LPDWORD pdwThreadId);
+HANDLE WINAPI CreateEventW(LPVOID pSecurity, BOOL fManualReset, BOOL fInitialState, LPCWSTR pszName);
+BOOL WINAPI SetEvent(HANDLE hEvent);
+BOOL WINAPI ResetEvent(HANDLE hEvent);
+HANDLE WINAPI CreateSemaphoreW(LPVOID pSecurity, LONG lInitial, LONG lMax, LPCWSTR pszName);
+BOOL WINAPI ReleaseSemaphore(HANDLE hSemaphore, LONG lRelease, LPLONG plPrevious);
+DWORD WINAPI WaitForSingleObject(HANDLE h, DWORD dwTimeout);
+DWORD WINAPI WaitForMultipleObjects(DWORD cHandles, const HANDLE *pHandles, BOOL fWaitAll,
+                                    DWORD dwTimeout);
+
+// the command line and the resources
+LPWSTR WINAPI GetCommandLineW(VOID);
+INT WINAPI LoadStringW(HINSTANCE hInstance, UINT nID, LPWSTR psz, INT cchMax);
+
+// code pages. CP_ACP is Windows-1252 unless SetShimACP selects another one.
+#define CP_ACP 0
+#define CP_OEMCP 1
+#define CP_SHIM_DBCS 932 // a double-byte code page like 932, for the tests
+#define CP_UTF8 65001
+#define MB_ERR_INVALID_CHARS 8
+BOOL WINAPI GetCPInfo(UINT uCodePage, CPINFO *pInfo);
+BOOL WINAPI IsDBCSLeadByte(BYTE b);
+INT WINAPI MultiByteToWideChar(UINT uCodePage, DWORD dwFlags, LPCSTR pch, INT cch,
+                               LPWSTR pchWide, INT cchWide);
+INT WINAPI WideCharToMultiByte(UINT uCodePage, DWORD dwFlags, LPCWSTR pch, INT cch,
+                               LPSTR pb, INT cbMax, LPCSTR pDefault, BOOL *pfUsedDefault);
+VOID SetShimACP(UINT uCodePage);
+
+// the collation of /LOCALE: code point order, with NORM_IGNORECASE folding
+// the case of the letters that towupper knows
+#define LOCALE_USER_DEFAULT 0x400
+#define NORM_IGNORECASE 0x00000001
+#define LCMAP_SORTKEY 0x00000400
+#define CSTR_LESS_THAN 1
+#define CSTR_EQUAL 2
+#define CSTR_GREATER_THAN 3
+INT WINAPI LCMapStringA(LCID lcid, DWORD dwFlags, LPCSTR pch, INT cch, LPSTR pbKey, INT cbKey);
+INT WINAPI LCMapStringW(LCID lcid, DWORD dwFlags, LPCWSTR pch, INT cch, LPWSTR pbKey, INT cbKey);
+INT WINAPI CompareStringA(LCID lcid, DWORD dwFlags, LPCSTR pch0, INT cch0, LPCSTR pch1, INT cch1);
+INT WINAPI CompareStringW(LCID lcid, DWORD dwFlags, LPCWSTR pch0, INT cch0,
+                          LPCWSTR pch1, INT cch1);
+#ifdef UNICODE
+    #define LCMapString LCMapStringW
+    #define CompareString CompareStringW
+#else
+    #define LCMapString LCMapStringA
+    #define CompareString CompareStringA
+#endif
+
+// wide strings, and the wide output of the C library
+#define wcslen ShimWcslen
+#define wcscpy ShimWcscpy
+#define wcschr ShimWcschr
+#define wcsrchr ShimWcsrchr
+#define wcstoul ShimWcstoul
+#define _wcsicmp ShimWcsicmp
+#define _wcsnicmp ShimWcsnicmp
+#define towupper ShimTowupper
+#define iswdigit(ch) ((ch) >= L'0' && (ch) <= L'9')
+#define _vsnwprintf ShimVsnwprintf
+#define fputws ShimFputws
+#define vfwprintf ShimVfwprintf
+SIZE_T ShimWcslen(LPCWSTR psz);
+LPWSTR ShimWcscpy(LPWSTR psz, LPCWSTR pszSrc);
+LPWSTR ShimWcschr(LPCWSTR psz, WCHAR ch);
+LPWSTR ShimWcsrchr(LPCWSTR psz, WCHAR ch);
+unsigned long ShimWcstoul(LPCWSTR psz, LPWSTR *ppszEnd, INT nBase);
+INT ShimWcsicmp(LPCWSTR psz0, LPCWSTR psz1);
+INT ShimWcsnicmp(LPCWSTR psz0, LPCWSTR psz1, SIZE_T cch);
+WCHAR ShimTowupper(WCHAR ch);
+INT ShimVsnwprintf(LPWSTR psz, SIZE_T cchMax, LPCWSTR pszFormat, va_list va);
+INT ShimFputws(LPCWSTR psz, FILE *fp);
+INT ShimVfwprintf(FILE *fp, LPCWSTR pszFormat, va_list va);
+INT WINAPI lstrlenW(LPCWSTR psz);
+LPWSTR WINAPI lstrcpyW(LPWSTR psz, LPCWSTR pszSrc);
+LPWSTR WINAPI lstrcpynW(LPWSTR psz, LPCWSTR pszSrc, INT cchMax);
+LPWSTR WINAPI lstrcatW(LPWSTR psz, LPCWSTR pszSrc);
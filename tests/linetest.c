@@ -0,0 +1,247 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Tests and speed of the line-break scanning kernels
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "scan.c"
+#include "bench.h"
+
+// usage: linetest [megabytes]
+
+#define MAX_TEST_LENGTH 160
+#define MAX_ALIGNMENT 64
+#define GUARD 0xCDCD // the WCHARs after a widened run must stay as they are
+
+static INT s_cFailures = 0;
+
+typedef struct LINEKERNEL
+{
+    const char *name;
+    FN_FINDLINEBREAKA pfnA;
+    FN_FINDLINEBREAKW pfnW;
+    FN_WIDENASCII pfnWiden;
+    SCANLEVEL level;
+} LINEKERNEL;
+
+static const LINEKERNEL s_kernels[] =
+{
+    { "scalar", FindLineBreakScalarA, FindLineBreakScalarW, WidenAsciiScalar, SCAN_SCALAR },
+#ifdef HAVE_SSE2
+    { "SSE2", FindLineBreakSSE2A, FindLineBreakSSE2W, WidenAsciiSSE2, SCAN_SSE2 },
+#endif
+#ifdef HAVE_AVX2
+    { "AVX2", FindLineBreakAVX2A, FindLineBreakAVX2W, WidenAsciiAVX2, SCAN_AVX2 },
+#endif
+};
+
+static SIZE_T FindLineBreakReferenceA(const BYTE *pb, SIZE_T cb)
+{
+    SIZE_T ib;
+    for (ib = 0; ib < cb && pb[ib] != '\n' && pb[ib] != 0; ++ib)
+        ;
+    return ib;
+}
+
+static SIZE_T FindLineBreakReferenceW(const WORD *pw, SIZE_T cw)
+{
+    SIZE_T iw;
+    for (iw = 0; iw < cw && pw[iw] != '\n' && pw[iw] != 0; ++iw)
+        ;
+    return iw;
+}
+
+// A character that is not a line break. Some are '\n' or '\0' in one byte
+// of a WCHAR, or have the high bit set.
+static WORD RandomChar(VOID)
+{
+    static const WORD s_aw[] = { 'a', ' ', '\r', '\t', 0x0A0A, 0x0A00, 0x000B, 0x0100, 0x80, 0xFF };
+    return s_aw[Random() % _countof(s_aw)];
+}
+
+// The low byte of a character from RandomChar, unless that is a line break
+static BYTE NarrowChar(WORD w)
+{
+    return (BYTE)w == '\n' || (BYTE)w == 0 ? 'x' : (BYTE)w;
+}
+
+// Every length, alignment and position of '\n', '\0' or a non-ASCII byte
+static VOID TestKernel(const LINEKERNEL *pKernel, LPBYTE pb, LPWORD pw, LPWORD pwOut)
+{
+    SIZE_T cch, ich, ichBreak, ia, iGot, iRef;
+    LPBYTE pbA;
+    LPWORD pwW, pwOutA;
+    WORD wSave, wBreak;
+
+    for (ia = 0; ia < MAX_ALIGNMENT; ++ia)
+    {
+        pbA = pb + ia;
+        pwW = pw + ia / 2;
+        pwOutA = pwOut + ia % 16;
+        for (cch = 0; cch <= MAX_TEST_LENGTH; ++cch)
+        {
+            for (ich = 0; ich < cch; ++ich)
+            {
+                pwW[ich] = RandomChar();
+                pbA[ich] = NarrowChar(pwW[ich]);
+            }
+            // a line break beyond the length must not be found
+            pbA[cch] = '\n';
+            pwW[cch] = '\n';
+
+            for (ichBreak = 0; ichBreak <= cch; ++ichBreak)
+            {
+                wBreak = (ichBreak & 1) ? '\n' : 0;
+                if (ichBreak < cch)
+                {
+                    wSave = pwW[ichBreak];
+                    pwW[ichBreak] = wBreak;
+                    pbA[ichBreak] = (BYTE)wBreak;
+                }
+
+                iRef = FindLineBreakReferenceA(pbA, cch);
+                iGot = pKernel->pfnA((const BYTE *)pbA, cch);
+                CHECK(iGot == iRef, "%s A: cch %u, alignment %u: %u, expected %u",
+                      pKernel->name, (UINT)cch, (UINT)ia, (UINT)iGot, (UINT)iRef);
+
+                iRef = FindLineBreakReferenceW(pwW, cch);
+                iGot = pKernel->pfnW(pwW, cch);
+                CHECK(iGot == iRef, "%s W: cch %u, alignment %u: %u, expected %u",
+                      pKernel->name, (UINT)cch, (UINT)ia / 2, (UINT)iGot, (UINT)iRef);
+
+                if (ichBreak < cch)
+                {
+                    // the non-ASCII byte stops the widening
+                    pbA[ichBreak] = 0x80 | (BYTE)ichBreak;
+                    for (ich = 0; ich <= cch; ++ich)
+                        pwOutA[ich] = GUARD;
+                    iRef = ichBreak;
+                    for (ich = 0; ich < ichBreak; ++ich)
+                    {
+                        if (pbA[ich] >= 0x80)
+                        {
+                            iRef = ich;
+                            break;
+                        }
+                    }
+                    iGot = pKernel->pfnWiden(pwOutA, pbA, cch);
+                    CHECK(iGot == iRef, "%s widen: cch %u, alignment %u: %u, expected %u",
+                          pKernel->name, (UINT)cch, (UINT)ia, (UINT)iGot, (UINT)iRef);
+                    for (ich = 0; ich <= cch; ++ich)
+                    {
+                        CHECK(pwOutA[ich] == (ich < iRef ? pbA[ich] : GUARD),
+                              "%s widen: cch %u, alignment %u: WCHAR %u", pKernel->name,
+                              (UINT)cch, (UINT)ia, (UINT)ich);
+                    }
+
+                    pwW[ichBreak] = wSave;
+                    pbA[ichBreak] = NarrowChar(wSave);
+                }
+            }
+        }
+    }
+}
+
+// Lines of 0 to 79 printable characters, ending with CR LF
+static SIZE_T MakeLines(LPBYTE pb, SIZE_T cb)
+{
+    SIZE_T ib = 0, cLines = 0, cch;
+    while (ib + 82 <= cb)
+    {
+        for (cch = Random() % 80; cch > 0; --cch)
+            pb[ib++] = (BYTE)(' ' + Random() % 95);
+        pb[ib++] = '\r';
+        pb[ib++] = '\n';
+        ++cLines;
+    }
+    while (ib < cb)
+        pb[ib++] = ' ';
+    return cLines;
+}
+
+// Splits the text into lines, as ParseLines does
+static double MeasureA(FN_FINDLINEBREAKA pfn, const BYTE *pb, SIZE_T cb, SIZE_T cLines)
+{
+    double t0 = GetSeconds(), t;
+    ULONGLONG cTotal = 0;
+    SIZE_T ib, c;
+    do
+    {
+        for (ib = 0, c = 0; (ib += pfn(&pb[ib], cb - ib)) < cb; ++ib)
+            ++c;
+        CHECK(c == cLines, "lines");
+        cTotal += c;
+        t = GetSeconds() - t0;
+    } while (t < BENCH_MIN_SECONDS);
+    return cTotal / t / 1e6;
+}
+
+static double MeasureW(FN_FINDLINEBREAKW pfn, const WORD *pw, SIZE_T cw, SIZE_T cLines)
+{
+    double t0 = GetSeconds(), t;
+    ULONGLONG cTotal = 0;
+    SIZE_T iw, c;
+    do
+    {
+        for (iw = 0, c = 0; (iw += pfn(&pw[iw], cw - iw)) < cw; ++iw)
+            ++c;
+        CHECK(c == cLines, "lines");
+        cTotal += c;
+        t = GetSeconds() - t0;
+    } while (t < BENCH_MIN_SECONDS);
+    return cTotal / t / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+    SIZE_T cb = (SIZE_T)(argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024, cLines, i;
+    SCANLEVEL level = GetScanLevel();
+    LPBYTE pb;
+    LPWORD pw, pwOut;
+
+    pb = malloc(max(cb, MAX_ALIGNMENT + MAX_TEST_LENGTH + 1));
+    pw = malloc(max(cb, MAX_ALIGNMENT + MAX_TEST_LENGTH + 1) * sizeof(WORD));
+    pwOut = malloc((16 + MAX_TEST_LENGTH + 1) * sizeof(WORD));
+    if (!pb || !pw || !pwOut)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < _countof(s_kernels); ++i)
+    {
+        if (s_kernels[i].level > level)
+        {
+            printf("%-8s not supported by this CPU\n", s_kernels[i].name);
+            continue;
+        }
+        TestKernel(&s_kernels[i], pb, pw, pwOut);
+    }
+
+    cLines = MakeLines(pb, cb);
+    for (i = 0; i < cb; ++i)
+        pw[i] = pb[i];
+    printf("%u MB of lines of 0 to 79 characters (%u lines):\n",
+           (UINT)(cb / (1024 * 1024)), (UINT)cLines);
+    printf("%-8s %7.1f M lines/s (ANSI) %7.1f M lines/s (UNICODE)\n", "bytewise",
+           MeasureA(FindLineBreakReferenceA, pb, cb, cLines),
+           MeasureW(FindLineBreakReferenceW, pw, cb, cLines));
+    for (i = 0; i < _countof(s_kernels); ++i)
+    {
+        if (s_kernels[i].level > level)
+            continue;
+        printf("%-8s %7.1f M lines/s (ANSI) %7.1f M lines/s (UNICODE)\n", s_kernels[i].name,
+               MeasureA(s_kernels[i].pfnA, pb, cb, cLines),
+               MeasureW(s_kernels[i].pfnW, pw, cb, cLines));
+    }
+
+    free(pb);
+    free(pw);
+    free(pwOut);
+    if (s_cFailures)
+    {
+        printf("%d checks failed\n", s_cFailures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,226 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Generates pairs of input files for the tests and benchmarks
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "fc.h"
+#include "bench.h"
+
+// usage:
+//   mkinput binary file0 file1 megabytes differences
+//     Random bytes; file1 has runs of 1 to 16 bytes changed, and a run of
+//     16 bytes across every 4 MB boundary (the chunks of /THREADS).
+//   mkinput text file0 file1 lines edits
+//     Lines of words; file1 has runs of 1 to 3 lines changed, inserted or
+//     deleted. Some lines occur many times, as in real text.
+//   mkinput config file0 file1 blocks edits
+//     Nested service blocks of a generated config file, full of blank lines
+//     and lone braces; file1 has edits blocks inserted, deleted or edited.
+// The files are the same on every run.
+
+#define CHUNK_SIZE (4 * 1024 * 1024)
+
+static const char *s_apszWords[] =
+{
+    "alpha", "bravo", "charlie", "delta", "echo", "foxtrot", "golf", "hotel",
+    "india", "juliett", "kilo", "lima", "mike", "november", "oscar", "papa",
+    "quebec", "romeo", "sierra", "tango", "uniform", "victor", "whiskey", "xray",
+    "yankee", "zulu", "{", "}", "=", ";", "//", "return",
+};
+
+static FILE *OpenOutput(const char *file)
+{
+    FILE *fp = fopen(file, "wb");
+    if (!fp)
+        printf("mkinput: cannot write %s\n", file);
+    return fp;
+}
+
+static int MakeBinary(const char *file0, const char *file1, DWORD cMegabytes, DWORD cDiffs)
+{
+    SIZE_T cb = (SIZE_T)cMegabytes * 1024 * 1024, ib, cbRun;
+    LPBYTE pb = malloc(cb);
+    FILE *fp0, *fp1;
+    DWORD i;
+
+    if (!pb)
+        return 1;
+    for (ib = 0; ib < cb; ++ib)
+        pb[ib] = (BYTE)Random();
+    fp0 = OpenOutput(file0);
+    if (!fp0)
+        return 1;
+    fwrite(pb, 1, cb, fp0);
+    fclose(fp0);
+
+    for (i = 0; i < cDiffs && cb > 0; ++i)
+    {
+        ib = (((SIZE_T)Random() << 16) ^ Random()) % cb;
+        for (cbRun = 1 + Random() % 16; cbRun > 0 && ib < cb; --cbRun, ++ib)
+            pb[ib] ^= (BYTE)(1 + Random() % 255);
+    }
+    for (ib = CHUNK_SIZE - 8; ib + 8 < cb; ib += CHUNK_SIZE)
+    {
+        for (cbRun = 0; cbRun < 16; ++cbRun)
+            pb[ib + cbRun] ^= 0x5A;
+    }
+    fp1 = OpenOutput(file1);
+    if (!fp1)
+        return 1;
+    fwrite(pb, 1, cb, fp1);
+    fclose(fp1);
+    free(pb);
+    return 0;
+}
+
+// A line of 1 to 8 words. One line in 8 is taken from a few common lines.
+static VOID WriteLine(FILE *fp, DWORD iLine)
+{
+    DWORD cWords, i;
+    if (Random() % 8 == 0)
+    {
+        static const char *apszCommon[] = { "", "{", "}", "    return 0;", "end" };
+        fprintf(fp, "%s\r\n", apszCommon[Random() % _countof(apszCommon)]);
+        return;
+    }
+    fprintf(fp, "%u", iLine);
+    for (cWords = 1 + Random() % 8, i = 0; i < cWords; ++i)
+        fprintf(fp, " %s", s_apszWords[Random() % _countof(s_apszWords)]);
+    fprintf(fp, "\r\n");
+}
+
+static int MakeText(const char *file0, const char *file1, DWORD cLines, DWORD cEdits)
+{
+    FILE *fp0 = OpenOutput(file0), *fp1 = OpenOutput(file1);
+    DWORD iLine, cRun, dwSeed;
+
+    if (!fp0 || !fp1)
+        return 1;
+    for (iLine = 0; iLine < cLines; ++iLine)
+    {
+        if (cEdits && Random() % cLines < cEdits)
+        {
+            cRun = 1 + Random() % 3;
+            switch (Random() % 3)
+            {
+                case 0: // changed
+                    for (; cRun > 0 && iLine < cLines; --cRun, ++iLine)
+                    {
+                        WriteLine(fp0, iLine);
+                        WriteLine(fp1, iLine);
+                    }
+                    break;
+                case 1: // inserted into file1
+                    for (; cRun > 0; --cRun)
+                        WriteLine(fp1, cLines + iLine);
+                    break;
+                default: // deleted from file1
+                    for (; cRun > 0 && iLine < cLines; --cRun, ++iLine)
+                        WriteLine(fp0, iLine);
+                    break;
+            }
+            if (iLine >= cLines)
+                break;
+        }
+
+        // the same line in both files
+        dwSeed = s_dwRandom;
+        WriteLine(fp0, iLine);
+        s_dwRandom = dwSeed;
+        WriteLine(fp1, iLine);
+    }
+    fclose(fp0);
+    fclose(fp1);
+    return 0;
+}
+
+// A service block. The values are drawn the same whether or not the block is
+// edited; dwEdit picks what is changed in file1.
+static VOID WriteBlock(FILE *fp, DWORD iBlock, DWORD dwEdit)
+{
+    DWORD dwPort = 1024 + Random() % 60000, cCpu = 1 + Random() % 16;
+    DWORD cMemory = 64 << (Random() % 8), cRoutes = 1 + Random() % 3, i;
+    DWORD adwRoutes[3];
+
+    for (i = 0; i < cRoutes; ++i)
+        adwRoutes[i] = Random() % 1000;
+    switch (dwEdit)
+    {
+        case 1: dwPort += 1; break;
+        case 2: cCpu *= 2; break;
+        case 3: cMemory *= 2; break;
+        case 4: adwRoutes[0] += 1000; break;
+        case 5: cRoutes = (cRoutes < 3 ? cRoutes + 1 : 1); adwRoutes[2] = 999; break;
+    }
+
+    fprintf(fp, "service svc%u {\r\n", iBlock);
+    fprintf(fp, "    port = %u;\r\n", dwPort);
+    fprintf(fp, "    host = \"svc%u.example.com\";\r\n", iBlock);
+    fprintf(fp, "\r\n");
+    fprintf(fp, "    limits {\r\n");
+    fprintf(fp, "        cpu = %u;\r\n", cCpu);
+    fprintf(fp, "        memory = %u;\r\n", cMemory);
+    fprintf(fp, "    }\r\n");
+    fprintf(fp, "\r\n");
+    fprintf(fp, "    routes {\r\n");
+    for (i = 0; i < cRoutes; ++i)
+    {
+        fprintf(fp, "        route {\r\n");
+        fprintf(fp, "            path = \"/api/%u\";\r\n", adwRoutes[i]);
+        fprintf(fp, "            enabled = true;\r\n");
+        fprintf(fp, "        }\r\n");
+    }
+    fprintf(fp, "    }\r\n");
+    fprintf(fp, "}\r\n");
+    fprintf(fp, "\r\n");
+}
+
+static int MakeConfig(const char *file0, const char *file1, DWORD cBlocks, DWORD cEdits)
+{
+    FILE *fp0 = OpenOutput(file0), *fp1 = OpenOutput(file1);
+    DWORD iBlock, dwEdit, dwSeed;
+
+    if (!fp0 || !fp1)
+        return 1;
+    for (iBlock = 0; iBlock < cBlocks; ++iBlock)
+    {
+        dwEdit = 0;
+        if (cEdits && Random() % cBlocks < cEdits)
+        {
+            switch (Random() % 3)
+            {
+                case 0: // inserted into file1
+                    WriteBlock(fp1, cBlocks + iBlock, 0);
+                    break;
+                case 1: // deleted from file1
+                    WriteBlock(fp0, iBlock, 0);
+                    continue;
+                default: // edited
+                    dwEdit = 1 + Random() % 5;
+                    break;
+            }
+        }
+
+        // the same block in both files, but for the edit
+        dwSeed = s_dwRandom;
+        WriteBlock(fp0, iBlock, 0);
+        s_dwRandom = dwSeed;
+        WriteBlock(fp1, iBlock, dwEdit);
+    }
+    fclose(fp0);
+    fclose(fp1);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 6 && strcmp(argv[1], "binary") == 0)
+        return MakeBinary(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]));
+    if (argc == 6 && strcmp(argv[1], "text") == 0)
+        return MakeText(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]));
+    if (argc == 6 && strcmp(argv[1], "config") == 0)
+        return MakeConfig(argv[2], argv[3], atoi(argv[4]), atoi(argv[5]));
+    printf("usage: mkinput binary|text|config file0 file1 size differences\n");
+    return 2;
+}
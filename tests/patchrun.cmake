@@ -0,0 +1,55 @@
+# Applies the unified diff of FC to file 0 of each pair with patch, and checks
+# that the result is file 1, byte for byte.
+#
+# cmake -DFC=fc.exe -DPATCH=patch.exe -DDIR=tests/golden/patch "-DCASES=edit crlf"
+#       "-DRUNS=/UNIFIED|/UNIFIED:0" -P patchrun.cmake
+#
+# The files of a case are ${DIR}/${case}0.txt and ${DIR}/${case}1.txt. With
+# -DMKINPUT=mkinput.exe "-DINPUT=text big0.txt big1.txt 20000 200", mkinput
+# makes the files of a case first, in the current directory if DIR is not
+# given. The sets of switches in RUNS are separated by '|'.
+
+if(DEFINED INPUT)
+    separate_arguments(input UNIX_COMMAND "${INPUT}")
+    execute_process(COMMAND "${MKINPUT}" ${input} RESULT_VARIABLE code)
+    if(NOT code EQUAL 0)
+        message(FATAL_ERROR "mkinput ${INPUT} failed")
+    endif()
+endif()
+if(NOT DEFINED DIR)
+    set(DIR "${CMAKE_CURRENT_BINARY_DIR}")
+endif()
+
+separate_arguments(cases UNIX_COMMAND "${CASES}")
+string(REPLACE "|" ";" runs "${RUNS}")
+foreach(case IN LISTS cases)
+    # in hex, because file(READ) drops the CRs of text
+    file(READ "${DIR}/${case}1.txt" expected HEX)
+    foreach(run IN LISTS runs)
+        separate_arguments(switches UNIX_COMMAND "${run}")
+        set(diff "${CMAKE_CURRENT_BINARY_DIR}/${case}.diff")
+        set(patched "${CMAKE_CURRENT_BINARY_DIR}/${case}.patched")
+        execute_process(COMMAND "${FC}" ${switches} ${case}0.txt ${case}1.txt
+                        WORKING_DIRECTORY "${DIR}" RESULT_VARIABLE fc_code OUTPUT_FILE "${diff}")
+        if(fc_code EQUAL 0)
+            # no hunks; the files must be the same
+            file(READ "${DIR}/${case}0.txt" result HEX)
+        elseif(fc_code EQUAL 1)
+            file(REMOVE "${patched}")
+            execute_process(COMMAND "${PATCH}" --binary -s -o "${patched}" -i "${diff}"
+                                    "${DIR}/${case}0.txt"
+                            RESULT_VARIABLE code OUTPUT_VARIABLE output ERROR_VARIABLE output)
+            if(NOT code EQUAL 0)
+                message(FATAL_ERROR "patch of FC ${run} ${case} failed:\n${output}")
+            endif()
+            file(READ "${patched}" result HEX)
+        else()
+            message(FATAL_ERROR "FC ${run} ${case}: exit code ${fc_code}")
+        endif()
+        if(NOT result STREQUAL expected)
+            message(FATAL_ERROR "FC ${run} ${case}: the patched file 0 is not file 1; "
+                                "see ${diff}")
+        endif()
+        message(STATUS "FC ${run} ${case}: exit code ${fc_code}, patched")
+    endforeach()
+endforeach()
@@ -0,0 +1,100 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Makes the STRINGTABLE of fc.rc into C, for LoadStringW of
+ *              winshim.c
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+// usage: rcstrings fc.rc fcstrings.c
+// The strings of fc.rc are C string literals (with '\' at the end of the
+// continued lines), so they are copied as they are.
+
+int main(int argc, char **argv)
+{
+    FILE *fpIn, *fpOut;
+    char szLine[1024], *pch;
+    int fInTable = 0, fInString = 0;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: rcstrings fc.rc fcstrings.c\n");
+        return 2;
+    }
+    fpIn = fopen(argv[1], "r");
+    fpOut = fopen(argv[2], "w");
+    if (!fpIn || !fpOut)
+    {
+        fprintf(stderr, "rcstrings: cannot open %s\n", fpIn ? argv[2] : argv[1]);
+        return 2;
+    }
+
+    fprintf(fpOut, "// Made from %s by rcstrings\n", argv[1]);
+    fprintf(fpOut, "#include <windows.h>\n#include \"resource.h\"\n\n");
+    fprintf(fpOut, "const struct SHIMSTRING\n{\n    UINT nID;\n    LPCWSTR psz;\n}");
+    fprintf(fpOut, " g_aShimStrings[] =\n{\n");
+    while (fgets(szLine, sizeof(szLine), fpIn))
+    {
+        for (pch = szLine; isspace((unsigned char)*pch); ++pch)
+            ;
+        if (!fInTable)
+        {
+            fInTable = (strncmp(pch, "STRINGTABLE", 11) == 0);
+            continue;
+        }
+        if (!fInString)
+        {
+            if (strncmp(pch, "BEGIN", 5) == 0)
+                continue;
+            if (strncmp(pch, "END", 3) == 0)
+            {
+                fInTable = 0;
+                continue;
+            }
+            if (!*pch)
+                continue;
+
+            // ID "...
+            fprintf(fpOut, "    { ");
+            for (; *pch && !isspace((unsigned char)*pch); ++pch)
+                fputc(*pch, fpOut);
+            for (; isspace((unsigned char)*pch); ++pch)
+                ;
+            if (*pch != '"')
+            {
+                fprintf(stderr, "rcstrings: a string must follow the ID: %s", szLine);
+                return 1;
+            }
+            fprintf(fpOut, ", L\"");
+            ++pch;
+            fInString = 1;
+        }
+        else
+        {
+            pch = szLine;
+        }
+
+        // up to the quote that ends the string
+        for (; *pch && *pch != '\n'; ++pch)
+        {
+            if (*pch == '"')
+            {
+                fprintf(fpOut, "\" },");
+                fInString = 0;
+                break;
+            }
+            fputc(*pch, fpOut);
+            if (*pch == '\\' && pch[1] && pch[1] != '\n')
+                fputc(*++pch, fpOut);
+        }
+        fputc('\n', fpOut);
+    }
+    fprintf(fpOut, "    { 0, NULL }\n};\n");
+
+    fclose(fpIn);
+    fclose(fpOut);
+    return 0;
+}
@@ -0,0 +1,36 @@
+# Runs FC on a generated pair of files with each set of switches, and checks
+# that every run of a group displays the same and returns the same exit code.
+#
+# cmake -DFC=fc.exe -DMKINPUT=mkinput.exe "-DINPUT=binary a b 64 100"
+#       "-DRUNS=/B|/B /STREAM||/B /Q|/B /Q /STREAM" -P samerun.cmake
+#
+# INPUT is passed to mkinput; its 2nd and 3rd words are the files compared.
+# The sets of switches in RUNS are separated by '|', and the groups by '||'.
+
+separate_arguments(input UNIX_COMMAND "${INPUT}")
+list(GET input 1 file0)
+list(GET input 2 file1)
+execute_process(COMMAND "${MKINPUT}" ${input} RESULT_VARIABLE code)
+if(NOT code EQUAL 0)
+    message(FATAL_ERROR "mkinput ${INPUT} failed")
+endif()
+
+string(REPLACE "||" ";" groups "${RUNS}")
+foreach(group IN LISTS groups)
+    unset(first_run)
+    string(REPLACE "|" ";" runs "${group}")
+    foreach(run IN LISTS runs)
+        separate_arguments(switches UNIX_COMMAND "${run}")
+        execute_process(COMMAND "${FC}" ${switches} "${file0}" "${file1}"
+                        RESULT_VARIABLE code OUTPUT_VARIABLE output)
+        if(NOT DEFINED first_run)
+            set(first_run "${run}")
+            set(first_code "${code}")
+            set(first_output "${output}")
+            message(STATUS "FC ${run}: exit code ${code}")
+        elseif(NOT code STREQUAL first_code OR NOT output STREQUAL first_output)
+            message(FATAL_ERROR "FC ${run} differs from FC ${first_run}:\n"
+                                "exit code ${code}, expected ${first_code}\n${output}")
+        endif()
+    endforeach()
+endforeach()
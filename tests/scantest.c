@@ -0,0 +1,147 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Tests and throughput of the mismatch-scanning kernels
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#include "scan.c"
+#include "bench.h"
+
+// usage: scantest [megabytes]
+
+#define MAX_TEST_LENGTH 256
+#define MAX_ALIGNMENT 64
+
+static INT s_cFailures = 0;
+
+typedef struct MISMATCHKERNEL
+{
+    const char *name;
+    FN_FINDMISMATCH pfn;
+    FN_FINDMISMATCH pfnBack;
+    SCANLEVEL level;
+} MISMATCHKERNEL;
+
+static const MISMATCHKERNEL s_kernels[] =
+{
+    { "scalar", FindMismatchScalar, FindMismatchBackScalar, SCAN_SCALAR },
+#ifdef HAVE_SSE2
+    { "SSE2", FindMismatchSSE2, FindMismatchBackSSE2, SCAN_SSE2 },
+#endif
+#ifdef HAVE_AVX2
+    { "AVX2", FindMismatchAVX2, FindMismatchBackAVX2, SCAN_AVX2 },
+#endif
+};
+
+static SIZE_T FindMismatchReference(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib;
+    for (ib = 0; ib < cb && pb0[ib] == pb1[ib]; ++ib)
+        ;
+    return ib;
+}
+
+static SIZE_T FindMismatchBackReference(const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    SIZE_T ib;
+    for (ib = 0; ib < cb && pb0[cb - ib - 1] == pb1[cb - ib - 1]; ++ib)
+        ;
+    return ib;
+}
+
+// Every length, alignment and position of the difference
+static VOID TestKernel(const MISMATCHKERNEL *pKernel, LPBYTE pb0, LPBYTE pb1)
+{
+    SIZE_T cb, ib, ibDiff, ibRef, ibGot, ia0, ia1;
+    for (ia0 = 0; ia0 < MAX_ALIGNMENT; ++ia0)
+    {
+        ia1 = (ia0 * 7 + 3) % MAX_ALIGNMENT;
+        for (cb = 0; cb <= MAX_TEST_LENGTH; ++cb)
+        {
+            for (ib = 0; ib < cb; ++ib)
+                pb0[ia0 + ib] = pb1[ia1 + ib] = (BYTE)Random();
+            // bytes beyond the length differ and must not be looked at
+            pb0[ia0 + cb] = 0;
+            pb1[ia1 + cb] = 1;
+
+            for (ibDiff = 0; ibDiff <= cb; ++ibDiff)
+            {
+                if (ibDiff < cb)
+                    pb1[ia1 + ibDiff] ^= (BYTE)(1 << (ibDiff & 7));
+
+                ibRef = FindMismatchReference(&pb0[ia0], &pb1[ia1], cb);
+                ibGot = pKernel->pfn(&pb0[ia0], &pb1[ia1], cb);
+                CHECK(ibGot == ibRef, "%s: cb %u, alignments %u/%u: %u, expected %u",
+                      pKernel->name, (UINT)cb, (UINT)ia0, (UINT)ia1, (UINT)ibGot, (UINT)ibRef);
+
+                ibRef = FindMismatchBackReference(&pb0[ia0], &pb1[ia1], cb);
+                ibGot = pKernel->pfnBack(&pb0[ia0], &pb1[ia1], cb);
+                CHECK(ibGot == ibRef, "%s back: cb %u, alignments %u/%u: %u, expected %u",
+                      pKernel->name, (UINT)cb, (UINT)ia0, (UINT)ia1, (UINT)ibGot, (UINT)ibRef);
+
+                if (ibDiff < cb)
+                    pb1[ia1 + ibDiff] ^= (BYTE)(1 << (ibDiff & 7));
+            }
+        }
+    }
+}
+
+// Scans two equal buffers, as BinaryFileCompare does with identical files
+static double MeasureKernel(FN_FINDMISMATCH pfn, const BYTE *pb0, const BYTE *pb1, SIZE_T cb)
+{
+    double t0 = GetSeconds(), t;
+    ULONGLONG cbTotal = 0;
+    do
+    {
+        CHECK(pfn(pb0, pb1, cb) == cb, "equal buffers");
+        cbTotal += cb;
+        t = GetSeconds() - t0;
+    } while (t < BENCH_MIN_SECONDS);
+    return cbTotal / t / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    SIZE_T cb = (SIZE_T)(argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+    SCANLEVEL level = GetScanLevel();
+    LPBYTE pb0, pb1;
+    SIZE_T i;
+
+    pb0 = malloc(max(cb, 2 * MAX_ALIGNMENT + MAX_TEST_LENGTH));
+    pb1 = malloc(max(cb, 2 * MAX_ALIGNMENT + MAX_TEST_LENGTH));
+    if (!pb0 || !pb1)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < _countof(s_kernels); ++i)
+    {
+        if (s_kernels[i].level > level)
+        {
+            printf("%-8s not supported by this CPU\n", s_kernels[i].name);
+            continue;
+        }
+        TestKernel(&s_kernels[i], pb0, pb1);
+    }
+
+    for (i = 0; i < cb; ++i)
+        pb0[i] = (BYTE)Random();
+    memcpy(pb1, pb0, cb);
+    printf("FindMismatch on %u MB of equal data:\n", (UINT)(cb / (1024 * 1024)));
+    printf("%-8s %6.2f GB/s\n", "bytewise", MeasureKernel(FindMismatchReference, pb0, pb1, cb));
+    for (i = 0; i < _countof(s_kernels); ++i)
+    {
+        if (s_kernels[i].level <= level)
+            printf("%-8s %6.2f GB/s\n", s_kernels[i].name, MeasureKernel(s_kernels[i].pfn, pb0, pb1, cb));
+    }
+
+    free(pb0);
+    free(pb1);
+    if (s_cFailures)
+    {
+        printf("%d checks failed\n", s_cFailures);
+        return 1;
+    }
+    return 0;
+}
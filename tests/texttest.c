@@ -0,0 +1,1591 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     Tests of the line comparison of text.h
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#undef UNICODE
+#undef _UNICODE
+#ifndef _MBCS
+    #define _MBCS
+#endif
+#include "text.h"
+#include "bench.h"
+
+// usage: texttest [dbcs]
+// Tests the ANSI build of text.h (texta.c) from the inside: the symbol table
+// of the lines, Resync against the nested scan that it replaced, the output
+// of TextCompare when it skips the identical head and tail of the files, the
+// indexed diff against DiffAll, the ordinal comparison of the lines and
+// /LOCALE, and the marks of /INLINE. With
+// dbcs, the comparison and the marks are tested in a double-byte code page
+// (the one of the shim; on Windows, the tests run only if the code page is
+// one). The files of the tests are written to the current directory. The
+// functions of fc.c that text.h calls are replaced below;
+// the output goes into a buffer.
+
+static INT s_cFailures = 0;
+
+// ----------------------------------------------------------------------------
+// The output functions of fc.c
+
+#define OUTPUT_MAX (64 * 1024)
+
+static CHAR s_szOutput[OUTPUT_MAX];
+static SIZE_T s_cchOutput = 0;
+
+static VOID AppendOutput(LPCSTR pch, SIZE_T cch)
+{
+    cch = min(cch, OUTPUT_MAX - 1 - s_cchOutput);
+    memcpy(&s_szOutput[s_cchOutput], pch, cch);
+    s_cchOutput += cch;
+    s_szOutput[s_cchOutput] = 0;
+}
+
+static VOID AppendString(LPCSTR psz)
+{
+    AppendOutput(psz, strlen(psz));
+}
+
+static VOID AppendFileName(LPCWSTR file)
+{
+    CHAR ch;
+    for (; *file; ++file)
+    {
+        ch = (CHAR)*file;
+        AppendOutput(&ch, 1);
+    }
+}
+
+VOID PrintLineW(const FILECOMPARE *pFC, DWORD lineno, LPCWSTR pch, DWORD cch)
+{
+    CHECK(FALSE, "PrintLineW is called by the ANSI comparison");
+}
+
+VOID PrintLineA(const FILECOMPARE *pFC, DWORD lineno, LPCSTR pch, DWORD cch)
+{
+    CHAR sz[16];
+    if (pFC->dwFlags & FLAG_N)
+    {
+        sprintf(sz, "%5u:  ", lineno);
+        AppendString(sz);
+    }
+    AppendOutput(pch, cch);
+    AppendString("\n");
+}
+
+VOID PrintCaption(LPCWSTR file)
+{
+    AppendString("***** ");
+    AppendFileName(file);
+    AppendString("\n");
+}
+
+VOID PrintEndOfDiff(VOID)
+{
+    AppendString("*****\n\n");
+}
+
+VOID PrintDots(VOID)
+{
+    AppendString("...\n");
+}
+
+VOID PrintUnifiedHeader(LPCWSTR file0, LPCWSTR file1)
+{
+    AppendString("--- ");
+    AppendFileName(file0);
+    AppendString("\n+++ ");
+    AppendFileName(file1);
+    AppendString("\n");
+}
+
+VOID PrintHunkHeader(const DWORD lineno[2], const DWORD cLines[2])
+{
+    CHAR sz[64];
+    sprintf(sz, "@@ -%u,%u +%u,%u @@\n", lineno[0], cLines[0], lineno[1], cLines[1]);
+    AppendString(sz);
+}
+
+VOID PrintTextW(LPCWSTR pch, SIZE_T cch)
+{
+    CHECK(FALSE, "PrintTextW is called by the ANSI comparison");
+}
+
+VOID PrintTextA(LPCSTR pch, SIZE_T cch)
+{
+    AppendOutput(pch, cch);
+}
+
+FCRET NoDifference(VOID)
+{
+    AppendString("FC: no differences encountered\n\n");
+    return FCRET_IDENTICAL;
+}
+
+FCRET ResyncFailed(VOID)
+{
+    AppendString("Resync Failed.  Files are too different.\n");
+    return FCRET_DIFFERENT;
+}
+
+FCRET OutOfMemory(VOID)
+{
+    CHECK(FALSE, "out of memory");
+    return FCRET_INVALID;
+}
+
+FCRET CannotRead(LPCWSTR file)
+{
+    CHECK(FALSE, "cannot read a file");
+    return FCRET_INVALID;
+}
+
+static INT s_cOverMaxMem = 0;
+
+VOID OverMaxMem(VOID)
+{
+    ++s_cOverMaxMem;
+}
+
+HANDLE DoOpenFileForInput(LPCWSTR file)
+{
+    return CreateFileW(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+}
+
+// ----------------------------------------------------------------------------
+// The symbol table
+
+#define SYM_TEXTS 64 // the distinct texts of the lines
+#define SYM_TEXT_MAX 8
+#define SYM_WINDOW_MAX 300
+#define SYM_ROUNDS 20000
+
+typedef struct SYMWINDOW
+{
+    NODE *apNodes[SYM_WINDOW_MAX]; // oldest first, from iHead
+    DWORD iHead;
+    DWORD cNodes;
+} SYMWINDOW;
+
+static __inline NODE *WindowNode(const SYMWINDOW *pWindow, DWORD n)
+{
+    return pWindow->apNodes[(pWindow->iHead + n) % SYM_WINDOW_MAX];
+}
+
+// Checks the counts, the newest nodes, the slots and the free list of the
+// table against the nodes that are in the windows
+static VOID CheckSymTab(const FILECOMPARE *pFC, const SYMWINDOW aWindows[2])
+{
+    const LINESYMTAB *pTab = &pFC->symtab;
+    static DWORD s_acRefs[2][SYM_WINDOW_MAX * 2];
+    static NODE *s_apNewest[2][SYM_WINDOW_MAX * 2];
+    DWORD sym, n, cLive = 0, cSlots = 0, cFree = 0, iSlot, mask = pTab->cSlots - 1;
+    NODE *node;
+    INT i;
+
+    if (pTab->cSyms > SYM_WINDOW_MAX * 2)
+    {
+        CHECK(FALSE, "%u symbols for %u lines",
+              pTab->cSyms, aWindows[0].cNodes + aWindows[1].cNodes);
+        return;
+    }
+    ZeroMemory(s_acRefs, sizeof(s_acRefs));
+    ZeroMemory(s_apNewest, sizeof(s_apNewest));
+    for (i = 0; i < 2; ++i)
+    {
+        for (n = 0; n < aWindows[i].cNodes; ++n)
+        {
+            node = WindowNode(&aWindows[i], n);
+            ++s_acRefs[i][node->sym];
+            s_apNewest[i][node->sym] = node;
+        }
+    }
+
+    for (sym = 0; sym < pTab->cSyms; ++sym)
+    {
+        for (i = 0; i < 2; ++i)
+        {
+            CHECK(pTab->pSyms[sym].cRefs[i] == s_acRefs[i][sym],
+                  "symbol %u: %u nodes in window %d, not %u",
+                  sym, pTab->pSyms[sym].cRefs[i], i, s_acRefs[i][sym]);
+            CHECK(pTab->pSyms[sym].pRep[i] == s_apNewest[i][sym],
+                  "symbol %u: not the newest node of window %d", sym, i);
+        }
+        if (!s_acRefs[0][sym] && !s_acRefs[1][sym])
+            continue;
+        ++cLive;
+
+        // the symbol is found by probing from the slot of its hash
+        for (iSlot = (DWORD)pTab->pSyms[sym].hash & mask;
+             pTab->pSlots[iSlot] && pTab->pSlots[iSlot] != sym + 1; iSlot = (iSlot + 1) & mask)
+        {
+            ;
+        }
+        CHECK(pTab->pSlots[iSlot] == sym + 1, "symbol %u can't be found", sym);
+    }
+    for (iSlot = 0; iSlot < pTab->cSlots; ++iSlot)
+        cSlots += !!pTab->pSlots[iSlot];
+    for (sym = pTab->iFree; sym != SYM_NONE && cFree <= pTab->cSyms;
+         sym = pTab->pSyms[sym].iNextFree)
+    {
+        ++cFree;
+    }
+
+    CHECK(pTab->cLive == cLive, "%u symbols in use, not %u", pTab->cLive, cLive);
+    CHECK(cSlots == cLive, "%u slots in use for %u symbols", cSlots, cLive);
+    CHECK(cFree == pTab->cSyms - cLive, "%u symbols freed, not %u", cFree, pTab->cSyms - cLive);
+}
+
+// Interns and releases random lines in two windows that slide as in
+// TextCompare, and checks that the lines have the same symbol exactly when
+// CompareLines finds them identical. If fCollide, the hashes are cut to a few
+// values, so that the slots of different lines collide.
+static VOID TestSymbols(DWORD dwFlags, BOOL fCollide)
+{
+    static CHAR s_aszTexts[SYM_TEXTS][SYM_TEXT_MAX + 1];
+    static const CHAR s_szChars[] = "aAb \t";
+    static FILECOMPARE s_fc;
+    FILECOMPARE *pFC = &s_fc;
+    SYMWINDOW aWindows[2];
+    SYMWINDOW *pWindow;
+    ARENA arena;
+    NODE *node, *other;
+    DWORD iText, ich, cch, n, cLivePeak = 0, lineno = 1;
+    INT iRound, i, j;
+
+    for (iText = 0; iText < SYM_TEXTS; ++iText)
+    {
+        cch = Random() % (SYM_TEXT_MAX + 1);
+        for (ich = 0; ich < cch; ++ich)
+            s_aszTexts[iText][ich] = s_szChars[Random() % (_countof(s_szChars) - 1)];
+        s_aszTexts[iText][cch] = 0;
+    }
+
+    ZeroMemory(pFC, sizeof(*pFC));
+    pFC->dwFlags = dwFlags;
+    InitSymTab(&pFC->symtab);
+    InitArena(&arena);
+    ZeroMemory(aWindows, sizeof(aWindows));
+
+    for (iRound = 0; iRound < SYM_ROUNDS; ++iRound)
+    {
+        i = Random() % 2;
+        pWindow = &aWindows[i];
+        if (pWindow->cNodes == SYM_WINDOW_MAX || (pWindow->cNodes > 0 && Random() % 3 == 0))
+        {
+            // the oldest line is dropped
+            ReleaseNode(pFC, i, WindowNode(pWindow, 0));
+            pWindow->iHead = (pWindow->iHead + 1) % SYM_WINDOW_MAX;
+            --pWindow->cNodes;
+        }
+        else
+        {
+            iText = Random() % SYM_TEXTS;
+            node = AllocNode(pFC, &arena, s_aszTexts[iText], (DWORD)strlen(s_aszTexts[iText]),
+                             (BYTE)(Random() % 2), lineno++);
+            if (!node)
+            {
+                CHECK(FALSE, "out of memory");
+                break;
+            }
+            if (fCollide)
+                node->hash &= 3;
+            if (!InternNode(pFC, i, node))
+            {
+                CHECK(FALSE, "InternNode failed");
+                break;
+            }
+            pWindow->apNodes[(pWindow->iHead + pWindow->cNodes++) % SYM_WINDOW_MAX] = node;
+
+            for (j = 0; j < 2; ++j)
+            {
+                for (n = 0; n < aWindows[j].cNodes; ++n)
+                {
+                    other = WindowNode(&aWindows[j], n);
+                    CHECK((other->sym == node->sym) ==
+                          (CompareLines(pFC, other, node) == FCRET_IDENTICAL),
+                          "flags %#x: \"%s\" and \"%s\" have symbols %u and %u", dwFlags,
+                          s_aszTexts[iText], other->pch, node->sym, other->sym);
+                }
+            }
+        }
+        cLivePeak = max(cLivePeak, pFC->symtab.cLive);
+        if (iRound % 101 == 0)
+            CheckSymTab(pFC, aWindows);
+    }
+    CheckSymTab(pFC, aWindows);
+
+    // all the symbols are freed with their lines
+    for (i = 0; i < 2; ++i)
+    {
+        for (; aWindows[i].cNodes > 0; --aWindows[i].cNodes)
+        {
+            ReleaseNode(pFC, i, WindowNode(&aWindows[i], 0));
+            aWindows[i].iHead = (aWindows[i].iHead + 1) % SYM_WINDOW_MAX;
+        }
+    }
+    CheckSymTab(pFC, aWindows);
+    CHECK(pFC->symtab.cLive == 0, "flags %#x: %u symbols left", dwFlags, pFC->symtab.cLive);
+    // the numbers of the freed symbols are used again
+    CHECK(pFC->symtab.cSyms <= cLivePeak, "flags %#x: %u symbols for at most %u lines in use",
+          dwFlags, pFC->symtab.cSyms, cLivePeak);
+
+    FreeSymTab(&pFC->symtab);
+    FreeArena(&arena);
+}
+
+// ----------------------------------------------------------------------------
+// Resync
+
+static LPCWSTR s_aFiles[2] = { L"text0.txt", L"text1.txt" };
+
+static BOOL WriteTestFile(INT i, LPCSTR pch, SIZE_T cch)
+{
+    CHAR szFile[16];
+    FILE *fp;
+    BOOL ret;
+
+    sprintf(szFile, "text%d.txt", i);
+    fp = fopen(szFile, "wb");
+    if (!fp)
+    {
+        CHECK(FALSE, "cannot write %s", szFile);
+        return FALSE;
+    }
+    ret = (fwrite(pch, 1, cch, fp) == cch);
+    ret = (fclose(fp) == 0) && ret;
+    CHECK(ret, "cannot write %s", szFile);
+    return ret;
+}
+
+// Resync as it was: every line of window 1 within /LBn is compared with
+// every line of window 0 within /LBn, and the pair of the least penalty is
+// taken.
+static FCRET
+NestedResync(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1)
+{
+    FCRET ret;
+    struct list *ptr0, *ptr1, *save0 = NULL, *save1 = NULL;
+    NODE *node0, *node1;
+    DWORD lineno0, lineno1;
+    INT penalty, i0, i1, min_penalty = MAXLONG;
+
+    node0 = LIST_ENTRY(*pptr0, NODE, entry);
+    node1 = LIST_ENTRY(*pptr1, NODE, entry);
+    lineno0 = node0->lineno + pFC->n;
+    lineno1 = node1->lineno + pFC->n;
+
+    for (ptr1 = NextLine(pFC, 1, *pptr1), i1 = 0; ptr1; ptr1 = NextLine(pFC, 1, ptr1), ++i1)
+    {
+        node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (node1->lineno >= lineno1)
+            break;
+        for (ptr0 = NextLine(pFC, 0, *pptr0), i0 = 0; ptr0; ptr0 = NextLine(pFC, 0, ptr0), ++i0)
+        {
+            node0 = LIST_ENTRY(ptr0, NODE, entry);
+            if (node0->lineno >= lineno0)
+                break;
+            if (CompareNode(pFC, node0, node1) == FCRET_IDENTICAL)
+            {
+                penalty = min(i0, i1) + abs(i1 - i0);
+                if (min_penalty > penalty)
+                {
+                    min_penalty = penalty;
+                    save0 = ptr0;
+                    save1 = ptr1;
+                }
+            }
+        }
+    }
+
+    if (save0 && save1)
+    {
+        *pptr0 = save0;
+        *pptr1 = save1;
+        ret = ScanDiff(pFC, &save0, &save1, lineno0, lineno1);
+        if (save0 && save1)
+        {
+            *pptr0 = save0;
+            *pptr1 = save1;
+        }
+        return ret;
+    }
+
+    for (ptr0 = *pptr0; ptr0; ptr0 = NextLine(pFC, 0, ptr0))
+    {
+        node0 = LIST_ENTRY(ptr0, NODE, entry);
+        if (node0->lineno == lineno0)
+            break;
+    }
+    for (ptr1 = *pptr1; ptr1; ptr1 = NextLine(pFC, 1, ptr1))
+    {
+        node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (node1->lineno == lineno1)
+            break;
+    }
+    *pptr0 = ptr0;
+    *pptr1 = ptr1;
+    return FCRET_DIFFERENT;
+}
+
+#define RESYNC_ROUNDS 2000
+#define RESYNC_LINES_MAX 40
+#define RESYNC_FILE_MAX (4 * RESYNC_LINES_MAX * 8)
+
+// Makes file 0 of random lines of a few texts, and file 1 an edited copy.
+// Either may end without a line break.
+static VOID MakeResyncFiles(LPSTR psz0, LPSTR psz1)
+{
+    DWORD cTexts = 2 + Random() % 5, cLines = Random() % (RESYNC_LINES_MAX + 1), n;
+    LPSTR pch0 = psz0, pch1 = psz1;
+    CHAR szLine[16];
+
+    for (n = 0; n < cLines; ++n)
+    {
+        sprintf(szLine, "t%u\n", Random() % cTexts);
+        pch0 += sprintf(pch0, "%s", szLine);
+        switch (Random() % 8)
+        {
+            case 0: // changed
+                pch1 += sprintf(pch1, "t%u\n", Random() % (cTexts + 2));
+                break;
+            case 1: // inserted
+                pch1 += sprintf(pch1, "t%u\n%s", Random() % (cTexts + 2), szLine);
+                break;
+            case 2: // deleted
+                break;
+            default:
+                pch1 += sprintf(pch1, "%s", szLine);
+                break;
+        }
+    }
+    if (pch0 > psz0 && Random() % 4 == 0)
+        --pch0;
+    if (pch1 > psz1 && Random() % 4 == 0)
+        --pch1;
+    *pch0 = *pch1 = 0;
+}
+
+// Walks the files as TextCompare does, and checks at each difference that
+// Resync ends at the same lines as the nested scan
+static VOID TestResync(VOID)
+{
+    static CHAR s_sz[2][RESYNC_FILE_MAX];
+    static FILECOMPARE s_fc;
+    FILECOMPARE *pFC = &s_fc;
+    FCINPUT inputs[2];
+    struct list *ptr0, *ptr1, *ref0, *ref1;
+    FCRET ret, retRef;
+    DWORD cResyncs = 0;
+    INT iRound, i;
+
+    for (iRound = 0; iRound < RESYNC_ROUNDS; ++iRound)
+    {
+        MakeResyncFiles(s_sz[0], s_sz[1]);
+        ZeroMemory(pFC, sizeof(*pFC));
+        pFC->n = 1 + Random() % 10;
+        pFC->nnnn = 1 + Random() % 3;
+        for (i = 0; i < 2; ++i)
+        {
+            if (!WriteTestFile(i, s_sz[i], strlen(s_sz[i])))
+                return;
+            // some of the files are streamed
+            if (OpenInput(&inputs[i], s_aFiles[i], (Random() % 4 == 0)) != FCRET_IDENTICAL)
+            {
+                CHECK(FALSE, "cannot open text%d.txt", i);
+                return;
+            }
+            InitWindow(&pFC->window[i], &inputs[i]);
+        }
+        InitSymTab(&pFC->symtab);
+
+        ptr0 = FirstLine(pFC, 0);
+        ptr1 = FirstLine(pFC, 1);
+        while (ptr0 && ptr1 && !HasFailed(pFC))
+        {
+            SkipIdentical(pFC, &ptr0, &ptr1);
+            if (!ptr0 || !ptr1 || IsEOFNode(LIST_ENTRY(ptr0, NODE, entry)) ||
+                IsEOFNode(LIST_ENTRY(ptr1, NODE, entry)))
+            {
+                break;
+            }
+
+            ref0 = ptr0;
+            ref1 = ptr1;
+            retRef = NestedResync(pFC, &ref0, &ref1);
+            ret = Resync(pFC, &ptr0, &ptr1);
+            ++cResyncs;
+            if (ret != retRef || ptr0 != ref0 || ptr1 != ref1)
+            {
+                CHECK(FALSE, "round %d, /LB%d /%d: Resync ends at lines %u and %u, "
+                      "the nested scan at %u and %u", iRound, pFC->n, pFC->nnnn,
+                      ptr0 ? LIST_ENTRY(ptr0, NODE, entry)->lineno : 0,
+                      ptr1 ? LIST_ENTRY(ptr1, NODE, entry)->lineno : 0,
+                      ref0 ? LIST_ENTRY(ref0, NODE, entry)->lineno : 0,
+                      ref1 ? LIST_ENTRY(ref1, NODE, entry)->lineno : 0);
+                break;
+            }
+            if (ret != FCRET_IDENTICAL)
+                break;
+        }
+
+        for (i = 0; i < 2; ++i)
+        {
+            FreeWindow(&pFC->window[i]);
+            CloseInput(&inputs[i]);
+        }
+        FreeSymTab(&pFC->symtab);
+    }
+    CHECK(cResyncs >= RESYNC_ROUNDS, "only %u differences in %d rounds", cResyncs, RESYNC_ROUNDS);
+}
+
+// ----------------------------------------------------------------------------
+// The identical head and tail (SkipRawHead and FindRawTail)
+
+// More than TAIL_BLOCK_SIZE of lines "line 1" to "line TRIM_LINES"
+#define TRIM_LINES 100000
+
+typedef struct TRIMFILE
+{
+    DWORD linenoEdit; // the line that has "X0" or "X1" in front, or 0
+    DWORD linenoRepeat; // the line that is written twice, or 0
+    LPCSTR pszAppend; // lines after the common ones
+    BOOL fNoEOL; // the last line has no line break
+} TRIMFILE;
+
+typedef struct TRIMCASE
+{
+    LPCSTR pszName;
+    DWORD dwFlags;
+    LPCSTR pszEOL;
+    TRIMFILE files[2];
+    LPCSTR pszExpected; // the output, with /N
+} TRIMCASE;
+
+static BOOL WriteTrimFile(INT i, LPCSTR pszEOL, const TRIMFILE *pFile)
+{
+    CHAR szFile[16];
+    FILE *fp;
+    DWORD lineno;
+    BOOL ret;
+
+    sprintf(szFile, "text%d.txt", i);
+    fp = fopen(szFile, "wb");
+    if (!fp)
+    {
+        CHECK(FALSE, "cannot write %s", szFile);
+        return FALSE;
+    }
+    for (lineno = 1; lineno <= TRIM_LINES; ++lineno)
+    {
+        if (lineno == pFile->linenoEdit)
+            fprintf(fp, "X%d", i);
+        if (lineno == pFile->linenoRepeat)
+            fprintf(fp, "line %u%s", lineno, pszEOL);
+        fprintf(fp, "line %u", lineno);
+        if (lineno < TRIM_LINES || pFile->pszAppend || !pFile->fNoEOL)
+            fputs(pszEOL, fp);
+    }
+    if (pFile->pszAppend)
+        fputs(pFile->pszAppend, fp);
+    ret = (fclose(fp) == 0);
+    CHECK(ret, "cannot write %s", szFile);
+    return ret;
+}
+
+// Compares text0.txt and text1.txt as FC does, into s_szOutput
+static FCRET RunTextCompare(FILECOMPARE *pFC, DWORD dwFlags, FCALG alg)
+{
+    FCINPUT inputs[2];
+    FCRET ret = FCRET_INVALID;
+    INT i;
+
+    ZeroMemory(pFC, sizeof(*pFC));
+    pFC->dwFlags = dwFlags;
+    pFC->n = 100;
+    pFC->nnnn = 2;
+    pFC->nContext = 3;
+    pFC->alg = alg;
+    pFC->file[0] = s_aFiles[0];
+    pFC->file[1] = s_aFiles[1];
+    s_cchOutput = 0;
+    s_szOutput[0] = 0;
+
+    if (OpenInput(&inputs[0], s_aFiles[0], FALSE) != FCRET_IDENTICAL ||
+        OpenInput(&inputs[1], s_aFiles[1], FALSE) != FCRET_IDENTICAL)
+    {
+        CHECK(FALSE, "cannot open the files");
+    }
+    else
+    {
+        ret = TextCompareA(pFC, &inputs[0], &inputs[1]);
+    }
+    for (i = 0; i < 2; ++i)
+        CloseInput(&inputs[i]);
+    return ret;
+}
+
+// The outputs are those of FC before the head and the tail were skipped. Those
+// of /UNIFIED are those of streamed inputs, whose tail isn't skipped; all but
+// the last are also the hunks of diff -u. In the last two cases, file 1 has a
+// line twice just before the tail, so the windows get to the tail out of sync.
+static VOID TestTrim(VOID)
+{
+    static const TRIMCASE s_cases[] =
+    {
+        {
+            "an edit in the last line", 0, "\n", { { TRIM_LINES }, { TRIM_LINES } },
+            "***** text0.txt\n"
+            "99999:  line 99999\n"
+            "100000:  X0line 100000\n"
+            "***** text1.txt\n"
+            "99999:  line 99999\n"
+            "100000:  X1line 100000\n"
+            "*****\n\n"
+        },
+        {
+            "an edit in the last line without a line break", 0, "\n",
+            { { TRIM_LINES, 0, NULL, TRUE }, { TRIM_LINES, 0, NULL, TRUE } },
+            "***** text0.txt\n"
+            "99999:  line 99999\n"
+            "100000:  X0line 100000\n"
+            "***** text1.txt\n"
+            "99999:  line 99999\n"
+            "100000:  X1line 100000\n"
+            "*****\n\n"
+        },
+        {
+            "an edit in the last line of CR/LF", 0, "\r\n", { { TRIM_LINES }, { TRIM_LINES } },
+            "***** text0.txt\n"
+            "99999:  line 99999\n"
+            "100000:  X0line 100000\n"
+            "***** text1.txt\n"
+            "99999:  line 99999\n"
+            "100000:  X1line 100000\n"
+            "*****\n\n"
+        },
+        {
+            "a line appended", 0, "\n", { { 0 }, { 0, 0, "appended\n" } },
+            "***** text0.txt\n"
+            "***** text1.txt\n"
+            "100001:  appended\n"
+            "*****\n\n"
+        },
+        {
+            "a line appended without a line break", 0, "\n", { { 0 }, { 0, 0, "appended" } },
+            "***** text0.txt\n"
+            "***** text1.txt\n"
+            "100001:  appended\n"
+            "*****\n\n"
+        },
+        {
+            "the last line break removed", 0, "\n", { { 0 }, { 0, 0, NULL, TRUE } },
+            "FC: no differences encountered\n\n"
+        },
+        {
+            "an edit in the first line", 0, "\n", { { 1 }, { 1 } },
+            "***** text0.txt\n"
+            "    1:  X0line 1\n"
+            "    2:  line 2\n"
+            "***** text1.txt\n"
+            "    1:  X1line 1\n"
+            "    2:  line 2\n"
+            "*****\n\n"
+        },
+        {
+            "an edit in the middle", 0, "\n", { { TRIM_LINES / 2 }, { TRIM_LINES / 2 } },
+            "***** text0.txt\n"
+            "49999:  line 49999\n"
+            "50000:  X0line 50000\n"
+            "50001:  line 50001\n"
+            "***** text1.txt\n"
+            "49999:  line 49999\n"
+            "50000:  X1line 50000\n"
+            "50001:  line 50001\n"
+            "*****\n\n"
+        },
+        {
+            "edits near the head and the tail", 0, "\n", { { 10 }, { TRIM_LINES - 10 } },
+            "***** text0.txt\n"
+            "    9:  line 9\n"
+            "   10:  X0line 10\n"
+            "   11:  line 11\n"
+            "***** text1.txt\n"
+            "    9:  line 9\n"
+            "   10:  line 10\n"
+            "   11:  line 11\n"
+            "*****\n\n"
+            "***** text0.txt\n"
+            "99989:  line 99989\n"
+            "99990:  line 99990\n"
+            "99991:  line 99991\n"
+            "***** text1.txt\n"
+            "99989:  line 99989\n"
+            "99990:  X1line 99990\n"
+            "99991:  line 99991\n"
+            "*****\n\n"
+        },
+        {
+            "/UNIFIED, an edit in the middle", FLAG_UNIFIED, "\n",
+            { { TRIM_LINES / 2 }, { TRIM_LINES / 2 } },
+            "--- text0.txt\n"
+            "+++ text1.txt\n"
+            "@@ -49997,7 +49997,7 @@\n"
+            " line 49997\n"
+            " line 49998\n"
+            " line 49999\n"
+            "-X0line 50000\n"
+            "+X1line 50000\n"
+            " line 50001\n"
+            " line 50002\n"
+            " line 50003\n"
+        },
+        {
+            "/UNIFIED, an edit in the last line", FLAG_UNIFIED, "\n",
+            { { TRIM_LINES }, { TRIM_LINES } },
+            "--- text0.txt\n"
+            "+++ text1.txt\n"
+            "@@ -99997,4 +99997,4 @@\n"
+            " line 99997\n"
+            " line 99998\n"
+            " line 99999\n"
+            "-X0line 100000\n"
+            "+X1line 100000\n"
+        },
+        {
+            "/UNIFIED, edits near the head and the tail", FLAG_UNIFIED, "\n",
+            { { 2 }, { TRIM_LINES - 1 } },
+            "--- text0.txt\n"
+            "+++ text1.txt\n"
+            "@@ -1,5 +1,5 @@\n"
+            " line 1\n"
+            "-X0line 2\n"
+            "+line 2\n"
+            " line 3\n"
+            " line 4\n"
+            " line 5\n"
+            "@@ -99996,5 +99996,5 @@\n"
+            " line 99996\n"
+            " line 99997\n"
+            " line 99998\n"
+            "-line 99999\n"
+            "+X1line 99999\n"
+            " line 100000\n"
+        },
+        {
+            "a line repeated before the tail", 0, "\n", { { 0 }, { 0, TRIM_LINES - 10 } },
+            "***** text0.txt\n"
+            "99990:  line 99990\n"
+            "99991:  line 99991\n"
+            "99992:  line 99992\n"
+            "***** text1.txt\n"
+            "99990:  line 99990\n"
+            "99991:  line 99990\n"
+            "99992:  line 99991\n"
+            "99993:  line 99992\n"
+            "*****\n\n"
+        },
+        {
+            "/UNIFIED, a line repeated before the tail", FLAG_UNIFIED, "\n",
+            { { 0 }, { 0, TRIM_LINES - 10 } },
+            "--- text0.txt\n"
+            "+++ text1.txt\n"
+            "@@ -99988,7 +99988,8 @@\n"
+            " line 99988\n"
+            " line 99989\n"
+            " line 99990\n"
+            "-line 99991\n"
+            "+line 99990\n"
+            "+line 99991\n"
+            " line 99992\n"
+            " line 99993\n"
+            " line 99994\n"
+        },
+    };
+    static FILECOMPARE s_fc;
+    const TRIMCASE *pCase;
+    FCRET ret;
+    BOOL fDifferent;
+    INT iCase, i;
+
+    for (iCase = 0; iCase < (INT)_countof(s_cases); ++iCase)
+    {
+        pCase = &s_cases[iCase];
+        for (i = 0; i < 2; ++i)
+        {
+            if (!WriteTrimFile(i, pCase->pszEOL, &pCase->files[i]))
+                return;
+        }
+        ret = RunTextCompare(&s_fc, pCase->dwFlags | FLAG_N, ALG_FC);
+        fDifferent = !strstr(pCase->pszExpected, "no differences");
+        CHECK(ret == (fDifferent ? FCRET_DIFFERENT : FCRET_IDENTICAL),
+              "%s: exit code %d", pCase->pszName, ret);
+        CHECK(strcmp(s_szOutput, pCase->pszExpected) == 0, "%s: the output is\n%s",
+              pCase->pszName, s_szOutput);
+    }
+}
+
+// ----------------------------------------------------------------------------
+// The indexed diff (DiffIndexed)
+
+#define INDEX_ROUNDS 1000
+#define INDEX_LINES_MAX 1000 // several LINES_PER_PARSE, so that the lines are dropped
+#define INDEX_FILE_MAX (INDEX_LINES_MAX * 2 * 8)
+
+// Makes file 0 of random lines of a few texts, and file 1 an edited copy. The
+// lines end with LF or CR LF, and either file may end without a line break.
+static VOID MakeIndexFiles(LPSTR psz0, LPSTR psz1)
+{
+    static const LPCSTR s_apszEOL[] = { "\n", "\n", "\n", "\r\n" };
+    DWORD cTexts = 2 + Random() % 5, cLines = Random() % (INDEX_LINES_MAX + 1), n;
+    LPSTR pch0 = psz0, pch1 = psz1;
+    CHAR szLine[16];
+
+    for (n = 0; n < cLines; ++n)
+    {
+        sprintf(szLine, "t%u%s", Random() % cTexts, s_apszEOL[Random() % 4]);
+        pch0 += sprintf(pch0, "%s", szLine);
+        switch (Random() % 8)
+        {
+            case 0: // changed
+                pch1 += sprintf(pch1, "t%u%s", Random() % (cTexts + 2), s_apszEOL[Random() % 4]);
+                break;
+            case 1: // inserted
+                pch1 += sprintf(pch1, "t%u\n%s", Random() % (cTexts + 2), szLine);
+                break;
+            case 2: // deleted
+                break;
+            default:
+                pch1 += sprintf(pch1, "%s", szLine);
+                break;
+        }
+    }
+    if (pch0 > psz0 && Random() % 4 == 0)
+        --pch0;
+    if (pch1 > psz1 && Random() % 4 == 0)
+        --pch1;
+    *pch0 = *pch1 = 0;
+}
+
+// Compares text0.txt and text1.txt as TextCompare does with the settings,
+// into s_szOutput. If fIndexed, the files are compared by DiffIndexed instead,
+// after a few lines of each were parsed as by FitsDiffAll.
+static FCRET RunWholeCompare(FILECOMPARE *pFC, const FILECOMPARE *pSettings, BOOL fIndexed)
+{
+    FCINPUT inputs[2];
+    LINEINDEX index[2];
+    struct list *ptr;
+    FCRET ret = FCRET_INVALID;
+    DWORD cParsed;
+    INT i;
+
+    *pFC = *pSettings;
+    pFC->file[0] = s_aFiles[0];
+    pFC->file[1] = s_aFiles[1];
+    s_cchOutput = 0;
+    s_szOutput[0] = 0;
+
+    if (OpenInput(&inputs[0], s_aFiles[0], FALSE) != FCRET_IDENTICAL ||
+        OpenInput(&inputs[1], s_aFiles[1], FALSE) != FCRET_IDENTICAL)
+    {
+        CHECK(FALSE, "cannot open the files");
+    }
+    else if (!fIndexed)
+    {
+        ret = TextCompareA(pFC, &inputs[0], &inputs[1]);
+    }
+    else
+    {
+        InitWindow(&pFC->window[0], &inputs[0]);
+        InitWindow(&pFC->window[1], &inputs[1]);
+        InitSymTab(&pFC->symtab);
+        if (SkipRawHead(pFC) && FindRawTail(pFC))
+        {
+            for (i = 0; i < 2; ++i)
+            {
+                cParsed = Random() % (2 * LINES_PER_PARSE);
+                for (ptr = FirstLine(pFC, i); ptr && cParsed > 0; --cParsed)
+                    ptr = NextLine(pFC, i, ptr);
+            }
+            ZeroMemory(index, sizeof(index));
+            pFC->symtab.fKeep = TRUE;
+            if (IndexLines(pFC, 0, index) && IndexLines(pFC, 1, index))
+                ret = DiffIndexed(pFC, index);
+            CHECK(!HasFailed(pFC), "the indexed diff failed");
+            FreeIndex(&index[0]);
+            FreeIndex(&index[1]);
+            if (!HasFailed(pFC))
+                FlushHunk(pFC);
+        }
+        free(pFC->hunk.pText);
+        FreeWindow(&pFC->window[0]);
+        FreeWindow(&pFC->window[1]);
+        FreeSymTab(&pFC->symtab);
+    }
+    for (i = 0; i < 2; ++i)
+        CloseInput(&inputs[i]);
+    return ret;
+}
+
+// Checks that DiffIndexed shows the same as DiffAll, and that /MAXMEM that
+// neither fits in shows the same as Resync
+static VOID TestIndexed(VOID)
+{
+    static const DWORD s_adwFlags[] =
+    {
+        0, FLAG_A, FLAG_N | FLAG_INLINE, FLAG_C | FLAG_W, FLAG_UNIFIED
+    };
+    static CHAR s_sz[2][INDEX_FILE_MAX];
+    static CHAR s_szExpected[OUTPUT_MAX];
+    static FILECOMPARE s_fc, s_settings;
+    FCRET ret, retExpected;
+    INT iRound, i, cOverMaxMem = s_cOverMaxMem;
+
+    for (iRound = 0; iRound < INDEX_ROUNDS; ++iRound)
+    {
+        MakeIndexFiles(s_sz[0], s_sz[1]);
+        for (i = 0; i < 2; ++i)
+        {
+            if (!WriteTestFile(i, s_sz[i], strlen(s_sz[i])))
+                return;
+        }
+        ZeroMemory(&s_settings, sizeof(s_settings));
+        s_settings.dwFlags = s_adwFlags[Random() % _countof(s_adwFlags)];
+        s_settings.n = 100;
+        s_settings.nnnn = 1 + Random() % 3;
+        s_settings.nContext = Random() % 4;
+        s_settings.alg = ALG_MYERS;
+
+        retExpected = RunWholeCompare(&s_fc, &s_settings, FALSE);
+        strcpy(s_szExpected, s_szOutput);
+        ret = RunWholeCompare(&s_fc, &s_settings, TRUE);
+        CHECK(ret == retExpected && strcmp(s_szOutput, s_szExpected) == 0,
+              "round %d, flags %#x /%d: DiffIndexed returns %d and shows\n%s\n"
+              "DiffAll returns %d and shows\n%s", iRound, s_settings.dwFlags,
+              s_settings.nnnn, ret, s_szOutput, retExpected, s_szExpected);
+
+        // the index starts again at the first lines for Resync
+        s_settings.alg = ALG_FC;
+        retExpected = RunWholeCompare(&s_fc, &s_settings, FALSE);
+        strcpy(s_szExpected, s_szOutput);
+        s_settings.alg = ALG_MYERS;
+        s_settings.cbMaxMem = 1;
+        ret = RunWholeCompare(&s_fc, &s_settings, FALSE);
+        CHECK(ret == retExpected && strcmp(s_szOutput, s_szExpected) == 0,
+              "round %d, flags %#x /%d: /MAXMEM returns %d and shows\n%s\n"
+              "Resync returns %d and shows\n%s", iRound, s_settings.dwFlags,
+              s_settings.nnnn, ret, s_szOutput, retExpected, s_szExpected);
+    }
+    CHECK(s_cOverMaxMem - cOverMaxMem >= INDEX_ROUNDS / 2, "/MAXMEM was exceeded %d times",
+          s_cOverMaxMem - cOverMaxMem);
+}
+
+// ----------------------------------------------------------------------------
+// The marks of /INLINE (MarkLine and MarkChanges)
+
+#define MARK_ROUNDS 40000
+#define MARK_UNITS_MAX 60 // the characters of a line before the edit
+#define MARK_EDIT_MAX 8 // the characters deleted and inserted by the edit
+#define MARK_LINE_MAX (2 * (MARK_UNITS_MAX + MARK_EDIT_MAX))
+
+static LPCSTR RandomMarkChar(BOOL fDBCS)
+{
+    // 0xA9 is a single-byte character in the double-byte code page as well
+    static const LPCSTR s_apszSingle[] = { "a", "A", "b", "B", "_", "1", " ", ".", "\xA9" };
+    // double-byte characters whose trail bytes are letters, '_' and a lead byte
+    static const LPCSTR s_apszDouble[] = { "\x82\x61", "\x82\x41", "\x83\x61", "\x81\x81",
+                                           "\x82\x5F" };
+    if (fDBCS && Random() % 3 == 0)
+        return s_apszDouble[Random() % _countof(s_apszDouble)];
+    return s_apszSingle[Random() % _countof(s_apszSingle)];
+}
+
+// Makes a line of random characters, and its pair with an edit of a few
+// characters, and sometimes with some letters in the other case. The case of
+// the trail bytes of double-byte characters is changed as well.
+static VOID MakeMarkLines(LPSTR psz0, LPSTR psz1, BOOL fDBCS)
+{
+    LPCSTR apszChars[MARK_UNITS_MAX];
+    DWORD cChars, iChar, iEdit, cDelete, cInsert;
+    CHAR ch;
+
+    cChars = Random() % (MARK_UNITS_MAX + 1);
+    psz0[0] = 0;
+    for (iChar = 0; iChar < cChars; ++iChar)
+    {
+        apszChars[iChar] = RandomMarkChar(fDBCS);
+        strcat(psz0, apszChars[iChar]);
+    }
+
+    iEdit = Random() % (cChars + 1);
+    cDelete = Random() % (min(cChars - iEdit, MARK_EDIT_MAX) + 1);
+    cInsert = Random() % (MARK_EDIT_MAX + 1);
+    psz1[0] = 0;
+    for (iChar = 0; iChar < iEdit; ++iChar)
+        strcat(psz1, apszChars[iChar]);
+    for (; cInsert > 0; --cInsert)
+        strcat(psz1, RandomMarkChar(fDBCS));
+    for (iChar = iEdit + cDelete; iChar < cChars; ++iChar)
+        strcat(psz1, apszChars[iChar]);
+
+    if (Random() % 2)
+    {
+        for (; *psz1; ++psz1)
+        {
+            ch = *psz1;
+            if (((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')) && Random() % 8 == 0)
+                *psz1 ^= 'a' - 'A';
+        }
+    }
+}
+
+static BOOL IsCharBoundary(LPCSTR pch, DWORD cch, DWORD ich, BOOL fDBCS)
+{
+    return ich == cch || CharStart(pch, ich, fDBCS) == ich;
+}
+
+static BOOL IsSameChar(DWORD dwFlags, CHAR ch0, CHAR ch1)
+{
+    return ((dwFlags & FLAG_C) ? FoldCase(ch0) == FoldCase(ch1) : ch0 == ch1);
+}
+
+// Checks the marks of a pair of lines in a single-byte code page against the
+// head and the tail that are found byte by byte. /INLINE:WORD may move them
+// only over the word that they would cut.
+static VOID CheckMarkBytes(DWORD dwFlags, LPCSTR pch0, DWORD cch0, LPCSTR pch1, DWORD cch1,
+                           const INLINEMARK *pMark0, const INLINEMARK *pMark1)
+{
+    DWORD ichHead = 0, cchTail = 0, ich, cchMarkTail;
+
+    while (ichHead < min(cch0, cch1) && IsSameChar(dwFlags, pch0[ichHead], pch1[ichHead]))
+        ++ichHead;
+    while (cchTail < min(cch0, cch1) - ichHead &&
+           IsSameChar(dwFlags, pch0[cch0 - cchTail - 1], pch1[cch1 - cchTail - 1]))
+    {
+        ++cchTail;
+    }
+
+    cchMarkTail = cch0 - pMark0->ichEnd;
+    CHECK(cch1 - pMark1->ichEnd == cchMarkTail, "flags %#x: \"%s\" and \"%s\": tails %u and %u",
+          dwFlags, pch0, pch1, cchMarkTail, cch1 - pMark1->ichEnd);
+    if (!(dwFlags & FLAG_INLINE_WORD))
+    {
+        CHECK(pMark0->ichBegin == ichHead && cchMarkTail == cchTail,
+              "flags %#x: \"%s\" and \"%s\": head %u and tail %u, not %u and %u", dwFlags,
+              pch0, pch1, pMark0->ichBegin, cchMarkTail, ichHead, cchTail);
+        return;
+    }
+
+    // the head is cut back to the start of a word that the edit changes
+    CHECK(pMark0->ichBegin <= ichHead, "flags %#x: \"%s\" and \"%s\": head %u after %u",
+          dwFlags, pch0, pch1, pMark0->ichBegin, ichHead);
+    for (ich = pMark0->ichBegin; ich < ichHead; ++ich)
+    {
+        CHECK(IS_WORD_CHAR(pch0[ich]), "flags %#x: \"%s\" and \"%s\": head %u is not in a word",
+              dwFlags, pch0, pch1, pMark0->ichBegin);
+    }
+    if (pMark0->ichBegin > 0 && IS_WORD_CHAR(pch0[pMark0->ichBegin - 1]))
+    {
+        CHECK(!(ichHead < cch0 && IS_WORD_CHAR(pch0[ichHead])) &&
+              !(ichHead < cch1 && IS_WORD_CHAR(pch1[ichHead])),
+              "flags %#x: \"%s\" and \"%s\": head %u cuts a word", dwFlags, pch0, pch1,
+              pMark0->ichBegin);
+    }
+
+    // and the tail to the end of one
+    CHECK(cchMarkTail <= cchTail, "flags %#x: \"%s\" and \"%s\": tail %u longer than %u",
+          dwFlags, pch0, pch1, cchMarkTail, cchTail);
+    for (ich = cch0 - cchTail; ich < pMark0->ichEnd; ++ich)
+    {
+        CHECK(IS_WORD_CHAR(pch0[ich]), "flags %#x: \"%s\" and \"%s\": tail %u is not in a word",
+              dwFlags, pch0, pch1, cchMarkTail);
+    }
+    if (cchMarkTail > 0 && IS_WORD_CHAR(pch0[pMark0->ichEnd]))
+    {
+        CHECK(!(pMark0->ichEnd > pMark0->ichBegin && IS_WORD_CHAR(pch0[pMark0->ichEnd - 1])) &&
+              !(pMark1->ichEnd > pMark1->ichBegin && IS_WORD_CHAR(pch1[pMark1->ichEnd - 1])),
+              "flags %#x: \"%s\" and \"%s\": tail %u cuts a word", dwFlags, pch0, pch1,
+              cchMarkTail);
+    }
+}
+
+// Marks random pairs of lines, and checks that the marks are on whole
+// characters, that the lines are the same before and after them, and that
+// only the lines that CompareLines finds identical have no marks.
+static VOID TestMarkLine(BOOL fDBCS)
+{
+    static const DWORD s_adwFlags[] =
+    {
+        FLAG_INLINE, FLAG_INLINE | FLAG_C, FLAG_INLINE | FLAG_INLINE_WORD,
+        FLAG_INLINE | FLAG_INLINE_WORD | FLAG_C
+    };
+    static FILECOMPARE s_fc;
+    FILECOMPARE *pFC = &s_fc;
+    CHAR sz0[MARK_LINE_MAX + 1], sz1[MARK_LINE_MAX + 1];
+    ARENA arena;
+    NODE *node0, *node1, *part0, *part1;
+    INLINEMARK mark0, mark1;
+    DWORD cch0, cch1;
+    BOOL fValid, fSame, fMarked;
+    INT iRound;
+
+    ZeroMemory(pFC, sizeof(*pFC));
+    InitArena(&arena);
+    for (iRound = 0; iRound < MARK_ROUNDS; ++iRound)
+    {
+        if (iRound % 1000 == 0)
+        {
+            FreeArena(&arena);
+            InitArena(&arena);
+        }
+        pFC->dwFlags = s_adwFlags[iRound % _countof(s_adwFlags)];
+        MakeMarkLines(sz0, sz1, fDBCS);
+        cch0 = (DWORD)strlen(sz0);
+        cch1 = (DWORD)strlen(sz1);
+        node0 = AllocNode(pFC, &arena, sz0, cch0, EOL_LF, 1);
+        node1 = AllocNode(pFC, &arena, sz1, cch1, EOL_LF, 1);
+        if (!node0 || !node1)
+        {
+            CHECK(FALSE, "out of memory");
+            break;
+        }
+        MarkLine(pFC, node0, node1, &mark0, &mark1);
+
+        fValid = (mark0.ichBegin == mark1.ichBegin && mark0.ichBegin <= mark0.ichEnd &&
+                  mark0.ichEnd <= cch0 && mark1.ichBegin <= mark1.ichEnd && mark1.ichEnd <= cch1);
+        CHECK(fValid, "flags %#x: \"%s\" and \"%s\": marks [%u, %u) and [%u, %u)",
+              pFC->dwFlags, sz0, sz1, mark0.ichBegin, mark0.ichEnd, mark1.ichBegin, mark1.ichEnd);
+        if (!fValid)
+            continue;
+        CHECK(IsCharBoundary(sz0, cch0, mark0.ichBegin, fDBCS) &&
+              IsCharBoundary(sz0, cch0, mark0.ichEnd, fDBCS) &&
+              IsCharBoundary(sz1, cch1, mark1.ichBegin, fDBCS) &&
+              IsCharBoundary(sz1, cch1, mark1.ichEnd, fDBCS),
+              "flags %#x: \"%s\" and \"%s\": marks [%u, %u) and [%u, %u) cut a character",
+              pFC->dwFlags, sz0, sz1, mark0.ichBegin, mark0.ichEnd, mark1.ichBegin,
+              mark1.ichEnd);
+
+        fSame = (CompareLines(pFC, node0, node1) == FCRET_IDENTICAL);
+        fMarked = (mark0.ichBegin < mark0.ichEnd || mark1.ichBegin < mark1.ichEnd);
+        CHECK(fSame == !fMarked, "flags %#x: \"%s\" and \"%s\" are %s but marked [%u, %u) and "
+              "[%u, %u)", pFC->dwFlags, sz0, sz1, (fSame ? "the same" : "different"),
+              mark0.ichBegin, mark0.ichEnd, mark1.ichBegin, mark1.ichEnd);
+
+        part0 = AllocNode(pFC, &arena, sz0, mark0.ichBegin, EOL_LF, 1);
+        part1 = AllocNode(pFC, &arena, sz1, mark1.ichBegin, EOL_LF, 1);
+        if (part0 && part1)
+        {
+            CHECK(CompareLines(pFC, part0, part1) == FCRET_IDENTICAL,
+                  "flags %#x: \"%s\" and \"%s\": the heads differ before %u", pFC->dwFlags,
+                  sz0, sz1, mark0.ichBegin);
+        }
+        if (cch0 - mark0.ichEnd == cch1 - mark1.ichEnd)
+        {
+            part0 = AllocNode(pFC, &arena, &sz0[mark0.ichEnd], cch0 - mark0.ichEnd, EOL_LF, 1);
+            part1 = AllocNode(pFC, &arena, &sz1[mark1.ichEnd], cch1 - mark1.ichEnd, EOL_LF, 1);
+            if (part0 && part1)
+            {
+                CHECK(CompareLines(pFC, part0, part1) == FCRET_IDENTICAL,
+                      "flags %#x: \"%s\" and \"%s\": the tails differ after %u and %u",
+                      pFC->dwFlags, sz0, sz1, mark0.ichEnd, mark1.ichEnd);
+            }
+        }
+
+        if (!fDBCS)
+            CheckMarkBytes(pFC->dwFlags, sz0, cch0, sz1, cch1, &mark0, &mark1);
+    }
+    FreeArena(&arena);
+}
+
+#define MARK_LIMIT_LINES 300 // more changed lines than INLINE_MAX_PAIRS
+
+typedef struct MARKCASE
+{
+    LPCSTR pszName;
+    DWORD dwFlags;
+    LPCSTR psz0; // text0.txt
+    LPCSTR psz1; // text1.txt
+    LPCSTR pszExpected;
+} MARKCASE;
+
+static const CHAR s_szMarkFile0[] =
+    "same\nabc def ghi\nabc define\nHello World\na\tb\none\nsame\n";
+static const CHAR s_szMarkFile1[] =
+    "same\nabc xyz ghi\nabc defuse\nhello WORLD!\na\tc\nuno\ndos\nsame\n";
+
+// Compares files with /INLINE, and checks the marks in the output. The marks
+// of the double-byte cases are on whole characters, and /C keeps the case of
+// their trail bytes. Only the first INLINE_MAX_PAIRS pairs of a difference are
+// marked.
+static VOID TestMarkChanges(BOOL fDBCS)
+{
+    static const MARKCASE s_cases[] =
+    {
+        {
+            "/INLINE", FLAG_INLINE, s_szMarkFile0, s_szMarkFile1,
+            "***** text0.txt\n"
+            "same\n"
+            "abc [-def-] ghi\n"
+            "abc def[-in-]e\n"
+            "[-Hello World-]\n"
+            "a       [-b-]\n"
+            "[-one-]\n"
+            "same\n"
+            "***** text1.txt\n"
+            "same\n"
+            "abc {+xyz+} ghi\n"
+            "abc def{+us+}e\n"
+            "{+hello WORLD!+}\n"
+            "a       {+c+}\n"
+            "{+uno+}\n"
+            "dos\n"
+            "same\n"
+            "*****\n\n"
+        },
+        {
+            "/INLINE:WORD /C", FLAG_INLINE | FLAG_INLINE_WORD | FLAG_C,
+            s_szMarkFile0, s_szMarkFile1,
+            "***** text0.txt\n"
+            "same\n"
+            "abc [-def-] ghi\n"
+            "abc [-define-]\n"
+            "Hello World\n"
+            "a       [-b-]\n"
+            "[-one-]\n"
+            "same\n"
+            "***** text1.txt\n"
+            "same\n"
+            "abc {+xyz+} ghi\n"
+            "abc {+defuse+}\n"
+            "hello WORLD{+!+}\n"
+            "a       {+c+}\n"
+            "{+uno+}\n"
+            "dos\n"
+            "same\n"
+            "*****\n\n"
+        },
+    };
+    static const MARKCASE s_casesDBCS[] =
+    {
+        {
+            "/INLINE, a double-byte character", FLAG_INLINE, "x\x82\x61y\n", "x\x82\x62y\n",
+            "***** text0.txt\n"
+            "x[-\x82\x61-]y\n"
+            "***** text1.txt\n"
+            "x{+\x82\x62+}y\n"
+            "*****\n\n"
+        },
+        {
+            "/INLINE, a trail byte in the tail", FLAG_INLINE, "\x82\x41z\n", "xAz\n",
+            "***** text0.txt\n"
+            "[-\x82\x41-]z\n"
+            "***** text1.txt\n"
+            "{+x+}Az\n"
+            "*****\n\n"
+        },
+        {
+            "/INLINE /C, the case of a trail byte", FLAG_INLINE | FLAG_C,
+            "a\x82\x61z\n", "A\x82\x41Z\n",
+            "***** text0.txt\n"
+            "a[-\x82\x61-]z\n"
+            "***** text1.txt\n"
+            "A{+\x82\x41+}Z\n"
+            "*****\n\n"
+        },
+    };
+    static FILECOMPARE s_fc;
+    static const LPCSTR s_aszOpen[2] = { "[-", "{+" };
+    static CHAR s_szFiles[2][MARK_LIMIT_LINES * 8];
+    const MARKCASE *pCases = (fDBCS ? s_casesDBCS : s_cases);
+    INT cCases = (INT)(fDBCS ? _countof(s_casesDBCS) : _countof(s_cases));
+    const MARKCASE *pCase;
+    FCRET ret;
+    LPCSTR pch;
+    INT iCase, i, cMarks[2];
+    DWORD lineno;
+
+    for (iCase = 0; iCase < cCases; ++iCase)
+    {
+        pCase = &pCases[iCase];
+        if (!WriteTestFile(0, pCase->psz0, strlen(pCase->psz0)) ||
+            !WriteTestFile(1, pCase->psz1, strlen(pCase->psz1)))
+        {
+            return;
+        }
+        ret = RunTextCompare(&s_fc, pCase->dwFlags, ALG_FC);
+        CHECK(ret == FCRET_DIFFERENT, "%s: exit code %d", pCase->pszName, ret);
+        CHECK(strcmp(s_szOutput, pCase->pszExpected) == 0, "%s: the output is\n%s",
+              pCase->pszName, s_szOutput);
+    }
+    if (fDBCS)
+        return;
+
+    // one difference of MARK_LIMIT_LINES changed lines, more than /LBn
+    for (i = 0; i < 2; ++i)
+    {
+        strcpy(s_szFiles[i], "same\n");
+        for (lineno = 1; lineno <= MARK_LIMIT_LINES; ++lineno)
+            sprintf(&s_szFiles[i][strlen(s_szFiles[i])], "%c%03u\n", 'a' + i, lineno);
+        if (!WriteTestFile(i, s_szFiles[i], strlen(s_szFiles[i])))
+            return;
+    }
+    ret = RunTextCompare(&s_fc, FLAG_INLINE, ALG_MYERS);
+    CHECK(ret == FCRET_DIFFERENT, "%u changed lines: exit code %d", MARK_LIMIT_LINES, ret);
+    for (i = 0; i < 2; ++i)
+    {
+        cMarks[i] = 0;
+        for (pch = strstr(s_szOutput, s_aszOpen[i]); pch; pch = strstr(pch + 2, s_aszOpen[i]))
+            ++cMarks[i];
+    }
+    CHECK(cMarks[0] == INLINE_MAX_PAIRS && cMarks[1] == INLINE_MAX_PAIRS,
+          "%u changed lines: %d and %d lines marked", MARK_LIMIT_LINES, cMarks[0], cMarks[1]);
+    CHECK(strstr(s_szOutput, "\n[-a-]256\n") && strstr(s_szOutput, "\na257\n") &&
+          strstr(s_szOutput, "\n{+b+}256\n") && strstr(s_szOutput, "\nb257\n"),
+          "%u changed lines: the output is\n%s", MARK_LIMIT_LINES, s_szOutput);
+}
+
+// ----------------------------------------------------------------------------
+// The ordinal comparison of the lines, and /LOCALE
+
+#define COMPARE_ROUNDS 40000
+#define COMPARE_UNITS_MAX 48 // the characters of a line
+#define COMPARE_LINE_MAX (8 * COMPARE_UNITS_MAX)
+
+// Whether the lines are the same as NormalizeLine makes them, character by
+// character. /C folds the ASCII letters, and not the trail bytes of the
+// double-byte characters.
+static BOOL IsSameLine(const FILECOMPARE *pFC, LPCSTR pch0, DWORD cch0, LPCSTR pch1, DWORD cch1,
+                       BOOL fDBCS)
+{
+    LINEBUF buf0 = { 0 }, buf1 = { 0 };
+    DWORD ich;
+    BOOL ret = FALSE;
+
+    pch0 = NormalizeLine(pFC, &buf0, pch0, cch0, &cch0);
+    pch1 = NormalizeLine(pFC, &buf1, pch1, cch1, &cch1);
+    if (!pch0 || !pch1)
+        CHECK(FALSE, "out of memory");
+    else if (cch0 == cch1)
+    {
+        for (ich = 0; ich < cch0; ++ich)
+        {
+            if (fDBCS && IsDBCSLeadByte((BYTE)pch0[ich]) && ich + 1 < cch0)
+            {
+                if (pch0[ich] != pch1[ich] || pch0[ich + 1] != pch1[ich + 1])
+                    break;
+                ++ich;
+            }
+            else if (!IsSameChar(pFC->dwFlags, pch0[ich], pch1[ich]))
+            {
+                break;
+            }
+        }
+        ret = (ich >= cch0);
+    }
+    free(buf0.psz);
+    free(buf1.psz);
+    return ret;
+}
+
+// Makes a line of random characters, and a line that is much like it: with
+// some letters in the other case, the white space changed, or a character
+// replaced. The lines are ASCII if fASCII.
+static VOID MakeCompareLines(LPSTR psz0, LPSTR psz1, BOOL fDBCS, BOOL fASCII)
+{
+    static const LPCSTR s_apszSingle[] = { "a", "A", "b", "B", "1", ".", " ", "\t", "\xE9",
+                                           "\xC9" };
+    static const LPCSTR s_apszDouble[] = { "\x82\x61", "\x82\x41", "\x81\x40" };
+    static const LPCSTR s_apszSpaces[] = { " ", "\t", "  ", " \t", "\t " };
+    DWORD cUnits, cSingle = _countof(s_apszSingle) - ((fDBCS || fASCII) ? 2 : 0);
+    BOOL fCase = Random() % 2, fSpace = Random() % 2;
+    LPCSTR pch;
+    CHAR ch;
+
+    cUnits = Random() % (COMPARE_UNITS_MAX + 1);
+    psz0[0] = 0;
+    for (; cUnits > 0; --cUnits)
+    {
+        if (fDBCS && Random() % 4 == 0)
+            strcat(psz0, s_apszDouble[Random() % _countof(s_apszDouble)]);
+        else
+            strcat(psz0, s_apszSingle[Random() % cSingle]);
+    }
+
+    if (fSpace && Random() % 4 == 0)
+        *psz1++ = ' ';
+    for (pch = psz0; *pch; ++pch)
+    {
+        ch = *pch;
+        if (fCase && ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')) && Random() % 4 == 0)
+        {
+            *psz1++ = (CHAR)(ch ^ ('a' - 'A'));
+        }
+        else if (fSpace && IS_SPACE(ch) && Random() % 3 == 0)
+        {
+            strcpy(psz1, s_apszSpaces[Random() % _countof(s_apszSpaces)]);
+            psz1 += strlen(psz1);
+        }
+        else
+        {
+            *psz1++ = ch;
+        }
+    }
+    if (fSpace && Random() % 4 == 0)
+        *psz1++ = '\t';
+    *psz1 = 0;
+}
+
+typedef struct COMPARECASE
+{
+    DWORD dwFlags;
+    LPCSTR psz0;
+    LPCSTR psz1;
+    BOOL fSame;
+} COMPARECASE;
+
+// Compares random pairs of lines with CompareLines, with and without /LOCALE,
+// and checks them against IsSameLine. /LOCALE is checked on ASCII lines
+// only, which the collation of CompareString orders as the ordinal
+// comparison does. The lines that are the same have the same hash.
+static VOID TestCompare(BOOL fDBCS)
+{
+    static const DWORD s_adwFlags[] =
+    {
+        0, FLAG_C, FLAG_W, FLAG_T, FLAG_C | FLAG_W, FLAG_C | FLAG_T, FLAG_W | FLAG_T,
+        FLAG_C | FLAG_W | FLAG_T
+    };
+    // /C folds the ASCII letters only, and /LOCALE folds the others as well.
+    // é and É are 0xE9 and 0xC9 in the single-byte code page.
+    static const COMPARECASE s_cases[] =
+    {
+        { FLAG_C, "caf\xE9", "CAF\xC9", FALSE },
+        { FLAG_C | FLAG_LOCALE, "caf\xE9", "CAF\xC9", TRUE },
+        { FLAG_LOCALE, "caf\xE9", "caf\xC9", FALSE },
+        { FLAG_C | FLAG_W | FLAG_LOCALE, " caf\xE9\t ol\xE9", "CAF\xC9 OL\xC9 ", TRUE },
+    };
+    // /C keeps the trail bytes of the double-byte characters, which are 'a' and
+    // 'A' here
+    static const COMPARECASE s_casesDBCS[] =
+    {
+        { FLAG_C, "\x82\x61", "\x82\x41", FALSE },
+        { FLAG_C, "a\x82\x61z", "A\x82\x61Z", TRUE },
+        { FLAG_C | FLAG_W, "a  \x82\x61", "A \x82\x61", TRUE },
+        { FLAG_C | FLAG_W, "a  \x82\x61", "A \x82\x41", FALSE },
+    };
+    static FILECOMPARE s_fc;
+    FILECOMPARE *pFC = &s_fc;
+    CHAR sz0[COMPARE_LINE_MAX + 1], sz1[COMPARE_LINE_MAX + 1];
+    const COMPARECASE *pCases = (fDBCS ? s_casesDBCS : s_cases);
+    INT cCases = (INT)(fDBCS ? _countof(s_casesDBCS) : _countof(s_cases));
+    ARENA arena;
+    NODE *node0, *node1;
+    DWORD cch0, cch1, cSame = 0;
+    BOOL fASCII, fSame, fLocale;
+    INT iRound, iCase;
+
+    ZeroMemory(pFC, sizeof(*pFC));
+    InitArena(&arena);
+    for (iRound = 0; iRound < COMPARE_ROUNDS; ++iRound)
+    {
+        if (iRound % 1000 == 0)
+        {
+            FreeArena(&arena);
+            InitArena(&arena);
+        }
+        fASCII = !fDBCS && Random() % 2;
+        fLocale = fASCII && Random() % 2;
+        pFC->dwFlags = s_adwFlags[iRound % _countof(s_adwFlags)];
+        MakeCompareLines(sz0, sz1, fDBCS, fASCII);
+        cch0 = (DWORD)strlen(sz0);
+        cch1 = (DWORD)strlen(sz1);
+        fSame = IsSameLine(pFC, sz0, cch0, sz1, cch1, fDBCS);
+        cSame += fSame;
+
+        if (fLocale)
+            pFC->dwFlags |= FLAG_LOCALE;
+        node0 = AllocNode(pFC, &arena, sz0, cch0, EOL_LF, 1);
+        node1 = AllocNode(pFC, &arena, sz1, cch1, EOL_LF, 1);
+        if (!node0 || !node1)
+        {
+            CHECK(FALSE, "out of memory");
+            break;
+        }
+        CHECK((CompareLines(pFC, node0, node1) == FCRET_IDENTICAL) == fSame,
+              "flags %#x: \"%s\" and \"%s\" are %s", pFC->dwFlags, sz0, sz1,
+              (fSame ? "the same" : "different"));
+        if (fSame)
+        {
+            CHECK(node0->hash == node1->hash, "flags %#x: \"%s\" and \"%s\" have other hashes",
+                  pFC->dwFlags, sz0, sz1);
+        }
+    }
+    // enough of the lines are the same to test
+    CHECK(cSame >= COMPARE_ROUNDS / 8, "only %u of %d pairs of lines are the same", cSame,
+          COMPARE_ROUNDS);
+
+    for (iCase = 0; iCase < cCases; ++iCase)
+    {
+        pFC->dwFlags = pCases[iCase].dwFlags;
+        node0 = AllocNode(pFC, &arena, pCases[iCase].psz0, (DWORD)strlen(pCases[iCase].psz0),
+                          EOL_LF, 1);
+        node1 = AllocNode(pFC, &arena, pCases[iCase].psz1, (DWORD)strlen(pCases[iCase].psz1),
+                          EOL_LF, 1);
+        if (!node0 || !node1)
+        {
+            CHECK(FALSE, "out of memory");
+            break;
+        }
+        CHECK((CompareLines(pFC, node0, node1) == FCRET_IDENTICAL) == pCases[iCase].fSame,
+              "flags %#x: \"%s\" and \"%s\" are not %s", pFC->dwFlags, pCases[iCase].psz0,
+              pCases[iCase].psz1, (pCases[iCase].fSame ? "the same" : "different"));
+    }
+    FreeArena(&arena);
+}
+
+int main(int argc, char **argv)
+{
+    static const DWORD s_adwFlags[] =
+    {
+        0, FLAG_C, FLAG_W, FLAG_C | FLAG_W | FLAG_T, FLAG_LOCALE | FLAG_C, FLAG_UNIFIED
+    };
+    INT iFlags;
+
+    if (argc > 1 && strcmp(argv[1], "dbcs") == 0)
+    {
+#ifndef _WIN32
+        SetShimACP(CP_SHIM_DBCS);
+#endif
+        InitScan();
+        if (!IsDBCSCodePage())
+        {
+            printf("the code page isn't a double-byte one\n");
+            return 0;
+        }
+        TestCompare(TRUE);
+        TestMarkLine(TRUE);
+        TestMarkChanges(TRUE);
+    }
+    else
+    {
+        InitScan();
+        for (iFlags = 0; iFlags < (INT)_countof(s_adwFlags); ++iFlags)
+        {
+            TestSymbols(s_adwFlags[iFlags], FALSE);
+            TestSymbols(s_adwFlags[iFlags], TRUE);
+        }
+        TestResync();
+        TestTrim();
+        TestIndexed();
+        TestCompare(FALSE);
+        TestMarkLine(FALSE);
+        TestMarkChanges(FALSE);
+    }
+
+    if (s_cFailures)
+    {
+        printf("%d checks failed\n", s_cFailures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1765 @@
+/*
+ * PROJECT:     ReactOS FC Command
+ * LICENSE:     GPL-2.0-or-later (https://spdx.org/licenses/GPL-2.0-or-later)
+ * PURPOSE:     The Win32 functions that FC needs, on POSIX systems, so that
+ *              FC and its tests build and run on other systems
+ * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
+ */
+#define _GNU_SOURCE
+#include <windows.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Only what FC does is supported: waiting for all of several handles, file
+// locks of the whole process (fcntl), and the file names of the directory of
+// a wildcard. Paths may use '\\' or '/'.
+
+static __thread DWORD s_dwLastError = NO_ERROR;
+
+DWORD WINAPI GetLastError(VOID)
+{
+    return s_dwLastError;
+}
+
+VOID WINAPI SetLastError(DWORD dwError)
+{
+    s_dwLastError = dwError;
+}
+
+static VOID SetErrnoError(VOID)
+{
+    switch (errno)
+    {
+        case ENOENT: case ENOTDIR:
+            SetLastError(ERROR_FILE_NOT_FOUND);
+            break;
+        case EACCES: case EPERM: case EISDIR:
+            SetLastError(ERROR_ACCESS_DENIED);
+            break;
+        case ENOMEM:
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            break;
+        case EPIPE:
+            SetLastError(ERROR_BROKEN_PIPE);
+            break;
+        case EBADF:
+            SetLastError(ERROR_INVALID_HANDLE);
+            break;
+        default:
+            SetLastError(ERROR_READ_FAULT);
+            break;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// Handles
+
+typedef enum SHIMTYPE
+{
+    SHIM_FILE,
+    SHIM_MAPPING,
+    SHIM_EVENT,
+    SHIM_SEMAPHORE,
+    SHIM_THREAD,
+    SHIM_FIND
+} SHIMTYPE;
+
+typedef struct SHIMOBJECT
+{
+    SHIMTYPE type;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int fd;                     // file, mapping
+    BOOL fWrite;                // mapping
+    ULONGLONG cb;               // mapping
+    BOOL fManualReset;          // event
+    BOOL fSignaled;             // event, thread (exited)
+    LONG lCount;                // semaphore
+    LONG lMax;                  // semaphore
+    pthread_t thread;           // thread
+    BOOL fJoined;               // thread
+    LPTHREAD_START_ROUTINE pfn; // thread
+    LPVOID pParam;              // thread
+    char **apszNames;           // find
+    DWORD cNames;               // find
+    DWORD iNext;                // find
+} SHIMOBJECT;
+
+static SHIMOBJECT *NewObject(SHIMTYPE type)
+{
+    SHIMOBJECT *pObject = calloc(1, sizeof(SHIMOBJECT));
+    if (!pObject)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    pObject->type = type;
+    pObject->fd = -1;
+    pthread_mutex_init(&pObject->mutex, NULL);
+    pthread_cond_init(&pObject->cond, NULL);
+    return pObject;
+}
+
+static SHIMOBJECT s_aStd[3] =
+{
+    { SHIM_FILE, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 },
+    { SHIM_FILE, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 1 },
+    { SHIM_FILE, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 2 },
+};
+
+HANDLE WINAPI GetStdHandle(DWORD nStdHandle)
+{
+    switch (nStdHandle)
+    {
+        case STD_INPUT_HANDLE:
+            return &s_aStd[0];
+        case STD_OUTPUT_HANDLE:
+            return &s_aStd[1];
+        case STD_ERROR_HANDLE:
+            return &s_aStd[2];
+    }
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return INVALID_HANDLE_VALUE;
+}
+
+static int GetFd(HANDLE h)
+{
+    SHIMOBJECT *pObject = h;
+    if (!pObject || h == INVALID_HANDLE_VALUE || pObject->type != SHIM_FILE)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return -1;
+    }
+    return pObject->fd;
+}
+
+// A thread that CloseHandle closes is waited for
+BOOL WINAPI CloseHandle(HANDLE h)
+{
+    SHIMOBJECT *pObject = h;
+    DWORD i;
+
+    if (!pObject || h == INVALID_HANDLE_VALUE)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (pObject >= s_aStd && pObject < s_aStd + _countof(s_aStd))
+        return TRUE;
+
+    switch (pObject->type)
+    {
+        case SHIM_FILE:
+        case SHIM_MAPPING:
+            close(pObject->fd);
+            break;
+        case SHIM_THREAD:
+            if (!pObject->fJoined)
+                pthread_join(pObject->thread, NULL);
+            break;
+        case SHIM_FIND:
+            for (i = 0; i < pObject->cNames; ++i)
+                free(pObject->apszNames[i]);
+            free(pObject->apszNames);
+            break;
+        default:
+            break;
+    }
+    pthread_mutex_destroy(&pObject->mutex);
+    pthread_cond_destroy(&pObject->cond);
+    free(pObject);
+    return TRUE;
+}
+
+// ----------------------------------------------------------------------------
+// Threads and their synchronization
+
+static void *ShimThreadProc(void *pv)
+{
+    SHIMOBJECT *pThread = pv;
+    pThread->pfn(pThread->pParam);
+    pthread_mutex_lock(&pThread->mutex);
+    pThread->fSignaled = TRUE;
+    pthread_cond_broadcast(&pThread->cond);
+    pthread_mutex_unlock(&pThread->mutex);
+    return NULL;
+}
+
+HANDLE WINAPI CreateThread(LPVOID pSecurity, SIZE_T cbStack, LPTHREAD_START_ROUTINE pfn,
+                           LPVOID pParam, DWORD dwFlags, LPDWORD pdwThreadId)
+{
+    SHIMOBJECT *pThread = NewObject(SHIM_THREAD);
+    (void)pSecurity;
+    (void)cbStack;
+    (void)dwFlags;
+    if (!pThread)
+        return NULL;
+    pThread->pfn = pfn;
+    pThread->pParam = pParam;
+    if (pthread_create(&pThread->thread, NULL, ShimThreadProc, pThread))
+    {
+        pThread->fJoined = TRUE;
+        CloseHandle(pThread);
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    if (pdwThreadId)
+        *pdwThreadId = 0;
+    return pThread;
+}
+
+HANDLE WINAPI CreateEventW(LPVOID pSecurity, BOOL fManualReset, BOOL fInitialState, LPCWSTR pszName)
+{
+    SHIMOBJECT *pEvent = NewObject(SHIM_EVENT);
+    (void)pSecurity;
+    (void)pszName;
+    if (!pEvent)
+        return NULL;
+    pEvent->fManualReset = fManualReset;
+    pEvent->fSignaled = fInitialState;
+    return pEvent;
+}
+
+static BOOL SignalEvent(HANDLE hEvent, BOOL fSignaled)
+{
+    SHIMOBJECT *pEvent = hEvent;
+    if (!pEvent || pEvent->type != SHIM_EVENT)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    pthread_mutex_lock(&pEvent->mutex);
+    pEvent->fSignaled = fSignaled;
+    if (fSignaled)
+        pthread_cond_broadcast(&pEvent->cond);
+    pthread_mutex_unlock(&pEvent->mutex);
+    return TRUE;
+}
+
+BOOL WINAPI SetEvent(HANDLE hEvent)
+{
+    return SignalEvent(hEvent, TRUE);
+}
+
+BOOL WINAPI ResetEvent(HANDLE hEvent)
+{
+    return SignalEvent(hEvent, FALSE);
+}
+
+HANDLE WINAPI CreateSemaphoreW(LPVOID pSecurity, LONG lInitial, LONG lMax, LPCWSTR pszName)
+{
+    SHIMOBJECT *pSemaphore;
+    (void)pSecurity;
+    (void)pszName;
+    if (lInitial < 0 || lMax <= 0 || lInitial > lMax)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    pSemaphore = NewObject(SHIM_SEMAPHORE);
+    if (!pSemaphore)
+        return NULL;
+    pSemaphore->lCount = lInitial;
+    pSemaphore->lMax = lMax;
+    return pSemaphore;
+}
+
+BOOL WINAPI ReleaseSemaphore(HANDLE hSemaphore, LONG lRelease, LPLONG plPrevious)
+{
+    SHIMOBJECT *pSemaphore = hSemaphore;
+    BOOL ret = FALSE;
+    if (!pSemaphore || pSemaphore->type != SHIM_SEMAPHORE || lRelease <= 0)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    pthread_mutex_lock(&pSemaphore->mutex);
+    if (plPrevious)
+        *plPrevious = pSemaphore->lCount;
+    if (lRelease <= pSemaphore->lMax - pSemaphore->lCount)
+    {
+        pSemaphore->lCount += lRelease;
+        pthread_cond_broadcast(&pSemaphore->cond);
+        ret = TRUE;
+    }
+    pthread_mutex_unlock(&pSemaphore->mutex);
+    if (!ret)
+        SetLastError(ERROR_INVALID_PARAMETER);
+    return ret;
+}
+
+// Only INFINITE timeouts are supported
+DWORD WINAPI WaitForSingleObject(HANDLE h, DWORD dwTimeout)
+{
+    SHIMOBJECT *pObject = h;
+    (void)dwTimeout;
+    if (!pObject || h == INVALID_HANDLE_VALUE)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return WAIT_FAILED;
+    }
+
+    pthread_mutex_lock(&pObject->mutex);
+    switch (pObject->type)
+    {
+        case SHIM_EVENT:
+            while (!pObject->fSignaled)
+                pthread_cond_wait(&pObject->cond, &pObject->mutex);
+            if (!pObject->fManualReset)
+                pObject->fSignaled = FALSE;
+            break;
+        case SHIM_SEMAPHORE:
+            while (pObject->lCount == 0)
+                pthread_cond_wait(&pObject->cond, &pObject->mutex);
+            --pObject->lCount;
+            break;
+        case SHIM_THREAD:
+            while (!pObject->fSignaled)
+                pthread_cond_wait(&pObject->cond, &pObject->mutex);
+            break;
+        default:
+            pthread_mutex_unlock(&pObject->mutex);
+            SetLastError(ERROR_INVALID_HANDLE);
+            return WAIT_FAILED;
+    }
+    pthread_mutex_unlock(&pObject->mutex);
+    return WAIT_OBJECT_0;
+}
+
+// Only waiting for all the handles is supported
+DWORD WINAPI WaitForMultipleObjects(DWORD cHandles, const HANDLE *pHandles, BOOL fWaitAll,
+                                    DWORD dwTimeout)
+{
+    DWORD i;
+    if (!fWaitAll || cHandles == 0 || cHandles > MAXIMUM_WAIT_OBJECTS)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return WAIT_FAILED;
+    }
+    for (i = 0; i < cHandles; ++i)
+    {
+        if (WaitForSingleObject(pHandles[i], dwTimeout) == WAIT_FAILED)
+            return WAIT_FAILED;
+    }
+    return WAIT_OBJECT_0;
+}
+
+// ----------------------------------------------------------------------------
+// Wide strings
+
+SIZE_T ShimWcslen(LPCWSTR psz)
+{
+    LPCWSTR pch = psz;
+    while (*pch)
+        ++pch;
+    return pch - psz;
+}
+
+LPWSTR ShimWcscpy(LPWSTR psz, LPCWSTR pszSrc)
+{
+    memcpy(psz, pszSrc, (ShimWcslen(pszSrc) + 1) * sizeof(WCHAR));
+    return psz;
+}
+
+LPWSTR ShimWcschr(LPCWSTR psz, WCHAR ch)
+{
+    for (;; ++psz)
+    {
+        if (*psz == ch)
+            return (LPWSTR)psz;
+        if (!*psz)
+            return NULL;
+    }
+}
+
+LPWSTR ShimWcsrchr(LPCWSTR psz, WCHAR ch)
+{
+    LPCWSTR pchFound = NULL;
+    for (;; ++psz)
+    {
+        if (*psz == ch)
+            pchFound = psz;
+        if (!*psz)
+            return (LPWSTR)pchFound;
+    }
+}
+
+unsigned long ShimWcstoul(LPCWSTR psz, LPWSTR *ppszEnd, INT nBase)
+{
+    char sz[64], *pszEnd;
+    unsigned long ul;
+    INT ich;
+    for (ich = 0; ich < (INT)sizeof(sz) - 1 && psz[ich] && psz[ich] < 0x80; ++ich)
+        sz[ich] = (char)psz[ich];
+    sz[ich] = 0;
+    ul = strtoul(sz, &pszEnd, nBase);
+    if (ppszEnd)
+        *ppszEnd = (LPWSTR)&psz[pszEnd - sz];
+    return ul;
+}
+
+// The simple uppercase of Latin-1, Latin Extended-A, Greek and Cyrillic
+WCHAR ShimTowupper(WCHAR ch)
+{
+    if (ch >= 'a' && ch <= 'z')
+        return ch - ('a' - 'A');
+    if (ch < 0xE0)
+        return ch;
+    if (ch <= 0xFE)
+        return ch == 0xF7 ? ch : ch - 0x20;
+    if (ch == 0xFF)
+        return 0x178;
+    if (ch >= 0x100 && ch <= 0x17F)
+    {
+        if ((ch >= 0x139 && ch <= 0x148) || (ch >= 0x179 && ch <= 0x17E))
+            return (ch & 1) ? ch : ch - 1;
+        if (ch == 0x131 || ch == 0x138 || ch == 0x149 || ch == 0x178 || ch == 0x17F)
+            return ch == 0x131 ? 'I' : ch;
+        return (ch & 1) ? ch - 1 : ch;
+    }
+    if (ch >= 0x3B1 && ch <= 0x3C9)
+        return ch == 0x3C2 ? 0x3A3 : ch - 0x20;
+    if (ch >= 0x430 && ch <= 0x44F)
+        return ch - 0x20;
+    if (ch >= 0x450 && ch <= 0x45F)
+        return ch - 0x50;
+    return ch;
+}
+
+INT ShimWcsnicmp(LPCWSTR psz0, LPCWSTR psz1, SIZE_T cch)
+{
+    WCHAR ch0, ch1;
+    for (; cch > 0; --cch, ++psz0, ++psz1)
+    {
+        ch0 = ShimTowupper(*psz0);
+        ch1 = ShimTowupper(*psz1);
+        if (ch0 != ch1)
+            return ch0 < ch1 ? -1 : 1;
+        if (!ch0)
+            break;
+    }
+    return 0;
+}
+
+INT ShimWcsicmp(LPCWSTR psz0, LPCWSTR psz1)
+{
+    return ShimWcsnicmp(psz0, psz1, (SIZE_T)-1);
+}
+
+INT WINAPI lstrlenW(LPCWSTR psz)
+{
+    return psz ? (INT)ShimWcslen(psz) : 0;
+}
+
+LPWSTR WINAPI lstrcpyW(LPWSTR psz, LPCWSTR pszSrc)
+{
+    return ShimWcscpy(psz, pszSrc);
+}
+
+LPWSTR WINAPI lstrcpynW(LPWSTR psz, LPCWSTR pszSrc, INT cchMax)
+{
+    INT ich;
+    if (cchMax <= 0)
+        return psz;
+    for (ich = 0; ich < cchMax - 1 && pszSrc[ich]; ++ich)
+        psz[ich] = pszSrc[ich];
+    psz[ich] = 0;
+    return psz;
+}
+
+LPWSTR WINAPI lstrcatW(LPWSTR psz, LPCWSTR pszSrc)
+{
+    ShimWcscpy(psz + ShimWcslen(psz), pszSrc);
+    return psz;
+}
+
+// ----------------------------------------------------------------------------
+// Code pages
+
+static UINT s_uACP = 1252;
+
+// 0x80 to 0x9F of Windows-1252. The unused bytes map to the same C1 controls
+// as in Windows.
+static const WCHAR s_aw1252[32] =
+{
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+};
+
+// CP_SHIM_DBCS has the lead bytes of 932. A double-byte character maps to a
+// CJK ideograph of its own, and 0xA1 to 0xDF to the halfwidth katakana.
+#define DBCS_BASE 0x4E00
+
+VOID SetShimACP(UINT uCodePage)
+{
+    s_uACP = uCodePage;
+}
+
+static UINT ResolveCodePage(UINT uCodePage)
+{
+    return (uCodePage == CP_ACP || uCodePage == CP_OEMCP) ? s_uACP : uCodePage;
+}
+
+static BOOL IsLeadByteOf(UINT uCodePage, BYTE b)
+{
+    return uCodePage == CP_SHIM_DBCS && ((b >= 0x81 && b <= 0x9F) || (b >= 0xE0 && b <= 0xFC));
+}
+
+BOOL WINAPI IsDBCSLeadByte(BYTE b)
+{
+    return IsLeadByteOf(s_uACP, b);
+}
+
+BOOL WINAPI GetCPInfo(UINT uCodePage, CPINFO *pInfo)
+{
+    ZeroMemory(pInfo, sizeof(*pInfo));
+    pInfo->DefaultChar[0] = '?';
+    switch (ResolveCodePage(uCodePage))
+    {
+        case CP_UTF8:
+            pInfo->MaxCharSize = 4;
+            return TRUE;
+        case CP_SHIM_DBCS:
+            pInfo->MaxCharSize = 2;
+            pInfo->LeadByte[0] = 0x81;
+            pInfo->LeadByte[1] = 0x9F;
+            pInfo->LeadByte[2] = 0xE0;
+            pInfo->LeadByte[3] = 0xFC;
+            return TRUE;
+        case 1252:
+            pInfo->MaxCharSize = 1;
+            return TRUE;
+    }
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+}
+
+// Decodes one character of UTF-8. An invalid byte is U+FFFD.
+static DWORD DecodeUtf8(const BYTE *pb, INT cb, INT *pcbUsed)
+{
+    DWORD ch = pb[0], chMin;
+    INT cbChar, ib;
+
+    if (ch < 0x80)
+    {
+        *pcbUsed = 1;
+        return ch;
+    }
+    if (ch >= 0xC2 && ch <= 0xDF)
+        cbChar = 2, ch &= 0x1F, chMin = 0x80;
+    else if (ch >= 0xE0 && ch <= 0xEF)
+        cbChar = 3, ch &= 0x0F, chMin = 0x800;
+    else if (ch >= 0xF0 && ch <= 0xF4)
+        cbChar = 4, ch &= 0x07, chMin = 0x10000;
+    else
+        cbChar = 0, chMin = 0;
+
+    *pcbUsed = 1;
+    if (cbChar == 0 || cbChar > cb)
+        return 0xFFFD;
+    for (ib = 1; ib < cbChar; ++ib)
+    {
+        if ((pb[ib] & 0xC0) != 0x80)
+            return 0xFFFD;
+        ch = (ch << 6) | (pb[ib] & 0x3F);
+    }
+    if (ch < chMin || ch > 0x10FFFF || (ch >= 0xD800 && ch <= 0xDFFF))
+        return 0xFFFD;
+    *pcbUsed = cbChar;
+    return ch;
+}
+
+INT WINAPI MultiByteToWideChar(UINT uCodePage, DWORD dwFlags, LPCSTR pch, INT cch,
+                               LPWSTR pchWide, INT cchWide)
+{
+    const BYTE *pb = (const BYTE *)pch;
+    INT ib = 0, cbUsed, cchOut = 0, cchChar;
+    WCHAR aw[2];
+    DWORD ch;
+    BYTE b;
+
+    (void)dwFlags;
+    uCodePage = ResolveCodePage(uCodePage);
+    if (cch < 0)
+        cch = (INT)strlen(pch) + 1;
+
+    while (ib < cch)
+    {
+        b = pb[ib];
+        cchChar = 1;
+        if (uCodePage == CP_UTF8)
+        {
+            ch = DecodeUtf8(&pb[ib], cch - ib, &cbUsed);
+            ib += cbUsed;
+            if (ch >= 0x10000)
+            {
+                aw[0] = (WCHAR)(0xD800 + ((ch - 0x10000) >> 10));
+                aw[1] = (WCHAR)(0xDC00 + ((ch - 0x10000) & 0x3FF));
+                cchChar = 2;
+            }
+            else
+            {
+                aw[0] = (WCHAR)ch;
+            }
+        }
+        else if (uCodePage == CP_SHIM_DBCS)
+        {
+            if (IsLeadByteOf(uCodePage, b))
+            {
+                // a lead byte at the end stands for itself, as the default char
+                aw[0] = (ib + 1 < cch) ? (WCHAR)(DBCS_BASE + ((b - 0x80) << 8) + pb[ib + 1])
+                                       : (WCHAR)0x30FB;
+                ib += 2;
+            }
+            else
+            {
+                aw[0] = (b >= 0xA1 && b <= 0xDF) ? (WCHAR)(0xFF61 + b - 0xA1) : b;
+                ++ib;
+            }
+        }
+        else
+        {
+            aw[0] = (b >= 0x80 && b < 0xA0) ? s_aw1252[b - 0x80] : b;
+            ++ib;
+        }
+
+        if (cchWide > 0 && pchWide)
+        {
+            if (cchOut + cchChar > cchWide)
+            {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return 0;
+            }
+            memcpy(&pchWide[cchOut], aw, cchChar * sizeof(WCHAR));
+        }
+        cchOut += cchChar;
+    }
+    return cchOut;
+}
+
+INT WINAPI WideCharToMultiByte(UINT uCodePage, DWORD dwFlags, LPCWSTR pch, INT cch,
+                               LPSTR pb, INT cbMax, LPCSTR pDefault, BOOL *pfUsedDefault)
+{
+    INT ich = 0, cbOut = 0, cbChar, i;
+    BYTE ab[4];
+    DWORD ch;
+
+    (void)dwFlags;
+    uCodePage = ResolveCodePage(uCodePage);
+    if (cch < 0)
+        cch = (INT)ShimWcslen(pch) + 1;
+    if (pfUsedDefault)
+        *pfUsedDefault = FALSE;
+
+    while (ich < cch)
+    {
+        ch = pch[ich++];
+        if (uCodePage == CP_UTF8)
+        {
+            if (ch >= 0xD800 && ch <= 0xDBFF && ich < cch && pch[ich] >= 0xDC00 && pch[ich] <= 0xDFFF)
+                ch = 0x10000 + ((ch - 0xD800) << 10) + (pch[ich++] - 0xDC00);
+            else if (ch >= 0xD800 && ch <= 0xDFFF)
+                ch = 0xFFFD;
+            if (ch < 0x80)
+                ab[0] = (BYTE)ch, cbChar = 1;
+            else if (ch < 0x800)
+                ab[0] = (BYTE)(0xC0 | (ch >> 6)), ab[1] = (BYTE)(0x80 | (ch & 0x3F)), cbChar = 2;
+            else if (ch < 0x10000)
+            {
+                ab[0] = (BYTE)(0xE0 | (ch >> 12));
+                ab[1] = (BYTE)(0x80 | ((ch >> 6) & 0x3F));
+                ab[2] = (BYTE)(0x80 | (ch & 0x3F));
+                cbChar = 3;
+            }
+            else
+            {
+                ab[0] = (BYTE)(0xF0 | (ch >> 18));
+                ab[1] = (BYTE)(0x80 | ((ch >> 12) & 0x3F));
+                ab[2] = (BYTE)(0x80 | ((ch >> 6) & 0x3F));
+                ab[3] = (BYTE)(0x80 | (ch & 0x3F));
+                cbChar = 4;
+            }
+        }
+        else
+        {
+            cbChar = 1;
+            ab[0] = 0;
+            if (ch < 0x80 || (uCodePage != CP_SHIM_DBCS && ch >= 0xA0 && ch <= 0xFF))
+            {
+                ab[0] = (BYTE)ch;
+            }
+            else if (uCodePage == CP_SHIM_DBCS)
+            {
+                if (ch >= 0xFF61 && ch <= 0xFF9F)
+                {
+                    ab[0] = (BYTE)(0xA1 + ch - 0xFF61);
+                }
+                else if (ch >= DBCS_BASE && ch < DBCS_BASE + 0x7D00 &&
+                         IsLeadByteOf(uCodePage, (BYTE)(0x80 + ((ch - DBCS_BASE) >> 8))))
+                {
+                    ab[0] = (BYTE)(0x80 + ((ch - DBCS_BASE) >> 8));
+                    ab[1] = (BYTE)(ch - DBCS_BASE);
+                    cbChar = 2;
+                }
+            }
+            else
+            {
+                for (i = 0; i < (INT)_countof(s_aw1252); ++i)
+                {
+                    if (s_aw1252[i] == ch)
+                        ab[0] = (BYTE)(0x80 + i);
+                }
+            }
+            if (ab[0] == 0 && ch != 0)
+            {
+                ab[0] = pDefault ? (BYTE)*pDefault : '?';
+                if (pfUsedDefault)
+                    *pfUsedDefault = TRUE;
+            }
+        }
+
+        if (cbMax > 0 && pb)
+        {
+            if (cbOut + cbChar > cbMax)
+            {
+                SetLastError(ERROR_INVALID_PARAMETER);
+                return 0;
+            }
+            memcpy(&pb[cbOut], ab, cbChar);
+        }
+        cbOut += cbChar;
+    }
+    return cbOut;
+}
+
+// ----------------------------------------------------------------------------
+// Collation
+
+static LPWSTR WidenA(LPCSTR pch, INT *pcch)
+{
+    INT cchWide;
+    LPWSTR pchWide;
+    if (*pcch < 0)
+        *pcch = (INT)strlen(pch);
+    cchWide = MultiByteToWideChar(CP_ACP, 0, pch, *pcch, NULL, 0);
+    pchWide = malloc((cchWide + 1) * sizeof(WCHAR));
+    if (!pchWide)
+        return NULL;
+    MultiByteToWideChar(CP_ACP, 0, pch, *pcch, pchWide, cchWide + 1);
+    *pcch = cchWide;
+    return pchWide;
+}
+
+// The sort key is the folded characters, big-endian, then a zero byte
+INT WINAPI LCMapStringW(LCID lcid, DWORD dwFlags, LPCWSTR pch, INT cch, LPWSTR pbKey, INT cbKey)
+{
+    LPBYTE pb = (LPBYTE)pbKey;
+    INT ich, cb;
+    WCHAR ch;
+
+    (void)lcid;
+    if (!(dwFlags & LCMAP_SORTKEY))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+    if (cch < 0)
+        cch = (INT)ShimWcslen(pch);
+    cb = 2 * cch + 1;
+    if (cbKey == 0)
+        return cb;
+    if (cbKey < cb)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return 0;
+    }
+    for (ich = 0; ich < cch; ++ich)
+    {
+        ch = (dwFlags & NORM_IGNORECASE) ? ShimTowupper(pch[ich]) : pch[ich];
+        pb[2 * ich] = (BYTE)(ch >> 8);
+        pb[2 * ich + 1] = (BYTE)ch;
+    }
+    pb[2 * cch] = 0;
+    return cb;
+}
+
+INT WINAPI LCMapStringA(LCID lcid, DWORD dwFlags, LPCSTR pch, INT cch, LPSTR pbKey, INT cbKey)
+{
+    LPWSTR pchWide = WidenA(pch, &cch);
+    INT ret;
+    if (!pchWide)
+        return 0;
+    ret = LCMapStringW(lcid, dwFlags, pchWide, cch, (LPWSTR)pbKey, cbKey);
+    free(pchWide);
+    return ret;
+}
+
+INT WINAPI CompareStringW(LCID lcid, DWORD dwFlags, LPCWSTR pch0, INT cch0,
+                          LPCWSTR pch1, INT cch1)
+{
+    INT ich;
+    WCHAR ch0, ch1;
+
+    (void)lcid;
+    if (cch0 < 0)
+        cch0 = (INT)ShimWcslen(pch0);
+    if (cch1 < 0)
+        cch1 = (INT)ShimWcslen(pch1);
+    for (ich = 0; ich < cch0 && ich < cch1; ++ich)
+    {
+        ch0 = (dwFlags & NORM_IGNORECASE) ? ShimTowupper(pch0[ich]) : pch0[ich];
+        ch1 = (dwFlags & NORM_IGNORECASE) ? ShimTowupper(pch1[ich]) : pch1[ich];
+        if (ch0 != ch1)
+            return ch0 < ch1 ? CSTR_LESS_THAN : CSTR_GREATER_THAN;
+    }
+    if (cch0 != cch1)
+        return cch0 < cch1 ? CSTR_LESS_THAN : CSTR_GREATER_THAN;
+    return CSTR_EQUAL;
+}
+
+INT WINAPI CompareStringA(LCID lcid, DWORD dwFlags, LPCSTR pch0, INT cch0, LPCSTR pch1, INT cch1)
+{
+    LPWSTR pchWide0 = WidenA(pch0, &cch0), pchWide1 = WidenA(pch1, &cch1);
+    INT ret = 0;
+    if (pchWide0 && pchWide1)
+        ret = CompareStringW(lcid, dwFlags, pchWide0, cch0, pchWide1, cch1);
+    free(pchWide0);
+    free(pchWide1);
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+// Formatting as the wide printf functions of MSVC: %s and %c are wide unless
+// 'h' is given, 'l' is 32 bits, and I64 or ll is 64 bits.
+
+typedef struct FORMATSINK
+{
+    LPWSTR psz;
+    SIZE_T cchMax;
+    SIZE_T cch; // the characters of the whole output, even those beyond cchMax
+} FORMATSINK;
+
+static VOID PutChars(FORMATSINK *pSink, WCHAR ch, SIZE_T c)
+{
+    for (; c > 0; --c, ++pSink->cch)
+    {
+        if (pSink->cch < pSink->cchMax)
+            pSink->psz[pSink->cch] = ch;
+    }
+}
+
+static VOID PutString(FORMATSINK *pSink, LPCWSTR pch, SIZE_T cch)
+{
+    for (; cch > 0; --cch, ++pch, ++pSink->cch)
+    {
+        if (pSink->cch < pSink->cchMax)
+            pSink->psz[pSink->cch] = *pch;
+    }
+}
+
+// Puts the field with its padding
+static VOID PutField(FORMATSINK *pSink, LPCWSTR pch, SIZE_T cch, SIZE_T cchWidth, BOOL fLeft)
+{
+    if (!fLeft && cch < cchWidth)
+        PutChars(pSink, L' ', cchWidth - cch);
+    PutString(pSink, pch, cch);
+    if (fLeft && cch < cchWidth)
+        PutChars(pSink, L' ', cchWidth - cch);
+}
+
+static SIZE_T FormatCore(LPWSTR psz, SIZE_T cchMax, LPCWSTR pszFormat, va_list va)
+{
+    FORMATSINK sink = { psz, cchMax, 0 };
+    WCHAR szNumber[80], *pchNumber, chSign;
+    LPCWSTR pch, pszArg;
+    LPCSTR pszArgA;
+    SIZE_T cchWidth, cchPrecision, cch, ich;
+    BOOL fLeft, fZero, fPlus, fSpace, fPrecision, fNarrow, f64, fSigned;
+    ULONGLONG ull;
+    UINT uBase;
+    WCHAR ch;
+
+    for (pch = pszFormat; *pch; ++pch)
+    {
+        if (*pch != L'%')
+        {
+            PutChars(&sink, *pch, 1);
+            continue;
+        }
+
+        fLeft = fZero = fPlus = fSpace = fPrecision = fNarrow = f64 = FALSE;
+        for (++pch;; ++pch)
+        {
+            if (*pch == L'-')
+                fLeft = TRUE;
+            else if (*pch == L'0')
+                fZero = TRUE;
+            else if (*pch == L'+')
+                fPlus = TRUE;
+            else if (*pch == L' ')
+                fSpace = TRUE;
+            else if (*pch != L'#')
+                break;
+        }
+
+        cchWidth = 0;
+        if (*pch == L'*')
+        {
+            INT nWidth = va_arg(va, INT);
+            if (nWidth < 0)
+                fLeft = TRUE, nWidth = -nWidth;
+            cchWidth = nWidth;
+            ++pch;
+        }
+        for (; *pch >= L'0' && *pch <= L'9'; ++pch)
+            cchWidth = cchWidth * 10 + (*pch - L'0');
+
+        cchPrecision = 0;
+        if (*pch == L'.')
+        {
+            fPrecision = TRUE;
+            ++pch;
+            if (*pch == L'*')
+            {
+                INT nPrecision = va_arg(va, INT);
+                if (nPrecision < 0)
+                    fPrecision = FALSE;
+                else
+                    cchPrecision = nPrecision;
+                ++pch;
+            }
+            for (; *pch >= L'0' && *pch <= L'9'; ++pch)
+                cchPrecision = cchPrecision * 10 + (*pch - L'0');
+        }
+
+        if (*pch == L'h')
+            fNarrow = TRUE, ++pch;
+        else if (*pch == L'l' && pch[1] == L'l')
+            f64 = TRUE, pch += 2;
+        else if (*pch == L'l' || *pch == L'w')
+            ++pch;
+        else if (pch[0] == L'I' && pch[1] == L'6' && pch[2] == L'4')
+            f64 = TRUE, pch += 3;
+        else if (pch[0] == L'I' && pch[1] == L'3' && pch[2] == L'2')
+            pch += 3;
+        else if (*pch == L'I' || *pch == L'z')
+            f64 = (sizeof(SIZE_T) == 8), ++pch;
+
+        switch (*pch)
+        {
+            case L'%':
+                PutChars(&sink, L'%', 1);
+                break;
+
+            case L'c':
+                ch = (WCHAR)va_arg(va, INT);
+                if (fNarrow)
+                    ch = (BYTE)ch;
+                PutField(&sink, &ch, 1, cchWidth, fLeft);
+                break;
+
+            case L's':
+                if (fNarrow)
+                {
+                    // the bytes of a narrow string are Latin-1 here
+                    pszArgA = va_arg(va, LPCSTR);
+                    if (!pszArgA)
+                        pszArgA = "(null)";
+                    for (cch = 0; (!fPrecision || cch < cchPrecision) && pszArgA[cch]; ++cch)
+                        ;
+                    if (!fLeft && cch < cchWidth)
+                        PutChars(&sink, L' ', cchWidth - cch);
+                    for (ich = 0; ich < cch; ++ich)
+                        PutChars(&sink, (BYTE)pszArgA[ich], 1);
+                    if (fLeft && cch < cchWidth)
+                        PutChars(&sink, L' ', cchWidth - cch);
+                    break;
+                }
+                pszArg = va_arg(va, LPCWSTR);
+                if (!pszArg)
+                    pszArg = L"(null)";
+                for (cch = 0; (!fPrecision || cch < cchPrecision) && pszArg[cch]; ++cch)
+                    ;
+                PutField(&sink, pszArg, cch, cchWidth, fLeft);
+                break;
+
+            case L'd': case L'i': case L'u': case L'x': case L'X': case L'o': case L'p':
+                fSigned = (*pch == L'd' || *pch == L'i');
+                uBase = (*pch == L'x' || *pch == L'X' || *pch == L'p') ? 16 : (*pch == L'o' ? 8 : 10);
+                if (*pch == L'p')
+                {
+                    ull = (ULONG_PTR)va_arg(va, LPVOID);
+                    fPrecision = TRUE;
+                    cchPrecision = 2 * sizeof(LPVOID);
+                }
+                else if (f64)
+                {
+                    ull = va_arg(va, ULONGLONG);
+                }
+                else
+                {
+                    ull = fSigned ? (ULONGLONG)(LONGLONG)va_arg(va, INT) : va_arg(va, UINT);
+                }
+
+                chSign = 0;
+                if (fSigned && (LONGLONG)ull < 0)
+                    chSign = L'-', ull = (ULONGLONG)-(LONGLONG)ull;
+                else if (fSigned && fPlus)
+                    chSign = L'+';
+                else if (fSigned && fSpace)
+                    chSign = L' ';
+
+                pchNumber = &szNumber[_countof(szNumber)];
+                while (ull > 0)
+                {
+                    ch = (WCHAR)(ull % uBase);
+                    *--pchNumber = (WCHAR)(ch < 10 ? L'0' + ch : (*pch == L'x' ? L'a' : L'A') + ch - 10);
+                    ull /= uBase;
+                }
+                cch = &szNumber[_countof(szNumber)] - pchNumber;
+                if (!fPrecision)
+                    cchPrecision = 1;
+                while (cch < cchPrecision && cch < _countof(szNumber) - 1)
+                    *--pchNumber = L'0', ++cch;
+                if (fZero && !fLeft && !fPrecision)
+                {
+                    while (cch + !!chSign < cchWidth && cch < _countof(szNumber) - 1)
+                        *--pchNumber = L'0', ++cch;
+                }
+                if (chSign)
+                    *--pchNumber = chSign, ++cch;
+                PutField(&sink, pchNumber, cch, cchWidth, fLeft);
+                break;
+
+            default:
+                // unknown: displayed as it is
+                PutChars(&sink, L'%', 1);
+                if (!*pch)
+                    return sink.cch;
+                PutChars(&sink, *pch, 1);
+                break;
+        }
+    }
+    return sink.cch;
+}
+
+// Returns -1 and doesn't end the string if it doesn't fit, as MSVC does
+INT ShimVsnwprintf(LPWSTR psz, SIZE_T cchMax, LPCWSTR pszFormat, va_list va)
+{
+    SIZE_T cch = FormatCore(psz, cchMax, pszFormat, va);
+    if (cch > cchMax)
+        return -1;
+    if (cch < cchMax)
+        psz[cch] = 0;
+    return (INT)cch;
+}
+
+// Wide text goes to the C streams as UTF-8
+INT ShimFputws(LPCWSTR psz, FILE *fp)
+{
+    INT cch = (INT)ShimWcslen(psz), cb;
+    LPSTR pb;
+    if (cch == 0)
+        return 0;
+    cb = WideCharToMultiByte(CP_UTF8, 0, psz, cch, NULL, 0, NULL, NULL);
+    pb = malloc(cb);
+    if (!pb)
+        return EOF;
+    WideCharToMultiByte(CP_UTF8, 0, psz, cch, pb, cb, NULL, NULL);
+    cb = (INT)fwrite(pb, 1, cb, fp);
+    free(pb);
+    return cb;
+}
+
+INT ShimVfwprintf(FILE *fp, LPCWSTR pszFormat, va_list va)
+{
+    va_list vaCopy;
+    SIZE_T cch;
+    LPWSTR psz;
+    INT ret;
+
+    va_copy(vaCopy, va);
+    cch = FormatCore(NULL, 0, pszFormat, vaCopy);
+    va_end(vaCopy);
+    psz = malloc((cch + 1) * sizeof(WCHAR));
+    if (!psz)
+        return -1;
+    FormatCore(psz, cch + 1, pszFormat, va);
+    psz[cch] = 0;
+    ret = (ShimFputws(psz, fp) == EOF) ? -1 : (INT)cch;
+    free(psz);
+    return ret;
+}
+
+// ----------------------------------------------------------------------------
+// Paths and files
+
+// The UTF-8 path of a Win32 path, with '/' for '\\'
+static char *GetUnixPath(LPCWSTR file)
+{
+    INT cb = WideCharToMultiByte(CP_UTF8, 0, file, -1, NULL, 0, NULL, NULL), ib;
+    char *psz = malloc(cb);
+    if (!psz)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    WideCharToMultiByte(CP_UTF8, 0, file, -1, psz, cb, NULL, NULL);
+    for (ib = 0; psz[ib]; ++ib)
+    {
+        if (psz[ib] == '\\')
+            psz[ib] = '/';
+    }
+    return psz;
+}
+
+// Copies the UTF-8 text as UTF-16. Returns the WCHARs without the null, or
+// the WCHARs that are needed with the null if cchMax is too small.
+static DWORD CopyWide(LPWSTR psz, DWORD cchMax, const char *pszUtf8)
+{
+    INT cch = MultiByteToWideChar(CP_UTF8, 0, pszUtf8, -1, NULL, 0);
+    if ((DWORD)cch > cchMax)
+        return (DWORD)cch;
+    MultiByteToWideChar(CP_UTF8, 0, pszUtf8, -1, psz, cch);
+    return (DWORD)cch - 1;
+}
+
+HANDLE WINAPI CreateFileW(LPCWSTR file, DWORD dwAccess, DWORD dwShare, LPVOID pSecurity,
+                          DWORD dwCreation, DWORD dwFlags, HANDLE hTemplate)
+{
+    SHIMOBJECT *pFile;
+    struct stat st;
+    char *pszPath;
+    int fd, nFlags;
+
+    (void)dwShare;
+    (void)pSecurity;
+    (void)dwFlags;
+    (void)hTemplate;
+
+    nFlags = (dwAccess & GENERIC_WRITE) ? ((dwAccess & GENERIC_READ) ? O_RDWR : O_WRONLY) : O_RDONLY;
+    switch (dwCreation)
+    {
+        case CREATE_NEW:
+            nFlags |= O_CREAT | O_EXCL;
+            break;
+        case CREATE_ALWAYS:
+            nFlags |= O_CREAT | O_TRUNC;
+            break;
+        case OPEN_ALWAYS:
+            nFlags |= O_CREAT;
+            break;
+    }
+
+    pszPath = GetUnixPath(file);
+    if (!pszPath)
+        return INVALID_HANDLE_VALUE;
+    fd = open(pszPath, nFlags | O_CLOEXEC, 0666);
+    free(pszPath);
+    if (fd < 0)
+    {
+        SetErrnoError();
+        return INVALID_HANDLE_VALUE;
+    }
+    if (fstat(fd, &st) == 0 && S_ISDIR(st.st_mode))
+    {
+        // directories are not opened as files
+        close(fd);
+        SetLastError(ERROR_ACCESS_DENIED);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    pFile = NewObject(SHIM_FILE);
+    if (!pFile)
+    {
+        close(fd);
+        return INVALID_HANDLE_VALUE;
+    }
+    pFile->fd = fd;
+    return pFile;
+}
+
+BOOL WINAPI ReadFile(HANDLE hFile, LPVOID pv, DWORD cb, LPDWORD pcbRead, LPOVERLAPPED pov)
+{
+    int fd = GetFd(hFile);
+    ssize_t cbRead;
+    (void)pov;
+    *pcbRead = 0;
+    if (fd < 0)
+        return FALSE;
+    do
+    {
+        cbRead = read(fd, pv, cb);
+    } while (cbRead < 0 && errno == EINTR);
+    if (cbRead < 0)
+    {
+        SetErrnoError();
+        return FALSE;
+    }
+    *pcbRead = (DWORD)cbRead;
+    return TRUE;
+}
+
+BOOL WINAPI WriteFile(HANDLE hFile, LPCVOID pv, DWORD cb, LPDWORD pcbWritten, LPOVERLAPPED pov)
+{
+    const BYTE *pb = pv;
+    int fd = GetFd(hFile);
+    ssize_t cbPart;
+    (void)pov;
+    *pcbWritten = 0;
+    if (fd < 0)
+        return FALSE;
+    while (*pcbWritten < cb)
+    {
+        cbPart = write(fd, pb + *pcbWritten, cb - *pcbWritten);
+        if (cbPart < 0 && errno == EINTR)
+            continue;
+        if (cbPart <= 0)
+        {
+            SetErrnoError();
+            return FALSE;
+        }
+        *pcbWritten += (DWORD)cbPart;
+    }
+    return TRUE;
+}
+
+DWORD WINAPI GetFileType(HANDLE hFile)
+{
+    int fd = GetFd(hFile);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+        return FILE_TYPE_UNKNOWN;
+    if (S_ISREG(st.st_mode))
+        return FILE_TYPE_DISK;
+    if (S_ISCHR(st.st_mode))
+        return FILE_TYPE_CHAR;
+    return FILE_TYPE_PIPE;
+}
+
+DWORD WINAPI GetFileSize(HANDLE hFile, LPDWORD pdwHigh)
+{
+    int fd = GetFd(hFile);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            SetErrnoError();
+        return INVALID_FILE_SIZE;
+    }
+    if (pdwHigh)
+        *pdwHigh = (DWORD)((ULONGLONG)st.st_size >> 32);
+    SetLastError(NO_ERROR);
+    return (DWORD)st.st_size;
+}
+
+// 100-nanosecond intervals since 1601
+static VOID GetFileTime(const struct timespec *pts, FILETIME *pft)
+{
+    ULONGLONG ull = ((ULONGLONG)pts->tv_sec + 11644473600ULL) * 10000000 + pts->tv_nsec / 100;
+    pft->dwLowDateTime = (DWORD)ull;
+    pft->dwHighDateTime = (DWORD)(ull >> 32);
+}
+
+BOOL WINAPI GetFileInformationByHandle(HANDLE hFile, BY_HANDLE_FILE_INFORMATION *pInfo)
+{
+    int fd = GetFd(hFile);
+    struct stat st;
+    if (fd < 0)
+        return FALSE;
+    if (fstat(fd, &st) != 0)
+    {
+        SetErrnoError();
+        return FALSE;
+    }
+    ZeroMemory(pInfo, sizeof(*pInfo));
+    pInfo->dwFileAttributes = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+    GetFileTime(&st.st_ctim, &pInfo->ftCreationTime);
+    GetFileTime(&st.st_atim, &pInfo->ftLastAccessTime);
+    GetFileTime(&st.st_mtim, &pInfo->ftLastWriteTime);
+    pInfo->dwVolumeSerialNumber = (DWORD)st.st_dev;
+    pInfo->nFileSizeHigh = (DWORD)((ULONGLONG)st.st_size >> 32);
+    pInfo->nFileSizeLow = (DWORD)st.st_size;
+    pInfo->nNumberOfLinks = (DWORD)st.st_nlink;
+    pInfo->nFileIndexHigh = (DWORD)((ULONGLONG)st.st_ino >> 32);
+    pInfo->nFileIndexLow = (DWORD)st.st_ino;
+    return TRUE;
+}
+
+static BOOL LockRange(HANDLE hFile, short nType, DWORD cbLow, DWORD cbHigh, LPOVERLAPPED pov)
+{
+    int fd = GetFd(hFile);
+    struct flock lock;
+    if (fd < 0)
+        return FALSE;
+    ZeroMemory(&lock, sizeof(lock));
+    lock.l_type = nType;
+    lock.l_whence = SEEK_SET;
+    lock.l_start = (off_t)(((ULONGLONG)pov->OffsetHigh << 32) | pov->Offset);
+    lock.l_len = (off_t)(((ULONGLONG)cbHigh << 32) | cbLow);
+    while (fcntl(fd, F_SETLKW, &lock) != 0)
+    {
+        if (errno != EINTR)
+        {
+            SetLastError(ERROR_LOCK_VIOLATION);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+BOOL WINAPI LockFileEx(HANDLE hFile, DWORD dwFlags, DWORD dwReserved, DWORD cbLow, DWORD cbHigh,
+                       LPOVERLAPPED pov)
+{
+    (void)dwReserved;
+    return LockRange(hFile, (dwFlags & LOCKFILE_EXCLUSIVE_LOCK) ? F_WRLCK : F_RDLCK,
+                     cbLow, cbHigh, pov);
+}
+
+BOOL WINAPI UnlockFileEx(HANDLE hFile, DWORD dwReserved, DWORD cbLow, DWORD cbHigh,
+                         LPOVERLAPPED pov)
+{
+    (void)dwReserved;
+    return LockRange(hFile, F_UNLCK, cbLow, cbHigh, pov);
+}
+
+BOOL WINAPI GetConsoleMode(HANDLE hConsole, LPDWORD pdwMode)
+{
+    int fd = GetFd(hConsole);
+    *pdwMode = 0;
+    return fd >= 0 && isatty(fd);
+}
+
+DWORD WINAPI GetFullPathNameW(LPCWSTR file, DWORD cchMax, LPWSTR psz, LPWSTR *ppszFilePart)
+{
+    char *pszPath = GetUnixPath(file), *pszFull, szCwd[4096];
+    DWORD ret;
+
+    if (ppszFilePart)
+        *ppszFilePart = NULL;
+    if (!pszPath)
+        return 0;
+    if (pszPath[0] == '/')
+    {
+        pszFull = pszPath;
+    }
+    else
+    {
+        if (!getcwd(szCwd, sizeof(szCwd)) ||
+            !(pszFull = malloc(strlen(szCwd) + strlen(pszPath) + 2)))
+        {
+            free(pszPath);
+            SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+            return 0;
+        }
+        sprintf(pszFull, "%s/%s", szCwd, pszPath);
+        free(pszPath);
+    }
+    ret = CopyWide(psz, cchMax, pszFull);
+    free(pszFull);
+    return ret;
+}
+
+UINT WINAPI GetDriveTypeW(LPCWSTR pszRoot)
+{
+    (void)pszRoot;
+    return DRIVE_FIXED;
+}
+
+static int CompareNames(const void *p0, const void *p1)
+{
+    return strcasecmp(*(char *const *)p0, *(char *const *)p1);
+}
+
+static VOID FillFindData(SHIMOBJECT *pFind, WIN32_FIND_DATAW *pFindData)
+{
+    ZeroMemory(pFindData, sizeof(*pFindData));
+    pFindData->dwFileAttributes = FILE_ATTRIBUTE_NORMAL;
+    CopyWide(pFindData->cFileName, _countof(pFindData->cFileName), pFind->apszNames[pFind->iNext++]);
+}
+
+// The names in the directory of the pattern that match it, in the order of
+// the names regardless of case, as NTFS gives them
+HANDLE WINAPI FindFirstFileW(LPCWSTR pszPattern, WIN32_FIND_DATAW *pFindData)
+{
+    char *pszPath = GetUnixPath(pszPattern), *pszName, **apszNew;
+    const char *pszDir;
+    SHIMOBJECT *pFind;
+    struct dirent *pEntry;
+    DWORD cMax = 0;
+    DIR *pDir;
+
+    if (!pszPath)
+        return INVALID_HANDLE_VALUE;
+    pFind = NewObject(SHIM_FIND);
+    if (!pFind)
+    {
+        free(pszPath);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    pszName = strrchr(pszPath, '/');
+    if (pszName)
+    {
+        *pszName++ = 0;
+        pszDir = (pszPath[0] ? pszPath : "/");
+    }
+    else
+    {
+        pszName = pszPath;
+        pszDir = ".";
+    }
+    if (strcmp(pszName, "*.*") == 0)
+        pszName[1] = 0; // any name, with or without an extension
+
+    pDir = opendir(pszDir);
+    while (pDir && (pEntry = readdir(pDir)) != NULL)
+    {
+        if (fnmatch(pszName, pEntry->d_name, FNM_CASEFOLD) != 0)
+            continue;
+        if (pFind->cNames == cMax)
+        {
+            cMax = max(2 * cMax, 16);
+            apszNew = realloc(pFind->apszNames, cMax * sizeof(char *));
+            if (!apszNew)
+                break;
+            pFind->apszNames = apszNew;
+        }
+        pFind->apszNames[pFind->cNames] = strdup(pEntry->d_name);
+        if (!pFind->apszNames[pFind->cNames])
+            break;
+        ++pFind->cNames;
+    }
+    if (pDir)
+        closedir(pDir);
+    free(pszPath);
+
+    if (pFind->cNames == 0)
+    {
+        CloseHandle(pFind);
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return INVALID_HANDLE_VALUE;
+    }
+    qsort(pFind->apszNames, pFind->cNames, sizeof(char *), CompareNames);
+    FillFindData(pFind, pFindData);
+    return pFind;
+}
+
+BOOL WINAPI FindNextFileW(HANDLE hFind, WIN32_FIND_DATAW *pFindData)
+{
+    SHIMOBJECT *pFind = hFind;
+    if (!pFind || hFind == INVALID_HANDLE_VALUE || pFind->type != SHIM_FIND)
+    {
+        SetLastError(ERROR_INVALID_HANDLE);
+        return FALSE;
+    }
+    if (pFind->iNext >= pFind->cNames)
+    {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+    FillFindData(pFind, pFindData);
+    return TRUE;
+}
+
+BOOL WINAPI FindClose(HANDLE hFind)
+{
+    return CloseHandle(hFind);
+}
+
+// ----------------------------------------------------------------------------
+// File mappings and memory
+
+HANDLE WINAPI CreateFileMappingW(HANDLE hFile, LPVOID pSecurity, DWORD dwProtect,
+                                 DWORD cbHigh, DWORD cbLow, LPCWSTR pszName)
+{
+    int fd = GetFd(hFile);
+    ULONGLONG cb = ((ULONGLONG)cbHigh << 32) | cbLow;
+    SHIMOBJECT *pMapping;
+    struct stat st;
+
+    (void)pSecurity;
+    (void)pszName;
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0)
+    {
+        SetErrnoError();
+        return NULL;
+    }
+    if (cb == 0)
+        cb = (ULONGLONG)st.st_size;
+    if (cb == 0)
+    {
+        SetLastError(ERROR_FILE_INVALID); // an empty file can't be mapped
+        return NULL;
+    }
+    if (cb > (ULONGLONG)st.st_size)
+    {
+        // a writable mapping larger than the file extends it with zeros
+        if (dwProtect != PAGE_READWRITE || ftruncate(fd, (off_t)cb) != 0)
+        {
+            SetLastError(ERROR_ACCESS_DENIED);
+            return NULL;
+        }
+    }
+
+    pMapping = NewObject(SHIM_MAPPING);
+    if (!pMapping)
+        return NULL;
+    pMapping->fd = dup(fd);
+    pMapping->fWrite = (dwProtect == PAGE_READWRITE);
+    pMapping->cb = cb;
+    if (pMapping->fd < 0)
+    {
+        SetErrnoError();
+        CloseHandle(pMapping);
+        return NULL;
+    }
+    return pMapping;
+}
+
+// The views, so that UnmapViewOfFile knows their sizes
+typedef struct SHIMVIEW
+{
+    struct SHIMVIEW *pNext;
+    LPVOID pv;
+    SIZE_T cb;
+} SHIMVIEW;
+
+static SHIMVIEW *s_pViews = NULL;
+static pthread_mutex_t s_viewMutex = PTHREAD_MUTEX_INITIALIZER;
+
+LPVOID WINAPI MapViewOfFile(HANDLE hMapping, DWORD dwAccess, DWORD ibHigh, DWORD ibLow, SIZE_T cb)
+{
+    SHIMOBJECT *pMapping = hMapping;
+    ULONGLONG ib = ((ULONGLONG)ibHigh << 32) | ibLow;
+    SHIMVIEW *pView;
+    LPVOID pv;
+
+    if (!pMapping || pMapping->type != SHIM_MAPPING || ib % (64 * 1024) != 0 ||
+        ib >= pMapping->cb || ((dwAccess & FILE_MAP_WRITE) && !pMapping->fWrite))
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    if (cb == 0)
+        cb = (SIZE_T)(pMapping->cb - ib);
+    if (cb > pMapping->cb - ib)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+
+    pView = malloc(sizeof(SHIMVIEW));
+    if (!pView)
+    {
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+        return NULL;
+    }
+    pv = mmap(NULL, cb, (dwAccess & FILE_MAP_WRITE) ? PROT_READ | PROT_WRITE : PROT_READ,
+              MAP_SHARED, pMapping->fd, (off_t)ib);
+    if (pv == MAP_FAILED)
+    {
+        free(pView);
+        SetErrnoError();
+        return NULL;
+    }
+
+    pView->pv = pv;
+    pView->cb = cb;
+    pthread_mutex_lock(&s_viewMutex);
+    pView->pNext = s_pViews;
+    s_pViews = pView;
+    pthread_mutex_unlock(&s_viewMutex);
+    return pv;
+}
+
+BOOL WINAPI UnmapViewOfFile(LPCVOID pv)
+{
+    SHIMVIEW **ppView, *pView = NULL;
+
+    pthread_mutex_lock(&s_viewMutex);
+    for (ppView = &s_pViews; *ppView; ppView = &(*ppView)->pNext)
+    {
+        if ((*ppView)->pv == pv)
+        {
+            pView = *ppView;
+            *ppView = pView->pNext;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s_viewMutex);
+
+    if (!pView)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+    munmap(pView->pv, pView->cb);
+    free(pView);
+    return TRUE;
+}
+
+// The pages of VirtualAlloc are zeroed
+LPVOID WINAPI VirtualAlloc(LPVOID pv, SIZE_T cb, DWORD dwType, DWORD dwProtect)
+{
+    (void)dwType;
+    (void)dwProtect;
+    if (pv)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return NULL;
+    }
+    pv = calloc(1, cb);
+    if (!pv)
+        SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return pv;
+}
+
+BOOL WINAPI VirtualFree(LPVOID pv, SIZE_T cb, DWORD dwType)
+{
+    (void)cb;
+    (void)dwType;
+    free(pv);
+    return TRUE;
+}
+
+HGLOBAL WINAPI GlobalAlloc(UINT uFlags, SIZE_T cb)
+{
+    (void)uFlags;
+    return malloc(cb);
+}
+
+LPVOID WINAPI GlobalLock(HGLOBAL hMem)
+{
+    return hMem;
+}
+
+HLOCAL WINAPI LocalFree(HLOCAL hMem)
+{
+    free(hMem);
+    return NULL;
+}
+
+VOID WINAPI GetSystemInfo(SYSTEM_INFO *pInfo)
+{
+    long nProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    pInfo->dwPageSize = (DWORD)sysconf(_SC_PAGESIZE);
+    pInfo->dwAllocationGranularity = 64 * 1024;
+    pInfo->dwNumberOfProcessors = (DWORD)(nProcessors > 0 ? nProcessors : 1);
+}
+
+VOID WINAPI GetSystemTimeAsFileTime(FILETIME *pft)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    GetFileTime(&ts, pft);
+}
+
+// ----------------------------------------------------------------------------
+// The command line
+
+static LPWSTR s_pszCommandLine = NULL;
+
+// Quotes the argument as CommandLineToArgvW unquotes it
+static SIZE_T QuoteArg(char *psz, const char *pszArg)
+{
+    SIZE_T cb = 0, cBackslashes;
+    BOOL fQuote = (pszArg[0] == 0 || strpbrk(pszArg, " \t\"") != NULL);
+
+    if (fQuote)
+        psz ? (psz[cb++] = '"') : ++cb;
+    for (; *pszArg; ++pszArg)
+    {
+        for (cBackslashes = 0; *pszArg == '\\'; ++pszArg)
+            ++cBackslashes;
+        if (*pszArg == '"' || (*pszArg == 0 && fQuote))
+            cBackslashes *= 2;
+        for (; cBackslashes > 0; --cBackslashes)
+            psz ? (psz[cb++] = '\\') : ++cb;
+        if (*pszArg == 0)
+            break;
+        if (*pszArg == '"')
+            psz ? (psz[cb++] = '\\') : ++cb;
+        psz ? (psz[cb++] = *pszArg) : ++cb;
+    }
+    if (fQuote)
+        psz ? (psz[cb++] = '"') : ++cb;
+    return cb;
+}
+
+// glibc passes the arguments of main to the constructors too
+__attribute__((constructor)) static void InitCommandLine(int argc, char **argv)
+{
+    SIZE_T cb = 1;
+    char *psz;
+    INT i, cch;
+
+    for (i = 0; i < argc; ++i)
+        cb += QuoteArg(NULL, argv[i]) + 1;
+    psz = malloc(cb);
+    if (!psz)
+        return;
+    for (i = 0, cb = 0; i < argc; ++i)
+    {
+        if (i > 0)
+            psz[cb++] = ' ';
+        cb += QuoteArg(&psz[cb], argv[i]);
+    }
+    psz[cb] = 0;
+
+    cch = MultiByteToWideChar(CP_UTF8, 0, psz, -1, NULL, 0);
+    s_pszCommandLine = malloc(cch * sizeof(WCHAR));
+    if (s_pszCommandLine)
+        MultiByteToWideChar(CP_UTF8, 0, psz, -1, s_pszCommandLine, cch);
+    free(psz);
+}
+
+LPWSTR WINAPI GetCommandLineW(VOID)
+{
+    return s_pszCommandLine ? s_pszCommandLine : (LPWSTR)L"";
+}
+
+// ----------------------------------------------------------------------------
+// The strings of fc.rc, which rcstrings makes into g_aShimStrings. The tests
+// that don't link them have no strings.
+
+typedef struct SHIMSTRING
+{
+    UINT nID;
+    LPCWSTR psz;
+} SHIMSTRING;
+
+extern const SHIMSTRING g_aShimStrings[] __attribute__((weak));
+
+INT WINAPI LoadStringW(HINSTANCE hInstance, UINT nID, LPWSTR psz, INT cchMax)
+{
+    const SHIMSTRING *pString;
+    INT cch;
+
+    (void)hInstance;
+    if (cchMax <= 0)
+        return 0;
+    psz[0] = 0;
+    for (pString = g_aShimStrings; pString && pString->psz; ++pString)
+    {
+        if (pString->nID == nID)
+        {
+            cch = min((INT)ShimWcslen(pString->psz), cchMax - 1);
+            memcpy(psz, pString->psz, cch * sizeof(WCHAR));
+            psz[cch] = 0;
+            return cch;
+        }
+    }
+    return 0;
+}
@@ -5,6 +5,7 @@
  * COPYRIGHT:   Copyright 2021 Katayama Hirofumi MZ (katayama.hirofumi.mz@gmail.com)
  */
 #include "fc.h"
+#include "hash.h"
 
 #define IS_SPACE(ch) ((ch) == TEXT(' ') || (ch) == TEXT('\t'))
 
@@ -14,61 +15,28 @@
 
 #ifdef UNICODE
     #define NODE NODE_W
+    #define FindLineBreak FindLineBreakW
+    #define FindMismatchNoCase FindMismatchNoCaseW
     #define PrintLine PrintLineW
+    #define PrintText PrintTextW
     #define TextCompare TextCompareW
+    #define TextCompareQuiet TextCompareQuietW
 #else
     #define NODE NODE_A
+    #define FindLineBreak FindLineBreakA
+    #define FindMismatchNoCase FindMismatchNoCaseA
     #define PrintLine PrintLineA
+    #define PrintText PrintTextA
     #define TextCompare TextCompareA
+    #define TextCompareQuiet TextCompareQuietA
 #endif
 
-static LPTSTR AllocLine(LPCTSTR pch, DWORD cch)
+// A growable buffer for a normalized line
+typedef struct LINEBUF
 {
-    LPTSTR pszNew = malloc((cch + 1) * sizeof(TCHAR));
-    if (!pszNew)
-        return NULL;
-    memcpy(pszNew, pch, cch * sizeof(TCHAR));
-    pszNew[cch] = 0;
-    return pszNew;
-}
-
-static NODE *AllocNode(LPTSTR psz, DWORD lineno)
-{
-    NODE *node;
-    if (!psz)
-        return NULL;
-    node = calloc(1, sizeof(NODE));
-    if (!node)
-    {
-        free(psz);
-        return NULL;
-    }
-    node->pszLine = psz;
-    node->lineno = lineno;
-    return node;
-}
-
-static __inline VOID DeleteNode(NODE *node)
-{
-    if (node)
-    {
-        free(node->pszLine);
-        free(node->pszComp);
-        free(node);
-    }
-}
-
-static VOID DeleteList(struct list *list)
-{
-    struct list *ptr;
-    NODE *node;
-    while ((ptr = list_head(list)) != NULL)
-    {
-        list_remove(ptr);
-        node = LIST_ENTRY(ptr, NODE, entry);
-        DeleteNode(node);
-    }
-}
+    LPTSTR psz;
+    DWORD cchMax;
+} LINEBUF;
 
 static __inline LPCTSTR SkipSpace(LPCTSTR pch)
 {
@@ -89,7 +57,7 @@ static __inline LPCTSTR FindLastNonSpace(LPCTSTR pch)
     return pchLast;
 }
 
-static VOID DeleteDuplicateSpaces(LPTSTR psz)
+static DWORD DeleteDuplicateSpaces(LPTSTR psz)
 {
     LPTSTR pch0, pch1;
     for (pch0 = pch1 = psz; *pch0; ++pch0)
@@ -105,97 +73,310 @@ static VOID DeleteDuplicateSpaces(LPTSTR psz)
         }
     }
     *pch1 = 0;
+    return (DWORD)(pch1 - psz);
 }
 
-static LPTSTR CompressSpace(LPCTSTR line)
+#define TAB_WIDTH 8
+
+static BOOL ReserveLineBuf(LINEBUF *pBuf, DWORD cch)
 {
     LPTSTR pszNew;
-    LPCTSTR pchLast;
+    if (pBuf->cchMax < cch + 1)
+    {
+        pszNew = realloc(pBuf->psz, (cch + 1) * sizeof(TCHAR));
+        if (!pszNew)
+            return FALSE;
+        pBuf->psz = pszNew;
+        pBuf->cchMax = cch + 1;
+    }
+    return TRUE;
+}
+
+static DWORD ExpandTabLength(const FILECOMPARE *pFC, LPCTSTR pch, DWORD cch)
+{
+    DWORD ich, cchNew = cch;
+    if (!(pFC->dwFlags & FLAG_T))
+    {
+        for (cchNew = ich = 0; ich < cch; ++ich)
+        {
+            if (pch[ich] == TEXT('\t'))
+                cchNew += TAB_WIDTH - (cchNew % TAB_WIDTH);
+            else
+                ++cchNew;
+        }
+    }
+    return cchNew;
+}
+
+// Copies a line into psz, expanding tabs unless /T. psz must have room for
+// ExpandTabLength() + 1 characters. Returns the new length.
+static DWORD ExpandTab(const FILECOMPARE *pFC, LPTSTR psz, LPCTSTR pch, DWORD cch)
+{
+    DWORD ich, cchNew = cch, spaces;
+
+    if (pFC->dwFlags & FLAG_T)
+    {
+        memcpy(psz, pch, cch * sizeof(TCHAR));
+    }
+    else
+    {
+        for (cchNew = ich = 0; ich < cch; ++ich)
+        {
+            if (pch[ich] == TEXT('\t'))
+            {
+                spaces = TAB_WIDTH - (cchNew % TAB_WIDTH);
+                while (spaces-- > 0)
+                    psz[cchNew++] = TEXT(' ');
+            }
+            else
+            {
+                psz[cchNew++] = pch[ich];
+            }
+        }
+    }
+    psz[cchNew] = 0;
+    return cchNew;
+}
 
-    line = SkipSpace(line);
-    pchLast = FindLastNonSpace(line);
-    if (pchLast == NULL)
-        return AllocLine(NULL, 0);
+// Compresses white space in place. Returns the new length.
+static DWORD CompressSpace(LPTSTR psz)
+{
+    LPCTSTR pchFirst = SkipSpace(psz), pchLast = FindLastNonSpace(pchFirst);
+    DWORD cchNew = (pchLast ? (DWORD)(pchLast - pchFirst) + 1 : 0);
+    memmove(psz, pchFirst, cchNew * sizeof(TCHAR));
+    psz[cchNew] = 0;
+    return DeleteDuplicateSpaces(psz);
+}
 
-    pszNew = AllocLine(line, (DWORD)(pchLast - line) + 1);
-    if (!pszNew)
+// Makes a normalized copy of a line into the buffer: tabs are expanded unless
+// /T, and white space is compressed if /W.
+static LPTSTR
+NormalizeLine(const FILECOMPARE *pFC, LINEBUF *pBuf, LPCTSTR pch, DWORD cch, LPDWORD pcchNew)
+{
+    if (!ReserveLineBuf(pBuf, ExpandTabLength(pFC, pch, cch)))
         return NULL;
+    *pcchNew = ExpandTab(pFC, pBuf->psz, pch, cch);
+    if (pFC->dwFlags & FLAG_W)
+        *pcchNew = CompressSpace(pBuf->psz);
+    return pBuf->psz;
+}
 
-    DeleteDuplicateSpaces(pszNew);
-    return pszNew;
+// Whether NormalizeLine would change the line. Most lines are compared as they are.
+static BOOL NeedsNormalize(const FILECOMPARE *pFC, LPCTSTR pch, DWORD cch)
+{
+    DWORD ich;
+    for (ich = 0; ich < cch; ++ich)
+    {
+        if (pch[ich] == TEXT('\t') && !(pFC->dwFlags & FLAG_T))
+            return TRUE;
+        if ((pFC->dwFlags & FLAG_W) && IS_SPACE(pch[ich]) &&
+            (ich == 0 || ich == cch - 1 || IS_SPACE(pch[ich - 1])))
+        {
+            return TRUE;
+        }
+    }
+    return FALSE;
 }
 
-#define TAB_WIDTH 8
+// /C folds the ASCII letters only. The case of the other letters is disregarded
+// by the collation of /LOCALE.
+#define FoldCase(ch) (((ch) >= 'a' && (ch) <= 'z') ? (TCHAR)((ch) - ('a' - 'A')) : (ch))
+
+#ifdef UNICODE
+    #define IS_DBCS_CODEPAGE() FALSE
+#else
+    #define IS_DBCS_CODEPAGE() IsDBCSCodePage()
+#endif
 
-static INT ExpandTabLength(LPCTSTR line)
+// Folds the case of a character for /C. The trail byte of a double-byte
+// character is kept as it is; *pfTrail tells whether the next byte is one.
+static __inline TCHAR FoldChar(TCHAR ch, BOOL fDBCS, BOOL *pfTrail)
 {
-    LPCTSTR pch;
-    INT cch = 0;
-    for (pch = line; *pch; ++pch)
+#ifndef UNICODE
+    if (*pfTrail)
     {
-        if (*pch == TEXT('\t'))
-            cch += TAB_WIDTH - (cch % TAB_WIDTH);
-        else
-            ++cch;
+        *pfTrail = FALSE;
+        return ch;
+    }
+    if (fDBCS && IsDBCSLeadByte((BYTE)ch))
+    {
+        *pfTrail = TRUE;
+        return ch;
     }
-    return cch;
+#endif
+    return FoldCase(ch);
 }
 
-static LPTSTR ExpandTab(LPCTSTR line)
+// Reads the characters of a line as NormalizeLine would make them, without
+// making a copy
+typedef struct NORMREADER
 {
-    INT spaces, cch = ExpandTabLength(line), ich;
-    LPTSTR pszNew = malloc((cch + 1) * sizeof(TCHAR));
     LPCTSTR pch;
-    if (!pszNew)
-        return NULL;
-    ich = 0;
-    for (pch = line; *pch; ++pch)
+    DWORD ich;
+    DWORD ichEnd;
+    DWORD cchColumn; // column in the tab-expanded line
+    DWORD cSpaces; // spaces left of an expanded tab
+    BOOL fExpand;
+    BOOL fCompress;
+} NORMREADER;
+
+static VOID InitNormReader(NORMREADER *pReader, const FILECOMPARE *pFC,
+                           LPCTSTR pch, DWORD cch, BOOL fNormalize)
+{
+    pReader->pch = pch;
+    pReader->ich = 0;
+    pReader->ichEnd = cch;
+    pReader->cchColumn = pReader->cSpaces = 0;
+    pReader->fExpand = fNormalize && !(pFC->dwFlags & FLAG_T);
+    pReader->fCompress = fNormalize && (pFC->dwFlags & FLAG_W);
+    if (pReader->fCompress)
+    {
+        while (pReader->ich < cch && IS_SPACE(pch[pReader->ich]))
+            ++pReader->ich;
+        while (pReader->ichEnd > pReader->ich && IS_SPACE(pch[pReader->ichEnd - 1]))
+            --pReader->ichEnd;
+    }
+}
+
+static __inline BOOL ReadNormChar(NORMREADER *pReader, TCHAR *pch)
+{
+    TCHAR ch;
+
+    if (pReader->cSpaces > 0)
+    {
+        --pReader->cSpaces;
+        *pch = TEXT(' ');
+        return TRUE;
+    }
+    if (pReader->ich >= pReader->ichEnd)
+        return FALSE;
+
+    ch = pReader->pch[pReader->ich++];
+    if (pReader->fCompress && IS_SPACE(ch))
+    {
+        // a run of white space becomes its first character
+        while (pReader->ich < pReader->ichEnd && IS_SPACE(pReader->pch[pReader->ich]))
+            ++pReader->ich;
+        *pch = (pReader->fExpand ? TEXT(' ') : ch);
+        return TRUE;
+    }
+    if (ch == TEXT('\t') && pReader->fExpand)
     {
-        if (*pch == TEXT('\t'))
+        pReader->cSpaces = TAB_WIDTH - 1 - (pReader->cchColumn % TAB_WIDTH);
+        pReader->cchColumn += pReader->cSpaces + 1;
+        *pch = TEXT(' ');
+        return TRUE;
+    }
+    ++pReader->cchColumn;
+    *pch = ch;
+    return TRUE;
+}
+
+#define HASH_BLOCK 64 // characters of a normalized line hashed at once
+
+// Hashes the sort key of the normalized line for /LOCALE, so that the lines
+// that CompareString finds equal have the same hash.
+static ULONGLONG
+GetSortKeyHash(const FILECOMPARE *pFC, LPCTSTR pch, DWORD cch, BOOL fNormalize)
+{
+    LINEBUF buf = { 0 };
+    LPBYTE pbKey = NULL;
+    DWORD dwMapFlags = LCMAP_SORTKEY | ((pFC->dwFlags & FLAG_C) ? NORM_IGNORECASE : 0);
+    INT cbKey = 0;
+    ULONGLONG hash;
+
+    do
+    {
+        if (fNormalize && !(pch = NormalizeLine(pFC, &buf, pch, cch, &cch)))
+            break;
+        if (cch == 0)
+            pch = TEXT(""); // LCMapString can't take an empty string by length
+
+        cbKey = LCMapString(LOCALE_USER_DEFAULT, dwMapFlags, pch, (cch ? (INT)cch : -1), NULL, 0);
+        if (cbKey <= 0 || !(pbKey = malloc(cbKey)))
         {
-            spaces = TAB_WIDTH - (ich % TAB_WIDTH);
-            while (spaces-- > 0)
-            {
-                pszNew[ich++] = TEXT(' ');
-            }
+            cbKey = 0;
+            break;
         }
-        else
+        cbKey = LCMapString(LOCALE_USER_DEFAULT, dwMapFlags, pch, (cch ? (INT)cch : -1),
+                            (LPTSTR)pbKey, cbKey);
+    } while (0);
+
+    hash = HashFinal(HashBytes(HASH_PRIME3, pbKey, cbKey), cbKey);
+    free(pbKey);
+    free(buf.psz);
+    return hash;
+}
+
+// Hashes the line as it is compared: normalized if fNormalize, and with the
+// case folded if /C. The normalized characters are hashed in blocks, so the
+// result is the same as if a normalized copy were hashed.
+static ULONGLONG
+GetHash(const FILECOMPARE *pFC, LPCTSTR pch, DWORD cch, BOOL fNormalize)
+{
+    TCHAR ach[HASH_BLOCK];
+    NORMREADER reader;
+    ULONGLONG acc = HASH_PRIME3;
+    SIZE_T cchTotal = 0;
+    DWORD ich;
+    BOOL bIgnoreCase = !!(pFC->dwFlags & FLAG_C), fDBCS, fTrail = FALSE;
+
+    if (pFC->dwFlags & FLAG_LOCALE)
+        return GetSortKeyHash(pFC, pch, cch, fNormalize);
+    if (!fNormalize && !bIgnoreCase)
+        return HashFinal(HashBytes(acc, (const BYTE *)pch, cch * sizeof(TCHAR)), cch);
+
+    fDBCS = (bIgnoreCase && IS_DBCS_CODEPAGE());
+    InitNormReader(&reader, pFC, pch, cch, fNormalize);
+    do
+    {
+        for (ich = 0; ich < HASH_BLOCK && ReadNormChar(&reader, &ach[ich]); ++ich)
         {
-            pszNew[ich++] = *pch;
+            if (bIgnoreCase)
+                ach[ich] = FoldChar(ach[ich], fDBCS, &fTrail);
         }
-    }
-    pszNew[ich] = 0;
-    return pszNew;
+        acc = HashBytes(acc, (const BYTE *)ach, ich * sizeof(TCHAR));
+        cchTotal += ich;
+    } while (ich == HASH_BLOCK);
+
+    return HashFinal(acc, cchTotal);
 }
 
-#define HASH_EOF 0xFFFFFFFF
-#define HASH_MASK 0x7FFFFFFF
+#define SYM_NONE MAXDWORD
+#define SYM_EOF (MAXDWORD - 1) // the symbol of the EOF node
 
-static DWORD GetHash(LPCTSTR psz, BOOL bIgnoreCase)
+// Makes a node for the line. The line itself stays in the view.
+static NODE *
+AllocNode(const FILECOMPARE *pFC, ARENA *pArena, LPCTSTR pch, DWORD cch, BYTE eol,
+          DWORD lineno)
 {
-    DWORD ret = 0xDEADFACE;
-    while (*psz)
-    {
-        ret += (bIgnoreCase ? towupper(*psz) : *psz);
-        ret <<= 2;
-        ++psz;
-    }
-    return (ret & HASH_MASK);
+    NODE *node = ArenaAlloc(pArena, sizeof(NODE));
+    if (!node)
+        return NULL;
+    ZeroMemory(node, sizeof(*node));
+
+    node->pch = pch;
+    node->cch = cch;
+    node->lineno = lineno;
+    node->eol = eol;
+    node->fNormalize = (BYTE)NeedsNormalize(pFC, pch, cch);
+    node->hash = GetHash(pFC, pch, cch, node->fNormalize);
+    // a patch tells the line breaks apart (see CompareLines)
+    if ((pFC->dwFlags & FLAG_UNIFIED) && eol != EOL_LF)
+        node->hash = HashFinal(HashRound(node->hash, eol), cch);
+    return node;
 }
 
-static NODE *AllocEOFNode(DWORD lineno)
+static NODE *AllocEOFNode(ARENA *pArena, DWORD lineno)
 {
-    NODE *node = AllocNode(AllocLine(NULL, 0), 0);
+    NODE *node = ArenaAlloc(pArena, sizeof(NODE));
     if (node == NULL)
         return NULL;
-    node->pszComp = AllocLine(NULL, 0);
-    if (node->pszComp == NULL)
-    {
-        DeleteNode(node);
-        return NULL;
-    }
+    ZeroMemory(node, sizeof(*node));
+    node->pch = TEXT("");
     node->lineno = lineno;
     node->hash = HASH_EOF;
+    node->sym = SYM_EOF;
     return node;
 }
 
@@ -204,410 +385,2080 @@ static __inline BOOL IsEOFNode(NODE *node)
     return !node || node->hash == HASH_EOF;
 }
 
-static BOOL ConvertNode(const FILECOMPARE *pFC, NODE *node)
+// Compares the normalized lines with CompareString (/LOCALE)
+static FCRET CompareNodeString(const FILECOMPARE *pFC, const NODE *node0, const NODE *node1)
 {
-    if (!(pFC->dwFlags & FLAG_T))
+    LINEBUF buf0 = { 0 }, buf1 = { 0 };
+    LPCTSTR pch0 = node0->pch, pch1 = node1->pch;
+    DWORD dwCmpFlags, cch0 = node0->cch, cch1 = node1->cch;
+    FCRET ret = FCRET_DIFFERENT;
+
+    do
     {
-        LPTSTR tmp = ExpandTab(node->pszLine);
-        if (!tmp)
-            return FALSE;
-        free(node->pszLine);
-        node->pszLine = tmp;
-        if (!(pFC->dwFlags & FLAG_W))
-            node->hash = GetHash(node->pszLine, !!(pFC->dwFlags & FLAG_C));
+        if (node0->fNormalize && !(pch0 = NormalizeLine(pFC, &buf0, pch0, cch0, &cch0)))
+            break;
+        if (node1->fNormalize && !(pch1 = NormalizeLine(pFC, &buf1, pch1, cch1, &cch1)))
+            break;
+
+        dwCmpFlags = ((pFC->dwFlags & FLAG_C) ? NORM_IGNORECASE : 0);
+        if (CompareString(LOCALE_USER_DEFAULT, dwCmpFlags, pch0, cch0, pch1, cch1) == CSTR_EQUAL)
+            ret = FCRET_IDENTICAL;
+    } while (0);
+
+    free(buf0.psz);
+    free(buf1.psz);
+    return ret;
+}
+
+// Compares the characters of the lines as they were hashed
+static FCRET CompareNodeOrdinal(const FILECOMPARE *pFC, const NODE *node0, const NODE *node1)
+{
+    NORMREADER reader0, reader1;
+    TCHAR ch0, ch1;
+    BOOL fMore0, fMore1, fTrail0 = FALSE, fTrail1 = FALSE;
+    BOOL bIgnoreCase = !!(pFC->dwFlags & FLAG_C), fDBCS = (bIgnoreCase && IS_DBCS_CODEPAGE());
+
+    if (!node0->fNormalize && !node1->fNormalize && !fDBCS)
+    {
+        // the lines differ unless only in case
+        if (!bIgnoreCase || node0->cch != node1->cch ||
+            FindMismatchNoCase(node0->pch, node1->pch, node0->cch) < node0->cch)
+        {
+            return FCRET_DIFFERENT;
+        }
+        return FCRET_IDENTICAL;
     }
-    if (pFC->dwFlags & FLAG_W)
+
+    InitNormReader(&reader0, pFC, node0->pch, node0->cch, node0->fNormalize);
+    InitNormReader(&reader1, pFC, node1->pch, node1->cch, node1->fNormalize);
+    for (;;)
     {
-        node->pszComp = CompressSpace(node->pszLine);
-        if (!node->pszComp)
-            return FALSE;
-        node->hash = GetHash(node->pszComp, !!(pFC->dwFlags & FLAG_C));
+        fMore0 = ReadNormChar(&reader0, &ch0);
+        fMore1 = ReadNormChar(&reader1, &ch1);
+        if (!fMore0 || !fMore1)
+            return ((!fMore0 && !fMore1) ? FCRET_IDENTICAL : FCRET_DIFFERENT);
+        if (bIgnoreCase)
+        {
+            ch0 = FoldChar(ch0, fDBCS, &fTrail0);
+            ch1 = FoldChar(ch1, fDBCS, &fTrail1);
+        }
+        if (ch0 != ch1)
+            return FCRET_DIFFERENT;
     }
-    return TRUE;
 }
 
-static FCRET CompareNode(const FILECOMPARE *pFC, const NODE *node0, const NODE *node1)
+// Compares two lines. The lines are compared by their characters, and by the
+// collation of the user locale if /LOCALE.
+static FCRET CompareLines(const FILECOMPARE *pFC, const NODE *node0, const NODE *node1)
 {
-    DWORD dwCmpFlags;
-    LPTSTR psz0, psz1;
-    INT ret;
     if (node0->hash != node1->hash)
         return FCRET_DIFFERENT;
+    if ((pFC->dwFlags & FLAG_UNIFIED) && node0->eol != node1->eol)
+        return FCRET_DIFFERENT;
+    if (node0->cch == node1->cch && memcmp(node0->pch, node1->pch, node0->cch * sizeof(TCHAR)) == 0)
+        return FCRET_IDENTICAL;
+    if (pFC->dwFlags & FLAG_LOCALE)
+        return CompareNodeString(pFC, node0, node1);
+    return CompareNodeOrdinal(pFC, node0, node1);
+}
+
+#define MIN_SYM_SLOTS 1024
 
-    psz0 = (pFC->dwFlags & FLAG_W) ? node0->pszComp : node0->pszLine;
-    psz1 = (pFC->dwFlags & FLAG_W) ? node1->pszComp : node1->pszLine;
-    dwCmpFlags = ((pFC->dwFlags & FLAG_C) ? NORM_IGNORECASE : 0);
-    ret = CompareString(LOCALE_USER_DEFAULT, dwCmpFlags, psz0, -1, psz1, -1);
-    return (ret == CSTR_EQUAL) ? FCRET_IDENTICAL : FCRET_DIFFERENT;
+static VOID InitSymTab(LINESYMTAB *pTab)
+{
+    ZeroMemory(pTab, sizeof(*pTab));
+    pTab->iFree = SYM_NONE;
 }
 
-static BOOL FindNextLine(LPCTSTR pch, DWORD ich, DWORD cch, LPDWORD pich)
+static VOID FreeSymTab(LINESYMTAB *pTab)
 {
-    while (ich < cch)
-    {
-        if (pch[ich] == TEXT('\n') || pch[ich] == TEXT('\0'))
-        {
-            *pich = ich;
-            return TRUE;
-        }
-        ++ich;
-    }
-    *pich = cch;
-    return FALSE;
+    free(pTab->pSyms);
+    free(pTab->pSlots);
+    InitSymTab(pTab);
 }
 
-static FCRET
-ParseLines(const FILECOMPARE *pFC, HANDLE *phMapping,
-           LARGE_INTEGER *pib, const LARGE_INTEGER *pcb, struct list *list)
+static __inline SIZE_T SymTabSize(const LINESYMTAB *pTab)
 {
-    DWORD lineno = 1, ich, cch, ichNext, cbView, cchNode;
-    LPTSTR psz, pszLine;
-    BOOL fLast, bCR;
-    NODE *node;
+    return pTab->cSymsMax * sizeof(LINESYM) + pTab->cSlots * sizeof(DWORD);
+}
 
-    if (*phMapping == NULL)
-        return FCRET_NO_MORE_DATA;
+// Doubles the slots. The table is kept at most half full.
+static BOOL GrowSymSlots(LINESYMTAB *pTab)
+{
+    DWORD cSlots = max(MIN_SYM_SLOTS, 2 * pTab->cSlots), sym, iSlot;
+    LPDWORD pSlots = calloc(cSlots, sizeof(DWORD));
+    if (!pSlots)
+        return FALSE;
 
-    if (pib->QuadPart >= pcb->QuadPart)
+    for (sym = 0; sym < pTab->cSyms; ++sym)
     {
-        CloseHandle(*phMapping);
-        *phMapping = NULL;
-        return FCRET_NO_MORE_DATA;
+        if (!pTab->pSyms[sym].cRefs[0] && !pTab->pSyms[sym].cRefs[1])
+            continue;
+        iSlot = (DWORD)pTab->pSyms[sym].hash & (cSlots - 1);
+        while (pSlots[iSlot])
+            iSlot = (iSlot + 1) & (cSlots - 1);
+        pSlots[iSlot] = sym + 1;
     }
 
-    cbView = (DWORD)min(pcb->QuadPart - pib->QuadPart, MAX_VIEW_SIZE);
-    psz = MapViewOfFile(*phMapping, FILE_MAP_READ, pib->HighPart, pib->LowPart, cbView);
-    if (!psz)
+    free(pTab->pSlots);
+    pTab->pSlots = pSlots;
+    pTab->cSlots = cSlots;
+    return TRUE;
+}
+
+static DWORD NewSym(LINESYMTAB *pTab, ULONGLONG hash)
+{
+    LINESYM *pSyms;
+    DWORD sym, cSymsMax;
+
+    if (pTab->iFree != SYM_NONE)
     {
-        return OutOfMemory();
+        sym = pTab->iFree;
+        pTab->iFree = pTab->pSyms[sym].iNextFree;
     }
-
-    ich = 0;
-    cch = cbView / sizeof(TCHAR);
-    fLast = (pib->QuadPart + cbView >= pcb->QuadPart);
-    while (ich < cch &&
-           (FindNextLine(psz, ich, cch, &ichNext) ||
-            (ichNext == cch && (fLast || ich == 0))))
+    else
     {
-        bCR = (ichNext > 0) && (psz[ichNext - 1] == TEXT('\r'));
-        cchNode = ichNext - ich - bCR;
-        pszLine = AllocLine(&psz[ich], cchNode);
-        node = AllocNode(pszLine, lineno++);
-        if (!node || !ConvertNode(pFC, node))
+        if (pTab->cSyms >= pTab->cSymsMax)
         {
-            DeleteNode(node);
-            UnmapViewOfFile(psz);
-            return OutOfMemory();
+            if (pTab->cSymsMax > MAXDWORD / (2 * sizeof(LINESYM)))
+                return SYM_NONE;
+            cSymsMax = max(MIN_SYM_SLOTS, 2 * pTab->cSymsMax);
+            pSyms = realloc(pTab->pSyms, cSymsMax * sizeof(LINESYM));
+            if (!pSyms)
+                return SYM_NONE;
+            pTab->pSyms = pSyms;
+            pTab->cSymsMax = cSymsMax;
         }
-        list_add_tail(list, &node->entry);
-        ich = ichNext + 1;
+        sym = pTab->cSyms++;
     }
 
-    UnmapViewOfFile(psz);
+    ZeroMemory(&pTab->pSyms[sym], sizeof(LINESYM));
+    pTab->pSyms[sym].hash = hash;
+    ++pTab->cLive;
+    return sym;
+}
 
-    pib->QuadPart += ichNext * sizeof(WCHAR);
+// Tells whether the node is a line of the symbol. A symbol whose nodes are
+// all dropped (fKeep) is known by the hash of its line alone.
+static BOOL IsSymLine(const FILECOMPARE *pFC, const LINESYM *pSym, const NODE *node)
+{
+    const NODE *rep = (pSym->pRep[0] ? pSym->pRep[0] : pSym->pRep[1]);
+    return pSym->hash == node->hash && (!rep || CompareLines(pFC, rep, node) == FCRET_IDENTICAL);
+}
 
-    if (pib->QuadPart < pcb->QuadPart)
-        return FCRET_IDENTICAL;
+// Gives the node the symbol of its line. The node is the newest of window i.
+static BOOL InternNode(FILECOMPARE *pFC, INT i, NODE *node)
+{
+    LINESYMTAB *pTab = &pFC->symtab;
+    LINESYM *pSym;
+    DWORD iSlot, sym;
 
-    // append EOF node
-    node = AllocEOFNode(lineno);
-    if (!node)
-        return OutOfMemory();
-    list_add_tail(list, &node->entry);
+    if (2 * (pTab->cLive + 1) > pTab->cSlots && !GrowSymSlots(pTab))
+        return FALSE;
+
+    for (iSlot = (DWORD)node->hash & (pTab->cSlots - 1); pTab->pSlots[iSlot];
+         iSlot = (iSlot + 1) & (pTab->cSlots - 1))
+    {
+        sym = pTab->pSlots[iSlot] - 1;
+        if (IsSymLine(pFC, &pTab->pSyms[sym], node))
+            break;
+    }
+
+    if (!pTab->pSlots[iSlot])
+    {
+        sym = NewSym(pTab, node->hash);
+        if (sym == SYM_NONE)
+            return FALSE;
+        pTab->pSlots[iSlot] = sym + 1;
+    }
 
-    return FCRET_NO_MORE_DATA;
+    pSym = &pTab->pSyms[sym];
+    pSym->pRep[i] = node;
+    ++pSym->cRefs[i];
+    node->sym = sym;
+    return TRUE;
 }
 
-static VOID
-ShowDiff(FILECOMPARE *pFC, INT i, struct list *begin, struct list *end)
+// Releases the symbol of a node dropped from window i. The nodes of a window
+// are dropped oldest first, so pRep[i] is the last one of the line there.
+static VOID ReleaseNode(FILECOMPARE *pFC, INT i, const NODE *node)
 {
-    NODE* node;
-    struct list *list = &pFC->list[i];
-    struct list *first = NULL, *last = NULL;
-    PrintCaption(pFC->file[i]);
-    if (begin && end && list_prev(list, begin))
-        begin = list_prev(list, begin);
-    while (begin != end)
+    LINESYMTAB *pTab = &pFC->symtab;
+    LINESYM *pSym;
+    DWORD iSlot, iNext, iHome, mask = pTab->cSlots - 1;
+
+    if (node->sym == SYM_EOF)
+        return;
+    pSym = &pTab->pSyms[node->sym];
+    if (pTab->fKeep)
     {
-        node = LIST_ENTRY(begin, NODE, entry);
-        if (IsEOFNode(node))
-            break;
-        if (!first)
-            first = begin;
-        last = begin;
-        if (!(pFC->dwFlags & FLAG_A))
-            PrintLine(pFC, node->lineno, node->pszLine);
-        begin = list_next(list, begin);
+        // the symbol stays for the lines that come later
+        if (pSym->pRep[i] == node)
+            pSym->pRep[i] = NULL;
+        return;
     }
-    if ((pFC->dwFlags & FLAG_A) && first)
+    if (--pSym->cRefs[i] > 0)
+        return;
+    pSym->pRep[i] = NULL;
+    if (pSym->cRefs[!i] > 0)
+        return;
+
+    // remove the slot, moving the following ones back to keep the probes short
+    iSlot = (DWORD)pSym->hash & mask;
+    while (pTab->pSlots[iSlot] != node->sym + 1)
+        iSlot = (iSlot + 1) & mask;
+    for (iNext = (iSlot + 1) & mask; pTab->pSlots[iNext]; iNext = (iNext + 1) & mask)
     {
-        node = LIST_ENTRY(first, NODE, entry);
-        PrintLine(pFC, node->lineno, node->pszLine);
-        first = list_next(list, first);
-        if (first != last)
+        iHome = (DWORD)pTab->pSyms[pTab->pSlots[iNext] - 1].hash & mask;
+        if (((iNext - iHome) & mask) >= ((iNext - iSlot) & mask))
         {
-            if (list_next(list, first) == last)
-            {
-                node = LIST_ENTRY(first, NODE, entry);
-                PrintLine(pFC, node->lineno, node->pszLine);
-            }
-            else
-            {
-                PrintDots();
-            }
+            pTab->pSlots[iSlot] = pTab->pSlots[iNext];
+            iSlot = iNext;
         }
-        node = LIST_ENTRY(last, NODE, entry);
-        PrintLine(pFC, node->lineno, node->pszLine);
     }
+    pTab->pSlots[iSlot] = 0;
+
+    pSym->iNextFree = pTab->iFree;
+    pTab->iFree = node->sym;
+    --pTab->cLive;
 }
 
-static VOID
-SkipIdentical(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1)
+// Compares two lines in the windows by their symbols
+static __inline FCRET CompareNode(const FILECOMPARE *pFC, const NODE *node0, const NODE *node1)
 {
-    struct list *ptr0 = *pptr0, *ptr1 = *pptr1;
-    while (ptr0 && ptr1)
-    {
-        NODE *node0 = LIST_ENTRY(ptr0, NODE, entry);
-        NODE *node1 = LIST_ENTRY(ptr1, NODE, entry);
-        if (CompareNode(pFC, node0, node1) != FCRET_IDENTICAL)
-            break;
-        ptr0 = list_next(&pFC->list[0], ptr0);
-        ptr1 = list_next(&pFC->list[1], ptr1);
-    }
-    *pptr0 = ptr0;
-    *pptr1 = ptr1;
+    return (node0->sym == node1->sym) ? FCRET_IDENTICAL : FCRET_DIFFERENT;
 }
 
-static DWORD
-SkipIdenticalN(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1,
-               DWORD nnnn, DWORD lineno0, DWORD lineno1)
+static __inline BOOL FindNextLine(LPCTSTR pch, SIZE_T ich, SIZE_T cch, SIZE_T *pich)
 {
-    struct list *ptr0 = *pptr0, *ptr1 = *pptr1;
-    DWORD count = 0;
-    while (ptr0 && ptr1)
+    ich += FindLineBreak(&pch[ich], cch - ich);
+    *pich = ich;
+    return ich < cch;
+}
+
+#define LINES_PER_CHUNK 16384
+#define LINES_PER_PARSE 256
+
+// The nodes of a window are allocated from a series of arenas, so that the
+// oldest ones can be freed as the window slides.
+typedef struct LINECHUNK
+{
+    struct list entry;
+    ARENA arena;
+    DWORD cNodes;
+    DWORD cDropped;
+} LINECHUNK;
+
+static VOID FreeChunk(LINEWINDOW *pWindow, LINECHUNK *pChunk)
+{
+    list_remove(&pChunk->entry);
+    pWindow->cbArena -= pChunk->arena.cbTotal;
+    FreeArena(&pChunk->arena);
+    free(pChunk);
+}
+
+// Frees the oldest chunks whose nodes are all dropped. The newest chunk is
+// kept because it is being filled.
+static VOID FreeDroppedChunks(LINEWINDOW *pWindow)
+{
+    struct list *ptr;
+    LINECHUNK *pChunk;
+    while ((ptr = list_head(&pWindow->chunks)) != list_tail(&pWindow->chunks))
     {
-        NODE *node0 = LIST_ENTRY(ptr0, NODE, entry);
-        NODE *node1 = LIST_ENTRY(ptr1, NODE, entry);
-        if (node0->lineno >= lineno0)
-            break;
-        if (node1->lineno >= lineno1)
-            break;
-        if (CompareNode(pFC, node0, node1) != FCRET_IDENTICAL)
-            break;
-        ptr0 = list_next(&pFC->list[0], ptr0);
-        ptr1 = list_next(&pFC->list[1], ptr1);
-        ++count;
-        if (count >= nnnn)
+        pChunk = LIST_ENTRY(ptr, LINECHUNK, entry);
+        if (pChunk->cDropped < pChunk->cNodes)
             break;
+        FreeChunk(pWindow, pChunk);
     }
-    *pptr0 = ptr0;
-    *pptr1 = ptr1;
-    return count;
 }
 
-static FCRET
-ScanDiff(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1,
-         DWORD lineno0, DWORD lineno1)
+static VOID InitWindow(LINEWINDOW *pWindow, FCINPUT *pInput)
+{
+    ZeroMemory(pWindow, sizeof(*pWindow));
+    list_init(&pWindow->list);
+    list_init(&pWindow->chunks);
+    pWindow->pInput = pInput;
+    pWindow->ibNext = pInput->ibText;
+    pWindow->lineno = 1;
+}
+
+static VOID FreeWindow(LINEWINDOW *pWindow)
+{
+    struct list *ptr;
+    while ((ptr = list_head(&pWindow->chunks)) != NULL)
+        FreeChunk(pWindow, LIST_ENTRY(ptr, LINECHUNK, entry));
+    list_init(&pWindow->list);
+}
+
+static __inline BOOL HasFailed(const FILECOMPARE *pFC)
+{
+    return pFC->window[0].fFailed || pFC->window[1].fFailed;
+}
+
+// Appends a node for the line, or the EOF node if pch is NULL
+static BOOL AddNode(FILECOMPARE *pFC, INT i, LPCTSTR pch, DWORD cch, BYTE eol)
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+    struct list *ptr = list_tail(&pWindow->chunks);
+    LINECHUNK *pChunk = (ptr ? LIST_ENTRY(ptr, LINECHUNK, entry) : NULL);
+    SIZE_T cbArena;
+    NODE *node;
+
+    if (!pChunk || pChunk->cNodes >= LINES_PER_CHUNK)
+    {
+        pChunk = malloc(sizeof(*pChunk));
+        if (!pChunk)
+            return FALSE;
+        InitArena(&pChunk->arena);
+        pChunk->cNodes = pChunk->cDropped = 0;
+        list_add_tail(&pWindow->chunks, &pChunk->entry);
+        FreeDroppedChunks(pWindow);
+    }
+
+    cbArena = pChunk->arena.cbTotal;
+    if (pch)
+        node = AllocNode(pFC, &pChunk->arena, pch, cch, eol, pWindow->lineno++);
+    else
+        node = AllocEOFNode(&pChunk->arena, pWindow->lineno);
+    pWindow->cbArena += pChunk->arena.cbTotal - cbArena;
+    if (!node || (pch && !InternNode(pFC, i, node)))
+        return FALSE;
+
+    ++pChunk->cNodes;
+    list_add_tail(&pWindow->list, &node->entry);
+    return TRUE;
+}
+
+// Drops the lines before keep (or all the lines if keep is NULL). They are
+// behind the sync point and no longer needed.
+static VOID DropLines(FILECOMPARE *pFC, INT i, struct list *keep)
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+    struct list *ptr;
+    LINECHUNK *pChunk;
+    BOOL fDropped = FALSE;
+
+    while ((ptr = list_head(&pWindow->list)) != NULL && ptr != keep)
+    {
+        ReleaseNode(pFC, i, LIST_ENTRY(ptr, NODE, entry));
+        list_remove(ptr);
+        // the nodes are dropped in the order they were allocated
+        pChunk = LIST_ENTRY(list_head(&pWindow->chunks), LINECHUNK, entry);
+        ++pChunk->cDropped;
+        fDropped = TRUE;
+    }
+    if (fDropped)
+        FreeDroppedChunks(pWindow);
+}
+
+// Gets a new view that starts at the oldest line in memory and reaches
+// further than the current one. The nodes are moved to the new view.
+static BOOL MoveView(FILECOMPARE *pFC, LINEWINDOW *pWindow)
+{
+    const BYTE *pbOld = pWindow->pbView;
+    LONGLONG ibOld = pWindow->ibView, ibHead = pWindow->ibNext, cbSpan;
+    struct list *ptr;
+    LPCVOID pv;
+    DWORD cbMax;
+    NODE *node;
+
+    ptr = list_head(&pWindow->list);
+    if (ptr)
+    {
+        node = LIST_ENTRY(ptr, NODE, entry);
+        ibHead = ibOld + ((const BYTE *)node->pch - pbOld);
+    }
+
+    // ask for twice as much as is kept, so that the view always moves on
+    cbSpan = ibOld + pWindow->cbView - ibHead;
+    if (cbSpan >= MAXDWORD / 2)
+    {
+        pWindow->fFailed = TRUE;
+        OutOfMemory();
+        return FALSE;
+    }
+    cbMax = (DWORD)max(MAX_VIEW_SIZE, 2 * cbSpan);
+
+    if (!GetInputView(pWindow->pInput, ibHead, cbMax, &pv, &pWindow->cbView, &pWindow->fLast))
+    {
+        pWindow->fFailed = TRUE;
+        CannotRead(pWindow->pInput->file);
+        return FALSE;
+    }
+    pWindow->pbView = pv;
+    pWindow->ibView = ibHead;
+
+    LIST_FOR_EACH(ptr, &pWindow->list)
+    {
+        node = LIST_ENTRY(ptr, NODE, entry);
+        node->pch = (LPCTSTR)(pWindow->pbView +
+                              (ibOld + ((const BYTE *)node->pch - pbOld) - ibHead));
+    }
+    return TRUE;
+}
+
+// Parses some more lines of the input into the window. The EOF node is
+// appended at the end of the input.
+static BOOL ParseLines(FILECOMPARE *pFC, INT i)
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+    SIZE_T ich, cch, cchAvail, ichNext, cb;
+    DWORD cchLine, cLines = 0;
+    BOOL fBreak, fEnd;
+    BYTE eol;
+    LPCTSTR pch;
+
+    while (cLines < LINES_PER_PARSE && !pWindow->fEOF)
+    {
+        pch = (LPCTSTR)pWindow->pbView;
+        ich = (SIZE_T)(pWindow->ibNext - pWindow->ibView) / sizeof(TCHAR);
+        cch = pWindow->cbView / sizeof(TCHAR);
+        if (ich >= cch && pWindow->fLast)
+        {
+            pWindow->fEOF = TRUE;
+            if (pWindow->lineno == 1)
+                break; // empty
+            if (!AddNode(pFC, i, NULL, 0, EOL_NONE))
+                goto nomem;
+            break;
+        }
+
+        // A line that is longer than MAX_VIEW_SIZE is split every
+        // MAX_VIEW_SIZE bytes, so that any view gives the same lines.
+        cchAvail = min(cch, ich + MAX_VIEW_SIZE / sizeof(TCHAR) + 1);
+        fBreak = (ich < cchAvail && FindNextLine(pch, ich, cchAvail, &ichNext));
+        if (!fBreak)
+        {
+            if (ich < cch && cch - ich > MAX_VIEW_SIZE / sizeof(TCHAR))
+            {
+                ichNext = ich + MAX_VIEW_SIZE / sizeof(TCHAR);
+            }
+            else if (!pWindow->fLast)
+            {
+                // the line goes on beyond the view
+                if (!MoveView(pFC, pWindow))
+                    return FALSE;
+                continue;
+            }
+            else
+            {
+                ichNext = cch;
+            }
+        }
+
+        // The CR of the last line is dropped even without a LF after it. A
+        // split line goes on as if it had a LF.
+        fEnd = (!fBreak && ichNext == cch);
+        cchLine = (DWORD)(ichNext - ich);
+        eol = (fEnd ? EOL_NONE : EOL_LF);
+        if ((fBreak || fEnd) && cchLine > 0 && pch[ichNext - 1] == TEXT('\r'))
+        {
+            --cchLine;
+            eol = (fEnd ? EOL_CR : EOL_CRLF);
+        }
+        if (pWindow->ibTail && pWindow->ibNext == pWindow->ibTail)
+            pWindow->linenoTail = pWindow->lineno;
+        if (!AddNode(pFC, i, &pch[ich], cchLine, eol))
+            goto nomem;
+        pWindow->ibNext = pWindow->ibView + (ichNext + fBreak) * sizeof(TCHAR);
+        ++cLines;
+    }
+
+    cb = pFC->window[0].cbArena + pFC->window[1].cbArena + SymTabSize(&pFC->symtab);
+    if (pFC->cbPeak < cb)
+        pFC->cbPeak = cb;
+    return TRUE;
+
+nomem:
+    pWindow->fFailed = TRUE;
+    OutOfMemory();
+    return FALSE;
+}
+
+static struct list *FirstLine(FILECOMPARE *pFC, INT i)
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+    if (list_empty(&pWindow->list) && !pWindow->fEOF)
+        ParseLines(pFC, i);
+    return list_head(&pWindow->list);
+}
+
+// Gets the line after ptr, parsing more lines as needed
+static struct list *NextLine(FILECOMPARE *pFC, INT i, struct list *ptr)
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+    struct list *next = list_next(&pWindow->list, ptr);
+    if (!next && !pWindow->fEOF && ParseLines(pFC, i))
+        next = list_next(&pWindow->list, ptr);
+    return next;
+}
+
+#define IS_WORD_CHAR(ch) \
+    (((ch) >= TEXT('0') && (ch) <= TEXT('9')) || ((ch) >= TEXT('A') && (ch) <= TEXT('Z')) || \
+     ((ch) >= TEXT('a') && (ch) <= TEXT('z')) || (ch) == TEXT('_') || (UINT)(ch) >= 0x80)
+#define IS_LOW_SURROGATE_CHAR(ch) ((ch) >= 0xDC00 && (ch) <= 0xDFFF)
+
+// Moves ich back to the start of its character
+static DWORD CharStart(LPCTSTR pch, DWORD ich, BOOL fDBCS)
+{
+#ifdef UNICODE
+    if (ich > 0 && IS_LOW_SURROGATE_CHAR(pch[ich]))
+        --ich;
+#else
+    DWORD ichChar, ichNext;
+    if (fDBCS)
+    {
+        for (ichChar = ichNext = 0; ichNext < ich;
+             ichNext += (IsDBCSLeadByte((BYTE)pch[ichNext]) ? 2 : 1))
+        {
+            ichChar = ichNext;
+        }
+        if (ichNext != ich)
+            ich = ichChar;
+    }
+#endif
+    return ich;
+}
+
+// Moves ich forward to the end of its character, from ichStart at the start of one
+static DWORD CharEnd(LPCTSTR pch, DWORD cch, DWORD ichStart, DWORD ich, BOOL fDBCS)
+{
+#ifdef UNICODE
+    if (ich > ichStart && ich < cch && IS_LOW_SURROGATE_CHAR(pch[ich]))
+        ++ich;
+#else
+    if (fDBCS)
+    {
+        while (ichStart < ich)
+            ichStart += (IsDBCSLeadByte((BYTE)pch[ichStart]) ? 2 : 1);
+        ich = min(ichStart, cch);
+    }
+#endif
+    return ich;
+}
+
+#ifndef UNICODE
+// Cuts a head that /C found the same in a double-byte code page before the
+// first double-byte character whose trail bytes differ, as FoldChar keeps them
+static DWORD CutHeadAtTrail(LPCSTR pch0, LPCSTR pch1, DWORD ichHead)
+{
+    DWORD ich;
+    for (ich = 0; ich + 1 < ichHead; ich += (IsDBCSLeadByte((BYTE)pch0[ich]) ? 2 : 1))
+    {
+        if (IsDBCSLeadByte((BYTE)pch0[ich]) && pch0[ich + 1] != pch1[ich + 1])
+            return ich;
+    }
+    return ichHead;
+}
+#endif
+
+// Finds the characters of a pair of changed lines that differ (/INLINE): the
+// characters between their common head and tail. The head and the tail are
+// found by the vector scans of scan.c, so long lines cost little.
+static VOID MarkLine(const FILECOMPARE *pFC, const NODE *node0, const NODE *node1,
+                     INLINEMARK *pMark0, INLINEMARK *pMark1)
+{
+    LPCTSTR pch0 = node0->pch, pch1 = node1->pch;
+    DWORD cch0 = node0->cch, cch1 = node1->cch, ichHead, cchTail = 0, cchMax;
+    BOOL fDBCS = IS_DBCS_CODEPAGE();
+
+    if (pFC->dwFlags & FLAG_C)
+    {
+        ichHead = (DWORD)FindMismatchNoCase(pch0, pch1, min(cch0, cch1));
+#ifndef UNICODE
+        if (fDBCS)
+            ichHead = CutHeadAtTrail(pch0, pch1, ichHead);
+#endif
+    }
+    else
+        ichHead = (DWORD)(FindMismatch(pch0, pch1, min(cch0, cch1) * sizeof(TCHAR)) / sizeof(TCHAR));
+    ichHead = CharStart(pch0, ichHead, fDBCS);
+
+    // the tail doesn't overlap the head
+    cchMax = min(cch0, cch1) - ichHead;
+    for (;;)
+    {
+        cchTail += (DWORD)(FindMismatchBack(&pch0[cch0 - cchMax], &pch1[cch1 - cchMax],
+                                            (cchMax - cchTail) * sizeof(TCHAR)) / sizeof(TCHAR));
+        // /C doesn't fold the trail bytes of double-byte characters
+        if (cchTail == cchMax || !(pFC->dwFlags & FLAG_C) ||
+            FoldCase(pch0[cch0 - cchTail - 1]) != FoldCase(pch1[cch1 - cchTail - 1]) ||
+            (fDBCS && (CharStart(pch0, cch0 - cchTail - 1, TRUE) != cch0 - cchTail - 1 ||
+                       CharStart(pch1, cch1 - cchTail - 1, TRUE) != cch1 - cchTail - 1)))
+        {
+            break;
+        }
+        ++cchTail;
+    }
+
+    if (pFC->dwFlags & FLAG_INLINE_WORD)
+    {
+        // a word that is changed in part is marked as a whole
+        if (ichHead > 0 && IS_WORD_CHAR(pch0[ichHead - 1]) &&
+            ((ichHead < cch0 && IS_WORD_CHAR(pch0[ichHead])) ||
+             (ichHead < cch1 && IS_WORD_CHAR(pch1[ichHead]))))
+        {
+            while (ichHead > 0 && IS_WORD_CHAR(pch0[ichHead - 1]))
+                --ichHead;
+        }
+        if (cchTail > 0 && IS_WORD_CHAR(pch0[cch0 - cchTail]) &&
+            ((cch0 - cchTail > ichHead && IS_WORD_CHAR(pch0[cch0 - cchTail - 1])) ||
+             (cch1 - cchTail > ichHead && IS_WORD_CHAR(pch1[cch1 - cchTail - 1]))))
+        {
+            while (cchTail > 0 && IS_WORD_CHAR(pch0[cch0 - cchTail]))
+                --cchTail;
+        }
+    }
+
+    pMark0->lineno = node0->lineno;
+    pMark0->ichBegin = ichHead;
+    pMark0->ichEnd = CharEnd(pch0, cch0, ichHead, cch0 - cchTail, fDBCS);
+    pMark1->lineno = node1->lineno;
+    pMark1->ichBegin = ichHead;
+    pMark1->ichEnd = CharEnd(pch1, cch1, ichHead, cch1 - cchTail, fDBCS);
+}
+
+// Pairs the changed lines from begin0 and begin1 in order, up to end0 and end1
+// (NULL for the end of the files), and marks them (/INLINE). The lines are
+// parsed as needed, but not dropped; ShowDiff shows them next.
+static VOID
+MarkChanges(FILECOMPARE *pFC, struct list *begin0, struct list *end0,
+            struct list *begin1, struct list *end1)
+{
+    NODE *node0, *node1;
+    DWORD n = 0;
+
+    pFC->cMarks = pFC->iMark[0] = pFC->iMark[1] = 0;
+    if (!(pFC->dwFlags & FLAG_INLINE))
+        return;
+
+    while (begin0 && begin1 && begin0 != end0 && begin1 != end1 && n < INLINE_MAX_PAIRS)
+    {
+        node0 = LIST_ENTRY(begin0, NODE, entry);
+        node1 = LIST_ENTRY(begin1, NODE, entry);
+        if (IsEOFNode(node0) || IsEOFNode(node1))
+            break;
+        MarkLine(pFC, node0, node1, &pFC->aMarks[0][n], &pFC->aMarks[1][n]);
+        ++n;
+        begin0 = NextLine(pFC, 0, begin0);
+        begin1 = NextLine(pFC, 1, begin1);
+    }
+    pFC->cMarks = n;
+}
+
+// The mark of a line of file i, or NULL. The lines are asked for in order.
+static const INLINEMARK *FindMark(FILECOMPARE *pFC, INT i, DWORD lineno)
+{
+    while (pFC->iMark[i] < pFC->cMarks && pFC->aMarks[i][pFC->iMark[i]].lineno < lineno)
+        ++pFC->iMark[i];
+    if (pFC->iMark[i] < pFC->cMarks && pFC->aMarks[i][pFC->iMark[i]].lineno == lineno)
+        return &pFC->aMarks[i][pFC->iMark[i]];
+    return NULL;
+}
+
+// Prints a line as it is, except that tabs are expanded unless /T. The marked
+// characters are put in [-...-] in file 0 and {+...+} in file 1 (/INLINE).
+static VOID PrintNode(const FILECOMPARE *pFC, INT i, const NODE *node, const INLINEMARK *pMark)
+{
+    static const TCHAR s_szOpen[2][3] = { TEXT("[-"), TEXT("{+") };
+    static const TCHAR s_szClose[2][3] = { TEXT("-]"), TEXT("+}") };
+    LINEBUF buf = { 0 }, bufMark = { 0 };
+    LPCTSTR pch = node->pch;
+    DWORD cch = node->cch, ichBegin = 0, ichEnd = 0;
+    if (pMark)
+    {
+        ichBegin = pMark->ichBegin;
+        ichEnd = pMark->ichEnd;
+    }
+    if (!(pFC->dwFlags & FLAG_T) && memchr(pch, TEXT('\t'), cch * sizeof(TCHAR)) &&
+        ReserveLineBuf(&buf, ExpandTabLength(pFC, pch, cch)))
+    {
+        ichBegin = ExpandTabLength(pFC, pch, ichBegin);
+        ichEnd = ExpandTabLength(pFC, pch, ichEnd);
+        cch = ExpandTab(pFC, buf.psz, pch, cch);
+        pch = buf.psz;
+    }
+    if (ichBegin < ichEnd && ReserveLineBuf(&bufMark, cch + 4))
+    {
+        memcpy(bufMark.psz, pch, ichBegin * sizeof(TCHAR));
+        memcpy(&bufMark.psz[ichBegin], s_szOpen[i], 2 * sizeof(TCHAR));
+        memcpy(&bufMark.psz[ichBegin + 2], &pch[ichBegin], (ichEnd - ichBegin) * sizeof(TCHAR));
+        memcpy(&bufMark.psz[ichEnd + 2], s_szClose[i], 2 * sizeof(TCHAR));
+        memcpy(&bufMark.psz[ichEnd + 4], &pch[ichEnd], (cch - ichEnd) * sizeof(TCHAR));
+        cch += 4;
+        pch = bufMark.psz;
+    }
+    PrintLine(pFC, node->lineno, pch, cch);
+    free(buf.psz);
+    free(bufMark.psz);
+}
+
+// Shows the lines from begin to end. If end is NULL, the lines up to the end
+// of the file are shown and dropped on the way.
+static VOID
+ShowDiff(FILECOMPARE *pFC, INT i, struct list *begin, struct list *end)
+{
+    NODE *node, *second = NULL, *last = NULL;
+    struct list *list = &pFC->window[i].list;
+    DWORD count = 0;
+    PrintCaption(pFC->file[i]);
+    if (begin && end && list_prev(list, begin))
+        begin = list_prev(list, begin);
+    while (begin != end)
+    {
+        node = LIST_ENTRY(begin, NODE, entry);
+        if (IsEOFNode(node))
+            break;
+        ++count;
+        if (!(pFC->dwFlags & FLAG_A) || count == 1)
+            PrintNode(pFC, i, node, FindMark(pFC, i, node->lineno));
+        else if (count == 2)
+            second = node;
+        last = node;
+        if (!end)
+            DropLines(pFC, i, (second && count <= 3) ? &second->entry : begin);
+        begin = NextLine(pFC, i, begin);
+    }
+    if ((pFC->dwFlags & FLAG_A) && count > 0)
+    {
+        // ``first,, ``...,, ``last,, (a single line is shown twice)
+        if (count == 3)
+            PrintNode(pFC, i, second, FindMark(pFC, i, second->lineno));
+        else if (count != 2)
+            PrintDots();
+        PrintNode(pFC, i, last, FindMark(pFC, i, last->lineno));
+    }
+}
+
+// The lines in sync that are kept before a difference: one for ShowDiff, or
+// the context of /UNIFIED
+static __inline DWORD KeptLines(const FILECOMPARE *pFC)
+{
+    return (pFC->dwFlags & FLAG_UNIFIED) ? (DWORD)max(pFC->nContext, 1) : 1;
+}
+
+#define NO_EOL_MARKER TEXT("\n\\ No newline at end of file\n")
+
+// Adds a line with its prefix (' ', '-' or '+') and its own line break to the
+// hunk of /UNIFIED. A last line without a LF is followed by the marker of
+// diff. The node of a line in sync is that of file 0; /UNIFIED compares the
+// line breaks, so the line ends in the same way in file 1.
+static BOOL AddHunkLine(FILECOMPARE *pFC, TCHAR chPrefix, const NODE *node)
+{
+    static const struct
+    {
+        LPCTSTR psz;
+        SIZE_T cch;
+    } s_aEOL[] = // by EOL_...
+    {
+        { TEXT("\n"), 1 },
+        { TEXT("\r\n"), 2 },
+        { TEXT("\r") NO_EOL_MARKER, _countof(NO_EOL_MARKER) },
+        { NO_EOL_MARKER, _countof(NO_EOL_MARKER) - 1 }
+    };
+    UNIHUNK *pHunk = &pFC->hunk;
+    LPCTSTR pszEOL = s_aEOL[node->eol].psz;
+    SIZE_T cchEOL = s_aEOL[node->eol].cch, cch = 1 + node->cch + cchEOL, cchMax;
+    LPTSTR pch;
+
+    if (pHunk->cchText + cch > pHunk->cchTextMax)
+    {
+        cchMax = max(2 * pHunk->cchTextMax, pHunk->cchText + cch);
+        cchMax = max(cchMax, 4096);
+        pch = realloc(pHunk->pText, cchMax * sizeof(TCHAR));
+        if (!pch)
+        {
+            pFC->window[0].fFailed = TRUE;
+            OutOfMemory();
+            return FALSE;
+        }
+        pHunk->pText = pch;
+        pHunk->cchTextMax = cchMax;
+    }
+
+    pch = (LPTSTR)pHunk->pText + pHunk->cchText;
+    pch[0] = chPrefix;
+    memcpy(&pch[1], node->pch, node->cch * sizeof(TCHAR));
+    memcpy(&pch[1 + node->cch], pszEOL, cchEOL * sizeof(TCHAR));
+    pHunk->cchText += cch;
+    if (chPrefix != TEXT('+'))
+        ++pHunk->cLines[0];
+    if (chPrefix != TEXT('-'))
+        ++pHunk->cLines[1];
+    return TRUE;
+}
+
+static VOID FlushHunk(FILECOMPARE *pFC)
+{
+    UNIHUNK *pHunk = &pFC->hunk;
+    if (!pHunk->fPending)
+        return;
+    if (!pHunk->fHeader)
+    {
+        PrintUnifiedHeader(pFC->file[0], pFC->file[1]);
+        pHunk->fHeader = TRUE;
+    }
+    PrintHunkHeader(pHunk->lineno, pHunk->cLines);
+    PrintText(pHunk->pText, pHunk->cchText);
+    pHunk->cchText = 0;
+    pHunk->fPending = FALSE;
+}
+
+// Adds a line in sync after the last change as context, if it needs more
+static __inline VOID AddTrail(FILECOMPARE *pFC, NODE *node)
+{
+    UNIHUNK *pHunk = &pFC->hunk;
+    if (pHunk->fPending && pHunk->cTrail < (DWORD)pFC->nContext && !IsEOFNode(node) &&
+        AddHunkLine(pFC, TEXT(' '), node))
+    {
+        ++pHunk->cTrail;
+    }
+}
+
+// Adds the changed lines from begin0 and begin1 up to the lines in sync end0
+// and end1 (NULL for the end of the files) to the unified diff. A change
+// that is within 2n lines of the last one joins its hunk; otherwise the hunk
+// is printed, and a new one starts with the n lines kept before the change.
+static VOID
+AddChange(FILECOMPARE *pFC, struct list *begin0, struct list *end0,
+          struct list *begin1, struct list *end1)
+{
+    UNIHUNK *pHunk = &pFC->hunk;
+    struct list *list0 = &pFC->window[0].list, *ptr, *begin[2] = { begin0, begin1 };
+    struct list *end[2] = { end0, end1 };
+    NODE *node;
+    DWORD lineno0, lineno1, cKept, cLead, nContext = (DWORD)pFC->nContext;
+    INT i;
+
+    // an empty file has no lines
+    lineno0 = (begin0 ? LIST_ENTRY(begin0, NODE, entry)->lineno : pFC->window[0].lineno);
+    lineno1 = (begin1 ? LIST_ENTRY(begin1, NODE, entry)->lineno : pFC->window[1].lineno);
+
+    for (ptr = begin0, cKept = 0; cKept < nContext && ptr && list_prev(list0, ptr); ++cKept)
+        ptr = list_prev(list0, ptr);
+    if (pHunk->fPending && lineno0 - pHunk->linenoNext <= 2 * nContext &&
+        lineno0 - pHunk->linenoNext - pHunk->cTrail <= cKept)
+    {
+        // the rest of the lines between the changes
+        cLead = lineno0 - pHunk->linenoNext - pHunk->cTrail;
+    }
+    else
+    {
+        FlushHunk(pFC);
+        cLead = cKept;
+        pHunk->lineno[0] = lineno0 - cLead;
+        pHunk->lineno[1] = lineno1 - cLead;
+        pHunk->cLines[0] = pHunk->cLines[1] = 0;
+        pHunk->fPending = TRUE;
+    }
+    for (ptr = begin0; cLead > 0; --cLead)
+        ptr = list_prev(list0, ptr);
+    for (; ptr != begin0; ptr = list_next(list0, ptr))
+    {
+        if (!AddHunkLine(pFC, TEXT(' '), LIST_ENTRY(ptr, NODE, entry)))
+            return;
+    }
+
+    for (i = 0; i < 2; ++i)
+    {
+        for (ptr = begin[i]; ptr && ptr != end[i];)
+        {
+            node = LIST_ENTRY(ptr, NODE, entry);
+            if (IsEOFNode(node) || !AddHunkLine(pFC, i ? TEXT('+') : TEXT('-'), node))
+                break;
+            if (!end[i])
+                DropLines(pFC, i, ptr);
+            ptr = NextLine(pFC, i, ptr);
+        }
+    }
+    pHunk->linenoNext = (end0 ? LIST_ENTRY(end0, NODE, entry)->lineno : MAXDWORD);
+    pHunk->cTrail = 0;
+}
+
+static VOID
+SkipIdentical(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1)
+{
+    struct list *ptr0 = *pptr0, *ptr1 = *pptr1, *keep0 = ptr0, *keep1 = ptr1;
+    DWORD cKept = 0;
+    while (ptr0 && ptr1)
+    {
+        NODE *node0 = LIST_ENTRY(ptr0, NODE, entry);
+        NODE *node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (node0->lineno == pFC->window[0].linenoTail &&
+            node1->lineno == pFC->window[1].linenoTail)
+        {
+            // in sync at the common tail; the rest is the same (FindRawTail)
+            while (pFC->hunk.fPending && pFC->hunk.cTrail < (DWORD)pFC->nContext &&
+                   ptr0 && !IsEOFNode(LIST_ENTRY(ptr0, NODE, entry)) && !HasFailed(pFC))
+            {
+                AddTrail(pFC, LIST_ENTRY(ptr0, NODE, entry));
+                ptr0 = NextLine(pFC, 0, ptr0);
+            }
+            ptr0 = ptr1 = NULL;
+            break;
+        }
+        if (CompareNode(pFC, node0, node1) != FCRET_IDENTICAL)
+            break;
+        AddTrail(pFC, node0);
+        // the lines are in sync; only the last ones are kept (KeptLines)
+        if (++cKept > KeptLines(pFC))
+        {
+            keep0 = list_next(&pFC->window[0].list, keep0);
+            keep1 = list_next(&pFC->window[1].list, keep1);
+        }
+        DropLines(pFC, 0, keep0);
+        DropLines(pFC, 1, keep1);
+        ptr0 = NextLine(pFC, 0, ptr0);
+        ptr1 = NextLine(pFC, 1, ptr1);
+    }
+    *pptr0 = ptr0;
+    *pptr1 = ptr1;
+}
+
+static DWORD
+SkipIdenticalN(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1,
+               DWORD nnnn, DWORD lineno0, DWORD lineno1)
+{
+    struct list *ptr0 = *pptr0, *ptr1 = *pptr1;
+    DWORD count = 0;
+    while (ptr0 && ptr1)
+    {
+        NODE *node0 = LIST_ENTRY(ptr0, NODE, entry);
+        NODE *node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (node0->lineno >= lineno0)
+            break;
+        if (node1->lineno >= lineno1)
+            break;
+        if (CompareNode(pFC, node0, node1) != FCRET_IDENTICAL)
+            break;
+        ptr0 = NextLine(pFC, 0, ptr0);
+        ptr1 = NextLine(pFC, 1, ptr1);
+        ++count;
+        if (count >= nnnn)
+            break;
+    }
+    *pptr0 = ptr0;
+    *pptr1 = ptr1;
+    return count;
+}
+
+static FCRET
+ScanDiff(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1,
+         DWORD lineno0, DWORD lineno1)
 {
     struct list *ptr0 = *pptr0, *ptr1 = *pptr1, *tmp0, *tmp1;
     NODE *node0, *node1;
     INT count;
     while (ptr0 && ptr1)
     {
-        node0 = LIST_ENTRY(ptr0, NODE, entry);
-        node1 = LIST_ENTRY(ptr1, NODE, entry);
-        if (node0->lineno >= lineno0)
-            return FCRET_DIFFERENT;
-        if (node1->lineno >= lineno1)
-            return FCRET_DIFFERENT;
-        tmp0 = ptr0;
-        tmp1 = ptr1;
-        count = SkipIdenticalN(pFC, &tmp0, &tmp1, pFC->nnnn, lineno0, lineno1);
-        if (count >= pFC->nnnn)
+        node0 = LIST_ENTRY(ptr0, NODE, entry);
+        node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (node0->lineno >= lineno0)
+            return FCRET_DIFFERENT;
+        if (node1->lineno >= lineno1)
+            return FCRET_DIFFERENT;
+        tmp0 = ptr0;
+        tmp1 = ptr1;
+        count = SkipIdenticalN(pFC, &tmp0, &tmp1, pFC->nnnn, lineno0, lineno1);
+        if (count >= pFC->nnnn)
+            break;
+        if (count > 0)
+        {
+            ptr0 = tmp0;
+            ptr1 = tmp1;
+        }
+        else
+        {
+            ptr0 = NextLine(pFC, 0, ptr0);
+            ptr1 = NextLine(pFC, 1, ptr1);
+        }
+    }
+    *pptr0 = ptr0;
+    *pptr1 = ptr1;
+    return FCRET_IDENTICAL;
+}
+
+// Indexes the lines of window 0 after ptr0 and before lineno0 by symbol.
+// Each symbol keeps the first of its lines (LINESYM.pResync).
+static VOID
+IndexResync(FILECOMPARE *pFC, struct list *ptr0, DWORD lineno0, NODE **ppEOF, BOOL fClear)
+{
+    NODE *node0;
+    LPVOID *ppResync;
+
+    *ppEOF = NULL;
+    for (ptr0 = NextLine(pFC, 0, ptr0); ptr0; ptr0 = NextLine(pFC, 0, ptr0))
+    {
+        node0 = LIST_ENTRY(ptr0, NODE, entry);
+        if (node0->lineno >= lineno0)
+            break;
+        if (node0->sym == SYM_EOF)
+        {
+            *ppEOF = node0;
+            continue;
+        }
+        ppResync = &pFC->symtab.pSyms[node0->sym].pResync;
+        if (fClear)
+            *ppResync = NULL;
+        else if (!*ppResync)
+            *ppResync = node0;
+    }
+}
+
+static FCRET
+Resync(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1)
+{
+    FCRET ret;
+    struct list *ptr0, *ptr1, *save0 = NULL, *save1 = NULL;
+    NODE *node0, *node1, *nodeEOF;
+    DWORD lineno0, lineno1;
+    INT penalty, i0, i1, min_penalty = MAXLONG;
+
+    node0 = LIST_ENTRY(*pptr0, NODE, entry);
+    node1 = LIST_ENTRY(*pptr1, NODE, entry);
+    lineno0 = node0->lineno + pFC->n;
+    lineno1 = node1->lineno + pFC->n;
+
+    // ``If the files that you are comparing have more than pFC->n consecutive
+    //   differing lines, FC cancels the comparison,,
+    // ``If the number of matching lines in the files is less than pFC->nnnn,
+    //   FC displays the matching lines as differences,,
+    // Each line of window 1 looks up its line in window 0 by symbol rather
+    // than comparing with all of them. For a given i1, the penalty is the
+    // least at the first of the equal lines of window 0 (the same pair as
+    // the nested scan of all the pairs would choose).
+    IndexResync(pFC, *pptr0, lineno0, &nodeEOF, FALSE);
+    for (ptr1 = NextLine(pFC, 1, *pptr1), i1 = 0; ptr1; ptr1 = NextLine(pFC, 1, ptr1), ++i1)
+    {
+        node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (node1->lineno >= lineno1)
+            break;
+        if (node1->sym == SYM_EOF)
+            node0 = nodeEOF;
+        else
+            node0 = pFC->symtab.pSyms[node1->sym].pResync;
+        if (!node0)
+            continue;
+        i0 = (INT)(node0->lineno - LIST_ENTRY(*pptr0, NODE, entry)->lineno - 1);
+        penalty = min(i0, i1) + abs(i1 - i0);
+        if (min_penalty > penalty)
+        {
+            min_penalty = penalty;
+            save0 = &node0->entry;
+            save1 = ptr1;
+        }
+    }
+    IndexResync(pFC, *pptr0, lineno0, &nodeEOF, TRUE);
+
+    if (save0 && save1)
+    {
+        *pptr0 = save0;
+        *pptr1 = save1;
+        ret = ScanDiff(pFC, &save0, &save1, lineno0, lineno1);
+        if (save0 && save1)
+        {
+            *pptr0 = save0;
+            *pptr1 = save1;
+        }
+        return ret;
+    }
+
+    for (ptr0 = *pptr0; ptr0; ptr0 = NextLine(pFC, 0, ptr0))
+    {
+        node0 = LIST_ENTRY(ptr0, NODE, entry);
+        if (node0->lineno == lineno0)
+            break;
+    }
+    for (ptr1 = *pptr1; ptr1; ptr1 = NextLine(pFC, 1, ptr1))
+    {
+        node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (node1->lineno == lineno1)
+            break;
+    }
+    *pptr0 = ptr0;
+    *pptr1 = ptr1;
+    return FCRET_DIFFERENT;
+}
+
+static FCRET 
+Finalize(FILECOMPARE* pFC, struct list *ptr0, struct list* ptr1, BOOL fDifferent)
+{
+    if (!ptr0 && !ptr1)
+    {
+        if (fDifferent)
+            return FCRET_DIFFERENT;//Different(pFC->file[0], pFC->file[1]);
+        if (pFC->dwFlags & FLAG_UNIFIED)
+            return FCRET_IDENTICAL;
+        return NoDifference();
+    }
+    else if (pFC->dwFlags & FLAG_UNIFIED)
+    {
+        AddChange(pFC, ptr0, NULL, ptr1, NULL);
+        return FCRET_DIFFERENT;
+    }
+    else
+    {
+        MarkChanges(pFC, ptr0, NULL, ptr1, NULL);
+        ShowDiff(pFC, 0, ptr0, NULL);
+        ShowDiff(pFC, 1, ptr1, NULL);
+        PrintEndOfDiff();
+        return FCRET_DIFFERENT;
+    }
+}
+
+// Parses all the lines of window i into an array of their nodes. The array
+// ends with the EOF node, or NULL if the file is empty.
+static NODE **LoadAllLines(FILECOMPARE *pFC, INT i, LPDWORD pcLines)
+{
+    struct list *ptr;
+    NODE **ppNodes;
+    DWORD cLines = 0;
+
+    for (ptr = FirstLine(pFC, i); ptr; ptr = NextLine(pFC, i, ptr))
+    {
+        if (IsEOFNode(LIST_ENTRY(ptr, NODE, entry)))
+            break;
+        ++cLines;
+    }
+    if (HasFailed(pFC))
+        return NULL;
+
+    ppNodes = malloc(((SIZE_T)cLines + 1) * sizeof(NODE *));
+    if (!ppNodes)
+    {
+        pFC->window[i].fFailed = TRUE;
+        OutOfMemory();
+        return NULL;
+    }
+    ppNodes[cLines] = NULL;
+    cLines = 0;
+    LIST_FOR_EACH(ptr, &pFC->window[i].list)
+    {
+        ppNodes[cLines++] = LIST_ENTRY(ptr, NODE, entry);
+    }
+    *pcLines = (ppNodes[0] && IsEOFNode(ppNodes[cLines - 1])) ? cLines - 1 : cLines;
+    return ppNodes;
+}
+
+#define NODE_ENTRY(node) ((node) ? &(node)->entry : NULL)
+
+// Shows the changed lines from begin0 and begin1 up to the lines in sync end0
+// and end1 as a difference, with the line before and the line in sync as
+// Resync does. A difference at the end of the files is shown as Finalize does.
+static VOID
+ShowHunk(FILECOMPARE *pFC, struct list *begin0, struct list *end0,
+         struct list *begin1, struct list *end1)
+{
+    if (pFC->dwFlags & FLAG_UNIFIED)
+    {
+        AddChange(pFC, begin0, end0, begin1, end1);
+        return;
+    }
+    MarkChanges(pFC, begin0, end0, begin1, end1);
+    if (IsEOFNode(LIST_ENTRY(end0, NODE, entry)) && IsEOFNode(LIST_ENTRY(end1, NODE, entry)))
+    {
+        ShowDiff(pFC, 0, begin0, NULL);
+        ShowDiff(pFC, 1, begin1, NULL);
+    }
+    else
+    {
+        ShowDiff(pFC, 0, begin0, NextLine(pFC, 0, end0));
+        ShowDiff(pFC, 1, begin1, NextLine(pFC, 1, end1));
+    }
+    PrintEndOfDiff();
+}
+
+// Finds the end of the difference that starts at the changed lines i0 and i1:
+// the lines in sync *pj0 and *pj1, or the ends of the files. The changes that
+// are less than nnnn lines apart are one difference.
+static VOID
+FindHunkEnd(LPBYTE pfChanged[2], const DWORD cLines[2], DWORD nnnn,
+            DWORD i0, DWORD i1, LPDWORD pj0, LPDWORD pj1)
+{
+    DWORD j0, j1, n;
+
+    for (j0 = i0, j1 = i1;;)
+    {
+        while (j0 < cLines[0] && pfChanged[0][j0])
+            ++j0;
+        while (j1 < cLines[1] && pfChanged[1][j1])
+            ++j1;
+        for (n = 0; n < nnnn && j0 + n < cLines[0] && j1 + n < cLines[1]; ++n)
+        {
+            if (pfChanged[0][j0 + n] || pfChanged[1][j1 + n])
+                break;
+        }
+        if (n >= nnnn || (j0 + n == cLines[0] && j1 + n == cLines[1]))
+            break;
+        j0 += n;
+        j1 += n;
+    }
+    *pj0 = j0;
+    *pj1 = j1;
+}
+
+// Finds the changed lines from the symbols of both files with the diff
+// algorithm (/ALG)
+static BOOL DiffSymbols(FILECOMPARE *pFC, LPDWORD pSyms[2], const DWORD cLines[2],
+                        LPBYTE pfChanged[2])
+{
+    if (pFC->nThreads > 1)
+        return ParallelDiff(pFC->alg, pFC->nThreads, pSyms[0], cLines[0], pSyms[1], cLines[1],
+                            pFC->symtab.cSyms, pfChanged[0], pfChanged[1]);
+    if (pFC->alg == ALG_HISTOGRAM)
+        return HistogramDiff(pSyms[0], cLines[0], pSyms[1], cLines[1], pFC->symtab.cSyms,
+                             pfChanged[0], pfChanged[1]);
+    return MyersDiff(pSyms[0], cLines[0], pSyms[1], cLines[1], pfChanged[0], pfChanged[1]);
+}
+
+// The bytes of DiffAll for each line besides its node: the node pointer, the
+// symbol, the changed flag and the vectors of the diff algorithms
+#define DIFF_LINE_SIZE (sizeof(NODE *) + sizeof(DWORD) + sizeof(BYTE) + 3 * sizeof(LONG))
+// and for each symbol (HistogramDiff)
+#define DIFF_SYM_SIZE (2 * sizeof(LONG))
+// The bytes of the input that the lines of DiffAll may span in one view, so
+// that MoveView can always double it
+#define DIFF_SPAN_MAX (MAXDWORD / 4)
+
+static SIZE_T DiffAllSize(const FILECOMPARE *pFC, DWORD cLines)
+{
+    return pFC->window[0].cbArena + pFC->window[1].cbArena + SymTabSize(&pFC->symtab) +
+           (SIZE_T)cLines * DIFF_LINE_SIZE + (SIZE_T)pFC->symtab.cSyms * DIFF_SYM_SIZE;
+}
+
+// The offset of a line of window i in its input
+static __inline LONGLONG NodeOffset(const LINEWINDOW *pWindow, const NODE *node)
+{
+    return pWindow->ibView + ((const BYTE *)node->pch - pWindow->pbView);
+}
+
+// Tells whether the lines can be read again from an offset: the inputs are
+// mapped, not streamed (DiffIndexed)
+static BOOL CanIndex(const FILECOMPARE *pFC)
+{
+    return !pFC->window[0].pInput->fStream && !pFC->window[1].pInput->fStream;
+}
+
+// Parses the lines of both files as long as DiffAll fits in /MAXMEM, and in
+// the views of the inputs if DiffIndexed can be used instead. Returns FALSE
+// if it doesn't; the lines parsed so far are kept.
+static BOOL FitsDiffAll(FILECOMPARE *pFC)
+{
+    LINEWINDOW *pWindow;
+    struct list *ptr;
+    DWORD cLines = 0;
+    BOOL fIndex = CanIndex(pFC);
+    INT i;
+
+    if (!pFC->cbMaxMem && !fIndex)
+        return TRUE;
+
+    for (i = 0; i < 2; ++i)
+    {
+        pWindow = &pFC->window[i];
+        for (ptr = FirstLine(pFC, i); ptr; ptr = NextLine(pFC, i, ptr))
+        {
+            if (pFC->cbMaxMem && DiffAllSize(pFC, ++cLines) > pFC->cbMaxMem)
+                return FALSE;
+            if (fIndex && pWindow->ibNext -
+                NodeOffset(pWindow, LIST_ENTRY(list_head(&pWindow->list), NODE, entry)) >
+                DIFF_SPAN_MAX)
+            {
+                return FALSE;
+            }
+        }
+    }
+    return TRUE;
+}
+
+// Compares the whole files with a diff algorithm (/ALG). All the lines are in
+// memory. The changed lines are shown in the same form as the default, and
+// the changes that are less than /nnnn lines apart are shown together.
+static FCRET DiffAll(FILECOMPARE *pFC)
+{
+    NODE **ppNodes[2] = { NULL, NULL };
+    LPDWORD pSyms[2] = { NULL, NULL };
+    LPBYTE pfChanged[2] = { NULL, NULL };
+    DWORD cLines[2], n, i0, i1, j0, j1, nnnn = (DWORD)max(pFC->nnnn, 1);
+    BOOL fDifferent = FALSE;
+    FCRET ret = FCRET_INVALID;
+    INT i;
+
+    // the hunks of /UNIFIED are joined by their context instead
+    if (pFC->dwFlags & FLAG_UNIFIED)
+        nnnn = 1;
+
+    do
+    {
+        for (i = 0; i < 2; ++i)
+        {
+            ppNodes[i] = LoadAllLines(pFC, i, &cLines[i]);
+            if (!ppNodes[i])
+                break;
+            pSyms[i] = malloc(((SIZE_T)cLines[i] + 1) * sizeof(DWORD));
+            pfChanged[i] = calloc((SIZE_T)cLines[i] + 1, sizeof(BYTE));
+            if (!pSyms[i] || !pfChanged[i])
+            {
+                OutOfMemory();
+                break;
+            }
+            for (n = 0; n < cLines[i]; ++n)
+                pSyms[i][n] = ppNodes[i][n]->sym;
+        }
+        if (i < 2)
+            break;
+        if (pFC->cbPeak < DiffAllSize(pFC, cLines[0] + cLines[1]))
+            pFC->cbPeak = DiffAllSize(pFC, cLines[0] + cLines[1]);
+
+        if (!DiffSymbols(pFC, pSyms, cLines, pfChanged))
+        {
+            OutOfMemory();
+            break;
+        }
+
+        // the unchanged lines of both files are in sync in order
+        for (i0 = i1 = 0; i0 < cLines[0] || i1 < cLines[1];)
+        {
+            if (i0 < cLines[0] && i1 < cLines[1] && !pfChanged[0][i0] && !pfChanged[1][i1])
+            {
+                AddTrail(pFC, ppNodes[0][i0]);
+                ++i0;
+                ++i1;
+                continue;
+            }
+
+            FindHunkEnd(pfChanged, cLines, nnnn, i0, i1, &j0, &j1);
+            ShowHunk(pFC, NODE_ENTRY(ppNodes[0][i0]), NODE_ENTRY(ppNodes[0][j0]),
+                     NODE_ENTRY(ppNodes[1][i1]), NODE_ENTRY(ppNodes[1][j1]));
+            fDifferent = TRUE;
+            i0 = j0;
+            i1 = j1;
+        }
+        ret = Finalize(pFC, NULL, NULL, fDifferent);
+    } while (0);
+
+    for (i = 0; i < 2; ++i)
+    {
+        free(ppNodes[i]);
+        free(pSyms[i]);
+        free(pfChanged[i]);
+    }
+    return ret;
+}
+
+// The lines of a file in DiffIndexed: their symbols and where they start in
+// the input, instead of their nodes
+typedef struct LINEINDEX
+{
+    LPDWORD pSyms;
+    LONGLONG *pib; // and the end of the lines after the last one
+    DWORD cLines;
+    DWORD cLinesMax;
+    DWORD lineno; // the line number of the first line
+} LINEINDEX;
+
+// The bytes of DiffIndexed for each line in the index (the symbol and the
+// offset), and for each line indexed (the changed flag and the vectors of the
+// diff algorithms)
+#define INDEX_SLOT_SIZE (sizeof(DWORD) + sizeof(LONGLONG))
+#define INDEX_LINE_SIZE (sizeof(BYTE) + 3 * sizeof(LONG))
+
+static SIZE_T DiffIndexedSize(const FILECOMPARE *pFC, const LINEINDEX index[2])
+{
+    return pFC->window[0].cbArena + pFC->window[1].cbArena + SymTabSize(&pFC->symtab) +
+           ((SIZE_T)index[0].cLinesMax + index[1].cLinesMax) * INDEX_SLOT_SIZE +
+           ((SIZE_T)index[0].cLines + index[1].cLines) * INDEX_LINE_SIZE +
+           (SIZE_T)pFC->symtab.cSyms * DIFF_SYM_SIZE;
+}
+
+static VOID FreeIndex(LINEINDEX *pIndex)
+{
+    free(pIndex->pSyms);
+    free(pIndex->pib);
+    ZeroMemory(pIndex, sizeof(*pIndex));
+}
+
+// Grows the index by half, so that it doesn't go much over /MAXMEM
+static BOOL GrowIndex(LINEINDEX *pIndex)
+{
+    DWORD cLinesMax = max(LINES_PER_CHUNK, pIndex->cLinesMax + pIndex->cLinesMax / 2);
+    LPDWORD pSyms;
+    LONGLONG *pib;
+
+    if (pIndex->cLinesMax >= MAXDWORD / 3 * 2)
+        return FALSE;
+    pSyms = realloc(pIndex->pSyms, (SIZE_T)cLinesMax * sizeof(DWORD));
+    if (pSyms)
+        pIndex->pSyms = pSyms;
+    pib = realloc(pIndex->pib, ((SIZE_T)cLinesMax + 1) * sizeof(LONGLONG));
+    if (pib)
+        pIndex->pib = pib;
+    if (!pSyms || !pib)
+        return FALSE;
+    pIndex->cLinesMax = cLinesMax;
+    return TRUE;
+}
+
+// Starts window i again at the line that starts at the offset ib. The lines
+// in the window are dropped.
+static BOOL SeekWindow(FILECOMPARE *pFC, INT i, LONGLONG ib, DWORD lineno)
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+    LPCVOID pv;
+
+    DropLines(pFC, i, NULL);
+    if (!GetInputView(pWindow->pInput, ib, MAX_VIEW_SIZE, &pv, &pWindow->cbView, &pWindow->fLast))
+    {
+        pWindow->fFailed = TRUE;
+        CannotRead(pWindow->pInput->file);
+        return FALSE;
+    }
+    pWindow->pbView = pv;
+    pWindow->ibView = pWindow->ibNext = ib;
+    pWindow->lineno = lineno;
+    pWindow->fEOF = FALSE;
+    return TRUE;
+}
+
+// Drops the lines of window i, so that SeekWindow can take it back to any
+// line. A decoded input is decoded again from the beginning.
+static BOOL RewindWindow(FILECOMPARE *pFC, INT i)
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+
+    DropLines(pFC, i, NULL);
+    if (RewindInput(pWindow->pInput))
+        return TRUE;
+    pWindow->fFailed = TRUE;
+    CannotRead(pWindow->pInput->file);
+    return FALSE;
+}
+
+// Parses the rest of the lines of window i into the index, dropping them on
+// the way. The lines that are already parsed are indexed first. Returns FALSE
+// if the index exceeds /MAXMEM or on an error (HasFailed).
+static BOOL IndexLines(FILECOMPARE *pFC, INT i, LINEINDEX index[2])
+{
+    LINEWINDOW *pWindow = &pFC->window[i];
+    LINEINDEX *pIndex = &index[i];
+    struct list *ptr = FirstLine(pFC, i);
+    NODE *node;
+
+    pIndex->lineno = (ptr ? LIST_ENTRY(ptr, NODE, entry)->lineno : pWindow->lineno);
+    for (; ptr; ptr = NextLine(pFC, i, ptr))
+    {
+        node = LIST_ENTRY(ptr, NODE, entry);
+        DropLines(pFC, i, ptr);
+        if (IsEOFNode(node))
             break;
-        if (count > 0)
+        if (pIndex->cLines >= pIndex->cLinesMax && !GrowIndex(pIndex))
         {
-            ptr0 = tmp0;
-            ptr1 = tmp1;
-        }
-        else
-        {
-            ptr0 = list_next(&pFC->list[0], ptr0);
-            ptr1 = list_next(&pFC->list[1], ptr1);
+            pWindow->fFailed = TRUE;
+            OutOfMemory();
+            return FALSE;
         }
+        if (pFC->cbMaxMem && DiffIndexedSize(pFC, index) > pFC->cbMaxMem)
+            return FALSE;
+        pIndex->pSyms[pIndex->cLines] = node->sym;
+        pIndex->pib[pIndex->cLines++] = NodeOffset(pWindow, node);
     }
-    *pptr0 = ptr0;
-    *pptr1 = ptr1;
-    return FCRET_IDENTICAL;
+    if (HasFailed(pFC))
+        return FALSE;
+    if (!pIndex->pib && !GrowIndex(pIndex))
+    {
+        pWindow->fFailed = TRUE;
+        OutOfMemory();
+        return FALSE;
+    }
+    pIndex->pib[pIndex->cLines] = pWindow->ibNext;
+    return TRUE;
 }
 
-static FCRET
-Resync(FILECOMPARE *pFC, struct list **pptr0, struct list **pptr1)
+// Gets line n of window i (the EOF node for the line after the last one).
+// The lines from KeptLines before it on are in the window: it starts again
+// at them if it doesn't have them, and the lines before them are dropped.
+static struct list *
+GetIndexedLine(FILECOMPARE *pFC, INT i, const LINEINDEX *pIndex, DWORD n)
 {
-    FCRET ret;
-    struct list *ptr0, *ptr1, *save0 = NULL, *save1 = NULL;
-    NODE *node0, *node1;
-    struct list *list0 = &pFC->list[0], *list1 = &pFC->list[1];
-    DWORD lineno0, lineno1;
-    INT penalty, i0, i1, min_penalty = MAXLONG;
+    LINEWINDOW *pWindow = &pFC->window[i];
+    DWORD linenoFirst = pIndex->lineno + n - min(n, KeptLines(pFC));
+    struct list *ptr = list_head(&pWindow->list);
 
-    node0 = LIST_ENTRY(*pptr0, NODE, entry);
-    node1 = LIST_ENTRY(*pptr1, NODE, entry);
-    lineno0 = node0->lineno + pFC->n;
-    lineno1 = node1->lineno + pFC->n;
+    if (!ptr || LIST_ENTRY(ptr, NODE, entry)->lineno > linenoFirst ||
+        (pWindow->lineno <= linenoFirst && !pWindow->fEOF))
+    {
+        if (!SeekWindow(pFC, i, pIndex->pib[linenoFirst - pIndex->lineno], linenoFirst))
+            return NULL;
+        ptr = FirstLine(pFC, i);
+    }
+    for (; ptr && LIST_ENTRY(ptr, NODE, entry)->lineno < linenoFirst;
+         ptr = NextLine(pFC, i, ptr))
+    {
+    }
+    DropLines(pFC, i, ptr);
+    for (; ptr && LIST_ENTRY(ptr, NODE, entry)->lineno < pIndex->lineno + n;
+         ptr = NextLine(pFC, i, ptr))
+    {
+    }
+    return ptr;
+}
 
-    // ``If the files that you are comparing have more than pFC->n consecutive
-    //   differing lines, FC cancels the comparison,,
-    // ``If the number of matching lines in the files is less than pFC->nnnn,
-    //   FC displays the matching lines as differences,,
-    for (ptr1 = list_next(list1, *pptr1), i1 = 0; ptr1; ptr1 = list_next(list1, ptr1), ++i1)
+// Gets the line n lines after ptr in window i
+static struct list *SkipLines(FILECOMPARE *pFC, INT i, struct list *ptr, DWORD n)
+{
+    for (; ptr && n > 0; --n)
+        ptr = NextLine(pFC, i, ptr);
+    return ptr;
+}
+
+// Compares the whole files with a diff algorithm (/ALG) as DiffAll does, but
+// only the symbol and the offset of each line are kept. The lines of each
+// difference are read again to show it. The symbols of the lines that are
+// dropped are known by their hashes alone.
+static FCRET DiffIndexed(FILECOMPARE *pFC, LINEINDEX index[2])
+{
+    LPDWORD pSyms[2] = { index[0].pSyms, index[1].pSyms };
+    LPBYTE pfChanged[2] = { NULL, NULL };
+    DWORD cLines[2] = { index[0].cLines, index[1].cLines };
+    DWORD i0, i1, j0, j1, nnnn = (DWORD)max(pFC->nnnn, 1);
+    struct list *begin0, *begin1;
+    BOOL fDifferent = FALSE;
+    FCRET ret = FCRET_INVALID;
+    INT i;
+
+    if (pFC->dwFlags & FLAG_UNIFIED)
+        nnnn = 1;
+
+    do
     {
-        node1 = LIST_ENTRY(ptr1, NODE, entry);
-        if (node1->lineno >= lineno1)
-            break;
-        for (ptr0 = list_next(list0, *pptr0), i0 = 0; ptr0; ptr0 = list_next(list0, ptr0), ++i0)
+        for (i = 0; i < 2; ++i)
         {
-            node0 = LIST_ENTRY(ptr0, NODE, entry);
-            if (node0->lineno >= lineno0)
+            pfChanged[i] = calloc((SIZE_T)cLines[i] + 1, sizeof(BYTE));
+            if (!pfChanged[i])
                 break;
-            if (CompareNode(pFC, node0, node1) == FCRET_IDENTICAL)
+        }
+        if (i < 2 || !DiffSymbols(pFC, pSyms, cLines, pfChanged))
+        {
+            OutOfMemory();
+            break;
+        }
+        if (pFC->cbPeak < DiffIndexedSize(pFC, index))
+            pFC->cbPeak = DiffIndexedSize(pFC, index);
+
+        for (i0 = i1 = 0; i0 < cLines[0] || i1 < cLines[1];)
+        {
+            if (i0 < cLines[0] && i1 < cLines[1] && !pfChanged[0][i0] && !pfChanged[1][i1])
             {
-                penalty = min(i0, i1) + abs(i1 - i0);
-                if (min_penalty > penalty)
+                // the context of /UNIFIED after a change
+                if (pFC->hunk.fPending && pFC->hunk.cTrail < (DWORD)pFC->nContext)
                 {
-                    min_penalty = penalty;
-                    save0 = ptr0;
-                    save1 = ptr1;
+                    begin0 = GetIndexedLine(pFC, 0, &index[0], i0);
+                    if (HasFailed(pFC))
+                        break;
+                    AddTrail(pFC, LIST_ENTRY(begin0, NODE, entry));
                 }
+                ++i0;
+                ++i1;
+                continue;
             }
+
+            FindHunkEnd(pfChanged, cLines, nnnn, i0, i1, &j0, &j1);
+            begin0 = GetIndexedLine(pFC, 0, &index[0], i0);
+            begin1 = GetIndexedLine(pFC, 1, &index[1], i1);
+            if (HasFailed(pFC))
+                break;
+            ShowHunk(pFC, begin0, SkipLines(pFC, 0, begin0, j0 - i0),
+                     begin1, SkipLines(pFC, 1, begin1, j1 - i1));
+            fDifferent = TRUE;
+            i0 = j0;
+            i1 = j1;
         }
+        if (!HasFailed(pFC))
+            ret = Finalize(pFC, NULL, NULL, fDifferent);
+    } while (0);
+
+    for (i = 0; i < 2; ++i)
+        free(pfChanged[i]);
+    return ret;
+}
+
+// Compares the files with a diff algorithm (/ALG) if its lines fit in memory
+// (/MAXMEM), by DiffAll or DiffIndexed. Returns FALSE if they don't; the
+// windows are then at the first lines, for Resync.
+static BOOL DiffWhole(FILECOMPARE *pFC, FCRET *pret)
+{
+    LINEINDEX index[2];
+    LONGLONG ib[2];
+    DWORD lineno[2];
+    struct list *ptr;
+    BOOL fIndexed;
+    INT i;
+
+    *pret = FCRET_INVALID;
+    if (FitsDiffAll(pFC))
+    {
+        *pret = DiffAll(pFC);
+        return TRUE;
+    }
+    if (HasFailed(pFC))
+        return TRUE;
+    if (!CanIndex(pFC))
+    {
+        OverMaxMem();
+        return FALSE;
     }
 
-    if (save0 && save1)
+    // where Resync starts if the index doesn't fit either
+    for (i = 0; i < 2; ++i)
     {
-        *pptr0 = save0;
-        *pptr1 = save1;
-        ret = ScanDiff(pFC, &save0, &save1, lineno0, lineno1);
-        if (save0 && save1)
+        ptr = FirstLine(pFC, i);
+        ib[i] = (ptr ? NodeOffset(&pFC->window[i], LIST_ENTRY(ptr, NODE, entry))
+                     : pFC->window[i].ibNext);
+        lineno[i] = (ptr ? LIST_ENTRY(ptr, NODE, entry)->lineno : pFC->window[i].lineno);
+    }
+
+    ZeroMemory(index, sizeof(index));
+    pFC->symtab.fKeep = TRUE;
+    fIndexed = (IndexLines(pFC, 0, index) && IndexLines(pFC, 1, index));
+    if (fIndexed && RewindWindow(pFC, 0) && RewindWindow(pFC, 1))
+        *pret = DiffIndexed(pFC, index);
+    FreeIndex(&index[0]);
+    FreeIndex(&index[1]);
+    if (fIndexed || HasFailed(pFC))
+        return TRUE;
+
+    OverMaxMem();
+    for (i = 0; i < 2; ++i)
+        DropLines(pFC, i, NULL);
+    FreeSymTab(&pFC->symtab);
+    if (RewindWindow(pFC, 0) && RewindWindow(pFC, 1) && SeekWindow(pFC, 0, ib[0], lineno[0]))
+        SeekWindow(pFC, 1, ib[1], lineno[1]);
+    return FALSE;
+}
+
+// A line cursor walks an input line by line, asking for a new view at the
+// start of the current line whenever a line crosses the end of the view.
+typedef struct LINECURSOR
+{
+    FCINPUT *pInput;
+    LONGLONG ibView;    // input offset of the view
+    LPCTSTR pchView;
+    DWORD cchView;
+    BOOL fLast;         // the view reaches the end of the input
+    DWORD ich;          // current position in the view
+} LINECURSOR;
+
+static BOOL MapCursor(LINECURSOR *pCursor, LONGLONG ib)
+{
+    DWORD cbView;
+    if (!GetInputView(pCursor->pInput, ib, MAX_VIEW_SIZE,
+                      (LPCVOID *)&pCursor->pchView, &cbView, &pCursor->fLast))
+    {
+        return FALSE;
+    }
+    pCursor->ibView = ib;
+    pCursor->cchView = cbView / sizeof(TCHAR);
+    pCursor->ich = 0;
+    return TRUE;
+}
+
+static __inline LONGLONG CursorOffset(const LINECURSOR *pCursor)
+{
+    return pCursor->ibView + (LONGLONG)pCursor->ich * sizeof(TCHAR);
+}
+
+// Gets the next line (without CR/LF). *pfEOF is set at the end of the file.
+static BOOL
+GetNextLine(LINECURSOR *pCursor, LPCTSTR *ppch, LPDWORD pcch, BOOL *pfEOF)
+{
+    SIZE_T ichNext;
+    BOOL fBreak;
+
+    for (;;)
+    {
+        if (pCursor->ich < pCursor->cchView)
         {
-            *pptr0 = save0;
-            *pptr1 = save1;
+            // A line that fills a whole view is split at the end of the view
+            fBreak = FindNextLine(pCursor->pchView, pCursor->ich, pCursor->cchView, &ichNext);
+            if (fBreak || pCursor->fLast || pCursor->ich == 0)
+            {
+                *ppch = &pCursor->pchView[pCursor->ich];
+                *pcch = (DWORD)(ichNext - pCursor->ich);
+                if ((fBreak || pCursor->fLast) && *pcch > 0 && (*ppch)[*pcch - 1] == TEXT('\r'))
+                    --(*pcch);
+                pCursor->ich = (DWORD)(ichNext + fBreak);
+                *pfEOF = FALSE;
+                return TRUE;
+            }
         }
-        return ret;
+        else if (pCursor->fLast)
+        {
+            *pfEOF = TRUE;
+            return TRUE;
+        }
+
+        if (!MapCursor(pCursor, CursorOffset(pCursor)))
+            return FALSE;
     }
+}
 
-    for (ptr0 = *pptr0; ptr0; ptr0 = list_next(list0, ptr0))
+// Finds the start of the line that has pch[ich], but not before ichMin
+static DWORD FindLineStart(LPCTSTR pch, DWORD ichMin, DWORD ich)
+{
+    for (; ich > ichMin; --ich)
     {
-        node0 = LIST_ENTRY(ptr0, NODE, entry);
-        if (node0->lineno == lineno0)
+        if (pch[ich - 1] == TEXT('\n') || pch[ich - 1] == 0)
             break;
     }
-    for (ptr1 = *pptr1; ptr1; ptr1 = list_next(list1, ptr1))
+    return ich;
+}
+
+// Counts the lines of pch[0, cch), which ends with a line break
+static DWORD CountLines(LPCTSTR pch, SIZE_T cch)
+{
+    SIZE_T ich = 0;
+    DWORD cLines = 0;
+    while (ich < cch)
     {
-        node1 = LIST_ENTRY(ptr1, NODE, entry);
-        if (node1->lineno == lineno1)
-            break;
+        ich += FindLineBreak(&pch[ich], cch - ich) + 1;
+        ++cLines;
     }
-    *pptr0 = ptr0;
-    *pptr1 = ptr1;
-    return FCRET_DIFFERENT;
+    return cLines;
 }
 
-static FCRET 
-Finalize(FILECOMPARE* pFC, struct list *ptr0, struct list* ptr1, BOOL fDifferent)
+// Skips the leading lines that are byte-for-byte identical in both files. If
+// pcLines isn't NULL, the lines skipped are counted, and the last cKeep of
+// them are kept to show before the difference (KeptLines).
+static BOOL SkipRawIdentical(LINECURSOR *pCursor0, LINECURSOR *pCursor1, LPDWORD pcLines,
+                             DWORD cKeep)
 {
-    if (!ptr0 && !ptr1)
+    DWORD ich, ichLine, cch, n;
+    BOOL fDone;
+
+    for (;;)
     {
-        if (fDifferent)
-            return FCRET_DIFFERENT;//Different(pFC->file[0], pFC->file[1]);
-        return NoDifference();
+        // both cursors are at the same input offset here
+        ich = pCursor0->ich;
+        cch = min(pCursor0->cchView, pCursor1->cchView);
+        if (ich >= cch)
+            return TRUE;
+
+        ich += (DWORD)(FindMismatch(&pCursor0->pchView[ich], &pCursor1->pchView[ich],
+                                    (cch - ich) * sizeof(TCHAR)) / sizeof(TCHAR));
+        ichLine = FindLineStart(pCursor0->pchView, pCursor0->ich, ich);
+        fDone = (ich < cch || ichLine == pCursor0->ich ||
+                 (pCursor0->fLast && cch == pCursor0->cchView) ||
+                 (pCursor1->fLast && cch == pCursor1->cchView));
+
+        if (pcLines)
+        {
+            // The next view starts at the kept lines, so that a stream never
+            // has to go back. If that doesn't move on, stop here.
+            for (n = 0; n < cKeep && ichLine > pCursor0->ich; ++n)
+                ichLine = FindLineStart(pCursor0->pchView, pCursor0->ich, ichLine - 1);
+            if (ichLine == pCursor0->ich)
+                fDone = TRUE;
+            *pcLines += CountLines(&pCursor0->pchView[pCursor0->ich], ichLine - pCursor0->ich);
+        }
+
+        if (fDone)
+        {
+            pCursor0->ich = pCursor1->ich = ichLine;
+            return TRUE;
+        }
+
+        // the common part of the views is identical; go on from the last line start
+        pCursor0->ich = pCursor1->ich = ichLine;
+        if (!MapCursor(pCursor0, CursorOffset(pCursor0)) ||
+            !MapCursor(pCursor1, CursorOffset(pCursor1)))
+        {
+            return FALSE;
+        }
     }
-    else
+}
+
+// Skips the identical head of the files without parsing it. The line numbers
+// go on from there.
+static BOOL SkipRawHead(FILECOMPARE *pFC)
+{
+    LINECURSOR cursor[2];
+    DWORD cLines = 0;
+    INT i;
+
+    for (i = 0; i < 2; ++i)
     {
-        ShowDiff(pFC, 0, ptr0, NULL);
-        ShowDiff(pFC, 1, ptr1, NULL);
-        PrintEndOfDiff();
-        return FCRET_DIFFERENT;
+        ZeroMemory(&cursor[i], sizeof(cursor[i]));
+        cursor[i].pInput = pFC->window[i].pInput;
+        if (!MapCursor(&cursor[i], pFC->window[i].ibNext))
+            goto failed;
+    }
+    if (!SkipRawIdentical(&cursor[0], &cursor[1], &cLines, KeptLines(pFC)))
+    {
+        i = 0;
+        goto failed;
+    }
+
+    for (i = 0; i < 2; ++i)
+    {
+        pFC->window[i].ibNext = CursorOffset(&cursor[i]);
+        pFC->window[i].lineno += cLines;
+    }
+    return TRUE;
+
+failed:
+    pFC->window[i].fFailed = TRUE;
+    CannotRead(pFC->window[i].pInput->file);
+    return FALSE;
+}
+
+#define TAIL_BLOCK_SIZE (1024 * 1024)
+
+// Finds the common tail of two mapped inputs, from the first line that
+// starts in it. The lines of the tail are parsed only if the comparison is
+// out of sync there (see SkipIdentical).
+static BOOL FindRawTail(FILECOMPARE *pFC)
+{
+    FCINPUT *pInput;
+    LONGLONG cbText[2], cbMax, cbTail = 0;
+    const BYTE *pb[2];
+    DWORD cb, cbView, ib;
+    SIZE_T ich;
+    LPCVOID pv;
+    BOOL fLast;
+    INT i;
+
+    for (i = 0; i < 2; ++i)
+    {
+        pInput = pFC->window[i].pInput;
+        if (pInput->fStream || pInput->fDecode)
+            return TRUE;
+        cbText[i] = pInput->cb.QuadPart - pFC->window[i].ibNext;
+        if (cbText[i] % sizeof(TCHAR))
+            return TRUE;
     }
+    cbMax = min(cbText[0], cbText[1]);
+
+    // compare the blocks from the end
+    while (cbTail < cbMax)
+    {
+        cb = (DWORD)min(TAIL_BLOCK_SIZE, cbMax - cbTail);
+        for (i = 0; i < 2; ++i)
+        {
+            pInput = pFC->window[i].pInput;
+            if (!GetInputView(pInput, pInput->cb.QuadPart - cbTail - cb, cb, &pv, &cbView, &fLast))
+                goto failed;
+            if (cbView < cb)
+                return TRUE;
+            pb[i] = pv;
+        }
+        if (FindMismatch(pb[0], pb[1], cb) == cb)
+        {
+            cbTail += cb;
+            continue;
+        }
+        for (ib = cb; ib > 0 && pb[0][ib - 1] == pb[1][ib - 1]; --ib)
+            ++cbTail;
+        break;
+    }
+    cbTail -= cbTail % sizeof(TCHAR);
+
+    // the tail starts at the line after the first line break in it
+    i = 0;
+    pInput = pFC->window[0].pInput;
+    cb = (DWORD)min(MAX_VIEW_SIZE, cbTail);
+    if (cb == 0)
+        return TRUE;
+    if (!GetInputView(pInput, pInput->cb.QuadPart - cbTail, cb, &pv, &cbView, &fLast))
+        goto failed;
+    ich = FindLineBreak(pv, cbView / sizeof(TCHAR));
+    if (ich >= cbView / sizeof(TCHAR) || (ich + 1) * sizeof(TCHAR) >= (SIZE_T)cbTail)
+        return TRUE;
+    for (i = 0; i < 2; ++i)
+    {
+        pFC->window[i].ibTail = pFC->window[i].pInput->cb.QuadPart - cbTail +
+                                (ich + 1) * sizeof(TCHAR);
+    }
+    return TRUE;
+
+failed:
+    pFC->window[i].fFailed = TRUE;
+    CannotRead(pFC->window[i].pInput->file);
+    return FALSE;
 }
 
-FCRET TextCompare(FILECOMPARE *pFC, HANDLE *phMapping0, const LARGE_INTEGER *pcb0,
-                                    HANDLE *phMapping1, const LARGE_INTEGER *pcb1)
+// Compares the files line by line. Only the lines around the current
+// difference are in memory (see LINEWINDOW), so the size of the files
+// doesn't matter.
+FCRET TextCompare(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1)
 {
-    FCRET ret, ret0, ret1;
+    FCRET ret;
     struct list *ptr0, *ptr1, *save0, *save1, *next0, *next1;
     NODE* node0, * node1;
     BOOL fDifferent = FALSE;
-    LARGE_INTEGER ib0 = { 0 }, ib1 = { 0 };
-    struct list *list0 = &pFC->list[0], *list1 = &pFC->list[1];
-    list_init(list0);
-    list_init(list1);
+    InitWindow(&pFC->window[0], pInput0);
+    InitWindow(&pFC->window[1], pInput1);
+    InitSymTab(&pFC->symtab);
+    if (!SkipRawHead(pFC) || !FindRawTail(pFC))
+    {
+        ret = FCRET_INVALID;
+        goto cleanup;
+    }
+    if (pFC->alg != ALG_FC && DiffWhole(pFC, &ret))
+        goto cleanup;
 
-    do
+    ptr0 = FirstLine(pFC, 0);
+    ptr1 = FirstLine(pFC, 1);
+    for (;;)
     {
-        ret0 = ParseLines(pFC, phMapping0, &ib0, pcb0, list0);
-        if (ret0 == FCRET_INVALID)
+        if (HasFailed(pFC))
         {
-            ret = ret0;
+            ret = FCRET_INVALID;
             goto cleanup;
         }
-        ret1 = ParseLines(pFC, phMapping1, &ib1, pcb1, list1);
-        if (ret1 == FCRET_INVALID)
+        if (!ptr0 || !ptr1)
+            goto quit;
+
+        // skip identical (sync'ed)
+        SkipIdentical(pFC, &ptr0, &ptr1);
+        if (HasFailed(pFC))
         {
-            ret = ret1;
+            ret = FCRET_INVALID;
             goto cleanup;
         }
+        if (ptr0 || ptr1)
+            fDifferent = TRUE;
+        node0 = LIST_ENTRY(ptr0, NODE, entry);
+        node1 = LIST_ENTRY(ptr1, NODE, entry);
+        if (IsEOFNode(node0) || IsEOFNode(node1))
+            goto quit;
 
-        ptr0 = list_head(list0);
-        ptr1 = list_head(list1);
-        for (;;)
+        // try to resync
+        save0 = ptr0;
+        save1 = ptr1;
+        ret = Resync(pFC, &ptr0, &ptr1);
+        if (ret == FCRET_INVALID || HasFailed(pFC))
         {
-            if (!ptr0 || !ptr1)
-                goto quit;
-
-            // skip identical (sync'ed)
-            SkipIdentical(pFC, &ptr0, &ptr1);
-            if (ptr0 || ptr1)
-                fDifferent = TRUE;
-            node0 = LIST_ENTRY(ptr0, NODE, entry);
-            node1 = LIST_ENTRY(ptr1, NODE, entry);
-            if (IsEOFNode(node0) || IsEOFNode(node1))
-                goto quit;
-
-            // try to resync
-            save0 = ptr0;
-            save1 = ptr1;
-            ret = Resync(pFC, &ptr0, &ptr1);
-            if (ret == FCRET_INVALID)
-                goto cleanup;
-            if (ret == FCRET_DIFFERENT)
-            {
-                // resync failed
-                ret = ResyncFailed();
-                // show the difference
-                ShowDiff(pFC, 0, save0, ptr0);
-                ShowDiff(pFC, 1, save1, ptr1);
-                PrintEndOfDiff();
-                goto cleanup;
-            }
-
+            ret = FCRET_INVALID;
+            goto cleanup;
+        }
+        if (ret == FCRET_DIFFERENT && (pFC->dwFlags & FLAG_UNIFIED))
+        {
+            // the rest of the files is a change, so that the diff can be applied
+            AddChange(pFC, save0, NULL, save1, NULL);
+            goto cleanup;
+        }
+        if (ret == FCRET_DIFFERENT)
+        {
+            // resync failed
+            ret = ResyncFailed();
             // show the difference
-            fDifferent = TRUE;
-            next0 = ptr0 ? list_next(list0, ptr0) : ptr0;
-            next1 = ptr1 ? list_next(list1, ptr1) : ptr1;
-            ShowDiff(pFC, 0, save0, (next0 ? next0 : ptr0));
-            ShowDiff(pFC, 1, save1, (next1 ? next1 : ptr1));
+            MarkChanges(pFC, save0, ptr0, save1, ptr1);
+            ShowDiff(pFC, 0, save0, ptr0);
+            ShowDiff(pFC, 1, save1, ptr1);
             PrintEndOfDiff();
+            goto cleanup;
+        }
 
-            // now resync'ed
+        // show the difference
+        fDifferent = TRUE;
+        if (pFC->dwFlags & FLAG_UNIFIED)
+        {
+            AddChange(pFC, save0, ptr0, save1, ptr1);
+            continue;
         }
-    } while (ret0 != FCRET_NO_MORE_DATA || ret1 != FCRET_NO_MORE_DATA);
+        next0 = ptr0 ? NextLine(pFC, 0, ptr0) : ptr0;
+        next1 = ptr1 ? NextLine(pFC, 1, ptr1) : ptr1;
+        MarkChanges(pFC, save0, ptr0, save1, ptr1);
+        ShowDiff(pFC, 0, save0, (next0 ? next0 : ptr0));
+        ShowDiff(pFC, 1, save1, (next1 ? next1 : ptr1));
+        PrintEndOfDiff();
+
+        // now resync'ed
+    }
 
 quit:
     ret = Finalize(pFC, ptr0, ptr1, fDifferent);
 cleanup:
-    DeleteList(list0);
-    DeleteList(list1);
+    if (!HasFailed(pFC))
+        FlushHunk(pFC);
+    free(pFC->hunk.pText);
+    ZeroMemory(&pFC->hunk, sizeof(pFC->hunk));
+    if (HasFailed(pFC))
+        ret = FCRET_INVALID;
+    FreeWindow(&pFC->window[0]);
+    FreeWindow(&pFC->window[1]);
+    FreeSymTab(&pFC->symtab);
+    return ret;
+}
+
+static VOID InitQuietNode(const FILECOMPARE *pFC, NODE *node, LPCTSTR pch, DWORD cch)
+{
+    node->pch = pch;
+    node->cch = cch;
+    node->fNormalize = (BYTE)NeedsNormalize(pFC, pch, cch);
+    node->hash = GetHash(pFC, pch, cch, node->fNormalize);
+}
+
+// Finds the first difference only. Nothing is printed and no node list is built.
+FCRET TextCompareQuiet(FILECOMPARE *pFC, FCINPUT *pInput0, FCINPUT *pInput1)
+{
+    FCRET ret;
+    LINECURSOR cursor0 = { 0 }, cursor1 = { 0 };
+    LPCTSTR pch0, pch1;
+    DWORD cch0, cch1;
+    BOOL fEOF0, fEOF1;
+    NODE node0 = { { 0 } }, node1 = { { 0 } };
+
+    cursor0.pInput = pInput0;
+    cursor1.pInput = pInput1;
+
+    do
+    {
+        if (!MapCursor(&cursor0, pInput0->ibText))
+        {
+            ret = CannotRead(pInput0->file);
+            break;
+        }
+        if (!MapCursor(&cursor1, pInput1->ibText))
+        {
+            ret = CannotRead(pInput1->file);
+            break;
+        }
+        if (!SkipRawIdentical(&cursor0, &cursor1, NULL, 0))
+        {
+            ret = CannotRead(pInput0->file);
+            break;
+        }
+
+        for (;;)
+        {
+            if (!GetNextLine(&cursor0, &pch0, &cch0, &fEOF0))
+            {
+                ret = CannotRead(pInput0->file);
+                break;
+            }
+            if (!GetNextLine(&cursor1, &pch1, &cch1, &fEOF1))
+            {
+                ret = CannotRead(pInput1->file);
+                break;
+            }
+            if (fEOF0 || fEOF1)
+            {
+                ret = (fEOF0 && fEOF1) ? FCRET_IDENTICAL : FCRET_DIFFERENT;
+                break;
+            }
+            if (cch0 == cch1 && memcmp(pch0, pch1, cch0 * sizeof(TCHAR)) == 0)
+                continue;
+
+            InitQuietNode(pFC, &node0, pch0, cch0);
+            InitQuietNode(pFC, &node1, pch1, cch1);
+            if (CompareLines(pFC, &node0, &node1) != FCRET_IDENTICAL)
+            {
+                ret = FCRET_DIFFERENT;
+                break;
+            }
+        }
+    } while (0);
+
     return ret;
 }